@@ -1,6 +1,7 @@
 CREATE TABLE weather_data (
     id SERIAL PRIMARY KEY,
     created TIMESTAMP NOT NULL,
+    station_id INTEGER NOT NULL,
     packet_num INTEGER,
     temperature NUMERIC(5,2),
     dew_point NUMERIC(5,2),
@@ -11,22 +12,36 @@ CREATE TABLE weather_data (
     uv_index NUMERIC(5,2),
     rainfall NUMERIC(7,2),
     wind_speed NUMERIC(5,2),
-    wind_gust NUMERIC(5,2)
+    wind_gust NUMERIC(5,2),
+    avg_wind_speed_10m NUMERIC(5,2),
+    max_wind_gust_10m NUMERIC(5,2),
+    rainfall_1h NUMERIC(7,2),
+    rainfall_24h NUMERIC(7,2),
+    rain_rate NUMERIC(7,2),
+    pressure_tendency_3h NUMERIC(5,2)
 );
 
+CREATE UNIQUE INDEX weather_data_station_created_idx ON weather_data (station_id, created);
+
 CREATE TABLE telemetry_data (
     id SERIAL PRIMARY KEY,
     created TIMESTAMP NOT NULL,
+    station_id INTEGER NOT NULL,
     packet_num INTEGER,
     battery_voltage NUMERIC(3,2),
     battery_percentage NUMERIC(5,2),
     battery_crate NUMERIC(5,2),
-    status_bits INTEGER
+    status_bits INTEGER,
+    packet_loss_rate NUMERIC(5,2),
+    longest_gap INTEGER
 );
 
+CREATE UNIQUE INDEX telemetry_data_station_created_idx ON telemetry_data (station_id, created);
+
 CREATE TABLE daily_summary (
     id SERIAL PRIMARY KEY,
     created DATE NOT NULL,
+    station_id INTEGER NOT NULL,
     min_temperature NUMERIC(5,2),
     max_temperature NUMERIC(5,2),
     min_pressure NUMERIC(6,2),
@@ -38,3 +53,5 @@ CREATE TABLE daily_summary (
     max_wind_speed NUMERIC(5,2),
     max_wind_gust NUMERIC(5,2)
 );
+
+CREATE UNIQUE INDEX daily_summary_created_station_idx ON daily_summary (created, station_id);
@@ -0,0 +1,405 @@
+#include <bit>
+#include <algorithm>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "logger.h"
+#include "utils.h"
+#include "packet.h"
+#include "station.h"
+#include "schema.h"
+#include "decoder.h"
+#include "batch.h"
+
+using namespace std;
+
+#define LN_2                                0.69314718056f
+
+/*
+** Bit pattern of sqrt(0.5), the fast log reduces its argument
+** to m x 2^e with m in [sqrt(0.5), sqrt(2))...
+*/
+#define SQRT_HALF_BITS                      0x3F3504F3
+#define QUIET_NAN_BITS                      0x7FC00000
+
+#define BENCHMARK_RUNS                      3
+
+/*
+** Natural log with no table lookups or branches, so a loop of
+** these vectorises. With m reduced as above, t = (m-1)/(m+1)
+** lies within +/- 0.172 and ln(m) = 2(t + t^3/3 + t^5/5 + t^7/7)
+** is good to a few parts in 10^8, about the precision of a float.
+**
+** Zero or negative x gives a NaN, like log() does (give or take
+** -inf for zero). That is done by ORing in the bits of a NaN, as
+** gcc will vectorise an integer select but not a float one...
+*/
+static inline float _fastLog(float x) {
+    int32_t bits = bit_cast<int32_t>(x);
+    int32_t exponent = (bits - SQRT_HALF_BITS) >> 23;
+
+    float m = bit_cast<float>(bits - (exponent << 23));
+
+    float t = (m - 1.0f) / (m + 1.0f);
+    float t2 = t * t;
+
+    float lnM = t * (2.0f + t2 * (0.66666667f + t2 * (0.4f + t2 * 0.28571429f)));
+
+    int32_t nanBits = (bits > 0 ? 0 : QUIET_NAN_BITS);
+
+    return bit_cast<float>(bit_cast<int32_t>((float)exponent * LN_2 + lnM) | nanBits);
+}
+
+/*
+** Unpack a block of packets into one array per field. The
+** fields sit 32 bytes apart in the input, so this part is
+** scalar, everything after it is not...
+*/
+static void _gatherBlock(const weather_packet_t * packets, const int * index, int numPackets, weather_block_t * b) {
+    typedef weather_schema w;
+
+    for (int i = 0;i < numPackets;i++) {
+        const uint8_t * payload = (const uint8_t *)&packets[index[i]];
+
+        b->packetNum[i] = w::packetNum::decode(payload);
+        b->status[i] = (int32_t)w::status::decode(payload);
+
+        b->rawBatteryVolts[i] = (float)w::batteryVolts::field::decode(payload);
+        b->rawBatteryPercentage[i] = (float)w::batteryPercentage::field::decode(payload);
+        b->rawBatteryChargeRate[i] = (float)w::batteryChargeRate::field::decode(payload);
+        b->rawTemperature[i] = (float)w::temperature::field::decode(payload);
+        b->rawHumidity[i] = (float)w::humidity::field::decode(payload);
+        b->rawPressure[i] = (float)w::rawPressure::decode(payload);
+        b->rawRainfall[i] = (float)w::rainfall::field::decode(payload);
+        b->rawWindspeed[i] = (float)w::rawWindspeed::decode(payload);
+        b->rawWindGust[i] = (float)w::rawWindGust::decode(payload);
+    }
+
+    /*
+    ** Pad a short block with harmless values, so the kernels
+    ** can always run over all of it...
+    */
+    for (int i = numPackets;i < BATCH_BLOCK_SIZE;i++) {
+        b->rawBatteryVolts[i] = 0.0f;
+        b->rawBatteryPercentage[i] = 0.0f;
+        b->rawBatteryChargeRate[i] = 0.0f;
+        b->rawTemperature[i] = 0.0f;
+        b->rawHumidity[i] = 0.0f;
+        b->rawPressure[i] = 0.0f;
+        b->rawRainfall[i] = 0.0f;
+        b->rawWindspeed[i] = 0.0f;
+        b->rawWindGust[i] = 0.0f;
+    }
+}
+
+/*
+** value = raw * Scale + Bias for a whole block, exactly as
+** scaled_field::decode() does it for one value...
+*/
+template <typename Field>
+static inline void _scaleBlock(const float * raw, float * target) {
+    for (int i = 0;i < BATCH_BLOCK_SIZE;i++) {
+        target[i] = raw[i] * Field::scale + Field::bias;
+    }
+}
+
+/*
+** The same sums as transformWeatherPacket, a field at a time...
+*/
+static void _transformBlock(weather_block_t * b, const calibration_t * cal) {
+    typedef weather_schema w;
+
+    const double pressureScale = cal->pressureScale;
+    const float windspeedMph = cal->windspeedMph;
+    const float windspeedMetresPerSec = cal->windspeedMetresPerSec;
+
+    _scaleBlock<w::batteryVolts>(b->rawBatteryVolts, b->batteryVoltage);
+    _scaleBlock<w::batteryPercentage>(b->rawBatteryPercentage, b->batteryPercentage);
+    _scaleBlock<w::batteryChargeRate>(b->rawBatteryChargeRate, b->batteryChargeRate);
+    _scaleBlock<w::temperature>(b->rawTemperature, b->temperature);
+    _scaleBlock<w::humidity>(b->rawHumidity, b->humidity);
+    _scaleBlock<w::pressure>(b->rawPressure, b->actualPressure);
+    _scaleBlock<w::rainfall>(b->rawRainfall, b->rainfall);
+
+    /*
+    ** Like the scalar path, the dew point uses the unclamped
+    ** humidity and is NaN when that is not positive...
+    */
+    for (int i = 0;i < BATCH_BLOCK_SIZE;i++) {
+        float temperature = b->temperature[i];
+
+        float lnHumidity = _fastLog(b->humidity[i] * 0.01f);
+        float a = (17.625f * temperature) / (243.04f + temperature);
+
+        b->dewPoint[i] = 243.04f * (lnHumidity + a) / (17.625f - lnHumidity - a);
+    }
+
+    /*
+    ** Same result as fminf(fmaxf()) for anything but a NaN,
+    ** which a humidity can't be, without the calls...
+    */
+    for (int i = 0;i < BATCH_BLOCK_SIZE;i++) {
+        float humidity = b->humidity[i];
+
+        humidity = (humidity < 0.0f ? 0.0f : humidity);
+        b->humidity[i] = (humidity > 100.0f ? 100.0f : humidity);
+    }
+
+    for (int i = 0;i < BATCH_BLOCK_SIZE;i++) {
+        b->normalisedPressure[i] = (float)((double)b->rawPressure[i] * pressureScale);
+    }
+
+    for (int i = 0;i < BATCH_BLOCK_SIZE;i++) {
+        b->windspeed[i] = b->rawWindspeed[i] * windspeedMph;
+        b->gustSpeed[i] = b->rawWindGust[i] * windspeedMph;
+        b->windSpeedms[i] = b->rawWindspeed[i] * windspeedMetresPerSec;
+        b->gustSpeedms[i] = b->rawWindGust[i] * windspeedMetresPerSec;
+    }
+}
+
+/*
+** Write a block back out as transforms...
+*/
+static void _scatterBlock(const weather_block_t * b, int numPackets, const station * s, weather_transform_t * target) {
+    for (int i = 0;i < numPackets;i++) {
+        weather_transform_t * tr = &target[i];
+
+        tr->timestamp = 0;
+        tr->stationID = s->stationID;
+        tr->pipe = s->pipe;
+
+        tr->packetNum = b->packetNum[i];
+        tr->status_bits = b->status[i];
+
+        tr->batteryVoltage = b->batteryVoltage[i];
+        tr->batteryPercentage = b->batteryPercentage[i];
+        tr->batteryChargeRate = b->batteryChargeRate[i];
+        tr->batteryTemperature = 0.0f;
+
+        tr->temperature = b->temperature[i];
+        tr->dewPoint = b->dewPoint[i];
+        tr->actualPressure = b->actualPressure[i];
+        tr->normalisedPressure = b->normalisedPressure[i];
+        tr->humidity = b->humidity[i];
+        tr->rainfall = b->rainfall[i];
+        tr->windspeed = b->windspeed[i];
+        tr->gustSpeed = b->gustSpeed[i];
+        tr->windSpeedms = b->windSpeedms[i];
+        tr->gustSpeedms = b->gustSpeedms[i];
+
+        tr->packetLossRate = 0.0f;
+        tr->longestGap = 0;
+
+        tr->avgWindspeed10min = 0.0f;
+        tr->maxGust10min = 0.0f;
+        tr->rainfall1h = 0.0f;
+        tr->rainfall24h = 0.0f;
+        tr->rainRate = 0.0f;
+        tr->pressureTendency3h = 0.0f;
+    }
+}
+
+int transformWeatherBatch(const weather_packet_t * packets, int numPackets, const station * s, weather_transform_t * target) {
+    weather_block_t *       b;
+    int                     index[BATCH_BLOCK_SIZE];
+    int                     numTransforms = 0;
+    int                     i = 0;
+
+    /*
+    ** Too big for the stack of a thread...
+    */
+    b = (weather_block_t *)aligned_alloc(64, sizeof(weather_block_t));
+
+    if (b == NULL) {
+        return -1;
+    }
+
+    const calibration_t * cal = s->getCalibration();
+
+    while (i < numPackets) {
+        int numInBlock = 0;
+
+        /*
+        ** Captures are mostly weather packets, but the odd sleep
+        ** or watchdog packet is skipped over...
+        */
+        while (i < numPackets && numInBlock < BATCH_BLOCK_SIZE) {
+            if (packets[i].packetID == PACKET_ID_WEATHER) {
+                index[numInBlock++] = i;
+            }
+
+            i++;
+        }
+
+        if (numInBlock == 0) {
+            break;
+        }
+
+        _gatherBlock(packets, index, numInBlock, b);
+        _transformBlock(b, cal);
+        _scatterBlock(b, numInBlock, s, &target[numTransforms]);
+
+        numTransforms += numInBlock;
+    }
+
+    free(b);
+
+    return numTransforms;
+}
+
+static bool _isFieldMatch(float scalar, float batch) {
+    if (isnan(scalar) || isnan(batch)) {
+        return (isnan(scalar) && isnan(batch));
+    }
+
+    return (scalar == batch);
+}
+
+/*
+** Synthetic packets covering the range the sensors report...
+*/
+static void _buildBenchmarkPackets(weather_packet_t * packets, int numRecords) {
+    typedef weather_schema w;
+
+    unsigned short randomState[3] = {0x1234, 0x5678, 0x9ABC};
+
+    for (int i = 0;i < numRecords;i++) {
+        uint8_t * payload = (uint8_t *)&packets[i];
+
+        memset(payload, 0, sizeof(weather_packet_t));
+
+        w::id::encode(payload, PACKET_ID_WEATHER);
+        w::packetNum::encode(payload, (uint32_t)i & 0x00FFFFFF);
+        w::status::encode(payload, 0x00);
+
+        w::batteryPercentage::encode(payload, erand48(randomState) * 100.0);
+        w::batteryChargeRate::encode(payload, (erand48(randomState) - 0.5) * 20.0);
+        w::batteryVolts::encode(payload, 3.4 + erand48(randomState) * 0.8);
+
+        w::temperature::encode(payload, -30.0 + erand48(randomState) * 70.0);
+        w::rawPressure::encode(payload, (uint32_t)(95000.0 + erand48(randomState) * 10000.0));
+        w::humidity::encode(payload, 1.0 + erand48(randomState) * 99.0);
+
+        uint32_t rawWindspeed = (uint32_t)(erand48(randomState) * 2000.0);
+
+        w::rainfall::field::encode(payload, (uint32_t)(erand48(randomState) * 4.0));
+        w::rawWindspeed::encode(payload, rawWindspeed);
+        w::rawWindGust::encode(payload, rawWindspeed + (uint32_t)(erand48(randomState) * 1000.0));
+    }
+}
+
+int runTransformBenchmark(int numRecords) {
+    station *               s = NULL;
+    weather_packet_t *      packets;
+    weather_transform_t *   scalar;
+    weather_transform_t *   batch;
+
+    stationmgr & stations = stationmgr::getInstance();
+
+    stations.initialise();
+
+    for (int pipe = 0;pipe < NRF24L01_NUM_RX_PIPES && s == NULL;pipe++) {
+        s = stations.getStation(pipe);
+    }
+
+    if (s == NULL) {
+        fprintf(stderr, "No station is configured\n");
+        return -1;
+    }
+
+    packets = (weather_packet_t *)malloc(sizeof(weather_packet_t) * numRecords);
+    scalar = (weather_transform_t *)malloc(sizeof(weather_transform_t) * numRecords);
+    batch = (weather_transform_t *)malloc(sizeof(weather_transform_t) * numRecords);
+
+    if (packets == NULL || scalar == NULL || batch == NULL) {
+        fprintf(stderr, "Failed to allocate memory for %d records\n", numRecords);
+        free(packets);
+        free(scalar);
+        free(batch);
+        return -1;
+    }
+
+    _buildBenchmarkPackets(packets, numRecords);
+
+    /*
+    ** Touch the output first so neither path pays for the page
+    ** faults, then take the best of a few runs of each...
+    */
+    memset(scalar, 0, sizeof(weather_transform_t) * numRecords);
+    memset(batch, 0, sizeof(weather_transform_t) * numRecords);
+
+    printf("Transforming %d records, best of %d runs...\n", numRecords, BENCHMARK_RUNS);
+
+    uint64_t scalarTime = UINT64_MAX;
+    uint64_t batchTime = UINT64_MAX;
+    int numTransforms = 0;
+
+    for (int run = 0;run < BENCHMARK_RUNS;run++) {
+        uint64_t startTime = getEpochNanoseconds();
+
+        for (int i = 0;i < numRecords;i++) {
+            transformWeatherPacket((const uint8_t *)&packets[i], s, &scalar[i]);
+        }
+
+        scalarTime = min(scalarTime, getEpochNanoseconds() - startTime);
+
+        startTime = getEpochNanoseconds();
+
+        numTransforms = transformWeatherBatch(packets, numRecords, s, batch);
+
+        batchTime = min(batchTime, getEpochNanoseconds() - startTime);
+    }
+
+    int numMismatches = 0;
+    float maxDewPointError = 0.0f;
+
+    for (int i = 0;i < numTransforms;i++) {
+        weather_transform_t & a = scalar[i];
+        weather_transform_t & b = batch[i];
+
+        if (!isnan(a.dewPoint) && !isnan(b.dewPoint)) {
+            maxDewPointError = fmaxf(maxDewPointError, fabsf(a.dewPoint - b.dewPoint));
+        }
+        else if (isnan(a.dewPoint) != isnan(b.dewPoint)) {
+            numMismatches++;
+        }
+
+        if (a.packetNum != b.packetNum ||
+            a.status_bits != b.status_bits ||
+            !_isFieldMatch(a.batteryVoltage, b.batteryVoltage) ||
+            !_isFieldMatch(a.batteryPercentage, b.batteryPercentage) ||
+            !_isFieldMatch(a.batteryChargeRate, b.batteryChargeRate) ||
+            !_isFieldMatch(a.temperature, b.temperature) ||
+            !_isFieldMatch(a.humidity, b.humidity) ||
+            !_isFieldMatch(a.actualPressure, b.actualPressure) ||
+            !_isFieldMatch(a.normalisedPressure, b.normalisedPressure) ||
+            !_isFieldMatch(a.windspeed, b.windspeed) ||
+            !_isFieldMatch(a.gustSpeed, b.gustSpeed) ||
+            !_isFieldMatch(a.windSpeedms, b.windSpeedms) ||
+            !_isFieldMatch(a.gustSpeedms, b.gustSpeedms) ||
+            !_isFieldMatch(a.rainfall, b.rainfall))
+        {
+            numMismatches++;
+        }
+    }
+
+    double scalarRate = (double)numRecords * 1.0E9 / (double)(scalarTime > 0 ? scalarTime : 1);
+    double batchRate = (double)numTransforms * 1.0E9 / (double)(batchTime > 0 ? batchTime : 1);
+
+    printf("\n Path      Records/sec\n");
+    printf(" scalar  %13.0f\n", scalarRate);
+    printf(" batch   %13.0f  (x%.2f)\n\n", batchRate, batchRate / scalarRate);
+
+    printf(" Max dew point difference: %.6f C (tolerance %.2f C)\n", maxDewPointError, BATCH_DEWPOINT_TOLERANCE);
+    printf(" Records that differ otherwise: %d\n\n", numMismatches);
+
+    free(packets);
+    free(scalar);
+    free(batch);
+
+    return ((numTransforms == numRecords && numMismatches == 0 && maxDewPointError <= BATCH_DEWPOINT_TOLERANCE) ? 0 : -1);
+}
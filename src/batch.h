@@ -0,0 +1,72 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "packet.h"
+#include "station.h"
+
+#ifndef __INCL_BATCH
+#define __INCL_BATCH
+
+/*
+** Packets are transformed a fixed size block at a time. With a
+** constant trip count and no remainder the kernels vectorise at
+** plain -O2, and a block of inputs and outputs stays in L1...
+*/
+#define BATCH_BLOCK_SIZE                    64
+
+/*
+** The batch path matches transformWeatherPacket exactly, apart
+** from the dew point, which uses a fast log and is within this
+** of the scalar value...
+*/
+#define BATCH_DEWPOINT_TOLERANCE            0.01f
+
+/*
+** One block of weather packets, unpacked into an array per field...
+*/
+typedef struct {
+    alignas(64) uint32_t    packetNum[BATCH_BLOCK_SIZE];
+    alignas(64) int32_t     status[BATCH_BLOCK_SIZE];
+
+    alignas(64) float   rawBatteryVolts[BATCH_BLOCK_SIZE];
+    alignas(64) float   rawBatteryPercentage[BATCH_BLOCK_SIZE];
+    alignas(64) float   rawBatteryChargeRate[BATCH_BLOCK_SIZE];
+    alignas(64) float   rawTemperature[BATCH_BLOCK_SIZE];
+    alignas(64) float   rawHumidity[BATCH_BLOCK_SIZE];
+    alignas(64) float   rawPressure[BATCH_BLOCK_SIZE];
+    alignas(64) float   rawRainfall[BATCH_BLOCK_SIZE];
+    alignas(64) float   rawWindspeed[BATCH_BLOCK_SIZE];
+    alignas(64) float   rawWindGust[BATCH_BLOCK_SIZE];
+
+    alignas(64) float   batteryVoltage[BATCH_BLOCK_SIZE];
+    alignas(64) float   batteryPercentage[BATCH_BLOCK_SIZE];
+    alignas(64) float   batteryChargeRate[BATCH_BLOCK_SIZE];
+    alignas(64) float   temperature[BATCH_BLOCK_SIZE];
+    alignas(64) float   humidity[BATCH_BLOCK_SIZE];
+    alignas(64) float   dewPoint[BATCH_BLOCK_SIZE];
+    alignas(64) float   actualPressure[BATCH_BLOCK_SIZE];
+    alignas(64) float   normalisedPressure[BATCH_BLOCK_SIZE];
+    alignas(64) float   rainfall[BATCH_BLOCK_SIZE];
+    alignas(64) float   windspeed[BATCH_BLOCK_SIZE];
+    alignas(64) float   gustSpeed[BATCH_BLOCK_SIZE];
+    alignas(64) float   windSpeedms[BATCH_BLOCK_SIZE];
+    alignas(64) float   gustSpeedms[BATCH_BLOCK_SIZE];
+}
+weather_block_t;
+
+/*
+** Transform numPackets captured weather packets from one station,
+** as transformWeatherPacket would. Packets that are not weather
+** packets are skipped, returns the number of transforms written
+** to target. Timestamps and the rolling metrics (metrics.h)
+** are left for the caller to fill in...
+*/
+int transformWeatherBatch(const weather_packet_t * packets, int numPackets, const station * s, weather_transform_t * target);
+
+/*
+** The --benchmark command line mode, records/sec for the scalar
+** and batch transforms, and how far apart their results are...
+*/
+int runTransformBenchmark(int numRecords);
+
+#endif
@@ -0,0 +1,233 @@
+#include <string>
+#include <vector>
+#include <span>
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "logger.h"
+#include "cfgmgr.h"
+#include "packet.h"
+#include "bus.h"
+
+using namespace std;
+
+void sinkRegistry::registerSink(const char * name, sink_factory_t factory) {
+    factories[name] = factory;
+}
+
+readingSink * sinkRegistry::create(const string & name) {
+    auto it = factories.find(name);
+
+    if (it == factories.end()) {
+        return NULL;
+    }
+
+    return it->second();
+}
+
+busSubscription::busSubscription(const string & name, const sink_policy_t & policy) {
+    this->name = name;
+    this->policy = policy;
+
+    memset(nextDueTime, 0, sizeof(nextDueTime));
+}
+
+/*
+** The next reading is due an interval after the last one was due,
+** rather than after it arrived, so the jitter on arrival times
+** doesn't stretch the interval...
+*/
+bool busSubscription::isDue(const weather_transform_t & tr) {
+    if (policy.intervalSeconds == 0 || tr.pipe < 0 || tr.pipe >= NRF24L01_NUM_RX_PIPES) {
+        return true;
+    }
+
+    uint64_t intervalNs = (uint64_t)policy.intervalSeconds * 1000000000ULL;
+    uint64_t & due = nextDueTime[tr.pipe];
+
+    if (due != 0 && tr.timestamp < due) {
+        return false;
+    }
+
+    if (due != 0 && tr.timestamp - due < intervalNs) {
+        due += intervalNs;
+    }
+    else {
+        due = tr.timestamp + intervalNs;
+    }
+
+    return true;
+}
+
+bool busSubscription::offer(const weather_transform_t & tr) {
+    if (!isDue(tr)) {
+        numFiltered.fetch_add(1, memory_order_relaxed);
+        return true;
+    }
+
+    return queue.push(tr);
+}
+
+/*
+** Keep the last reading from each pipe, in the order they
+** arrived...
+*/
+uint32_t busSubscription::removeSuperseded(weather_transform_t * batch, uint32_t numReadings) {
+    bool        isLatest[BUS_QUEUE_CAPACITY];
+    bool        isPipeSeen[NRF24L01_NUM_RX_PIPES];
+    uint32_t    numKept = 0;
+
+    memset(isPipeSeen, 0, sizeof(isPipeSeen));
+
+    for (int i = (int)numReadings - 1;i >= 0;i--) {
+        int pipe = batch[i].pipe;
+
+        if (pipe < 0 || pipe >= NRF24L01_NUM_RX_PIPES) {
+            isLatest[i] = true;
+        }
+        else {
+            isLatest[i] = !isPipeSeen[pipe];
+            isPipeSeen[pipe] = true;
+        }
+    }
+
+    for (uint32_t i = 0;i < numReadings;i++) {
+        if (isLatest[i]) {
+            if (numKept != i) {
+                batch[numKept] = batch[i];
+            }
+
+            numKept++;
+        }
+    }
+
+    numSuperseded.fetch_add(numReadings - numKept, memory_order_relaxed);
+
+    return numKept;
+}
+
+uint32_t busSubscription::collect(weather_transform_t * batch, uint32_t maxReadings) {
+    uint32_t    numReadings = 0;
+
+    if (maxReadings > BUS_QUEUE_CAPACITY) {
+        maxReadings = BUS_QUEUE_CAPACITY;
+    }
+
+    while (numReadings < maxReadings && queue.pop(batch[numReadings])) {
+        numReadings++;
+    }
+
+    if (policy.dropPolicy == sink_drop_superseded && numReadings > 1) {
+        numReadings = removeSuperseded(batch, numReadings);
+    }
+
+    return numReadings;
+}
+
+static const char * getDropPolicyName(sink_drop_policy dropPolicy) {
+    return (dropPolicy == sink_drop_superseded ? "superseded" : "newest");
+}
+
+readingBus::~readingBus() {
+    for (busSubscription * subscription : subscriptions) {
+        delete subscription;
+    }
+}
+
+busSubscription * readingBus::subscribe(readingSink & sink) {
+    sink_policy_t       policy;
+
+    cfgmgr & cfg = cfgmgr::getInstance();
+
+    policy.maxBatch = SINK_DEFAULT_MAX_BATCH;
+    policy.batchDelayMs = 0;
+    policy.intervalSeconds = 0;
+    policy.dropPolicy = sink_drop_newest;
+
+    sink.getPolicy(&policy);
+
+    string prefix = "sink.";
+    prefix.append(sink.getName());
+
+    if (cfg.getValue(prefix + ".batchsize").length() > 0) {
+        policy.maxBatch = cfg.getValueAsLongUnsignedInteger(prefix + ".batchsize");
+    }
+
+    if (cfg.getValue(prefix + ".batchdelay").length() > 0) {
+        policy.batchDelayMs = cfg.getValueAsLongUnsignedInteger(prefix + ".batchdelay");
+    }
+
+    if (cfg.getValue(prefix + ".interval").length() > 0) {
+        policy.intervalSeconds = cfg.getValueAsLongUnsignedInteger(prefix + ".interval");
+    }
+
+    string dropPolicy = cfg.getValue(prefix + ".droppolicy");
+
+    if (dropPolicy.compare("superseded") == 0) {
+        policy.dropPolicy = sink_drop_superseded;
+    }
+    else if (dropPolicy.compare("newest") == 0) {
+        policy.dropPolicy = sink_drop_newest;
+    }
+    else if (dropPolicy.length() > 0) {
+        logger::getInstance().logError("Unknown %s.droppolicy '%s', using '%s'", prefix.c_str(), dropPolicy.c_str(), getDropPolicyName(policy.dropPolicy));
+    }
+
+    if (policy.maxBatch == 0) {
+        policy.maxBatch = 1;
+    }
+    else if (policy.maxBatch > BUS_QUEUE_CAPACITY) {
+        policy.maxBatch = BUS_QUEUE_CAPACITY;
+    }
+
+    logger::getInstance().logInfo(
+        "Sink '%s': batches of up to %u reading(s), wait %u ms for a batch, interval %u s, drop %s",
+        sink.getName(),
+        policy.maxBatch,
+        policy.batchDelayMs,
+        policy.intervalSeconds,
+        getDropPolicyName(policy.dropPolicy));
+
+    busSubscription * subscription = new busSubscription(sink.getName(), policy);
+
+    subscriptions.push_back(subscription);
+
+    return subscription;
+}
+
+/*
+** On the listen thread, so a drop is only counted here, the sink's
+** thread says so when it next looks at its queue...
+*/
+void readingBus::publish(const weather_transform_t & tr) {
+    for (busSubscription * subscription : subscriptions) {
+        subscription->offer(tr);
+    }
+}
+
+uint32_t readingBus::getRoom() {
+    uint32_t    room = BUS_QUEUE_CAPACITY;
+
+    for (busSubscription * subscription : subscriptions) {
+        uint32_t depth = subscription->getDepth();
+        uint32_t free = (depth < subscription->getCapacity() ? subscription->getCapacity() - depth : 0);
+
+        if (free < room) {
+            room = free;
+        }
+    }
+
+    return room;
+}
+
+uint64_t readingBus::getNumDropped() {
+    uint64_t    numDropped = 0;
+
+    for (busSubscription * subscription : subscriptions) {
+        numDropped += subscription->getNumDropped();
+    }
+
+    return numDropped;
+}
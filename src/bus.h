@@ -0,0 +1,286 @@
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <span>
+#include <atomic>
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "packet.h"
+#include "radio.h"
+#include "queue.h"
+#include "reactor.h"
+
+using namespace std;
+
+#ifndef __INCL_BUS
+#define __INCL_BUS
+
+/*
+** Each subscriber has its own queue of this many readings...
+*/
+#define BUS_QUEUE_CAPACITY                  256
+
+/*
+** A queue this deep means the sink is falling behind, so what
+** comes off it is offered to spill() before write()...
+*/
+#define BUS_SPILL_THRESHOLD                 (BUS_QUEUE_CAPACITY * 3 / 4)
+
+#define SINK_DEFAULT_MAX_BATCH              32
+#define SINK_DEFAULT_STOP_TIMEOUT_MS        2000U
+
+/*
+** The sinks we run if the config doesn't say...
+*/
+#define SINK_DEFAULT_LIST                   "db,wow"
+
+/*
+** What a sink does when it can't keep up. With sink_drop_newest a
+** reading that arrives to a full queue is thrown away (and counted),
+** so what is queued is delivered in order. A sink that can spill()
+** only gets that far if one write() takes longer than the queue
+** takes to fill. With sink_drop_superseded a batch is also cut
+** down to the latest reading from each station, for a sink that
+** only cares about now...
+*/
+enum sink_drop_policy {
+    sink_drop_newest,
+    sink_drop_superseded
+};
+
+typedef struct {
+    uint32_t            maxBatch;                   // Readings handed to write() at once
+    uint32_t            batchDelayMs;               // How long to wait for a batch to fill, 0 to not wait
+    uint32_t            intervalSeconds;            // Least time between readings from a station, 0 for every reading
+    sink_drop_policy    dropPolicy;
+}
+sink_policy_t;
+
+/*
+** Somewhere readings go. A sink runs on its own thread, in an
+** event loop it can add its own fds and timers to in open(), and
+** is handed readings in batches through write(). open() is called
+** again if the thread is restarted, close() once it has been
+** stopped and everything queued has been written...
+*/
+class readingSink {
+    public:
+        virtual ~readingSink() {}
+
+        /*
+        ** The name in the sinks= config, and sink.<name>.* keys...
+        */
+        virtual const char * getName() = 0;
+        virtual const char * getThreadName() = 0;
+
+        /*
+        ** Change any of the defaults in policy, the config
+        ** overrides whatever we set...
+        */
+        virtual void getPolicy(sink_policy_t * policy) {}
+
+        /*
+        ** See PosixThread::setStallTimeout(), and how long
+        ** stopping may take...
+        */
+        virtual uint32_t getStallTimeoutMs() {
+            return 0;
+        }
+
+        virtual uint32_t getStopTimeoutMs() {
+            return SINK_DEFAULT_STOP_TIMEOUT_MS;
+        }
+
+        virtual void open(eventLoop & loop) {}
+        virtual void write(span<weather_transform_t> readings) = 0;
+
+        /*
+        ** Instead of write() while the queue is past
+        ** BUS_SPILL_THRESHOLD, for a sink that can put readings
+        ** somewhere quicker than where they are going, to be
+        ** written later. Returns false if it can't, and they go
+        ** to write()...
+        */
+        virtual bool spill(span<weather_transform_t> readings) {
+            return false;
+        }
+
+        virtual void close(eventLoop & loop) {}
+
+        /*
+        ** Called on the supervisor's thread when the sink's thread
+        ** has stopped beating, to make whatever write() is stuck
+        ** in give up. The thread is cancelled if that doesn't
+        ** work...
+        */
+        virtual void onStalled() {}
+};
+
+typedef readingSink * (* sink_factory_t)();
+
+/*
+** Sinks by name. Each one registers itself at startup with a
+** static sinkRegistration, see dbsink.cpp...
+*/
+class sinkRegistry {
+    public:
+        static sinkRegistry & getInstance() {
+            static sinkRegistry registry;
+            return registry;
+        }
+
+    private:
+        unordered_map<string, sink_factory_t>   factories;
+
+        sinkRegistry() {}
+
+    public:
+        ~sinkRegistry() {}
+
+        void registerSink(const char * name, sink_factory_t factory);
+
+        /*
+        ** NULL if there is no sink called name...
+        */
+        readingSink * create(const string & name);
+};
+
+class sinkRegistration {
+    public:
+        sinkRegistration(const char * name, sink_factory_t factory) {
+            sinkRegistry::getInstance().registerSink(name, factory);
+        }
+};
+
+/*
+** One subscriber's view of the bus. The producer side (offer()) is
+** the listen thread, it applies the rate limit before anything is
+** copied. The consumer side (collect() and the wakeup calls) is the
+** sink's thread...
+*/
+class busSubscription {
+    private:
+        string                                              name;
+        sink_policy_t                                       policy;
+
+        spscQueue<weather_transform_t, BUS_QUEUE_CAPACITY>  queue;
+
+        /*
+        ** Producer only, per pipe...
+        */
+        uint64_t                                            nextDueTime[NRF24L01_NUM_RX_PIPES];
+        atomic<uint64_t>                                    numFiltered{0};
+
+        /*
+        ** Consumer only...
+        */
+        atomic<uint64_t>                                    numSuperseded{0};
+
+        bool isDue(const weather_transform_t & tr);
+        uint32_t removeSuperseded(weather_transform_t * batch, uint32_t numReadings);
+
+    public:
+        busSubscription(const string & name, const sink_policy_t & policy);
+
+        /*
+        ** Returns false if the reading was dropped because the
+        ** queue is full, a reading held back by the rate limit
+        ** counts as taken...
+        */
+        bool offer(const weather_transform_t & tr);
+
+        /*
+        ** Pop up to maxReadings readings into batch, returns
+        ** how many there are...
+        */
+        uint32_t collect(weather_transform_t * batch, uint32_t maxReadings);
+
+        const char * getName() {
+            return name.c_str();
+        }
+
+        const sink_policy_t & getPolicy() {
+            return policy;
+        }
+
+        int getEventFD() {
+            return queue.getEventFD();
+        }
+
+        bool armWakeup() {
+            return queue.armWakeup();
+        }
+
+        void armWakeupOnPush() {
+            queue.armWakeupOnPush();
+        }
+
+        void clearWakeup() {
+            queue.clearWakeup();
+        }
+
+        uint32_t getDepth() {
+            return queue.getDepth();
+        }
+
+        uint32_t getCapacity() {
+            return queue.getCapacity();
+        }
+
+        uint32_t getHighWaterMark() {
+            return queue.getHighWaterMark();
+        }
+
+        uint64_t getNumDropped() {
+            return queue.getNumDropped();
+        }
+
+        uint64_t getNumFiltered() {
+            return numFiltered.load(memory_order_relaxed);
+        }
+
+        uint64_t getNumSuperseded() {
+            return numSuperseded.load(memory_order_relaxed);
+        }
+};
+
+/*
+** Every reading the listen thread decodes is published here and
+** copied to each subscriber's queue. Subscribers don't share a
+** queue, so one that falls behind only ever drops its own
+** readings. All subscribing is done before the threads start...
+*/
+class readingBus {
+    public:
+        static readingBus & getInstance() {
+            static readingBus instance;
+            return instance;
+        }
+
+    private:
+        vector<busSubscription *>   subscriptions;
+
+        readingBus() {}
+
+    public:
+        ~readingBus();
+
+        /*
+        ** The sink's policy, with any sink.<name>.* config on top...
+        */
+        busSubscription * subscribe(readingSink & sink);
+
+        void publish(const weather_transform_t & tr);
+
+        /*
+        ** How many more readings can be published before the
+        ** fullest queue drops one...
+        */
+        uint32_t getRoom();
+
+        uint64_t getNumDropped();
+};
+
+#endif
@@ -0,0 +1,259 @@
+#include <string>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "logger.h"
+#include "utils.h"
+#include "capture.h"
+
+using namespace std;
+
+static int _writeFully(int fd, const void * buffer, size_t length) {
+    const uint8_t * p = (const uint8_t *)buffer;
+
+    while (length > 0) {
+        ssize_t bytesWritten = ::write(fd, p, length);
+
+        if (bytesWritten < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            return -1;
+        }
+
+        p += bytesWritten;
+        length -= bytesWritten;
+    }
+
+    return 0;
+}
+
+captureWriter::captureWriter(const string & filename, uint64_t maxFileSize) {
+    this->filename = filename;
+    this->maxFileSize = (maxFileSize > 0 ? maxFileSize : CAPTURE_DEFAULT_MAX_SIZE);
+
+    openFile();
+}
+
+captureWriter::~captureWriter() {
+    if (fd >= 0) {
+        ::close(fd);
+    }
+}
+
+/*
+** Where the current file goes when it is rotated, or set aside...
+*/
+string captureWriter::getArchiveFileName() {
+    char            szSuffix[32];
+    struct tm       tmNow;
+
+    time_t t = time(NULL);
+    localtime_r(&t, &tmNow);
+
+    strftime(szSuffix, sizeof(szSuffix), "%Y%m%d%H%M%S", &tmNow);
+
+    return filename + "_" + szSuffix;
+}
+
+void captureWriter::openFile() {
+    capture_header_t header;
+
+    logger & log = logger::getInstance();
+
+    fd = ::open(filename.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+
+    if (fd < 0) {
+        throw capture_error(capture_error::buildMsg("Failed to open capture file '%s': %s", filename.c_str(), strerror(errno)));
+    }
+
+    struct stat st;
+    fstat(fd, &st);
+
+    currentFileSize = (uint64_t)st.st_size;
+
+    /*
+    ** We only append to a capture that will be read back the
+    ** way we write it, anything else is moved out of the way...
+    */
+    if (currentFileSize >= sizeof(capture_header_t)) {
+        if (pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+            header.magic != CAPTURE_FILE_MAGIC ||
+            header.version != CAPTURE_FILE_VERSION ||
+            header.recordSize != sizeof(capture_record_t))
+        {
+            string archiveFileName = getArchiveFileName();
+
+            ::close(fd);
+            fd = -1;
+
+            if (rename(filename.c_str(), archiveFileName.c_str()) < 0) {
+                throw capture_error(capture_error::buildMsg("Failed to move capture file '%s' aside: %s", filename.c_str(), strerror(errno)));
+            }
+
+            log.logError(
+                "Capture file '%s' isn't a version %u capture we can append to, moved it to '%s'",
+                filename.c_str(),
+                (unsigned)CAPTURE_FILE_VERSION,
+                archiveFileName.c_str());
+
+            openFile();
+            return;
+        }
+    }
+
+    /*
+    ** A crash mid-write leaves a partial record (or header) on the
+    ** end, which would put every record we append out of step, so
+    ** it is cut off, as the journal does with its segments...
+    */
+    uint64_t validSize = 0;
+
+    if (currentFileSize >= sizeof(capture_header_t)) {
+        validSize = currentFileSize - ((currentFileSize - sizeof(capture_header_t)) % sizeof(capture_record_t));
+    }
+
+    if (validSize != currentFileSize) {
+        log.logError(
+            "Truncating capture file '%s' from %llu to %llu bytes",
+            filename.c_str(),
+            (unsigned long long)currentFileSize,
+            (unsigned long long)validSize);
+
+        if (ftruncate(fd, (off_t)validSize) < 0) {
+            int err = errno;
+            ::close(fd);
+            fd = -1;
+            throw capture_error(capture_error::buildMsg("Failed to truncate capture file '%s': %s", filename.c_str(), strerror(err)));
+        }
+
+        currentFileSize = validSize;
+    }
+
+    if (currentFileSize == 0) {
+        header.magic = CAPTURE_FILE_MAGIC;
+        header.version = CAPTURE_FILE_VERSION;
+        header.recordSize = sizeof(capture_record_t);
+        header.created = getEpochNanoseconds();
+
+        if (_writeFully(fd, &header, sizeof(header)) < 0) {
+            int err = errno;
+            ::close(fd);
+            fd = -1;
+            throw capture_error(capture_error::buildMsg("Failed to write capture header to '%s': %s", filename.c_str(), strerror(err)));
+        }
+
+        currentFileSize = sizeof(header);
+    }
+
+    log.logInfo("Capturing raw packets to '%s'", filename.c_str());
+}
+
+void captureWriter::rotate() {
+    string archiveFileName = getArchiveFileName();
+
+    ::close(fd);
+    fd = -1;
+
+    if (rename(filename.c_str(), archiveFileName.c_str()) < 0) {
+        throw capture_error(capture_error::buildMsg("Failed to rotate capture file '%s': %s", filename.c_str(), strerror(errno)));
+    }
+
+    logger::getInstance().logStatus("Rotated capture file to '%s'", archiveFileName.c_str());
+
+    openFile();
+}
+
+void captureWriter::write(const uint8_t * payload, int length, int pipe, uint64_t timestamp) {
+    capture_record_t record;
+
+    if (currentFileSize + sizeof(record) > maxFileSize) {
+        rotate();
+    }
+
+    if (length > CAPTURE_PAYLOAD_LEN) {
+        length = CAPTURE_PAYLOAD_LEN;
+    }
+
+    record.timestamp = timestamp;
+    record.pipe = (uint8_t)pipe;
+    record.length = (uint8_t)length;
+
+    memcpy(record.payload, payload, length);
+    memset(&record.payload[length], 0, CAPTURE_PAYLOAD_LEN - length);
+
+    /*
+    ** One write() per record, so a record is either
+    ** appended whole or not at all...
+    */
+    if (_writeFully(fd, &record, sizeof(record)) < 0) {
+        throw capture_error(capture_error::buildMsg("Failed to write to capture file '%s': %s", filename.c_str(), strerror(errno)));
+    }
+
+    currentFileSize += sizeof(record);
+}
+
+captureReader::captureReader(const string & filename) {
+    struct stat st;
+
+    this->filename = filename;
+
+    fd = ::open(filename.c_str(), O_RDONLY);
+
+    if (fd < 0) {
+        throw capture_error(capture_error::buildMsg("Failed to open capture file '%s': %s", filename.c_str(), strerror(errno)));
+    }
+
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(capture_header_t)) {
+        ::close(fd);
+        throw capture_error(capture_error::buildMsg("Capture file '%s' is too short", filename.c_str()));
+    }
+
+    mappedSize = (size_t)st.st_size;
+
+    void * p = mmap(NULL, mappedSize, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    if (p == MAP_FAILED) {
+        ::close(fd);
+        throw capture_error(capture_error::buildMsg("Failed to mmap capture file '%s': %s", filename.c_str(), strerror(errno)));
+    }
+
+    mapping = (const uint8_t *)p;
+
+    madvise(p, mappedSize, MADV_SEQUENTIAL);
+
+    const capture_header_t * header = (const capture_header_t *)mapping;
+
+    if (header->magic != CAPTURE_FILE_MAGIC || header->version != CAPTURE_FILE_VERSION || header->recordSize != sizeof(capture_record_t)) {
+        munmap(p, mappedSize);
+        ::close(fd);
+        throw capture_error(capture_error::buildMsg("'%s' is not a version %d capture file", filename.c_str(), CAPTURE_FILE_VERSION));
+    }
+
+    records = (const capture_record_t *)&mapping[sizeof(capture_header_t)];
+
+    /*
+    ** Ignore a partial record left by a crash mid-write...
+    */
+    numRecords = (mappedSize - sizeof(capture_header_t)) / sizeof(capture_record_t);
+}
+
+captureReader::~captureReader() {
+    if (mapping != NULL) {
+        munmap((void *)mapping, mappedSize);
+    }
+
+    if (fd >= 0) {
+        ::close(fd);
+    }
+}
@@ -0,0 +1,132 @@
+#include <string>
+#include <exception>
+
+#include <stdint.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+using namespace std;
+
+#ifndef __INCL_CAPTURE
+#define __INCL_CAPTURE
+
+#define CAPTURE_FILE_MAGIC                  0x50414357          // 'WCAP'
+#define CAPTURE_FILE_VERSION                1
+
+#define CAPTURE_PAYLOAD_LEN                 32
+
+#define CAPTURE_DEFAULT_MAX_SIZE            (64UL * 1024UL * 1024UL)
+
+/*
+** A capture file is a header followed by fixed size records,
+** appended in the order the payloads were received...
+*/
+#pragma pack(push, 1)
+typedef struct {                                    // O/S  - Description
+                                                    // ----   ---------------------------------
+    uint32_t            magic;                      // 0x00 - CAPTURE_FILE_MAGIC
+    uint16_t            version;                    // 0x04 - CAPTURE_FILE_VERSION
+    uint16_t            recordSize;                 // 0x06 - sizeof(capture_record_t)
+    uint64_t            created;                    // 0x08 - ns since the epoch
+}
+capture_header_t;
+
+typedef struct {                                    // O/S  - Description
+                                                    // ----   ---------------------------------
+    uint64_t            timestamp;                  // 0x00 - Receive time, ns since the epoch
+    uint8_t             pipe;                       // 0x08 - RX pipe number
+    uint8_t             length;                     // 0x09 - Payload length
+    uint8_t             payload[CAPTURE_PAYLOAD_LEN];   // 0x0A - Raw payload
+}
+capture_record_t;
+#pragma pack(pop)
+
+class capture_error : public exception {
+    private:
+        string message;
+        static const int MESSAGE_BUFFER_LEN = 4096;
+
+    public:
+        const char * getTitle() {
+            return "Capture Error: ";
+        }
+
+        capture_error() {
+            this->message.assign(getTitle());
+        }
+
+        capture_error(const char * msg) : capture_error() {
+            this->message.append(msg);
+        }
+
+        capture_error(const char * msg, const char * file, int line) : capture_error() {
+            char lineNumBuf[8];
+
+            snprintf(lineNumBuf, 8, ":%d", line);
+
+            this->message.append(msg);
+            this->message.append(" at ");
+            this->message.append(file);
+            this->message.append(lineNumBuf);
+        }
+
+        virtual const char * what() const noexcept {
+            return this->message.c_str();
+        }
+
+        static char * buildMsg(const char * fmt, ...) {
+            va_list     args;
+            char *      buffer;
+
+            buffer = (char *)malloc(MESSAGE_BUFFER_LEN);
+
+            va_start(args, fmt);
+            vsnprintf(buffer, MESSAGE_BUFFER_LEN, fmt, args);
+            va_end(args);
+
+            return buffer;
+        }
+};
+
+class captureWriter {
+    private:
+        string          filename;
+        int             fd = -1;
+        uint64_t        maxFileSize;
+        uint64_t        currentFileSize = 0;
+
+        string getArchiveFileName();
+        void openFile();
+        void rotate();
+
+    public:
+        captureWriter(const string & filename, uint64_t maxFileSize);
+        ~captureWriter();
+
+        void write(const uint8_t * payload, int length, int pipe, uint64_t timestamp);
+};
+
+class captureReader {
+    private:
+        string                      filename;
+        int                         fd = -1;
+        size_t                      mappedSize = 0;
+        const uint8_t *             mapping = NULL;
+        const capture_record_t *    records = NULL;
+        uint64_t                    numRecords = 0;
+
+    public:
+        captureReader(const string & filename);
+        ~captureReader();
+
+        uint64_t getNumRecords() {
+            return numRecords;
+        }
+
+        const capture_record_t * getRecord(uint64_t index) {
+            return &records[index];
+        }
+};
+
+#endif
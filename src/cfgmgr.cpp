@@ -14,7 +14,7 @@
 using namespace std;
 
 static bool inline isStringHexadecimal(string & value) {
-    if (value[0] == '0' && (value[1] == 'x' || value[1] == 'X')) {
+    if (value.length() > 1 && value[0] == '0' && (value[1] == 'x' || value[1] == 'X')) {
         return true;
     }
 
@@ -22,8 +22,7 @@ static bool inline isStringHexadecimal(string & value) {
 }
 
 static const char * getHexadecimalValue(string & value) {
-    static string hexValue = value.substr(2);
-    return hexValue.c_str();
+    return value.c_str() + 2;
 }
 
 static const char * getDecimalValue(string & value) {
@@ -92,7 +91,7 @@ char * cfgmgr::readPropertyValue(string & value, string & configFilePath) {
     return property;
 }
 
-void cfgmgr::initialise(const string & configFileName) {
+void cfgmgr::parseConfig(const string & configFileName, unordered_map<string, string> & target) {
     ifstream ifs;
 
     try {
@@ -122,20 +121,63 @@ void cfgmgr::initialise(const string & configFileName) {
             free(property);
         }
 
-        this->values[key] = value;
+        target[key] = value;
     }
 
+    ifs.close();
+}
+
+void cfgmgr::initialise(const string & configFileName) {
+    parseConfig(configFileName, this->values);
+
+    this->configFileName = configFileName;
+
     isConfigured = true;
+}
 
-    ifs.close();
+void cfgmgr::reload() {
+    unordered_map<string, string> newValues;
+
+    if (!isConfigured) {
+        return;
+    }
+
+    parseConfig(configFileName, newValues);
+
+    pthread_mutex_lock(&mutex);
+
+    for (auto& i : overrides) {
+        newValues[i.first] = i.second;
+    }
+
+    values.swap(newValues);
+
+    pthread_mutex_unlock(&mutex);
+}
+
+void cfgmgr::setValue(const string & key, const string & value) {
+    pthread_mutex_lock(&mutex);
+
+    this->values[key] = value;
+    this->overrides[key] = value;
+
+    pthread_mutex_unlock(&mutex);
 }
 
 string cfgmgr::getValue(const string & key) {
-    if (values.count(key) == 0) {
-        return "";
+    string value;
+
+    pthread_mutex_lock(&mutex);
+
+    auto i = values.find(key);
+
+    if (i != values.end()) {
+        value = i->second;
     }
 
-    return values[key];
+    pthread_mutex_unlock(&mutex);
+
+    return value;
 }
 
 bool cfgmgr::getValueAsBoolean(const string & key) {
@@ -6,6 +6,7 @@
 #include <limits.h>
 #include <stdint.h>
 #include <stdarg.h>
+#include <pthread.h>
 
 using namespace std;
 
@@ -70,10 +71,19 @@ class cfgmgr {
         unordered_map<string, string> values;
         bool isConfigured = false;
 
+        /*
+        ** Values set on the command line, these survive a reload...
+        */
+        unordered_map<string, string> overrides;
+        string configFileName;
+
+        pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+
         cfgmgr() {}
 
         bool isValuePropertyFile(string & value);
         char * readPropertyValue(string & propertyFileName, string & configFilePath);
+        void parseConfig(const string & configFileName, unordered_map<string, string> & target);
 
     public:
         ~cfgmgr() {}
@@ -81,6 +91,14 @@ class cfgmgr {
         void initialise(const string & configFileName);
         void readConfig();
 
+        /*
+        ** Re-read the config file we were initialised with, the
+        ** new values replace the old all at once...
+        */
+        void reload();
+
+        void setValue(const string & key, const string & value);
+
         string getValue(const string & key);
         bool getValueAsBoolean(const string & key);
         int getValueAsInteger(const string & key);
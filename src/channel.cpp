@@ -0,0 +1,221 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "logger.h"
+#include "utils.h"
+#include "radio.h"
+#include "posixthread.h"
+#include "threads.h"
+#include "channel.h"
+
+using namespace std;
+
+#define NANOSECONDS_PER_HOUR                3600000000000.0
+
+#define HISTOGRAM_WIDTH                     50
+
+channelMonitor::channelMonitor() {
+    memset(stats, 0, sizeof(stats));
+}
+
+void channelMonitor::accumulateTime(uint64_t now) {
+    if (currentChannel >= NRF24L01_MIN_CHANNEL && now > channelStartTime) {
+        stats[currentChannel].timeOnChannel += now - channelStartTime;
+    }
+
+    channelStartTime = now;
+}
+
+void channelMonitor::setCurrentChannel(int channel, uint64_t now) {
+    accumulateTime(now);
+
+    if (channel != currentChannel) {
+        numSweepsSinceMove = 0;
+    }
+
+    currentChannel = channel;
+}
+
+void channelMonitor::recordPackets(int numPackets) {
+    if (currentChannel >= NRF24L01_MIN_CHANNEL) {
+        stats[currentChannel].numPackets += numPackets;
+    }
+}
+
+void channelMonitor::sweep(nrfdevice & radio, int samplesPerChannel) {
+    int channel;
+
+    for (channel = NRF24L01_MIN_CHANNEL;channel <= NRF24L01_MAX_CHANNEL;channel++) {
+        channel_stats_t & s = stats[channel];
+
+        for (int i = 0;i < samplesPerChannel;i++) {
+            /*
+            ** Re-enter RX each time, RPD latches until we do...
+            */
+            radio.setChannel(channel);
+
+            usleep(NRF24L01_RPD_SETTLE_US);
+
+            s.numSamples++;
+
+            if (radio.isCarrierDetected()) {
+                s.numBusy++;
+            }
+        }
+
+        if (s.numSamples >= CHANNEL_MAX_SAMPLES) {
+            s.numSamples >>= 1;
+            s.numBusy >>= 1;
+        }
+    }
+
+    if (currentChannel >= NRF24L01_MIN_CHANNEL) {
+        radio.setChannel(currentChannel);
+    }
+
+    numSweeps++;
+    numSweepsSinceMove++;
+}
+
+double channelMonitor::getBusyFraction(int channel) {
+    channel_stats_t & s = stats[channel];
+
+    if (s.numSamples == 0) {
+        return 0.0;
+    }
+
+    return (double)s.numBusy / (double)s.numSamples;
+}
+
+double channelMonitor::getPacketsPerHour(int channel) {
+    channel_stats_t & s = stats[channel];
+    uint64_t timeOnChannel = s.timeOnChannel;
+
+    if (channel == currentChannel) {
+        uint64_t now = getEpochNanoseconds();
+
+        if (now > channelStartTime) {
+            timeOnChannel += now - channelStartTime;
+        }
+    }
+
+    if (timeOnChannel == 0) {
+        return 0.0;
+    }
+
+    return (double)s.numPackets * NANOSECONDS_PER_HOUR / (double)timeOnChannel;
+}
+
+int channelMonitor::getRecommendedChannel() {
+    int bestChannel = currentChannel;
+
+    if (numSweeps < CHANNEL_MIN_SWEEPS || currentChannel < NRF24L01_MIN_CHANNEL) {
+        return currentChannel;
+    }
+
+    for (int channel = NRF24L01_MIN_CHANNEL;channel <= NRF24L01_MAX_CHANNEL;channel++) {
+        if (stats[channel].numSamples == 0) {
+            continue;
+        }
+
+        double busy = getBusyFraction(channel);
+        double bestBusy = getBusyFraction(bestChannel);
+
+        /*
+        ** On a tie, stay as close to where we are as we can...
+        */
+        if (busy < bestBusy || (busy == bestBusy && abs(channel - currentChannel) < abs(bestChannel - currentChannel))) {
+            bestChannel = channel;
+        }
+    }
+
+    if (getBusyFraction(currentChannel) - getBusyFraction(bestChannel) < CHANNEL_BUSY_MARGIN) {
+        return currentChannel;
+    }
+
+    return bestChannel;
+}
+
+void channelMonitor::logReport() {
+    logger & log = logger::getInstance();
+
+    log.logInfo("Channel occupancy after %d sweep(s), listening on channel %d:", numSweeps, currentChannel);
+
+    for (int channel = NRF24L01_MIN_CHANNEL;channel <= NRF24L01_MAX_CHANNEL;channel++) {
+        channel_stats_t & s = stats[channel];
+
+        if (s.numSamples == 0 && s.timeOnChannel == 0 && channel != currentChannel) {
+            continue;
+        }
+
+        log.logInfo(
+            "\tCh %2d (%d MHz): %5.1f%% busy, %.1f packets/hour%s",
+            channel,
+            2400 + channel,
+            getBusyFraction(channel) * 100.0,
+            getPacketsPerHour(channel),
+            (channel == currentChannel ? " <-" : ""));
+    }
+}
+
+void channelMonitor::printHistogram(FILE * fp) {
+    char szBar[HISTOGRAM_WIDTH + 1];
+
+    fprintf(fp, "\n Ch   MHz   Busy  Occupancy\n");
+
+    for (int channel = NRF24L01_MIN_CHANNEL;channel <= NRF24L01_MAX_CHANNEL;channel++) {
+        double busy = getBusyFraction(channel);
+
+        int barLength = (int)(busy * HISTOGRAM_WIDTH + 0.5);
+
+        memset(szBar, '#', barLength);
+        szBar[barLength] = 0;
+
+        fprintf(fp, " %2d  %4d  %5.1f%%  %s\n", channel, 2400 + channel, busy * 100.0, szBar);
+    }
+
+    int quietest = NRF24L01_MIN_CHANNEL;
+
+    for (int channel = NRF24L01_MIN_CHANNEL;channel <= NRF24L01_MAX_CHANNEL;channel++) {
+        if (getBusyFraction(channel) < getBusyFraction(quietest)) {
+            quietest = channel;
+        }
+    }
+
+    fprintf(fp, "\n Quietest channel: %d (%.1f%% busy)\n\n", quietest, getBusyFraction(quietest) * 100.0);
+}
+
+/*
+** The --scan command line mode, sweep all channels numPasses
+** times and print the occupancy histogram...
+*/
+int runChannelScan(int numPasses) {
+    channelMonitor      monitor;
+
+    nrfdevice & radio = nrfdevice::getInstance();
+
+    nrfcfg radioConfig = getRadioConfig();
+
+    try {
+        radio.open(radioConfig);
+    }
+    catch (nrf24_error & e) {
+        fprintf(stderr, "Failed to open radio: %s\n", e.what());
+        return -1;
+    }
+
+    printf("Scanning channels %d - %d, %d pass(es)...\n", NRF24L01_MIN_CHANNEL, NRF24L01_MAX_CHANNEL, numPasses);
+
+    for (int i = 0;i < numPasses;i++) {
+        monitor.sweep(radio, CHANNEL_DEFAULT_SAMPLES);
+    }
+
+    radio.close();
+
+    monitor.printHistogram(stdout);
+
+    return 0;
+}
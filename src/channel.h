@@ -0,0 +1,87 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "radio.h"
+
+#ifndef __INCL_CHANNEL
+#define __INCL_CHANNEL
+
+#define CHANNEL_DEFAULT_SAMPLES             4
+
+/*
+** Counts are halved once a channel has this many samples,
+** so old interference slowly drops out of the picture...
+*/
+#define CHANNEL_MAX_SAMPLES                 1024
+
+/*
+** Don't recommend (or move to) another channel until we have
+** this many sweeps behind us, and unless it is this much quieter...
+*/
+#define CHANNEL_MIN_SWEEPS                  3
+#define CHANNEL_BUSY_MARGIN                 0.2
+
+typedef struct {
+    uint32_t            numSamples;
+    uint32_t            numBusy;                    // Samples with RPD set
+
+    uint64_t            numPackets;                 // Received while on this channel
+    uint64_t            timeOnChannel;              // ns
+}
+channel_stats_t;
+
+/*
+** Keeps an occupancy picture of channels 1 - 39 from Received
+** Power Detector samples, plus the packet rate we have seen on
+** each channel we have listened on...
+*/
+class channelMonitor {
+    private:
+        channel_stats_t     stats[NRF24L01_MAX_CHANNEL + 1];
+
+        int                 currentChannel = 0;
+        uint64_t            channelStartTime = 0;
+        int                 numSweeps = 0;
+        int                 numSweepsSinceMove = 0;
+
+        void accumulateTime(uint64_t now);
+
+    public:
+        channelMonitor();
+
+        void setCurrentChannel(int channel, uint64_t now);
+
+        int getCurrentChannel() {
+            return currentChannel;
+        }
+
+        void recordPackets(int numPackets);
+
+        /*
+        ** Sample RPD on every channel, then go back to the one
+        ** we were listening on. We are deaf to our own stations
+        ** while this runs, roughly 39 x samples x 0.25ms...
+        */
+        void sweep(nrfdevice & radio, int samplesPerChannel);
+
+        double getBusyFraction(int channel);
+        double getPacketsPerHour(int channel);
+
+        /*
+        ** The channel we should be on, the current one unless
+        ** another is clearly quieter...
+        */
+        int getRecommendedChannel();
+
+        bool isMoveAllowed() {
+            return (numSweepsSinceMove >= CHANNEL_MIN_SWEEPS);
+        }
+
+        void logReport();
+        void printHistogram(FILE * fp);
+};
+
+int runChannelScan(int numPasses);
+
+#endif
@@ -0,0 +1,1655 @@
+#include <string>
+#include <span>
+#include <deque>
+#include <vector>
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <sys/epoll.h>
+
+#include <postgresql/libpq-fe.h>
+
+#include "logger.h"
+#include "cfgmgr.h"
+#include "psql.h"
+#include "utils.h"
+#include "packet.h"
+#include "radio.h"
+#include "station.h"
+#include "reactor.h"
+#include "journal.h"
+#include "bus.h"
+#include "dbsink.h"
+
+#include "sql.h"
+
+using namespace std;
+
+#define INSERT_STRING_LEN          2048
+
+/*
+** How often we look at the clock for the daily summary...
+*/
+#define SUMMARY_CHECK_INTERVAL_MS   30000U
+
+/*
+** While the database is down, the longest we wait before trying
+** it again (unless db.reconnectmax says otherwise), and how many
+** held readings we replay at a time once it's up...
+*/
+#define JOURNAL_DEFAULT_RETRY_MS    30000U
+#define JOURNAL_REPLAY_BATCH_SIZE   64
+
+/*
+** Without a journal, this many readings are held in memory while
+** the database is down, the oldest go first beyond that...
+*/
+#define DB_HOLD_MAX_READINGS        8192
+
+/*
+** How often an idle connection is checked, so we find out the
+** database has gone before there's a reading to write...
+*/
+#define DB_DEFAULT_PROBE_INTERVAL_MS 60000U
+
+/*
+** Readings are written a batch at a time, in one transaction, so
+** they cost one commit (and one fsync on the server) between them.
+** A batch goes once it has this many rows or is this old...
+*/
+#define DB_GROUP_COMMIT_ROWS        32
+#define DB_GROUP_COMMIT_DELAY_MS    1000U
+
+/*
+** With db.pipeline on, up to db.pipelinedepth readings are in
+** flight at once, before write() waits for the server. A pipeline
+** that hasn't answered in this long is given up on...
+*/
+#define DB_PIPELINE_DEFAULT_DEPTH   256
+#define DB_PIPELINE_TIMEOUT_MS      30000
+
+/*
+** --benchmark-db writes each path's rows as a different
+** station, so they don't conflict...
+*/
+#define BENCHMARK_TEXT_STATION_ID   1
+#define BENCHMARK_PREPARED_STATION_ID 3
+#define BENCHMARK_PIPELINE_STATION_ID 5
+
+/*
+** A long PQexec() holds up our heartbeat, and at shutdown we
+** may have a daily summary to write...
+*/
+#define DB_STALL_TIMEOUT_MS         120000U
+#define SHUTDOWN_DB_TIMEOUT_MS      3000U
+
+/*
+** How much of that we spend draining the pipeline and replaying
+** held readings, leaving the rest for the summary and whatever
+** was running when we were asked to stop...
+*/
+#define SHUTDOWN_DB_REPLAY_MS       (SHUTDOWN_DB_TIMEOUT_MS / 2U)
+
+/*
+** The first batch replayed at shutdown, after that each one is
+** as big as we reckon there's time for...
+*/
+#define SHUTDOWN_DB_REPLAY_FIRST_BATCH 8U
+
+/*
+** A station's day whose summary needs working out again, because
+** the day is over, we're stopping part way through, or readings
+** for it have been replayed...
+*/
+typedef struct {
+    uint32_t                        stationID;
+    time_t                          day;
+}
+db_summary_t;
+
+/*
+** A batch sent down the pipeline, one transaction ended by the
+** sync tagged with tag. Its readings are only done with once
+** the sync says it committed. Each statement is tagged with its
+** reading's place in the batch...
+*/
+typedef struct {
+    uint64_t                        tag;
+    vector<weather_transform_t>     readings;
+}
+db_pipelined_batch_t;
+
+typedef struct {
+    psqlPipeline *                  pipeline;
+    int                             socketFD;
+    uint32_t                        maxReadings;
+    uint32_t                        numReadings;
+    uint64_t                        nextTag;
+
+    deque<db_pipelined_batch_t>     inFlight;
+
+    /*
+    ** Readings whose batch failed, written again one at a
+    ** time once the pipeline is empty...
+    */
+    vector<weather_transform_t>     retry;
+}
+db_pipeline_t;
+
+/*
+** Everything the DB sink's event handlers share...
+*/
+typedef struct {
+    psqlConnectionManager * db;
+    psqlConnection *        connection;
+    uint32_t                pipelineDepth;
+    db_pipeline_t *         pipe;
+    spillJournal *          journal;
+    deque<weather_transform_t> * held;
+    eventLoop *             loop;
+    int                     replayTimerFD;
+    uint32_t                retryIntervalMs;
+    bool                    isDatabaseDown;
+    uint64_t                numSpilled;
+    daily_summary_t         ds[NRF24L01_NUM_RX_PIPES];
+    vector<db_summary_t> *  unwritten;
+    bool                    isSummaryDone;
+}
+db_sink_state_t;
+
+static int getLocalDay(time_t t) {
+    struct tm tmLocal;
+
+    localtime_r(&t, &tmLocal);
+
+    return (tmLocal.tm_year * 1000 + tmLocal.tm_yday);
+}
+
+/*
+** Once for each station and day...
+*/
+static void markSummary(db_sink_state_t * state, uint32_t stationID, time_t day) {
+    int localDay = getLocalDay(day);
+
+    for (db_summary_t & summary : *state->unwritten) {
+        if (summary.stationID == stationID && getLocalDay(summary.day) == localDay) {
+            return;
+        }
+    }
+
+    state->unwritten->push_back({stationID, day});
+}
+
+/*
+** The station's day so far is finished with, its summary waits
+** in unwritten until the database takes it...
+*/
+static void closeSummary(db_sink_state_t * state, int pipe) {
+    station * s = stationmgr::getInstance().getStation(pipe);
+
+    if (s != NULL && state->ds[pipe].num_readings > 0) {
+        markSummary(state, s->stationID, state->ds[pipe].created);
+    }
+
+    memset(&state->ds[pipe], 0, sizeof(daily_summary_t));
+}
+
+/*
+** A reading from a day the summary isn't for closes it first, so
+** each day's summary is written for that day. Only the day and
+** how many readings there have been are kept, the summary itself
+** comes from weather_data...
+*/
+static void addToSummary(db_sink_state_t * state, weather_transform_t & tr) {
+    time_t received = (time_t)(tr.timestamp / 1000000000ULL);
+
+    daily_summary_t * ds = &state->ds[tr.pipe];
+
+    if (ds->num_readings > 0 && getLocalDay(received) != getLocalDay(ds->created)) {
+        closeSummary(state, tr.pipe);
+    }
+
+    if (ds->num_readings == 0) {
+        ds->created = received;
+    }
+
+    ds->num_readings++;
+}
+
+/*
+** How we used to insert a reading, formatted into SQL text. Only
+** --benchmark-db uses it now, to compare with the prepared path...
+*/
+static void insertReadingAsText(psqlConnection * connection, weather_transform_t & tr) {
+    char                    szInsertStr[INSERT_STRING_LEN];
+
+    string timestamp = getTimestamp(tr.timestamp);
+
+    snprintf(
+        szInsertStr,
+        INSERT_STRING_LEN,
+        pszWeatherInsertStmt,
+        timestamp.c_str(),
+        (int32_t)tr.stationID,
+        (int32_t)tr.packetNum,
+        tr.temperature,
+        tr.dewPoint,
+        tr.actualPressure,
+        tr.normalisedPressure,
+        tr.humidity,
+        tr.rainfall,
+        tr.windspeed,
+        tr.gustSpeed,
+        tr.avgWindspeed10min,
+        tr.maxGust10min,
+        tr.rainfall1h,
+        tr.rainfall24h,
+        tr.rainRate,
+        tr.pressureTendency3h
+    );
+
+    PQclear(connection->execute(szInsertStr, connection->isInTransaction()));
+
+    snprintf(
+        szInsertStr,
+        INSERT_STRING_LEN,
+        pszTelemetryInsertStmt,
+        timestamp.c_str(),
+        (int32_t)tr.stationID,
+        (int32_t)tr.packetNum,
+        tr.batteryVoltage,
+        tr.batteryPercentage,
+        tr.batteryChargeRate,
+        tr.status_bits,
+        tr.packetLossRate,
+        (int32_t)tr.longestGap
+    );
+
+    PQclear(connection->execute(szInsertStr, connection->isInTransaction()));
+}
+
+static void addWeatherParams(psqlParams & params, weather_transform_t & tr) {
+    params
+        .addTimestamp(tr.timestamp)
+        .addInt4((int32_t)tr.stationID)
+        .addInt4((int32_t)tr.packetNum)
+        .addFloat4(tr.temperature)
+        .addFloat4(tr.dewPoint)
+        .addFloat4(tr.actualPressure)
+        .addFloat4(tr.normalisedPressure)
+        .addFloat4(tr.humidity)
+        .addFloat4(tr.rainfall)
+        .addFloat4(tr.windspeed)
+        .addFloat4(tr.gustSpeed)
+        .addFloat4(tr.avgWindspeed10min)
+        .addFloat4(tr.maxGust10min)
+        .addFloat4(tr.rainfall1h)
+        .addFloat4(tr.rainfall24h)
+        .addFloat4(tr.rainRate)
+        .addFloat4(tr.pressureTendency3h);
+}
+
+static void addTelemetryParams(psqlParams & params, weather_transform_t & tr) {
+    params
+        .addTimestamp(tr.timestamp)
+        .addInt4((int32_t)tr.stationID)
+        .addInt4((int32_t)tr.packetNum)
+        .addFloat4(tr.batteryVoltage)
+        .addFloat4(tr.batteryPercentage)
+        .addFloat4(tr.batteryChargeRate)
+        .addInt4((int32_t)tr.status_bits)
+        .addFloat4(tr.packetLossRate)
+        .addInt4((int32_t)tr.longestGap);
+}
+
+static void insertReadingPrepared(psqlConnection * connection, weather_transform_t & tr) {
+    psqlParams              params;
+
+    logger & log = logger::getInstance();
+
+    log.logDebug("Inserting weather data");
+
+    addWeatherParams(params, tr);
+
+    PQclear(connection->executePrepared(PSQL_WEATHER_INSERT_NAME, params));
+
+    log.logDebug("Inserting telemetry data");
+
+    params.clear();
+
+    addTelemetryParams(params, tr);
+
+    PQclear(connection->executePrepared(PSQL_TELEMETRY_INSERT_NAME, params));
+}
+
+/*
+** Either on a connection, or registered with the connection
+** manager to be prepared on each session it starts...
+*/
+template <typename T>
+static void prepareStatements(T * connection) {
+    connection->prepare(
+                PSQL_WEATHER_INSERT_NAME,
+                pszWeatherInsertPrepared,
+                sizeof(weatherInsertTypes) / sizeof(Oid),
+                weatherInsertTypes);
+
+    connection->prepare(
+                PSQL_TELEMETRY_INSERT_NAME,
+                pszTelemetryInsertPrepared,
+                sizeof(telemetryInsertTypes) / sizeof(Oid),
+                telemetryInsertTypes);
+
+    connection->prepare(
+                PSQL_SUMMARY_INSERT_NAME,
+                pszSummaryInsertPrepared,
+                sizeof(summaryInsertTypes) / sizeof(Oid),
+                summaryInsertTypes);
+}
+
+static void handlePipelineResult(uint64_t tag, psql_result_status status, const char * error, void * context);
+static void handlePipelineSync(uint64_t tag, psql_result_status status, const char * error, void * context);
+
+/*
+** The connection, or NULL while the database is down. The first
+** time we have one, the pipeline is set up on it. The manager
+** keeps the same psqlConnection across reconnects...
+*/
+static psqlConnection * connectDatabase(db_sink_state_t * state) {
+    psqlConnection * connection = state->db->getConnection();
+
+    if (connection != NULL && state->connection == NULL) {
+        state->connection = connection;
+
+        if (state->pipelineDepth > 0) {
+            state->pipe = new db_pipeline_t;
+
+            state->pipe->pipeline = new psqlPipeline(*connection, &handlePipelineResult, &handlePipelineSync, state);
+            state->pipe->socketFD = -1;
+            state->pipe->numReadings = 0;
+            state->pipe->nextTag = 0;
+            state->pipe->maxReadings = state->pipelineDepth;
+
+            logger::getInstance().logInfo("Writing to the database in pipeline mode, up to %u reading(s) in flight", state->pipe->maxReadings);
+        }
+    }
+
+    return connection;
+}
+
+/*
+** Returns false if the database can't take the reading right now,
+** so it should be kept and tried again later. A reading the database
+** rejects for any other reason would be rejected again, so that is
+** logged and counts as done. The inserts ignore a reading that is
+** already there, so trying one twice does no harm...
+*/
+static bool insertReading(db_sink_state_t * state, weather_transform_t & tr) {
+    logger & log = logger::getInstance();
+
+    psqlConnection * connection = connectDatabase(state);
+
+    if (connection == NULL) {
+        return false;
+    }
+
+    try {
+        insertReadingPrepared(connection, tr);
+    }
+    catch (psql_error & e) {
+        log.logError("Failed to insert packet %u from station 0x%08X: %s", tr.packetNum, tr.stationID, e.what());
+
+        if (!connection->isConnected() || connection->isLastErrorTransient()) {
+            state->db->setLost(e.what());
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*
+** Write the readings in one transaction, returns false if they
+** weren't, having rolled back anything we did...
+*/
+static bool insertBatch(db_sink_state_t * state, span<weather_transform_t> readings) {
+    logger & log = logger::getInstance();
+
+    try {
+        state->connection->beginTransaction();
+
+        for (weather_transform_t & tr : readings) {
+            insertReadingPrepared(state->connection, tr);
+        }
+
+        state->connection->endTransaction();
+    }
+    catch (psql_error & e) {
+        log.logError("Failed to write %d reading(s) in one transaction, writing them one at a time: %s", (int)readings.size(), e.what());
+
+        if (state->connection->isConnected()) {
+            try {
+                state->connection->rollbackTransaction();
+            }
+            catch (psql_error & e) {
+                log.logError("%s", e.what());
+            }
+        }
+
+        return false;
+    }
+
+    log.logDebug("Wrote %d reading(s) in one transaction", (int)readings.size());
+
+    return true;
+}
+
+static void scheduleReplay(db_sink_state_t * state, uint32_t delayMs) {
+    state->loop->setTimer(state->replayTimerFD, delayMs, false);
+}
+
+/*
+** Readings waiting for the database are in the journal if we
+** have one, otherwise held in memory...
+*/
+static bool hasHeldReadings(db_sink_state_t * state) {
+    if (state->journal != NULL) {
+        return !state->journal->isEmpty();
+    }
+
+    return !state->held->empty();
+}
+
+static uint64_t getNumHeldReadings(db_sink_state_t * state) {
+    if (state->journal != NULL) {
+        return state->journal->getNumPending();
+    }
+
+    return (uint64_t)state->held->size();
+}
+
+static uint32_t peekHeldReadings(db_sink_state_t * state, weather_transform_t * batch, uint32_t maxReadings) {
+    if (state->journal != NULL) {
+        return state->journal->peek(batch, maxReadings);
+    }
+
+    uint32_t numReadings = 0;
+
+    while (numReadings < maxReadings && numReadings < state->held->size()) {
+        batch[numReadings] = (*state->held)[numReadings];
+        numReadings++;
+    }
+
+    return numReadings;
+}
+
+static void advanceHeldReadings(db_sink_state_t * state, uint32_t numReadings) {
+    if (state->journal != NULL) {
+        state->journal->advance(numReadings);
+    }
+    else {
+        state->held->erase(state->held->begin(), state->held->begin() + numReadings);
+    }
+}
+
+static void spillReading(db_sink_state_t * state, weather_transform_t & tr) {
+    if (state->journal == NULL) {
+        if (state->held->size() >= DB_HOLD_MAX_READINGS) {
+            weather_transform_t & oldest = state->held->front();
+
+            logger::getInstance().logError("Dropped packet %u from station 0x%08X, too many readings held for the database", oldest.packetNum, oldest.stationID);
+
+            state->held->pop_front();
+        }
+
+        state->held->push_back(tr);
+        return;
+    }
+
+    try {
+        state->journal->append(tr);
+    }
+    catch (journal_error & e) {
+        logger::getInstance().logError("Dropped packet %u from station 0x%08X: %s", tr.packetNum, tr.stationID, e.what());
+    }
+}
+
+static void storeReading(db_sink_state_t * state, weather_transform_t & tr) {
+    logger & log = logger::getInstance();
+
+    /*
+    ** Once anything is held, everything is, so readings reach
+    ** the database in the order they arrived...
+    */
+    if (state->isDatabaseDown || hasHeldReadings(state)) {
+        spillReading(state, tr);
+        return;
+    }
+
+    if (insertReading(state, tr)) {
+        return;
+    }
+
+    log.logError("Database is unavailable, keeping readings %s until it is back", (state->journal != NULL ? "in the journal" : "in memory"));
+
+    state->isDatabaseDown = true;
+
+    spillReading(state, tr);
+    scheduleReplay(state, state->db->getRetryDelayMs());
+}
+
+static bool isPipelineActive(db_sink_state_t * state) {
+    return (state->pipe != NULL && state->pipe->pipeline->isInPipeline());
+}
+
+/*
+** Results come back in the order the statements were sent, two
+** for each reading, all from the oldest batch in flight. One that
+** failed is only logged here, its batch is dealt with at the sync...
+*/
+static void handlePipelineResult(uint64_t tag, psql_result_status status, const char * error, void * context) {
+    db_sink_state_t * state = (db_sink_state_t *)context;
+    db_pipeline_t * pipe = state->pipe;
+
+    if (pipe->inFlight.empty() || tag >= pipe->inFlight.front().readings.size()) {
+        logger::getInstance().logError("Pipeline result for an unknown reading (tag %llu)", (unsigned long long)tag);
+        return;
+    }
+
+    if (status == psql_result_error) {
+        weather_transform_t & tr = pipe->inFlight.front().readings[tag];
+
+        logger::getInstance().logError(
+            "Failed to insert packet %u from station 0x%08X, writing its batch again one at a time: %s",
+            tr.packetNum,
+            tr.stationID,
+            error);
+    }
+}
+
+/*
+** The batch has committed, or it hasn't and everything in it
+** goes again, including readings whose own inserts worked but
+** were rolled back with the rest...
+*/
+static void handlePipelineSync(uint64_t tag, psql_result_status status, const char * error, void * context) {
+    db_sink_state_t * state = (db_sink_state_t *)context;
+    db_pipeline_t * pipe = state->pipe;
+
+    if (pipe->inFlight.empty() || pipe->inFlight.front().tag != tag) {
+        logger::getInstance().logError("Pipeline sync for an unknown batch (tag %llu)", (unsigned long long)tag);
+        return;
+    }
+
+    db_pipelined_batch_t & batch = pipe->inFlight.front();
+
+    if (status != psql_result_ok) {
+        pipe->retry.insert(pipe->retry.end(), batch.readings.begin(), batch.readings.end());
+    }
+
+    pipe->numReadings -= (uint32_t)batch.readings.size();
+    pipe->inFlight.pop_front();
+}
+
+static void handlePipelineEvent(int fd, uint32_t events, void * context);
+
+static void startPipeline(db_sink_state_t * state) {
+    db_pipeline_t * pipe = state->pipe;
+
+    pipe->pipeline->enter();
+
+    pipe->socketFD = state->connection->getSocket();
+
+    state->loop->addFD(pipe->socketFD, pipe->pipeline->getEvents(), &handlePipelineEvent, state);
+}
+
+/*
+** Out of pipeline mode, then anything that failed goes again
+** the ordinary way, which sorts out a reading the database
+** won't take from one that was just caught up in its batch...
+*/
+static void finishPipeline(db_sink_state_t * state) {
+    db_pipeline_t * pipe = state->pipe;
+
+    state->loop->removeFD(pipe->socketFD);
+
+    try {
+        pipe->pipeline->exit();
+    }
+    catch (psql_error & e) {
+        logger::getInstance().logError("%s", e.what());
+    }
+
+    if (pipe->retry.empty()) {
+        return;
+    }
+
+    for (weather_transform_t & tr : pipe->retry) {
+        storeReading(state, tr);
+    }
+
+    pipe->retry.clear();
+
+    if (state->journal != NULL) {
+        state->journal->sync();
+    }
+}
+
+/*
+** The connection has gone, or stopped answering. It is left in
+** pipeline mode, so we start a new session before what was in
+** flight is retried, which holds it if the database is really
+** down...
+*/
+static void abandonPipeline(db_sink_state_t * state, const char * reason) {
+    db_pipeline_t * pipe = state->pipe;
+
+    logger::getInstance().logError("Giving up on %u reading(s) in the pipeline: %s", pipe->numReadings, reason);
+
+    state->loop->removeFD(pipe->socketFD);
+
+    pipe->pipeline->abandon();
+
+    /*
+    ** A batch that failed part way through sending never got
+    ** its sync, so abandon() didn't hand it back...
+    */
+    for (db_pipelined_batch_t & batch : pipe->inFlight) {
+        pipe->retry.insert(pipe->retry.end(), batch.readings.begin(), batch.readings.end());
+    }
+
+    pipe->inFlight.clear();
+    pipe->numReadings = 0;
+
+    state->db->reconnect(reason);
+
+    finishPipeline(state);
+}
+
+static void updatePipeline(db_sink_state_t * state) {
+    db_pipeline_t * pipe = state->pipe;
+
+    if (pipe->pipeline->getNumPending() == 0) {
+        finishPipeline(state);
+    }
+    else {
+        state->loop->modifyFD(pipe->socketFD, pipe->pipeline->getEvents());
+    }
+}
+
+static void handlePipelineEvent(int fd, uint32_t events, void * context) {
+    db_sink_state_t * state = (db_sink_state_t *)context;
+
+    try {
+        if (events & EPOLLOUT) {
+            state->pipe->pipeline->flush();
+        }
+
+        if (events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+            state->pipe->pipeline->processResults();
+        }
+    }
+    catch (psql_error & e) {
+        abandonPipeline(state, e.what());
+        return;
+    }
+
+    updatePipeline(state);
+}
+
+/*
+** Wait for everything in the pipeline to be answered, for
+** anything that needs the connection to itself...
+*/
+static void drainPipeline(db_sink_state_t * state, int timeoutMs) {
+    if (!isPipelineActive(state)) {
+        return;
+    }
+
+    uint64_t deadline = getEpochNanoseconds() + (uint64_t)timeoutMs * 1000000ULL;
+
+    try {
+        while (state->pipe->pipeline->getNumPending() > 0) {
+            uint64_t now = getEpochNanoseconds();
+
+            if (now >= deadline || !state->pipe->pipeline->wait((int)((deadline - now) / 1000000ULL))) {
+                abandonPipeline(state, "timed out waiting for the server");
+                return;
+            }
+        }
+    }
+    catch (psql_error & e) {
+        abandonPipeline(state, e.what());
+        return;
+    }
+
+    finishPipeline(state);
+}
+
+/*
+** The batch is sent followed by a sync, so it commits as one
+** transaction, and we go back to the event loop without waiting
+** for it unless there's already too much in flight...
+*/
+static void sendPipelined(db_sink_state_t * state, span<weather_transform_t> readings) {
+    psqlParams      params;
+
+    db_pipeline_t * pipe = state->pipe;
+
+    try {
+        if (!pipe->pipeline->isInPipeline()) {
+            startPipeline(state);
+        }
+
+        pipe->inFlight.push_back({pipe->nextTag++, vector<weather_transform_t>(readings.begin(), readings.end())});
+        pipe->numReadings += (uint32_t)readings.size();
+
+        db_pipelined_batch_t & batch = pipe->inFlight.back();
+
+        for (uint64_t i = 0;i < batch.readings.size();i++) {
+            params.clear();
+            addWeatherParams(params, batch.readings[i]);
+            pipe->pipeline->send(PSQL_WEATHER_INSERT_NAME, params, i);
+
+            params.clear();
+            addTelemetryParams(params, batch.readings[i]);
+            pipe->pipeline->send(PSQL_TELEMETRY_INSERT_NAME, params, i);
+        }
+
+        pipe->pipeline->sync(batch.tag);
+        pipe->pipeline->flush();
+
+        while (pipe->numReadings > pipe->maxReadings) {
+            if (!pipe->pipeline->wait(DB_PIPELINE_TIMEOUT_MS)) {
+                abandonPipeline(state, "timed out waiting for the server");
+                return;
+            }
+        }
+    }
+    catch (psql_error & e) {
+        /*
+        ** Anything we couldn't send at all is retried with the
+        ** rest of what was in flight...
+        */
+        if (pipe->pipeline->isInPipeline()) {
+            abandonPipeline(state, e.what());
+        }
+        else {
+            logger::getInstance().logError("Failed to start pipeline: %s", e.what());
+
+            for (weather_transform_t & tr : readings) {
+                storeReading(state, tr);
+            }
+        }
+
+        return;
+    }
+
+    updatePipeline(state);
+}
+
+static void writeSummaries(db_sink_state_t * state);
+
+/*
+** Replay a batch from the journal (or what's held in memory
+** without one), then come back for the next one so the queue
+** gets a look in. Each batch is one transaction, as in write(),
+** and is only moved past once it has committed. At most
+** maxReadings, up to JOURNAL_REPLAY_BATCH_SIZE, go at once...
+*/
+static void replayJournal(db_sink_state_t * state, uint32_t maxReadings = JOURNAL_REPLAY_BATCH_SIZE) {
+    weather_transform_t     batch[JOURNAL_REPLAY_BATCH_SIZE];
+    uint32_t                numReplayed = 0;
+
+    if (maxReadings > JOURNAL_REPLAY_BATCH_SIZE) {
+        maxReadings = JOURNAL_REPLAY_BATCH_SIZE;
+    }
+
+    logger & log = logger::getInstance();
+
+    drainPipeline(state, DB_PIPELINE_TIMEOUT_MS);
+
+    /*
+    ** See if the database is back, the manager decides when
+    ** it is worth trying again...
+    */
+    if (connectDatabase(state) == NULL) {
+        state->isDatabaseDown = true;
+        scheduleReplay(state, state->db->getRetryDelayMs());
+        return;
+    }
+
+    try {
+        while (numReplayed < maxReadings) {
+            uint32_t numReadings = peekHeldReadings(state, batch, maxReadings - numReplayed);
+
+            if (numReadings == 0) {
+                break;
+            }
+
+            if (numReadings > 1 && insertBatch(state, span<weather_transform_t>(batch, numReadings))) {
+                for (uint32_t i = 0;i < numReadings;i++) {
+                    markSummary(state, batch[i].stationID, (time_t)(batch[i].timestamp / 1000000000ULL));
+                }
+
+                advanceHeldReadings(state, numReadings);
+                numReplayed += numReadings;
+                continue;
+            }
+
+            for (uint32_t i = 0;i < numReadings;i++) {
+                if (!insertReading(state, batch[i])) {
+                    state->isDatabaseDown = true;
+                    scheduleReplay(state, state->db->getRetryDelayMs());
+                    return;
+                }
+
+                markSummary(state, batch[i].stationID, (time_t)(batch[i].timestamp / 1000000000ULL));
+
+                advanceHeldReadings(state, 1);
+                numReplayed++;
+            }
+        }
+    }
+    catch (journal_error & e) {
+        log.logError("Failed to replay journal: %s", e.what());
+        scheduleReplay(state, state->retryIntervalMs);
+        return;
+    }
+
+    state->db->resetBackoff();
+
+    if (state->isDatabaseDown) {
+        log.logStatus("Database is back, replaying %llu held reading(s)", (unsigned long long)(getNumHeldReadings(state) + numReplayed));
+        state->isDatabaseDown = false;
+    }
+
+    if (hasHeldReadings(state)) {
+        scheduleReplay(state, 0);
+        return;
+    }
+
+    if (numReplayed > 0) {
+        log.logStatus("Held readings replayed, writing readings straight to the database again");
+    }
+
+    writeSummaries(state);
+}
+
+static void openJournal(db_sink_state_t * state) {
+    cfgmgr & cfg = cfgmgr::getInstance();
+
+    string directory = cfg.getValue("journal.dir");
+
+    state->retryIntervalMs = JOURNAL_DEFAULT_RETRY_MS;
+
+    if (cfg.getValue("journal.retryinterval").length() > 0) {
+        state->retryIntervalMs = (uint32_t)cfg.getValueAsInteger("journal.retryinterval") * 1000U;
+    }
+
+    if (directory.length() == 0) {
+        return;
+    }
+
+    try {
+        state->journal = new spillJournal(
+                                directory,
+                                cfg.getValueAsLongUnsignedInteger("journal.segmentsize"),
+                                cfg.getValueAsLongUnsignedInteger("journal.maxsize"),
+                                cfg.getValueAsLongUnsignedInteger("journal.syncrecords"));
+    }
+    catch (journal_error & e) {
+        logger::getInstance().logError("Failed to open journal, continuing without it: %s", e.what());
+    }
+}
+
+/*
+** Work out the summaries waiting for the database, oldest first,
+** each from its day's weather_data rows. That replaces any row
+** already there, so doing one again (we were restarted, or don't
+** know if the last attempt committed) does no harm. While readings
+** are held the rows aren't all there, so we wait for the replay
+** timer to have written them...
+*/
+static void writeSummaries(db_sink_state_t * state) {
+    psqlParams              params;
+
+    logger & log = logger::getInstance();
+
+    if (state->unwritten->empty() || hasHeldReadings(state)) {
+        return;
+    }
+
+    drainPipeline(state, DB_PIPELINE_TIMEOUT_MS);
+
+    psqlConnection * connection = connectDatabase(state);
+
+    if (connection == NULL) {
+        state->isDatabaseDown = true;
+        scheduleReplay(state, state->db->getRetryDelayMs());
+        return;
+    }
+
+    size_t numWritten = 0;
+
+    for (db_summary_t & summary : *state->unwritten) {
+        log.logDebug("Inserting daily summary for station 0x%08X", summary.stationID);
+
+        params.clear();
+
+        params
+            .addDate(summary.day)
+            .addInt4((int32_t)summary.stationID);
+
+        try {
+            PQclear(connection->executePrepared(PSQL_SUMMARY_INSERT_NAME, params));
+        }
+        catch (psql_error & e) {
+            log.logError("Failed to write daily summary for station 0x%08X: %s", summary.stationID, e.what());
+
+            /*
+            ** One the database rejects would be rejected again...
+            */
+            if (!connection->isConnected() || connection->isLastErrorTransient()) {
+                state->db->setLost(e.what());
+                state->isDatabaseDown = true;
+                scheduleReplay(state, state->db->getRetryDelayMs());
+                break;
+            }
+        }
+
+        numWritten++;
+    }
+
+    state->unwritten->erase(state->unwritten->begin(), state->unwritten->begin() + numWritten);
+}
+
+/*
+** The day is over (or we're stopping), so each station's summary
+** so far is written and started again...
+*/
+static void writeDailySummary(db_sink_state_t * state) {
+    for (int pipe = 0;pipe < NRF24L01_NUM_RX_PIPES;pipe++) {
+        closeSummary(state, pipe);
+    }
+
+    writeSummaries(state);
+}
+
+/*
+** Runs off a timer rather than off the back of an insert, so the
+** summary is still written on a night when no packets arrive...
+*/
+static void checkDailySummary(db_sink_state_t * state) {
+    struct tm * localtime = getLocalTime();
+
+    int hour = localtime->tm_hour;
+    int minute = localtime->tm_min;
+
+    /*
+    ** On the stroke of midnight, write the daily_summary
+    ** and reset the summary values...
+    */
+    if (hour == 23 && minute == 59 && !state->isSummaryDone) {
+        writeDailySummary(state);
+
+        state->isSummaryDone = true;
+    }
+    else if (hour == 1) {
+        /*
+        ** Once we've got to 1am, reset isSummaryDone flag...
+        */
+        state->isSummaryDone = false;
+    }
+
+    /*
+    ** A summary closed by the first reading of a new day goes
+    ** as soon as the database is free. One the database didn't
+    ** take is left to the replay timer...
+    */
+    if (!state->isDatabaseDown && !hasHeldReadings(state)) {
+        writeSummaries(state);
+    }
+}
+
+static void handleSummaryTimer(int fd, uint32_t events, void * context) {
+    checkDailySummary((db_sink_state_t *)context);
+}
+
+static void handleReplayTimer(int fd, uint32_t events, void * context) {
+    replayJournal((db_sink_state_t *)context);
+}
+
+/*
+** Only while nothing else is using the connection, if it has
+** gone we hold readings from now on rather than find out when
+** writing them...
+*/
+static void handleProbeTimer(int fd, uint32_t events, void * context) {
+    db_sink_state_t * state = (db_sink_state_t *)context;
+
+    if (state->isDatabaseDown || isPipelineActive(state) || state->db->getState() != psql_state_connected) {
+        return;
+    }
+
+    if (!state->db->probe()) {
+        state->isDatabaseDown = true;
+        scheduleReplay(state, state->db->getRetryDelayMs());
+    }
+}
+
+/*
+** Writes readings to the database, holding them in the journal
+** (or in memory) while it is down, and each station's daily
+** summary...
+*/
+class dbSink : public readingSink {
+    private:
+        db_sink_state_t       state;
+
+        /*
+        ** Keeps state.db there while the supervisor cancels
+        ** through it...
+        */
+        pthread_mutex_t       dbMutex = PTHREAD_MUTEX_INITIALIZER;
+
+        void release();
+
+    public:
+        dbSink() {
+            memset(&state, 0, sizeof(state));
+        }
+
+        ~dbSink() {
+            release();
+
+            if (state.unwritten != NULL) {
+                delete state.unwritten;
+            }
+        }
+
+        const char * getName() override {
+            return "db";
+        }
+
+        const char * getThreadName() override {
+            return "DBUpdateThread";
+        }
+
+        void getPolicy(sink_policy_t * policy) override {
+            policy->maxBatch = DB_GROUP_COMMIT_ROWS;
+            policy->batchDelayMs = DB_GROUP_COMMIT_DELAY_MS;
+        }
+
+        uint32_t getStallTimeoutMs() override {
+            return DB_STALL_TIMEOUT_MS;
+        }
+
+        uint32_t getStopTimeoutMs() override {
+            return SHUTDOWN_DB_TIMEOUT_MS;
+        }
+
+        void open(eventLoop & loop) override;
+        void write(span<weather_transform_t> readings) override;
+        bool spill(span<weather_transform_t> readings) override;
+        void close(eventLoop & loop) override;
+        void onStalled() override;
+};
+
+void dbSink::release() {
+    if (state.pipe != NULL) {
+        delete state.pipe->pipeline;
+        delete state.pipe;
+        state.pipe = NULL;
+    }
+
+    if (state.journal != NULL) {
+        delete state.journal;
+        state.journal = NULL;
+    }
+
+    if (state.held != NULL) {
+        delete state.held;
+        state.held = NULL;
+    }
+
+    /*
+    ** The manager owns the connection...
+    */
+    if (state.db != NULL) {
+        pthread_mutex_lock(&dbMutex);
+
+        delete state.db;
+        state.db = NULL;
+
+        pthread_mutex_unlock(&dbMutex);
+    }
+
+    state.connection = NULL;
+}
+
+/*
+** Whatever we're waiting on the server for fails with 57014, which
+** counts as transient, so the readings are held and we carry on...
+*/
+void dbSink::onStalled() {
+    pthread_mutex_lock(&dbMutex);
+
+    if (state.db != NULL && state.db->cancel()) {
+        logger::getInstance().logStatus("Asked the database to cancel the statement we're stuck on");
+    }
+
+    pthread_mutex_unlock(&dbMutex);
+}
+
+void dbSink::open(eventLoop & loop) {
+    logger & log = logger::getInstance();
+    cfgmgr & cfg = cfgmgr::getInstance();
+
+    /*
+    ** If we've been restarted, start again with everything but
+    ** the daily summary...
+    */
+    release();
+
+    state.loop = &loop;
+    state.isDatabaseDown = false;
+    state.held = new deque<weather_transform_t>();
+
+    if (state.unwritten == NULL) {
+        state.unwritten = new vector<db_summary_t>();
+    }
+
+    openJournal(&state);
+
+    /*
+    ** Nothing connects until there's something to write, after
+    ** a failed attempt the manager waits reconnectmin seconds,
+    ** doubling each time up to reconnectmax...
+    */
+    uint32_t minBackoffMs = PSQL_DEFAULT_RECONNECT_MIN_MS;
+    uint32_t maxBackoffMs = state.retryIntervalMs;
+
+    if (cfg.getValue("db.reconnectmin").length() > 0) {
+        minBackoffMs = (uint32_t)cfg.getValueAsInteger("db.reconnectmin") * 1000U;
+    }
+    if (cfg.getValue("db.reconnectmax").length() > 0) {
+        maxBackoffMs = (uint32_t)cfg.getValueAsInteger("db.reconnectmax") * 1000U;
+    }
+
+    psqlConnectionManager * db = new psqlConnectionManager(
+                                cfg.getValue("db.host"), 
+                                cfg.getValueAsInteger("db.port"),
+                                cfg.getValue("db.database"),
+                                cfg.getValue("db.user"),
+                                cfg.getValue("db.password"),
+                                minBackoffMs,
+                                maxBackoffMs);
+
+    pthread_mutex_lock(&dbMutex);
+    state.db = db;
+    pthread_mutex_unlock(&dbMutex);
+
+    prepareStatements(state.db);
+
+    if (cfg.getValueAsBoolean("db.pipeline")) {
+        state.pipelineDepth = DB_PIPELINE_DEFAULT_DEPTH;
+
+        if (cfg.getValue("db.pipelinedepth").length() > 0) {
+            state.pipelineDepth = cfg.getValueAsLongUnsignedInteger("db.pipelinedepth");
+        }
+    }
+
+    /*
+    ** Besides the readings, it is time to look at the daily
+    ** summary, to have another go at replaying held readings,
+    ** or to check the connection is still there...
+    */
+    loop.addTimer(SUMMARY_CHECK_INTERVAL_MS, true, &handleSummaryTimer, &state);
+
+    state.replayTimerFD = loop.addTimer(0, false, &handleReplayTimer, &state);
+
+    uint32_t probeIntervalMs = DB_DEFAULT_PROBE_INTERVAL_MS;
+
+    if (cfg.getValue("db.probeinterval").length() > 0) {
+        probeIntervalMs = (uint32_t)cfg.getValueAsInteger("db.probeinterval") * 1000U;
+    }
+
+    if (probeIntervalMs > 0) {
+        loop.addTimer(probeIntervalMs, true, &handleProbeTimer, &state);
+    }
+
+    if (!hasHeldReadings(&state)) {
+        loop.disarmTimer(state.replayTimerFD);
+    }
+
+    log.logDebug("Database reconnects back off from %u ms to %u ms", minBackoffMs, maxBackoffMs);
+}
+
+void dbSink::write(span<weather_transform_t> readings) {
+    logger & log = logger::getInstance();
+
+    for (weather_transform_t & tr : readings) {
+        log.logDebug("Updating summary structure");
+
+        addToSummary(&state, tr);
+    }
+
+    /*
+    ** The first write connects...
+    */
+    if (state.connection == NULL && !state.isDatabaseDown) {
+        connectDatabase(&state);
+    }
+
+    /*
+    ** Readings only go down the pipeline while nothing is held,
+    ** so they stay in order. Replaying held readings waits for
+    ** the pipeline to empty first...
+    */
+    if (state.pipe != NULL && !state.isDatabaseDown && !hasHeldReadings(&state)) {
+        sendPipelined(&state, readings);
+        return;
+    }
+
+    /*
+    ** If the batch won't go in one, or the readings have to go
+    ** through the journal, each is stored on its own. A failed
+    ** batch has been rolled back, so nothing is written twice...
+    */
+    bool isBatchDone = false;
+
+    if (readings.size() > 1 &&
+        state.db->getState() == psql_state_connected &&
+        !state.isDatabaseDown &&
+        !hasHeldReadings(&state))
+    {
+        isBatchDone = insertBatch(&state, readings);
+    }
+
+    if (!isBatchDone) {
+        for (weather_transform_t & tr : readings) {
+            storeReading(&state, tr);
+        }
+    }
+
+    /*
+    ** Whatever we spilled this time round goes to disk
+    ** in one fsync...
+    */
+    if (state.journal != NULL) {
+        state.journal->sync();
+    }
+}
+
+/*
+** The database is up but slower than the readings are coming
+** in, so they are held as if it were down, behind anything
+** already held, rather than left to fill the queue. The replay
+** timer writes them as fast as the database will take them...
+*/
+bool dbSink::spill(span<weather_transform_t> readings) {
+    logger & log = logger::getInstance();
+
+    for (weather_transform_t & tr : readings) {
+        log.logDebug("Updating summary structure");
+
+        addToSummary(&state, tr);
+    }
+
+    if (!state.isDatabaseDown && !hasHeldReadings(&state)) {
+        log.logError("Database is falling behind, keeping readings %s until it catches up", (state.journal != NULL ? "in the journal" : "in memory"));
+
+        scheduleReplay(&state, 0);
+    }
+
+    for (weather_transform_t & tr : readings) {
+        spillReading(&state, tr);
+    }
+
+    state.numSpilled += readings.size();
+
+    if (state.journal != NULL) {
+        state.journal->sync();
+    }
+
+    return true;
+}
+
+/*
+** Everything queued has been written, anything the database
+** can't take now stays in the journal for next time. Without
+** a journal, held readings are lost...
+*/
+void dbSink::close(eventLoop & loop) {
+    logger & log = logger::getInstance();
+
+    uint64_t replayDeadline = getEpochNanoseconds() + (uint64_t)SHUTDOWN_DB_REPLAY_MS * 1000000ULL;
+
+    drainPipeline(&state, SHUTDOWN_DB_TIMEOUT_MS / 2);
+
+    /*
+    ** One last go at what we're holding, which matters most for
+    ** readings only held in memory. A batch that's too big for the
+    ** time left would hold up the stop, so we time the first small
+    ** one and size the rest from that. If the database is down we
+    ** only try it if the backoff is up, a connection attempt can
+    ** take longer than we've got...
+    */
+    uint64_t numHeld = getNumHeldReadings(&state);
+    uint32_t batchSize = SHUTDOWN_DB_REPLAY_FIRST_BATCH;
+
+    while (batchSize > 0 && hasHeldReadings(&state)) {
+        if (state.isDatabaseDown && state.db->getRetryDelayMs() > 0) {
+            break;
+        }
+
+        uint64_t startTime = getEpochNanoseconds();
+        uint64_t numBefore = getNumHeldReadings(&state);
+
+        replayJournal(&state, batchSize);
+
+        uint64_t now = getEpochNanoseconds();
+        uint64_t numReplayed = numBefore - getNumHeldReadings(&state);
+
+        if (state.isDatabaseDown || numReplayed == 0 || now >= replayDeadline) {
+            break;
+        }
+
+        uint64_t timePerReading = (now - startTime) / numReplayed + 1;
+        uint64_t numThereIsTimeFor = (replayDeadline - now) / timePerReading;
+
+        batchSize = (uint32_t)(numThereIsTimeFor < JOURNAL_REPLAY_BATCH_SIZE ? numThereIsTimeFor : JOURNAL_REPLAY_BATCH_SIZE);
+    }
+
+    if (getNumHeldReadings(&state) < numHeld) {
+        log.logStatus(
+            "Replayed %llu of %llu held reading(s) before stopping",
+            (unsigned long long)(numHeld - getNumHeldReadings(&state)),
+            (unsigned long long)numHeld);
+    }
+
+    writeDailySummary(&state);
+
+    if (state.journal != NULL) {
+        log.logStatus("DB queue drained, %llu reading(s) left in the journal", (unsigned long long)state.journal->getNumPending());
+    }
+    else if (!state.held->empty()) {
+        log.logError("DB queue drained, lost %llu reading(s) held in memory for the database", (unsigned long long)state.held->size());
+    }
+    else {
+        log.logStatus("DB queue drained");
+    }
+
+    if (!state.unwritten->empty()) {
+        log.logError("%llu daily summary row(s) not written", (unsigned long long)state.unwritten->size());
+    }
+    else {
+        log.logStatus("Daily summary written");
+    }
+
+    log.logStatus(
+        "Database %s, %llu connect(s), %llu reconnect(s), lost %llu time(s), %llu failed attempt(s)",
+        state.db->getStateName(),
+        (unsigned long long)state.db->getNumConnects(),
+        (unsigned long long)state.db->getNumReconnects(),
+        (unsigned long long)state.db->getNumLost(),
+        (unsigned long long)state.db->getNumFailedAttempts());
+
+    if (state.numSpilled > 0) {
+        log.logStatus("%llu reading(s) held while the database was falling behind", (unsigned long long)state.numSpilled);
+    }
+
+    release();
+}
+
+static readingSink * createDBSink() {
+    return new dbSink();
+}
+
+static sinkRegistration _dbSink("db", &createDBSink);
+
+/*
+** Synthetic readings covering the range the sensors report, a
+** second apart...
+*/
+static void buildBenchmarkReadings(weather_transform_t * readings, int numRecords) {
+    unsigned short randomState[3] = {0x1234, 0x5678, 0x9ABC};
+
+    uint64_t startTime = getEpochNanoseconds() - (uint64_t)numRecords * 1000000000ULL;
+
+    for (int i = 0;i < numRecords;i++) {
+        weather_transform_t & tr = readings[i];
+
+        memset(&tr, 0, sizeof(weather_transform_t));
+
+        tr.timestamp = startTime + (uint64_t)i * 1000000000ULL;
+        tr.packetNum = (uint32_t)i;
+
+        tr.batteryVoltage = 3.4 + erand48(randomState) * 0.8;
+        tr.batteryPercentage = erand48(randomState) * 100.0;
+        tr.batteryChargeRate = (erand48(randomState) - 0.5) * 20.0;
+        tr.status_bits = (int)(erand48(randomState) * 16.0);
+        tr.packetLossRate = erand48(randomState) * 5.0;
+        tr.longestGap = (uint32_t)(erand48(randomState) * 10.0);
+
+        tr.temperature = -30.0 + erand48(randomState) * 70.0;
+        tr.dewPoint = tr.temperature - erand48(randomState) * 10.0;
+        tr.actualPressure = 950.0 + erand48(randomState) * 100.0;
+        tr.normalisedPressure = tr.actualPressure + 6.5;
+        tr.humidity = 1.0 + erand48(randomState) * 99.0;
+        tr.rainfall = erand48(randomState) * 4.0;
+        tr.windspeed = erand48(randomState) * 40.0;
+        tr.gustSpeed = tr.windspeed + erand48(randomState) * 20.0;
+        tr.avgWindspeed10min = tr.windspeed * 0.9;
+        tr.maxGust10min = tr.gustSpeed;
+        tr.rainfall1h = tr.rainfall * 4.0;
+        tr.rainfall24h = tr.rainfall1h * 10.0;
+        tr.rainRate = tr.rainfall * 12.0;
+        tr.pressureTendency3h = (erand48(randomState) - 0.5) * 6.0;
+    }
+}
+
+/*
+** With a group size above 1, each group of rows is written in
+** one transaction...
+*/
+static double timeInserts(
+                psqlConnection * connection,
+                weather_transform_t * readings,
+                int numRecords,
+                uint32_t stationID,
+                int groupSize,
+                void (* insert)(psqlConnection *, weather_transform_t &))
+{
+    uint64_t startTime = getEpochNanoseconds();
+
+    for (int i = 0;i < numRecords;i++) {
+        readings[i].stationID = stationID;
+
+        if (groupSize > 1 && (i % groupSize) == 0) {
+            connection->beginTransaction();
+        }
+
+        insert(connection, readings[i]);
+
+        if (groupSize > 1 && ((i % groupSize) == groupSize - 1 || i == numRecords - 1)) {
+            connection->endTransaction();
+        }
+    }
+
+    uint64_t elapsed = getEpochNanoseconds() - startTime;
+
+    return (double)numRecords * 1.0E9 / (double)(elapsed > 0 ? elapsed : 1);
+}
+
+static void countBenchmarkResult(uint64_t tag, psql_result_status status, const char * error, void * context) {
+    if (status != psql_result_ok) {
+        (*(int *)context)++;
+    }
+}
+
+/*
+** The pipelined path, a sync after each group, with no more
+** than the default depth of readings in flight...
+*/
+static double timePipelinedInserts(psqlConnection * connection, weather_transform_t * readings, int numRecords, uint32_t stationID) {
+    psqlParams      params;
+    int             numFailed = 0;
+
+    psqlPipeline pipeline(*connection, &countBenchmarkResult, NULL, &numFailed);
+
+    uint64_t startTime = getEpochNanoseconds();
+
+    pipeline.enter();
+
+    for (int i = 0;i < numRecords;i++) {
+        readings[i].stationID = stationID;
+
+        params.clear();
+        addWeatherParams(params, readings[i]);
+        pipeline.send(PSQL_WEATHER_INSERT_NAME, params, (uint64_t)i);
+
+        params.clear();
+        addTelemetryParams(params, readings[i]);
+        pipeline.send(PSQL_TELEMETRY_INSERT_NAME, params, (uint64_t)i);
+
+        if ((i % DB_GROUP_COMMIT_ROWS) == DB_GROUP_COMMIT_ROWS - 1 || i == numRecords - 1) {
+            pipeline.sync();
+            pipeline.flush();
+        }
+
+        while (pipeline.getNumPending() > DB_PIPELINE_DEFAULT_DEPTH * 2) {
+            pipeline.wait(DB_PIPELINE_TIMEOUT_MS);
+        }
+    }
+
+    while (pipeline.getNumPending() > 0) {
+        if (!pipeline.wait(DB_PIPELINE_TIMEOUT_MS)) {
+            pipeline.abandon();
+            throw psql_error("Timed out waiting for the pipeline");
+        }
+    }
+
+    pipeline.exit();
+
+    uint64_t elapsed = getEpochNanoseconds() - startTime;
+
+    if (numFailed > 0) {
+        throw psql_error(psql_error::buildMsg("%d pipelined insert(s) failed", numFailed));
+    }
+
+    return (double)numRecords * 1.0E9 / (double)(elapsed > 0 ? elapsed : 1);
+}
+
+static long long getBenchmarkCount(psqlConnection * connection, const char * sql) {
+    PGresult * result = connection->execute(sql);
+
+    long long count = (PQntuples(result) > 0 ? atoll(PQgetvalue(result, 0, 0)) : -1);
+
+    PQclear(result);
+
+    return count;
+}
+
+int runDBBenchmark(int numRecords) {
+    psqlConnection *        connection;
+    weather_transform_t *   readings;
+
+    cfgmgr & cfg = cfgmgr::getInstance();
+
+    try {
+        connection = new psqlConnection(
+                            cfg.getValue("db.host"), 
+                            cfg.getValueAsInteger("db.port"),
+                            cfg.getValue("db.database"),
+                            cfg.getValue("db.user"),
+                            cfg.getValue("db.password"));
+    }
+    catch (psql_error & e) {
+        fprintf(stderr, "Failed to connect to database: %s\n", e.what());
+        return -1;
+    }
+
+    readings = (weather_transform_t *)malloc(sizeof(weather_transform_t) * numRecords);
+
+    if (readings == NULL) {
+        fprintf(stderr, "Failed to allocate memory for %d records\n", numRecords);
+        delete connection;
+        return -1;
+    }
+
+    buildBenchmarkReadings(readings, numRecords);
+
+    double textRate;
+    double textGroupedRate;
+    double preparedRate;
+    double preparedGroupedRate;
+    double pipelinedRate;
+    long long numDifferent;
+    char szQuery[INSERT_STRING_LEN];
+
+    try {
+        /*
+        ** Temporary tables come first in our search path, so
+        ** the statements write to these copies and not the real
+        ** tables. They go when we disconnect...
+        */
+        PQclear(connection->execute("CREATE TEMP TABLE weather_data (LIKE public.weather_data INCLUDING ALL)"));
+        PQclear(connection->execute("CREATE TEMP TABLE telemetry_data (LIKE public.telemetry_data INCLUDING ALL)"));
+
+        prepareStatements(connection);
+
+        printf("Inserting %d readings each way into temporary tables...\n", numRecords);
+
+        textRate = timeInserts(connection, readings, numRecords, BENCHMARK_TEXT_STATION_ID, 1, &insertReadingAsText);
+        textGroupedRate = timeInserts(connection, readings, numRecords, BENCHMARK_TEXT_STATION_ID + 1, DB_GROUP_COMMIT_ROWS, &insertReadingAsText);
+        preparedRate = timeInserts(connection, readings, numRecords, BENCHMARK_PREPARED_STATION_ID, 1, &insertReadingPrepared);
+        preparedGroupedRate = timeInserts(connection, readings, numRecords, BENCHMARK_PREPARED_STATION_ID + 1, DB_GROUP_COMMIT_ROWS, &insertReadingPrepared);
+        pipelinedRate = timePipelinedInserts(connection, readings, numRecords, BENCHMARK_PIPELINE_STATION_ID);
+
+        /*
+        ** The values as stored should be the same either way...
+        */
+        snprintf(
+            szQuery,
+            sizeof(szQuery),
+            "SELECT count(*) FROM weather_data t JOIN weather_data p "
+            "ON p.created = t.created AND t.station_id = %d AND p.station_id = %d "
+            "WHERE (t.temperature, t.dew_point, t.actual_pressure, t.pressure, t.humidity, t.rainfall, "
+            "t.wind_speed, t.wind_gust, t.avg_wind_speed_10m, t.max_wind_gust_10m, t.rainfall_1h, "
+            "t.rainfall_24h, t.rain_rate, t.pressure_tendency_3h) IS DISTINCT FROM "
+            "(p.temperature, p.dew_point, p.actual_pressure, p.pressure, p.humidity, p.rainfall, "
+            "p.wind_speed, p.wind_gust, p.avg_wind_speed_10m, p.max_wind_gust_10m, p.rainfall_1h, "
+            "p.rainfall_24h, p.rain_rate, p.pressure_tendency_3h)",
+            BENCHMARK_TEXT_STATION_ID,
+            BENCHMARK_PREPARED_STATION_ID);
+
+        numDifferent = getBenchmarkCount(connection, szQuery);
+    }
+    catch (psql_error & e) {
+        fprintf(stderr, "Benchmark failed: %s\n", e.what());
+        free(readings);
+        delete connection;
+        return -1;
+    }
+
+    printf("\n Path                Rows/sec\n");
+    printf(" text               %10.0f\n", textRate);
+    printf(" text, %2d/commit    %10.0f  (x%.2f)\n", DB_GROUP_COMMIT_ROWS, textGroupedRate, textGroupedRate / textRate);
+    printf(" prepared           %10.0f  (x%.2f)\n", preparedRate, preparedRate / textRate);
+    printf(" prepared, %2d/commit%10.0f  (x%.2f)\n", DB_GROUP_COMMIT_ROWS, preparedGroupedRate, preparedGroupedRate / textRate);
+    printf(" pipelined, %2d/sync %10.0f  (x%.2f)\n\n", DB_GROUP_COMMIT_ROWS, pipelinedRate, pipelinedRate / textRate);
+
+    printf(" Weather rows that differ between the paths: %lld\n", numDifferent);
+    printf(" (the text path rounds with %%.2f, the server rounds the binary float4 to the column's scale)\n\n");
+
+    free(readings);
+    delete connection;
+
+    return 0;
+}
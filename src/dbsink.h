@@ -0,0 +1,14 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifndef __INCL_DBSINK
+#define __INCL_DBSINK
+
+/*
+** The --benchmark-db command line mode, rows/sec inserting n
+** synthetic readings each way we can, into temporary copies of
+** the tables...
+*/
+int runDBBenchmark(int numRecords);
+
+#endif
@@ -0,0 +1,154 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "logger.h"
+#include "packet.h"
+#include "station.h"
+#include "schema.h"
+#include "decoder.h"
+
+using namespace std;
+
+void decoderRegistry::registerDecoder(uint8_t packetID, const char * name, int minimumLength, packet_decoder_t decoder) {
+    decoders[packetID].name = name;
+    decoders[packetID].minimumLength = minimumLength;
+    decoders[packetID].decoder = decoder;
+}
+
+bool decoderRegistry::decode(const uint8_t * payload, int length, const station * s, decoded_packet_t * decoded) {
+    logger & log = logger::getInstance();
+
+    if (length < 1) {
+        return false;
+    }
+
+    decoder_entry_t & entry = decoders[payload[0]];
+
+    if (entry.decoder == NULL) {
+        log.logError("Undefined packet type received: ID[0x%02X]", payload[0]);
+        return false;
+    }
+
+    if (length < entry.minimumLength) {
+        log.logError("Short %s packet received: %d bytes, expected %d", entry.name, length, entry.minimumLength);
+        return false;
+    }
+
+    memset(decoded, 0, sizeof(decoded_packet_t));
+
+    decoded->packetID = payload[0];
+    decoded->name = entry.name;
+
+    decoded->transform.stationID = s->stationID;
+    decoded->transform.pipe = s->pipe;
+
+    return entry.decoder(payload, length, s, decoded);
+}
+
+static float _computeDewPoint(float temperature, float humidity) {
+    float           dewPoint;
+    float           lnHumidity;
+
+    lnHumidity = (float)log((double)humidity / (double)100.0f);
+
+    dewPoint = 
+        243.04f * 
+        (lnHumidity + 
+        ((17.625f * temperature) / 
+        (243.04f + temperature))) / 
+        (17.625f - lnHumidity -
+        ((17.625f * temperature) / 
+        (243.04f + temperature)));
+
+    return dewPoint;
+}
+
+/*
+** Straight-line decode of a weather packet, see schema.h...
+*/
+void transformWeatherPacket(const uint8_t * payload, const station * s, weather_transform_t * target) {
+    typedef weather_schema w;
+
+    target->stationID = s->stationID;
+    target->pipe = s->pipe;
+
+    target->packetNum = w::packetNum::decode(payload);
+    target->status_bits = (int32_t)w::status::decode(payload);
+
+    target->batteryVoltage = w::batteryVolts::decode(payload);
+    target->batteryPercentage = w::batteryPercentage::decode(payload);
+    target->batteryChargeRate = w::batteryChargeRate::decode(payload);
+
+    /*
+    ** TMP117 temperature
+    */
+    target->temperature = w::temperature::decode(payload);
+
+    /*
+    ** SHT4x humidity, the dew point uses the unclamped value
+    ** as it always has...
+    */
+    float humidity = w::humidity::decode(payload);
+
+    target->humidity = fminf(fmaxf(humidity, 0.0f), 100.0f);
+    target->dewPoint = _computeDewPoint(target->temperature, humidity);
+
+    /*
+    ** Calibrated values use the station's snapshot, where the
+    ** factors are already multiplied out...
+    */
+    const calibration_t * cal = s->getCalibration();
+
+    target->normalisedPressure = (float)((double)w::rawPressure::decode(payload) * cal->pressureScale);
+    target->actualPressure = w::pressure::decode(payload);
+
+    float rawWindspeed = (float)w::rawWindspeed::decode(payload);
+    float rawWindGust = (float)w::rawWindGust::decode(payload);
+
+    target->windspeed = rawWindspeed * cal->windspeedMph;
+    target->gustSpeed = rawWindGust * cal->windspeedMph;
+    target->windSpeedms = rawWindspeed * cal->windspeedMetresPerSec;
+    target->gustSpeedms = rawWindGust * cal->windspeedMetresPerSec;
+
+    target->rainfall = w::rainfall::decode(payload);
+}
+
+static bool _decodeWeatherPacket(const uint8_t * payload, int length, const station * s, decoded_packet_t * decoded) {
+    transformWeatherPacket(payload, s, &decoded->transform);
+
+    decoded->hasWeatherData = true;
+
+    return true;
+}
+
+static bool _decodeSleepPacket(const uint8_t * payload, int length, const station * s, decoded_packet_t * decoded) {
+    typedef sleep_schema sl;
+
+    logger & log = logger::getInstance();
+
+    decoded->transform.batteryVoltage = sl::batteryVolts::decode(payload);
+    decoded->transform.batteryPercentage = sl::batteryPercentage::decode(payload);
+    decoded->transform.status_bits = (int32_t)sl::status::decode(payload);
+
+    log.logStatus("Got sleep packet from station 0x%08X:", s->stationID);
+    log.logStatus("\tStatus:      0x%08X", (uint32_t)decoded->transform.status_bits);
+    log.logStatus("\tBat. volts:  %.2f", decoded->transform.batteryVoltage);
+    log.logStatus("\tSleep for:   %d", (int)sl::sleepHours::decode(payload));
+
+    return true;
+}
+
+static bool _decodeWatchdogPacket(const uint8_t * payload, int length, const station * s, decoded_packet_t * decoded) {
+    decoded->transform.status_bits = (int32_t)watchdog_schema::status::decode(payload);
+
+    logger::getInstance().logStatus("Got watchdog packet from station 0x%08X", s->stationID);
+
+    return true;
+}
+
+static decoderRegistration _weatherDecoder(weather_schema::packetID, "weather", weather_schema::length, &_decodeWeatherPacket);
+static decoderRegistration _sleepDecoder(sleep_schema::packetID, "sleep", sleep_schema::length, &_decodeSleepPacket);
+static decoderRegistration _watchdogDecoder(watchdog_schema::packetID, "watchdog", watchdog_schema::length, &_decodeWatchdogPacket);
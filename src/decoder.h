@@ -0,0 +1,89 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "packet.h"
+#include "station.h"
+
+#ifndef __INCL_DECODER
+#define __INCL_DECODER
+
+#define DECODER_NUM_PACKET_IDS              256
+
+/*
+** What a decoder hands back. Only packets that carry weather
+** data fill in the whole transform, anything else just sets
+** what it knows about (e.g. battery volts)...
+*/
+typedef struct {
+    uint8_t             packetID;
+    const char *        name;
+    bool                hasWeatherData;
+
+    weather_transform_t transform;
+}
+decoded_packet_t;
+
+/*
+** A decoder reads straight from the received payload, using the
+** field definitions in schema.h, and writes only to the caller's
+** decoded_packet_t, so any number of threads can decode at once.
+** Returns false if the payload is bad...
+*/
+typedef bool (* packet_decoder_t)(const uint8_t * payload, int length, const station * s, decoded_packet_t * decoded);
+
+/*
+** Decoders keyed by packet ID (the first byte of the payload).
+** Each packet type registers itself at startup with a static
+** decoderRegistration, see decoder.cpp...
+*/
+class decoderRegistry {
+    public:
+        static decoderRegistry & getInstance() {
+            static decoderRegistry registry;
+            return registry;
+        }
+
+    private:
+        typedef struct {
+            const char *        name;
+            int                 minimumLength;
+            packet_decoder_t    decoder;
+        }
+        decoder_entry_t;
+
+        decoder_entry_t     decoders[DECODER_NUM_PACKET_IDS];
+
+        decoderRegistry() {
+            for (int i = 0;i < DECODER_NUM_PACKET_IDS;i++) {
+                decoders[i].name = NULL;
+                decoders[i].minimumLength = 0;
+                decoders[i].decoder = NULL;
+            }
+        }
+
+    public:
+        ~decoderRegistry() {}
+
+        void registerDecoder(uint8_t packetID, const char * name, int minimumLength, packet_decoder_t decoder);
+
+        bool isRegistered(uint8_t packetID) {
+            return (decoders[packetID].decoder != NULL);
+        }
+
+        /*
+        ** Returns false if there is no decoder for the packet ID,
+        ** the payload is too short or the decoder rejected it...
+        */
+        bool decode(const uint8_t * payload, int length, const station * s, decoded_packet_t * decoded);
+};
+
+class decoderRegistration {
+    public:
+        decoderRegistration(uint8_t packetID, const char * name, int minimumLength, packet_decoder_t decoder) {
+            decoderRegistry::getInstance().registerDecoder(packetID, name, minimumLength, decoder);
+        }
+};
+
+void transformWeatherPacket(const uint8_t * payload, const station * s, weather_transform_t * target);
+
+#endif
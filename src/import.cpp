@@ -0,0 +1,818 @@
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include <postgresql/libpq-fe.h>
+
+#include "logger.h"
+#include "cfgmgr.h"
+#include "psql.h"
+#include "utils.h"
+#include "packet.h"
+#include "radio.h"
+#include "station.h"
+#include "decoder.h"
+#include "sequence.h"
+#include "metrics.h"
+#include "capture.h"
+#include "import.h"
+
+using namespace std;
+
+#define IMPORT_CSV_LINE_LEN                 4096
+#define IMPORT_SQL_LEN                      2048
+
+/*
+** Every NUMERIC column in the schema has 2 decimal places...
+*/
+#define IMPORT_NUMERIC_SCALE                2
+
+/*
+** The staging tables are temporary copies of the real tables'
+** columns, emptied at each commit. COPY can't update rows that
+** are already there, so each chunk is copied in to these and then
+** upserted from them, which is what makes a restart safe...
+*/
+#define IMPORT_WEATHER_STAGING              "import_weather"
+#define IMPORT_TELEMETRY_STAGING            "import_telemetry"
+
+enum import_table {
+    import_table_both,
+    import_table_weather,
+    import_table_telemetry
+};
+
+enum import_type {
+    import_type_timestamp,
+    import_type_int4,
+    import_type_numeric
+};
+
+typedef struct {
+    const char *        name;
+    import_table        table;
+    import_type         type;
+}
+import_column_t;
+
+/*
+** The columns we load, in the order they are copied...
+*/
+static const import_column_t columns[] = {
+    {"created",                 import_table_both,          import_type_timestamp},
+    {"station_id",              import_table_both,          import_type_int4},
+    {"packet_num",              import_table_both,          import_type_int4},
+    {"temperature",             import_table_weather,       import_type_numeric},
+    {"dew_point",               import_table_weather,       import_type_numeric},
+    {"actual_pressure",         import_table_weather,       import_type_numeric},
+    {"pressure",                import_table_weather,       import_type_numeric},
+    {"humidity",                import_table_weather,       import_type_numeric},
+    {"rainfall",                import_table_weather,       import_type_numeric},
+    {"wind_speed",              import_table_weather,       import_type_numeric},
+    {"wind_gust",               import_table_weather,       import_type_numeric},
+    {"avg_wind_speed_10m",      import_table_weather,       import_type_numeric},
+    {"max_wind_gust_10m",       import_table_weather,       import_type_numeric},
+    {"rainfall_1h",             import_table_weather,       import_type_numeric},
+    {"rainfall_24h",            import_table_weather,       import_type_numeric},
+    {"rain_rate",               import_table_weather,       import_type_numeric},
+    {"pressure_tendency_3h",    import_table_weather,       import_type_numeric},
+    {"battery_voltage",         import_table_telemetry,     import_type_numeric},
+    {"battery_percentage",      import_table_telemetry,     import_type_numeric},
+    {"battery_crate",           import_table_telemetry,     import_type_numeric},
+    {"status_bits",             import_table_telemetry,     import_type_int4},
+    {"packet_loss_rate",        import_table_telemetry,     import_type_numeric},
+    {"longest_gap",             import_table_telemetry,     import_type_int4}
+};
+
+#define IMPORT_NUM_COLUMNS                  (int)(sizeof(columns) / sizeof(import_column_t))
+#define IMPORT_COLUMN_CREATED               0
+
+/*
+** One record to load. The created column is held in timestamp,
+** anything not set is loaded as NULL...
+*/
+typedef struct {
+    uint64_t            timestamp;
+    double              values[IMPORT_NUM_COLUMNS];
+    bool                isSet[IMPORT_NUM_COLUMNS];
+}
+import_row_t;
+
+static void setValue(import_row_t * row, int column, double value) {
+    row->values[column] = value;
+    row->isSet[column] = true;
+}
+
+/*
+** Where the records come from. The position counts records read
+** so far, so it's also where to start again...
+*/
+class importSource {
+    public:
+        virtual ~importSource() {}
+
+        virtual bool next(import_row_t * row) = 0;
+
+        virtual uint64_t getPosition() = 0;
+
+        /*
+        ** How far through we are, 0 - 100...
+        */
+        virtual double getPercentComplete() = 0;
+
+        virtual bool hasTable(import_table table) = 0;
+};
+
+/*
+** Capture files are decoded just as the listen thread would, so the
+** loss rate and rolling figures are worked out again. Records before
+** the start offset still go through them, they just aren't loaded...
+*/
+class captureSource : public importSource {
+    private:
+        captureReader *     reader;
+        uint64_t            position = 0;
+        uint64_t            startOffset;
+
+        sequenceTracker     sequence[NRF24L01_NUM_RX_PIPES];
+        metricsEngine       metrics[NRF24L01_NUM_RX_PIPES];
+
+        bool decodeRecord(const capture_record_t * record, weather_transform_t * tr);
+
+    public:
+        captureSource(const string & filename, uint64_t startOffset) {
+            stationmgr::getInstance().initialise();
+
+            reader = new captureReader(filename);
+
+            this->startOffset = startOffset;
+        }
+
+        ~captureSource() {
+            delete reader;
+        }
+
+        bool next(import_row_t * row) override;
+
+        uint64_t getPosition() override {
+            return position;
+        }
+
+        double getPercentComplete() override {
+            uint64_t numRecords = reader->getNumRecords();
+
+            return (numRecords > 0 ? (double)position * 100.0 / (double)numRecords : 100.0);
+        }
+
+        bool hasTable(import_table table) override {
+            return true;
+        }
+};
+
+bool captureSource::decodeRecord(const capture_record_t * record, weather_transform_t * tr) {
+    decoded_packet_t    decoded;
+
+    station * s = stationmgr::getInstance().getStation(record->pipe);
+
+    if (s == NULL) {
+        return false;
+    }
+
+    if (!decoderRegistry::getInstance().decode(record->payload, record->length, s, &decoded)) {
+        return false;
+    }
+
+    if (!decoded.hasWeatherData) {
+        return false;
+    }
+
+    *tr = decoded.transform;
+
+    tr->timestamp = record->timestamp;
+
+    sequenceTracker & seq = sequence[s->pipe];
+
+    if (seq.update(tr->packetNum) == sequenceTracker::sequence_duplicate) {
+        return false;
+    }
+
+    tr->packetLossRate = (float)(seq.getLossRate() * 100.0);
+    tr->longestGap = seq.getLongestGap();
+
+    metrics[s->pipe].update(tr);
+
+    return true;
+}
+
+bool captureSource::next(import_row_t * row) {
+    weather_transform_t     tr;
+
+    while (position < reader->getNumRecords()) {
+        const capture_record_t * record = reader->getRecord(position++);
+
+        if (!decodeRecord(record, &tr) || position <= startOffset) {
+            continue;
+        }
+
+        row->timestamp = tr.timestamp;
+        row->isSet[IMPORT_COLUMN_CREATED] = true;
+
+        int c = IMPORT_COLUMN_CREATED + 1;
+
+        setValue(row, c++, tr.stationID);
+        setValue(row, c++, tr.packetNum);
+        setValue(row, c++, tr.temperature);
+        setValue(row, c++, tr.dewPoint);
+        setValue(row, c++, tr.actualPressure);
+        setValue(row, c++, tr.normalisedPressure);
+        setValue(row, c++, tr.humidity);
+        setValue(row, c++, tr.rainfall);
+        setValue(row, c++, tr.windspeed);
+        setValue(row, c++, tr.gustSpeed);
+        setValue(row, c++, tr.avgWindspeed10min);
+        setValue(row, c++, tr.maxGust10min);
+        setValue(row, c++, tr.rainfall1h);
+        setValue(row, c++, tr.rainfall24h);
+        setValue(row, c++, tr.rainRate);
+        setValue(row, c++, tr.pressureTendency3h);
+        setValue(row, c++, tr.batteryVoltage);
+        setValue(row, c++, tr.batteryPercentage);
+        setValue(row, c++, tr.batteryChargeRate);
+        setValue(row, c++, tr.status_bits);
+        setValue(row, c++, tr.packetLossRate);
+        setValue(row, c++, tr.longestGap);
+
+        return true;
+    }
+
+    return false;
+}
+
+/*
+** A CSV file, e.g. from psql's \copy ... TO ... CSV HEADER. The
+** header names the columns, in any order, columns we don't know
+** (such as id) are ignored and any we load that are missing are
+** NULL. created is local time, as 'YYYY-MM-DD HH:MM:SS[.ffffff]'...
+*/
+class csvSource : public importSource {
+    private:
+        FILE *              fp;
+        string              filename;
+        uint64_t            fileSize = 0;
+        uint64_t            position = 0;
+        uint64_t            lineNum = 1;
+
+        vector<int>         fieldColumns;
+        bool                isTableSet[import_table_telemetry + 1];
+
+        char                szLine[IMPORT_CSV_LINE_LEN];
+
+        int splitLine(char ** fields, int maxFields);
+        bool parseTimestamp(const char * value, uint64_t * timestamp);
+        bool parseLine(import_row_t * row);
+
+    public:
+        csvSource(const string & filename, uint64_t startOffset);
+
+        ~csvSource() {
+            fclose(fp);
+        }
+
+        bool next(import_row_t * row) override;
+
+        uint64_t getPosition() override {
+            return position;
+        }
+
+        double getPercentComplete() override {
+            return (fileSize > 0 ? (double)ftell(fp) * 100.0 / (double)fileSize : 100.0);
+        }
+
+        bool hasTable(import_table table) override {
+            return isTableSet[table];
+        }
+};
+
+csvSource::csvSource(const string & filename, uint64_t startOffset) {
+    struct stat     st;
+    char *          fields[IMPORT_NUM_COLUMNS * 2];
+
+    logger & log = logger::getInstance();
+
+    this->filename = filename;
+
+    fp = fopen(filename.c_str(), "r");
+
+    if (fp == NULL) {
+        throw psql_error(psql_error::buildMsg("Failed to open '%s': %s", filename.c_str(), strerror(errno)));
+    }
+
+    if (fstat(fileno(fp), &st) == 0) {
+        fileSize = (uint64_t)st.st_size;
+    }
+
+    if (fgets(szLine, IMPORT_CSV_LINE_LEN, fp) == NULL) {
+        fclose(fp);
+        throw psql_error(psql_error::buildMsg("'%s' has no header line", filename.c_str()));
+    }
+
+    memset(isTableSet, 0, sizeof(isTableSet));
+
+    bool isCreatedSet = false;
+    bool isStationSet = false;
+
+    int numFields = splitLine(fields, IMPORT_NUM_COLUMNS * 2);
+
+    for (int i = 0;i < numFields;i++) {
+        int column = -1;
+
+        for (int c = 0;c < IMPORT_NUM_COLUMNS;c++) {
+            if (strcmp(fields[i], columns[c].name) == 0) {
+                column = c;
+                break;
+            }
+        }
+
+        if (column < 0) {
+            log.logInfo("Ignoring column '%s' in '%s'", fields[i], filename.c_str());
+        }
+        else {
+            isTableSet[columns[column].table] = true;
+            isCreatedSet |= (column == IMPORT_COLUMN_CREATED);
+            isStationSet |= (strcmp(columns[column].name, "station_id") == 0);
+        }
+
+        fieldColumns.push_back(column);
+    }
+
+    if (!isCreatedSet || !isStationSet) {
+        fclose(fp);
+        throw psql_error(psql_error::buildMsg("'%s' must have created and station_id columns", filename.c_str()));
+    }
+
+    while (position < startOffset && fgets(szLine, IMPORT_CSV_LINE_LEN, fp) != NULL) {
+        position++;
+        lineNum++;
+    }
+}
+
+/*
+** Split szLine in place on commas, without the quotes or
+** whitespace around each field...
+*/
+int csvSource::splitLine(char ** fields, int maxFields) {
+    int     numFields = 0;
+    char *  p = szLine;
+
+    while (numFields < maxFields) {
+        char * end = strchr(p, ',');
+
+        if (end != NULL) {
+            *end = 0;
+        }
+
+        char * field = p;
+
+        while (*field == ' ' || *field == '"') {
+            field++;
+        }
+
+        char * last = field + strlen(field);
+
+        while (last > field && (last[-1] == ' ' || last[-1] == '"' || last[-1] == '\r' || last[-1] == '\n')) {
+            *--last = 0;
+        }
+
+        fields[numFields++] = field;
+
+        if (end == NULL) {
+            break;
+        }
+
+        p = end + 1;
+    }
+
+    return numFields;
+}
+
+bool csvSource::parseTimestamp(const char * value, uint64_t * timestamp) {
+    struct tm   localTime;
+    uint64_t    microseconds = 0;
+
+    memset(&localTime, 0, sizeof(localTime));
+
+    const char * p = strptime(value, "%Y-%m-%d %H:%M:%S", &localTime);
+
+    if (p == NULL) {
+        return false;
+    }
+
+    if (*p == '.') {
+        int numDigits = 0;
+
+        for (p++;*p >= '0' && *p <= '9' && numDigits < 6;p++, numDigits++) {
+            microseconds = microseconds * 10 + (uint64_t)(*p - '0');
+        }
+
+        for (;numDigits < 6;numDigits++) {
+            microseconds *= 10;
+        }
+    }
+
+    localTime.tm_isdst = -1;
+
+    time_t t = mktime(&localTime);
+
+    if (t == (time_t)-1) {
+        return false;
+    }
+
+    *timestamp = (uint64_t)t * 1000000000ULL + microseconds * 1000ULL;
+
+    return true;
+}
+
+bool csvSource::parseLine(import_row_t * row) {
+    char *      fields[IMPORT_NUM_COLUMNS * 2];
+    char *      end;
+
+    int numFields = splitLine(fields, IMPORT_NUM_COLUMNS * 2);
+
+    if (numFields != (int)fieldColumns.size()) {
+        logger::getInstance().logError("Skipping line %llu of '%s', it has %d field(s) not %d", (unsigned long long)lineNum, filename.c_str(), numFields, (int)fieldColumns.size());
+        return false;
+    }
+
+    for (int i = 0;i < numFields;i++) {
+        int column = fieldColumns[i];
+
+        if (column < 0 || fields[i][0] == 0) {
+            continue;
+        }
+
+        if (columns[column].type == import_type_timestamp) {
+            if (!parseTimestamp(fields[i], &row->timestamp)) {
+                logger::getInstance().logError("Skipping line %llu of '%s', bad %s '%s'", (unsigned long long)lineNum, filename.c_str(), columns[column].name, fields[i]);
+                return false;
+            }
+
+            row->isSet[column] = true;
+        }
+        else {
+            double value = strtod(fields[i], &end);
+
+            if (*end != 0) {
+                logger::getInstance().logError("Skipping line %llu of '%s', bad %s '%s'", (unsigned long long)lineNum, filename.c_str(), columns[column].name, fields[i]);
+                return false;
+            }
+
+            setValue(row, column, value);
+        }
+    }
+
+    return row->isSet[IMPORT_COLUMN_CREATED];
+}
+
+bool csvSource::next(import_row_t * row) {
+    while (fgets(szLine, IMPORT_CSV_LINE_LEN, fp) != NULL) {
+        position++;
+        lineNum++;
+
+        if (szLine[0] == '\n' || szLine[0] == '\r') {
+            continue;
+        }
+
+        memset(row->isSet, 0, sizeof(row->isSet));
+
+        if (parseLine(row)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static bool isInTable(const import_column_t & column, import_table table) {
+    return (column.table == import_table_both || column.table == table);
+}
+
+static int getNumTableColumns(import_table table) {
+    int numColumns = 0;
+
+    for (int c = 0;c < IMPORT_NUM_COLUMNS;c++) {
+        if (isInTable(columns[c], table)) {
+            numColumns++;
+        }
+    }
+
+    return numColumns;
+}
+
+static string getColumnList(import_table table) {
+    string list;
+
+    for (int c = 0;c < IMPORT_NUM_COLUMNS;c++) {
+        if (isInTable(columns[c], table)) {
+            if (list.length() > 0) {
+                list.append(", ");
+            }
+
+            list.append(columns[c].name);
+        }
+    }
+
+    return list;
+}
+
+static void createStagingTable(psqlConnection * connection, const char * staging, const char * target, import_table table) {
+    char        szSQL[IMPORT_SQL_LEN];
+
+    snprintf(
+        szSQL,
+        sizeof(szSQL),
+        "CREATE TEMP TABLE %s ON COMMIT DELETE ROWS AS SELECT %s FROM %s WITH NO DATA",
+        staging,
+        getColumnList(table).c_str(),
+        target);
+
+    PQclear(connection->execute(szSQL));
+}
+
+static void copyRows(psqlCopy & copy, vector<import_row_t> & rows, const char * staging, import_table table) {
+    char        szSQL[IMPORT_SQL_LEN];
+
+    snprintf(
+        szSQL,
+        sizeof(szSQL),
+        "COPY %s (%s) FROM STDIN (FORMAT binary)",
+        staging,
+        getColumnList(table).c_str());
+
+    int numFields = getNumTableColumns(table);
+
+    copy.begin(szSQL);
+
+    try {
+        for (import_row_t & row : rows) {
+            copy.beginRow(numFields);
+
+            for (int c = 0;c < IMPORT_NUM_COLUMNS;c++) {
+                if (!isInTable(columns[c], table)) {
+                    continue;
+                }
+
+                if (!row.isSet[c]) {
+                    copy.addNull();
+                }
+                else if (columns[c].type == import_type_timestamp) {
+                    copy.addTimestamp(row.timestamp);
+                }
+                else if (columns[c].type == import_type_int4) {
+                    copy.addInt4((int32_t)(int64_t)row.values[c]);
+                }
+                else {
+                    copy.addNumeric(row.values[c], IMPORT_NUMERIC_SCALE);
+                }
+            }
+        }
+    }
+    catch (psql_error & e) {
+        copy.abort(e.what());
+        throw;
+    }
+
+    copy.end();
+}
+
+/*
+** Every column but the key, set from the row we tried to insert...
+*/
+static string getUpdateList(import_table table) {
+    string list;
+
+    for (int c = 0;c < IMPORT_NUM_COLUMNS;c++) {
+        if (!isInTable(columns[c], table) || strcmp(columns[c].name, "station_id") == 0 || strcmp(columns[c].name, "created") == 0) {
+            continue;
+        }
+
+        if (list.length() > 0) {
+            list.append(", ");
+        }
+
+        list.append(columns[c].name);
+        list.append(" = EXCLUDED.");
+        list.append(columns[c].name);
+    }
+
+    return list;
+}
+
+/*
+** Returns the number of rows written. A row already there is
+** overwritten, as the live inserts do, so importing again after
+** a correction fixes what was imported before...
+*/
+static uint64_t insertFromStaging(psqlConnection * connection, const char * staging, const char * target, import_table table) {
+    char        szSQL[IMPORT_SQL_LEN];
+
+    string columnList = getColumnList(table);
+
+    snprintf(
+        szSQL,
+        sizeof(szSQL),
+        "INSERT INTO %s (%s) SELECT %s FROM %s ON CONFLICT (station_id, created) DO UPDATE SET %s",
+        target,
+        columnList.c_str(),
+        columnList.c_str(),
+        staging,
+        getUpdateList(table).c_str());
+
+    PGresult * result = connection->execute(szSQL, true);
+
+    uint64_t numRows = strtoull(PQcmdTuples(result), NULL, 10);
+
+    PQclear(result);
+
+    return numRows;
+}
+
+/*
+** Copy and insert a chunk in one transaction, so either all of
+** it is in or none of it...
+*/
+static uint64_t loadChunk(psqlConnection * connection, psqlCopy & copy, importSource * source, vector<import_row_t> & rows) {
+    uint64_t    numInserted = 0;
+
+    connection->beginTransaction();
+
+    try {
+        if (source->hasTable(import_table_weather)) {
+            copyRows(copy, rows, IMPORT_WEATHER_STAGING, import_table_weather);
+            numInserted += insertFromStaging(connection, IMPORT_WEATHER_STAGING, "weather_data", import_table_weather);
+        }
+
+        if (source->hasTable(import_table_telemetry)) {
+            copyRows(copy, rows, IMPORT_TELEMETRY_STAGING, import_table_telemetry);
+            numInserted += insertFromStaging(connection, IMPORT_TELEMETRY_STAGING, "telemetry_data", import_table_telemetry);
+        }
+
+        connection->endTransaction();
+    }
+    catch (psql_error & e) {
+        if (connection->isConnected()) {
+            try {
+                connection->rollbackTransaction();
+            }
+            catch (psql_error & rollbackError) {
+                logger::getInstance().logError("%s", rollbackError.what());
+            }
+        }
+
+        throw;
+    }
+
+    return numInserted;
+}
+
+static importSource * openSource(const char * filename, uint64_t startOffset) {
+    uint32_t    magic = 0;
+
+    FILE * fp = fopen(filename, "rb");
+
+    if (fp == NULL) {
+        throw psql_error(psql_error::buildMsg("Failed to open '%s': %s", filename, strerror(errno)));
+    }
+
+    size_t bytesRead = fread(&magic, 1, sizeof(magic), fp);
+
+    fclose(fp);
+
+    if (bytesRead == sizeof(magic) && magic == CAPTURE_FILE_MAGIC) {
+        try {
+            return new captureSource(filename, startOffset);
+        }
+        catch (capture_error & e) {
+            throw psql_error(e.what());
+        }
+    }
+
+    return new csvSource(filename, startOffset);
+}
+
+int runImport(const char * filename, uint64_t startOffset) {
+    psqlConnection *        connection;
+    importSource *          source;
+    vector<import_row_t>    rows;
+    import_row_t            row;
+
+    logger & log = logger::getInstance();
+    cfgmgr & cfg = cfgmgr::getInstance();
+
+    uint32_t chunkRows = IMPORT_DEFAULT_CHUNK_ROWS;
+
+    if (cfg.getValue("import.chunksize").length() > 0) {
+        chunkRows = cfg.getValueAsLongUnsignedInteger("import.chunksize");
+    }
+
+    if (chunkRows == 0) {
+        chunkRows = 1;
+    }
+
+    try {
+        source = openSource(filename, startOffset);
+    }
+    catch (psql_error & e) {
+        fprintf(stderr, "%s\n", e.what());
+        return -1;
+    }
+
+    try {
+        connection = new psqlConnection(
+                            cfg.getValue("db.host"),
+                            cfg.getValueAsInteger("db.port"),
+                            cfg.getValue("db.database"),
+                            cfg.getValue("db.user"),
+                            cfg.getValue("db.password"));
+    }
+    catch (psql_error & e) {
+        fprintf(stderr, "Failed to connect to database: %s\n", e.what());
+        delete source;
+        return -1;
+    }
+
+    rows.reserve(chunkRows);
+
+    uint64_t numRecords = 0;
+    uint64_t numRowsCopied = 0;
+    uint64_t numRowsInserted = 0;
+    uint64_t resumeOffset = startOffset;
+    uint64_t startTime = getEpochNanoseconds();
+
+    int rtn = 0;
+
+    try {
+        psqlCopy copy(*connection);
+
+        createStagingTable(connection, IMPORT_WEATHER_STAGING, "weather_data", import_table_weather);
+        createStagingTable(connection, IMPORT_TELEMETRY_STAGING, "telemetry_data", import_table_telemetry);
+
+        printf("Importing '%s' from record %llu, %u records per commit...\n", filename, (unsigned long long)resumeOffset, chunkRows);
+
+        while (true) {
+            rows.clear();
+
+            while (rows.size() < chunkRows && source->next(&row)) {
+                rows.push_back(row);
+            }
+
+            if (rows.empty()) {
+                break;
+            }
+
+            numRowsInserted += loadChunk(connection, copy, source, rows);
+
+            numRecords += rows.size();
+            numRowsCopied += rows.size() * ((source->hasTable(import_table_weather) ? 1 : 0) + (source->hasTable(import_table_telemetry) ? 1 : 0));
+            resumeOffset = source->getPosition();
+
+            uint64_t elapsed = getEpochNanoseconds() - startTime;
+
+            printf(
+                " %5.1f%%  %llu records, %.0f rows/sec, resume with --import-offset %llu\n",
+                source->getPercentComplete(),
+                (unsigned long long)numRecords,
+                (double)numRowsCopied * 1.0E9 / (double)(elapsed > 0 ? elapsed : 1),
+                (unsigned long long)resumeOffset);
+
+            log.logInfo("Imported %llu records from '%s', up to offset %llu", (unsigned long long)numRecords, filename, (unsigned long long)resumeOffset);
+        }
+    }
+    catch (psql_error & e) {
+        fprintf(stderr, "Import failed: %s\n", e.what());
+        fprintf(stderr, "Everything before offset %llu is in, resume with --import-offset %llu\n", (unsigned long long)resumeOffset, (unsigned long long)resumeOffset);
+        rtn = -1;
+    }
+
+    uint64_t elapsed = getEpochNanoseconds() - startTime;
+
+    printf(
+        "\n Imported %llu records, %llu rows written of %llu copied, in %.1f s (%.0f rows/sec)\n\n",
+        (unsigned long long)numRecords,
+        (unsigned long long)numRowsInserted,
+        (unsigned long long)numRowsCopied,
+        (double)elapsed / 1.0E9,
+        (double)numRowsCopied * 1.0E9 / (double)(elapsed > 0 ? elapsed : 1));
+
+    delete source;
+    delete connection;
+
+    return rtn;
+}
@@ -0,0 +1,22 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifndef __INCL_IMPORT
+#define __INCL_IMPORT
+
+/*
+** Records loaded and committed at a time, a failed import can be
+** restarted from the last chunk that committed...
+*/
+#define IMPORT_DEFAULT_CHUNK_ROWS           50000
+
+/*
+** The --import command line mode, bulk loads weather_data and
+** telemetry_data from a capture file (capture.h) or a CSV file
+** with a header line naming the columns. startOffset is the
+** record (or CSV data line) to start from, as printed by the
+** progress report...
+*/
+int runImport(const char * filename, uint64_t startOffset);
+
+#endif
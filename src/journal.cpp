@@ -0,0 +1,754 @@
+#include <string>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "logger.h"
+#include "journal.h"
+
+using namespace std;
+
+#define JOURNAL_SEGMENT_NAME_FORMAT         "segment-%010u.jnl"
+#define JOURNAL_SET_ASIDE_NAME_FORMAT       "set-aside-%010u.jnl"
+#define JOURNAL_CHECKPOINT_NAME             "checkpoint"
+
+#define FNV_OFFSET_BASIS                    0x811C9DC5U
+#define FNV_PRIME                           0x01000193U
+
+static const uint64_t headerSize = sizeof(journal_segment_header_t);
+static const uint64_t recordSize = sizeof(journal_record_t);
+
+/*
+** FNV-1a, enough to spot a torn or corrupt record...
+*/
+static uint32_t _checksum(const void * buffer, size_t length) {
+    const uint8_t * p = (const uint8_t *)buffer;
+    uint32_t        hash = FNV_OFFSET_BASIS;
+
+    for (size_t i = 0;i < length;i++) {
+        hash ^= p[i];
+        hash *= FNV_PRIME;
+    }
+
+    return hash;
+}
+
+static int _writeFully(int fd, const void * buffer, size_t length) {
+    const uint8_t * p = (const uint8_t *)buffer;
+
+    while (length > 0) {
+        ssize_t bytesWritten = ::write(fd, p, length);
+
+        if (bytesWritten < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            return -1;
+        }
+
+        p += bytesWritten;
+        length -= bytesWritten;
+    }
+
+    return 0;
+}
+
+static bool _isValidRecord(const journal_record_t * record) {
+    return (
+        record->magic == JOURNAL_RECORD_MAGIC &&
+        record->checksum == _checksum(&record->transform, sizeof(weather_transform_t)));
+}
+
+static void _initHeader(journal_segment_header_t * header) {
+    memset(header, 0, sizeof(journal_segment_header_t));
+
+    header->magic = JOURNAL_SEGMENT_MAGIC;
+    header->version = JOURNAL_FORMAT_VERSION;
+    header->headerSize = (uint16_t)headerSize;
+    header->recordSize = (uint32_t)recordSize;
+    header->checksum = _checksum(header, offsetof(journal_segment_header_t, checksum));
+}
+
+/*
+** The records in a segment this size, or before this offset...
+*/
+static uint64_t _getNumRecords(uint64_t size) {
+    return (size > headerSize ? (size - headerSize) / recordSize : 0);
+}
+
+/*
+** Back to the start of the record offset is in...
+*/
+static uint64_t _alignOffset(uint64_t offset) {
+    return headerSize + _getNumRecords(offset) * recordSize;
+}
+
+/*
+** So a new or renamed file survives a power cut...
+*/
+static void _syncDirectory(const string & directory) {
+    int fd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY);
+
+    if (fd >= 0) {
+        fsync(fd);
+        ::close(fd);
+    }
+}
+
+spillJournal::spillJournal(const string & directory, uint64_t maxSegmentSize, uint64_t maxSize, uint32_t syncRecords) {
+    uint32_t        firstSegment;
+    uint32_t        lastSegment;
+    bool            isFound;
+
+    logger & log = logger::getInstance();
+
+    this->directory = directory;
+    this->maxSegmentSize = (maxSegmentSize >= headerSize + recordSize ? maxSegmentSize : JOURNAL_DEFAULT_SEGMENT_SIZE);
+    this->maxSize = (maxSize > 0 ? maxSize : JOURNAL_DEFAULT_MAX_SIZE);
+    this->syncRecords = (syncRecords > 0 ? syncRecords : JOURNAL_DEFAULT_SYNC_RECORDS);
+
+    /*
+    ** We throw whole segments away when full, so we need at
+    ** least two of them...
+    */
+    if (this->maxSize < this->maxSegmentSize * 2) {
+        this->maxSize = this->maxSegmentSize * 2;
+    }
+
+    if (mkdir(directory.c_str(), 0755) < 0 && errno != EEXIST) {
+        throw journal_error(journal_error::buildMsg("Failed to create journal directory '%s': %s", directory.c_str(), strerror(errno)));
+    }
+
+    findSegments(&firstSegment, &lastSegment, &isFound);
+
+    /*
+    ** Anything we can't read is out of the way before we
+    ** work out where we are...
+    */
+    if (isFound) {
+        for (uint32_t segment = firstSegment;segment <= lastSegment;segment++) {
+            checkSegment(segment);
+        }
+
+        findSegments(&firstSegment, &lastSegment, &isFound);
+    }
+
+    bool isCheckpointValid = readCheckpoint();
+
+    if (isFound) {
+        recoverSegment(lastSegment);
+
+        writeSegment = lastSegment;
+
+        if (!isCheckpointValid || readSegment < firstSegment) {
+            readSegment = firstSegment;
+            readOffset = headerSize;
+        }
+        else if (readSegment > lastSegment) {
+            readSegment = lastSegment;
+            readOffset = getSegmentSize(lastSegment);
+        }
+
+        /*
+        ** Anything before the read segment has been replayed...
+        */
+        for (uint32_t segment = firstSegment;segment < readSegment;segment++) {
+            unlink(getSegmentFileName(segment).c_str());
+        }
+
+        uint64_t readSegmentSize = getSegmentSize(readSegment);
+
+        if (readOffset > readSegmentSize) {
+            readOffset = readSegmentSize;
+        }
+    }
+    else {
+        writeSegment = readSegment;
+        readOffset = headerSize;
+    }
+
+    openWriteSegment();
+
+    if (readOffset < headerSize) {
+        readOffset = headerSize;
+    }
+
+    countPending();
+
+    log.logStatus(
+        "Opened journal '%s', %llu reading(s) waiting to be replayed",
+        directory.c_str(),
+        (unsigned long long)numPending);
+}
+
+spillJournal::~spillJournal() {
+    sync();
+
+    if (numSinceCheckpoint > 0) {
+        try {
+            checkpoint();
+        }
+        catch (journal_error & e) {
+            logger::getInstance().logError("%s", e.what());
+        }
+    }
+
+    if (readFD >= 0) {
+        ::close(readFD);
+    }
+
+    if (writeFD >= 0) {
+        ::close(writeFD);
+    }
+}
+
+string spillJournal::getSegmentFileName(uint32_t segment) {
+    char szName[32];
+
+    snprintf(szName, sizeof(szName), JOURNAL_SEGMENT_NAME_FORMAT, segment);
+
+    return directory + "/" + szName;
+}
+
+string spillJournal::getCheckpointFileName() {
+    return directory + "/" + JOURNAL_CHECKPOINT_NAME;
+}
+
+void spillJournal::findSegments(uint32_t * first, uint32_t * last, bool * isFound) {
+    struct dirent *     entry;
+    uint32_t            segment;
+
+    *isFound = false;
+    *first = 0;
+    *last = 0;
+
+    DIR * dir = opendir(directory.c_str());
+
+    if (dir == NULL) {
+        throw journal_error(journal_error::buildMsg("Failed to open journal directory '%s': %s", directory.c_str(), strerror(errno)));
+    }
+
+    while ((entry = readdir(dir)) != NULL) {
+        if (sscanf(entry->d_name, JOURNAL_SEGMENT_NAME_FORMAT, &segment) != 1) {
+            continue;
+        }
+
+        if (!*isFound || segment < *first) {
+            *first = segment;
+        }
+        if (!*isFound || segment > *last) {
+            *last = segment;
+        }
+
+        *isFound = true;
+    }
+
+    closedir(dir);
+}
+
+bool spillJournal::readCheckpoint() {
+    journal_checkpoint_t cp;
+
+    int fd = ::open(getCheckpointFileName().c_str(), O_RDONLY);
+
+    if (fd < 0) {
+        return false;
+    }
+
+    ssize_t bytesRead = ::read(fd, &cp, sizeof(cp));
+
+    ::close(fd);
+
+    if (bytesRead != (ssize_t)sizeof(cp) ||
+        cp.magic != JOURNAL_CHECKPOINT_MAGIC ||
+        cp.checksum != _checksum(&cp, offsetof(journal_checkpoint_t, checksum)))
+    {
+        logger::getInstance().logError("Ignoring invalid journal checkpoint in '%s'", directory.c_str());
+        return false;
+    }
+
+    readSegment = cp.readSegment;
+    readOffset = _alignOffset(cp.readOffset);
+
+    return true;
+}
+
+/*
+** Make sure we can read a segment before we replay it. One from
+** before segments had a header is converted, if its first record
+** is one we understand. Anything else we can't read is renamed, so
+** it can be looked at, rather than being cut to nothing...
+*/
+void spillJournal::checkSegment(uint32_t segment) {
+    journal_segment_header_t    header;
+    journal_record_t            record;
+    struct stat                 st;
+
+    string fileName = getSegmentFileName(segment);
+
+    int fd = ::open(fileName.c_str(), O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0) {
+        return;
+    }
+
+    fstat(fd, &st);
+
+    uint64_t size = (uint64_t)st.st_size;
+
+    /*
+    ** We crashed creating it, before anything was written...
+    */
+    if (size < headerSize) {
+        ::close(fd);
+        unlink(fileName.c_str());
+        return;
+    }
+
+    bool isHeaderRead = (pread(fd, &header, headerSize, 0) == (ssize_t)headerSize);
+    bool isRecordRead = (pread(fd, &record, recordSize, 0) == (ssize_t)recordSize);
+
+    ::close(fd);
+
+    if (isHeaderRead &&
+        header.magic == JOURNAL_SEGMENT_MAGIC &&
+        header.checksum == _checksum(&header, offsetof(journal_segment_header_t, checksum)))
+    {
+        if (header.version == JOURNAL_FORMAT_VERSION && header.headerSize == headerSize && header.recordSize == recordSize) {
+            return;
+        }
+
+        char * reason = journal_error::buildMsg(
+                            "it was written by format version %u with %u byte records, we're version %u with %u",
+                            (unsigned)header.version,
+                            (unsigned)header.recordSize,
+                            (unsigned)JOURNAL_FORMAT_VERSION,
+                            (unsigned)recordSize);
+
+        setSegmentAside(segment, reason);
+        free(reason);
+        return;
+    }
+
+    if (isRecordRead && _isValidRecord(&record)) {
+        convertSegment(segment, size);
+        return;
+    }
+
+    setSegmentAside(segment, "it has no header we recognise");
+}
+
+/*
+** Copy the records after a header and rename the copy over the
+** original, so the segment is either one or the other...
+*/
+void spillJournal::convertSegment(uint32_t segment, uint64_t size) {
+    journal_segment_header_t    header;
+    journal_record_t            record;
+
+    string fileName = getSegmentFileName(segment);
+    string tempFileName = fileName + ".tmp";
+
+    int fd = ::open(fileName.c_str(), O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0) {
+        throw journal_error(journal_error::buildMsg("Failed to open journal segment '%s': %s", fileName.c_str(), strerror(errno)));
+    }
+
+    int tempFD = ::open(tempFileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+    if (tempFD < 0) {
+        int err = errno;
+        ::close(fd);
+        throw journal_error(journal_error::buildMsg("Failed to convert journal segment '%s': %s", fileName.c_str(), strerror(err)));
+    }
+
+    _initHeader(&header);
+
+    bool isWritten = (_writeFully(tempFD, &header, headerSize) == 0);
+
+    /*
+    ** A torn record at the end is left for recoverSegment()...
+    */
+    for (uint64_t offset = 0;isWritten && offset + recordSize <= size;offset += recordSize) {
+        isWritten = (
+            pread(fd, &record, recordSize, (off_t)offset) == (ssize_t)recordSize &&
+            _writeFully(tempFD, &record, recordSize) == 0);
+    }
+
+    isWritten = (isWritten && fsync(tempFD) == 0);
+
+    int err = errno;
+
+    ::close(tempFD);
+    ::close(fd);
+
+    if (!isWritten || rename(tempFileName.c_str(), fileName.c_str()) < 0) {
+        err = (isWritten ? errno : err);
+        unlink(tempFileName.c_str());
+        throw journal_error(journal_error::buildMsg("Failed to convert journal segment '%s': %s", fileName.c_str(), strerror(err)));
+    }
+
+    _syncDirectory(directory);
+
+    logger::getInstance().logStatus(
+        "Converted journal segment '%s' to format version %u, %llu reading(s)",
+        fileName.c_str(),
+        (unsigned)JOURNAL_FORMAT_VERSION,
+        (unsigned long long)(size / recordSize));
+}
+
+void spillJournal::setSegmentAside(uint32_t segment, const char * reason) {
+    char szName[32];
+
+    snprintf(szName, sizeof(szName), JOURNAL_SET_ASIDE_NAME_FORMAT, segment);
+
+    string fileName = getSegmentFileName(segment);
+    string asideFileName = directory + "/" + szName;
+
+    if (rename(fileName.c_str(), asideFileName.c_str()) < 0) {
+        throw journal_error(journal_error::buildMsg("Failed to set journal segment '%s' aside: %s", fileName.c_str(), strerror(errno)));
+    }
+
+    _syncDirectory(directory);
+
+    logger::getInstance().logError(
+        "Can't replay journal segment '%s', %s. Moved it to '%s'",
+        fileName.c_str(),
+        reason,
+        asideFileName.c_str());
+}
+
+/*
+** Cut off anything after the last good record, which is what
+** we're left with if we crashed part way through a write...
+*/
+void spillJournal::recoverSegment(uint32_t segment) {
+    journal_record_t record;
+
+    string fileName = getSegmentFileName(segment);
+
+    int fd = ::open(fileName.c_str(), O_RDWR);
+
+    if (fd < 0) {
+        throw journal_error(journal_error::buildMsg("Failed to open journal segment '%s': %s", fileName.c_str(), strerror(errno)));
+    }
+
+    struct stat st;
+    fstat(fd, &st);
+
+    uint64_t size = (uint64_t)st.st_size;
+    uint64_t validSize = _alignOffset(size);
+
+    while (validSize > headerSize) {
+        if (pread(fd, &record, recordSize, (off_t)(validSize - recordSize)) == (ssize_t)recordSize && _isValidRecord(&record)) {
+            break;
+        }
+
+        validSize -= recordSize;
+    }
+
+    if (validSize != size) {
+        logger::getInstance().logError(
+            "Truncating journal segment '%s' from %llu to %llu bytes",
+            fileName.c_str(),
+            (unsigned long long)size,
+            (unsigned long long)validSize);
+
+        if (ftruncate(fd, (off_t)validSize) < 0 || fsync(fd) < 0) {
+            int err = errno;
+            ::close(fd);
+            throw journal_error(journal_error::buildMsg("Failed to truncate journal segment '%s': %s", fileName.c_str(), strerror(err)));
+        }
+    }
+
+    ::close(fd);
+}
+
+uint64_t spillJournal::getSegmentSize(uint32_t segment) {
+    struct stat st;
+
+    if (segment == writeSegment && writeFD >= 0) {
+        return writeOffset;
+    }
+
+    if (stat(getSegmentFileName(segment).c_str(), &st) < 0 || (uint64_t)st.st_size < headerSize) {
+        return 0;
+    }
+
+    return _alignOffset((uint64_t)st.st_size);
+}
+
+void spillJournal::countPending() {
+    numPending = 0;
+
+    for (uint32_t segment = readSegment;segment <= writeSegment;segment++) {
+        numPending += _getNumRecords(getSegmentSize(segment));
+    }
+
+    numPending -= _getNumRecords(readOffset);
+}
+
+void spillJournal::openWriteSegment() {
+    string fileName = getSegmentFileName(writeSegment);
+
+    writeFD = ::open(fileName.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+
+    if (writeFD < 0) {
+        throw journal_error(journal_error::buildMsg("Failed to open journal segment '%s': %s", fileName.c_str(), strerror(errno)));
+    }
+
+    struct stat st;
+    fstat(writeFD, &st);
+
+    writeOffset = (uint64_t)st.st_size;
+
+    if (writeOffset == 0) {
+        journal_segment_header_t header;
+
+        _initHeader(&header);
+
+        if (_writeFully(writeFD, &header, headerSize) < 0 || fdatasync(writeFD) < 0) {
+            throw journal_error(journal_error::buildMsg("Failed to write to journal segment '%s': %s", fileName.c_str(), strerror(errno)));
+        }
+
+        writeOffset = headerSize;
+    }
+
+    _syncDirectory(directory);
+}
+
+void spillJournal::openReadSegment() {
+    readFD = ::open(getSegmentFileName(readSegment).c_str(), O_RDONLY | O_CLOEXEC);
+}
+
+/*
+** The read segment has been replayed (or thrown away)...
+*/
+void spillJournal::nextReadSegment() {
+    if (readFD >= 0) {
+        ::close(readFD);
+        readFD = -1;
+    }
+
+    unlink(getSegmentFileName(readSegment).c_str());
+
+    readSegment++;
+    readOffset = headerSize;
+}
+
+void spillJournal::discardOldestSegment() {
+    uint64_t numRecords = _getNumRecords(getSegmentSize(readSegment));
+    uint64_t numReplayed = _getNumRecords(readOffset);
+
+    numRecords = (numRecords > numReplayed ? numRecords - numReplayed : 0);
+
+    numPending -= numRecords;
+    numDiscarded += numRecords;
+
+    logger::getInstance().logError(
+        "Journal '%s' is full, discarded the %llu oldest reading(s)",
+        directory.c_str(),
+        (unsigned long long)numRecords);
+
+    nextReadSegment();
+    checkpoint();
+}
+
+void spillJournal::append(const weather_transform_t & tr) {
+    journal_record_t record;
+
+    if (writeOffset + recordSize > maxSegmentSize) {
+        sync();
+
+        ::close(writeFD);
+        writeFD = -1;
+
+        writeSegment++;
+
+        openWriteSegment();
+    }
+
+    while ((numPending + 1) * recordSize > maxSize && readSegment < writeSegment) {
+        discardOldestSegment();
+    }
+
+    memset(&record, 0, sizeof(record));
+
+    record.magic = JOURNAL_RECORD_MAGIC;
+    record.transform = tr;
+    record.checksum = _checksum(&record.transform, sizeof(weather_transform_t));
+
+    /*
+    ** One write() per record, a crash part way through leaves
+    ** a torn record that recoverSegment() cuts off...
+    */
+    if (_writeFully(writeFD, &record, recordSize) < 0) {
+        throw journal_error(journal_error::buildMsg("Failed to write to journal '%s': %s", directory.c_str(), strerror(errno)));
+    }
+
+    writeOffset += recordSize;
+    numPending++;
+
+    if (++numUnsynced >= syncRecords) {
+        sync();
+    }
+}
+
+void spillJournal::sync() {
+    if (numUnsynced > 0 && writeFD >= 0) {
+        fdatasync(writeFD);
+        numUnsynced = 0;
+    }
+}
+
+bool spillJournal::peek(weather_transform_t * tr) {
+    journal_record_t record;
+
+    logger & log = logger::getInstance();
+
+    while (numPending > 0) {
+        if (readOffset + recordSize > getSegmentSize(readSegment)) {
+            if (readSegment >= writeSegment) {
+                /*
+                ** Shouldn't happen, our count is out...
+                */
+                numPending = 0;
+                return false;
+            }
+
+            nextReadSegment();
+            continue;
+        }
+
+        if (readFD < 0) {
+            openReadSegment();
+
+            if (readFD < 0) {
+                log.logError("Journal segment %u has gone missing, skipping it", readSegment);
+                nextReadSegment();
+                countPending();
+                continue;
+            }
+        }
+
+        if (pread(readFD, &record, recordSize, (off_t)readOffset) != (ssize_t)recordSize) {
+            throw journal_error(journal_error::buildMsg("Failed to read from journal '%s': %s", directory.c_str(), strerror(errno)));
+        }
+
+        if (!_isValidRecord(&record)) {
+            log.logError("Skipping corrupt record in journal segment %u at offset %llu", readSegment, (unsigned long long)readOffset);
+
+            readOffset += recordSize;
+            numPending--;
+            continue;
+        }
+
+        *tr = record.transform;
+
+        return true;
+    }
+
+    return false;
+}
+
+uint32_t spillJournal::peek(weather_transform_t * batch, uint32_t maxRecords) {
+    journal_record_t record;
+
+    if (maxRecords == 0 || !peek(&batch[0])) {
+        return 0;
+    }
+
+    /*
+    ** peek() has skipped anything corrupt in front of the first
+    ** one, so we stop at the next, it'll sort that out next time...
+    */
+    uint32_t numRecords = 1;
+    uint64_t offset = readOffset + recordSize;
+    uint64_t segmentSize = getSegmentSize(readSegment);
+
+    while (numRecords < maxRecords && numRecords < numPending && offset + recordSize <= segmentSize) {
+        if (pread(readFD, &record, recordSize, (off_t)offset) != (ssize_t)recordSize || !_isValidRecord(&record)) {
+            break;
+        }
+
+        batch[numRecords++] = record.transform;
+        offset += recordSize;
+    }
+
+    return numRecords;
+}
+
+void spillJournal::advance(uint32_t numRecords) {
+    if (numRecords == 0) {
+        return;
+    }
+
+    for (uint32_t i = 0;i < numRecords;i++) {
+        advance();
+    }
+
+    if (numSinceCheckpoint > 0) {
+        checkpoint();
+    }
+}
+
+void spillJournal::advance() {
+    if (numPending == 0) {
+        return;
+    }
+
+    readOffset += recordSize;
+    numPending--;
+
+    if (++numSinceCheckpoint >= JOURNAL_CHECKPOINT_RECORDS || numPending == 0) {
+        checkpoint();
+    }
+}
+
+/*
+** Written to a temporary file and renamed over the old one, so
+** there is always one whole checkpoint on disk...
+*/
+void spillJournal::checkpoint() {
+    journal_checkpoint_t cp;
+
+    string fileName = getCheckpointFileName();
+    string tempFileName = fileName + ".tmp";
+
+    cp.magic = JOURNAL_CHECKPOINT_MAGIC;
+    cp.readSegment = readSegment;
+    cp.readOffset = readOffset;
+    cp.checksum = _checksum(&cp, offsetof(journal_checkpoint_t, checksum));
+
+    int fd = ::open(tempFileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+    if (fd < 0) {
+        throw journal_error(journal_error::buildMsg("Failed to write journal checkpoint '%s': %s", tempFileName.c_str(), strerror(errno)));
+    }
+
+    if (_writeFully(fd, &cp, sizeof(cp)) < 0 || fsync(fd) < 0) {
+        int err = errno;
+        ::close(fd);
+        throw journal_error(journal_error::buildMsg("Failed to write journal checkpoint '%s': %s", tempFileName.c_str(), strerror(err)));
+    }
+
+    ::close(fd);
+
+    if (rename(tempFileName.c_str(), fileName.c_str()) < 0) {
+        throw journal_error(journal_error::buildMsg("Failed to write journal checkpoint '%s': %s", fileName.c_str(), strerror(errno)));
+    }
+
+    _syncDirectory(directory);
+
+    numSinceCheckpoint = 0;
+}
@@ -0,0 +1,219 @@
+#include <string>
+#include <exception>
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "packet.h"
+
+using namespace std;
+
+#ifndef __INCL_JOURNAL
+#define __INCL_JOURNAL
+
+#define JOURNAL_SEGMENT_MAGIC               0x4745534A          // 'JSEG'
+#define JOURNAL_RECORD_MAGIC                0x4C4E524A          // 'JRNL'
+#define JOURNAL_CHECKPOINT_MAGIC            0x5450434A          // 'JCPT'
+
+/*
+** Goes up whenever journal_record_t changes, which includes any
+** change to weather_transform_t. A segment written by another
+** version is set aside, not replayed...
+*/
+#define JOURNAL_FORMAT_VERSION              1
+
+#define JOURNAL_DEFAULT_SEGMENT_SIZE        (1024UL * 1024UL)
+#define JOURNAL_DEFAULT_MAX_SIZE            (64UL * 1024UL * 1024UL)
+#define JOURNAL_DEFAULT_SYNC_RECORDS        32
+
+/*
+** Records advanced past one at a time between checkpoints,
+** advance(numRecords) checkpoints every time it is called...
+*/
+#define JOURNAL_CHECKPOINT_RECORDS          64
+
+/*
+** A journal is a directory of numbered segment files, each a header
+** then a run of fixed size records appended in the order they were
+** spilled, plus a checkpoint file saying how far replay has got...
+*/
+#pragma pack(push, 1)
+typedef struct {                                    // O/S  - Description
+                                                    // ----   ---------------------------------
+    uint32_t            magic;                      // 0x00 - JOURNAL_SEGMENT_MAGIC
+    uint16_t            version;                    // 0x04 - JOURNAL_FORMAT_VERSION
+    uint16_t            headerSize;                 // 0x06 - Where the first record is
+    uint32_t            recordSize;                 // 0x08 - sizeof(journal_record_t)
+    uint32_t            checksum;                   // 0x0C - Of the fields above
+}
+journal_segment_header_t;
+
+typedef struct {                                    // O/S  - Description
+                                                    // ----   ---------------------------------
+    uint32_t            magic;                      // 0x00 - JOURNAL_RECORD_MAGIC
+    uint32_t            checksum;                   // 0x04 - Of transform
+    weather_transform_t transform;                  // 0x08 - The reading
+}
+journal_record_t;
+
+typedef struct {                                    // O/S  - Description
+                                                    // ----   ---------------------------------
+    uint32_t            magic;                      // 0x00 - JOURNAL_CHECKPOINT_MAGIC
+    uint32_t            readSegment;                // 0x04 - Segment replay is in
+    uint64_t            readOffset;                 // 0x08 - Offset of the next record to replay
+    uint32_t            checksum;                   // 0x10 - Of the fields above
+}
+journal_checkpoint_t;
+#pragma pack(pop)
+
+class journal_error : public exception {
+    private:
+        string message;
+        static const int MESSAGE_BUFFER_LEN = 4096;
+
+    public:
+        const char * getTitle() {
+            return "Journal Error: ";
+        }
+
+        journal_error() {
+            this->message.assign(getTitle());
+        }
+
+        journal_error(const char * msg) : journal_error() {
+            this->message.append(msg);
+        }
+
+        journal_error(const char * msg, const char * file, int line) : journal_error() {
+            char lineNumBuf[8];
+
+            snprintf(lineNumBuf, 8, ":%d", line);
+
+            this->message.append(msg);
+            this->message.append(" at ");
+            this->message.append(file);
+            this->message.append(lineNumBuf);
+        }
+
+        virtual const char * what() const noexcept {
+            return this->message.c_str();
+        }
+
+        static char * buildMsg(const char * fmt, ...) {
+            va_list     args;
+            char *      buffer;
+
+            buffer = (char *)malloc(MESSAGE_BUFFER_LEN);
+
+            va_start(args, fmt);
+            vsnprintf(buffer, MESSAGE_BUFFER_LEN, fmt, args);
+            va_end(args);
+
+            return buffer;
+        }
+};
+
+/*
+** Readings the database can't take right now. append() goes to the
+** end of the newest segment, starting a new one when it is full, and
+** is fsync'd every syncRecords records or on sync(). peek()/advance()
+** replay from the oldest, a segment is deleted once it has been
+** replayed. If the journal grows past maxSize the oldest segment is
+** thrown away, so an outage costs bounded disk and no memory.
+**
+** On opening, a segment whose header says it was written with
+** another format is renamed out of the way and left alone, one from
+** before segments had a header is converted. A torn record at the
+** end of the newest segment (we crashed mid write) is truncated
+** away, and replay carries on from the checkpoint. A batch that was
+** written just before a crash, but not checkpointed, is replayed
+** again, which only writes the same rows again. Not thread safe,
+** owned by the DB thread...
+*/
+class spillJournal {
+    private:
+        string          directory;
+        uint64_t        maxSegmentSize;
+        uint64_t        maxSize;
+        uint32_t        syncRecords;
+
+        uint32_t        readSegment = 0;
+        uint64_t        readOffset = 0;
+        int             readFD = -1;
+
+        uint32_t        writeSegment = 0;
+        uint64_t        writeOffset = 0;
+        int             writeFD = -1;
+
+        uint64_t        numPending = 0;
+        uint32_t        numUnsynced = 0;
+        uint32_t        numSinceCheckpoint = 0;
+        uint64_t        numDiscarded = 0;
+
+        string getSegmentFileName(uint32_t segment);
+        string getCheckpointFileName();
+
+        void findSegments(uint32_t * first, uint32_t * last, bool * isFound);
+        void checkSegment(uint32_t segment);
+        void convertSegment(uint32_t segment, uint64_t size);
+        void setSegmentAside(uint32_t segment, const char * reason);
+        bool readCheckpoint();
+        void recoverSegment(uint32_t segment);
+        uint64_t getSegmentSize(uint32_t segment);
+        void countPending();
+
+        void openWriteSegment();
+        void openReadSegment();
+        void nextReadSegment();
+        void discardOldestSegment();
+
+    public:
+        spillJournal(const string & directory, uint64_t maxSegmentSize, uint64_t maxSize, uint32_t syncRecords);
+        ~spillJournal();
+
+        void append(const weather_transform_t & tr);
+
+        /*
+        ** fsync anything appended since the last sync...
+        */
+        void sync();
+
+        /*
+        ** The oldest record not yet replayed, false if there
+        ** isn't one. advance() moves past it...
+        */
+        bool peek(weather_transform_t * tr);
+        void advance();
+
+        /*
+        ** Up to maxRecords of the oldest records, stopping early at
+        ** the end of a segment, 0 if there aren't any. They are
+        ** only moved past by advance(numRecords), which checkpoints,
+        ** so call it once they're safely written...
+        */
+        uint32_t peek(weather_transform_t * batch, uint32_t maxRecords);
+        void advance(uint32_t numRecords);
+
+        /*
+        ** Record how far replay has got, done for us every
+        ** JOURNAL_CHECKPOINT_RECORDS records...
+        */
+        void checkpoint();
+
+        bool isEmpty() {
+            return (numPending == 0);
+        }
+
+        uint64_t getNumPending() {
+            return numPending;
+        }
+
+        uint64_t getNumDiscarded() {
+            return numDiscarded;
+        }
+};
+
+#endif
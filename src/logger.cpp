@@ -17,7 +17,23 @@ using namespace std;
 
 #define LOG_BUFFER_LENGTH               4096
 
-static pthread_mutex_t _mutex = PTHREAD_MUTEX_INITIALIZER;
+/*
+** Priority inheriting, so the radio thread (which may be SCHED_FIFO)
+** waiting on a thread that is writing to the SD card lends it its
+** priority, rather than the writer waiting behind everything in
+** between...
+*/
+static pthread_mutex_t _mutex;
+static pthread_once_t _mutexOnce = PTHREAD_ONCE_INIT;
+
+static void _initMutex() {
+    pthread_mutexattr_t attr;
+
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_INHERIT);
+    pthread_mutex_init(&_mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
 
 static int logLevel_atoi(const char * pszLoggingLevel) {
     int logLevel = 0;
@@ -85,26 +101,38 @@ static string & getLinePrefix(int logLevel) {
 }
 
 void logger::logMessage(int logLevel, bool addCR, const char * fmt, va_list args) {
-	pthread_mutex_lock(&_mutex);
+    int         cancelState;
 
-    if (isLogLevel(logLevel)) {
-        if (strlen(fmt) > MAX_LOG_LENGTH) {
-            throw log_error(log_error::buildMsg("Log line too long, mudt be less than %d", MAX_LOG_LENGTH));
-        }
+    if (!isLogLevel(logLevel)) {
+        return;
+    }
 
-        string prefix = getLinePrefix(logLevel);
+    if (strlen(fmt) > MAX_LOG_LENGTH) {
+        throw log_error(log_error::buildMsg("Log line too long, mudt be less than %d", MAX_LOG_LENGTH));
+    }
 
-        fwrite(prefix.c_str(), 1, prefix.length(), fptr);
-        vfprintf(fptr, fmt, args);
+    pthread_once(&_mutexOnce, &_initMutex);
 
-        if (addCR) {
-            fputc('\n', fptr);
-        }
+    /*
+    ** A thread cancelled by the supervisor must not leave
+    ** the mutex locked, and fwrite() can be cancelled...
+    */
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &cancelState);
+	pthread_mutex_lock(&_mutex);
 
-        fflush(fptr);
+    string prefix = getLinePrefix(logLevel);
+
+    fwrite(prefix.c_str(), 1, prefix.length(), fptr);
+    vfprintf(fptr, fmt, args);
+
+    if (addCR) {
+        fputc('\n', fptr);
     }
 
+    fflush(fptr);
+
 	pthread_mutex_unlock(&_mutex);
+    pthread_setcancelstate(cancelState, NULL);
 }
 
 void logger::initlogger(const string & logFileName, const char * logLevel) {
@@ -147,7 +175,7 @@ void logger::setLogLevel(const char * logLevel) {
 }
 
 bool logger::isLogLevel(int logLevel) {
-    return ((this->loggingLevel & logLevel) == logLevel ? true : false);
+    return ((this->loggingLevel.load(memory_order_relaxed) & logLevel) == logLevel ? true : false);
 }
 
 void logger::newline() {
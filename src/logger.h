@@ -1,6 +1,7 @@
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <atomic>
 
 #include <stdio.h>
 #include <unistd.h>
@@ -83,7 +84,11 @@ class logger {
 
         FILE * fptr;
 
-        int loggingLevel;
+        /*
+        ** Read without the lock, so a message we aren't going to
+        ** write costs nothing...
+        */
+        atomic<int> loggingLevel{0};
 
         void logMessage(int logLevel, bool addCR, const char * fmt, va_list args);
 
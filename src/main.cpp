@@ -7,6 +7,7 @@
 #include <fcntl.h>
 #include <time.h>
 #include <signal.h>
+#include <sys/signalfd.h>
 
 #include <lgpio.h>
 
@@ -19,6 +20,13 @@ extern "C" {
 #include "posixthread.h"
 #include "threads.h"
 #include "radio.h"
+#include "nrfreplay.h"
+#include "channel.h"
+#include "batch.h"
+#include "dbsink.h"
+#include "import.h"
+#include "reactor.h"
+#include "station.h"
 #include "utils.h"
 
 void printUsage(void) {
@@ -28,6 +36,14 @@ void printUsage(void) {
 	printf("   -version         Print the program version\n");
 	printf("   -cfg configfile  Specify the cfg file, default is ./webconfig.cfg\n");
     printf("   --dump-config    Dump the config contents and exit\n");
+    printf("   --replay file    Replay a packet capture file instead of using the radio\n");
+    printf("   --replay-speed n Replay at n x real time, default 0 is as fast as possible\n");
+    printf("   --scan           Scan channels %d - %d for interference and exit\n", NRF24L01_MIN_CHANNEL, NRF24L01_MAX_CHANNEL);
+    printf("   --scan-passes n  Sweep the channels n times, default is 100\n");
+    printf("   --benchmark n    Time the scalar and batch transforms over n records and exit\n");
+    printf("   --benchmark-db n Time inserting n readings into the database each way and exit\n");
+    printf("   --import file    Bulk load a capture or CSV file into the database and exit\n");
+    printf("   --import-offset n Start the import at record n, to resume one that stopped\n");
 	printf("   -d               Daemonise this application\n");
 	printf("   -log  filename   Write logs to the file\n");
 	printf("\n");
@@ -84,7 +100,27 @@ int archiveLogFile(const string & logFileName) {
 	return 0;
 }
 
-void handleSignal(int sigNum) {
+static void reloadConfig() {
+	logger & log = logger::getInstance();
+
+	log.logStatus("Detected SIGHUP, reloading calibration...");
+
+	try {
+		cfgmgr::getInstance().reload();
+	}
+	catch (cfg_error & e) {
+		log.logError("Failed to reload config: %s", e.what());
+		return;
+	}
+
+	stationmgr::getInstance().reloadCalibration();
+}
+
+/*
+** Signals arrive through a signalfd in the main event loop, so
+** this runs as ordinary code, not in a signal handler...
+*/
+void handleSignal(int sigNum, eventLoop & loop) {
 	logger & log = logger::getInstance();
 
 	switch (sigNum) {
@@ -124,19 +160,44 @@ void handleSignal(int sigNum) {
 				log.setLogLevel(level);
 			}
 			return;
+
+		case SIGHUP:
+			reloadConfig();
+			return;
 	}
 
-    puts("\n");
-    
-	ThreadManager & threadMgr = ThreadManager::getInstance();
-    threadMgr.kill();
-    
-	nrf24l01 & radio = nrf24l01::getInstance();
-	radio.close();
+	/*
+	** Anything else we listen for is a request to stop, the
+	** clean up happens once the main loop has returned...
+	*/
+	loop.stop();
+}
+
+static bool isReplay = false;
+
+static void handleSupervisorTimer(int fd, uint32_t events, void * context) {
+	ThreadManager::getInstance().supervise();
 
-    log.closelogger();
+	stationmgr::getInstance().freeRetiredCalibration(getEpochNanoseconds());
 
-    exit(0);
+	/*
+	** A replay stops once the whole capture is on the bus, stopping
+	** the threads writes whatever the sinks still have queued...
+	*/
+	if (isReplay && nrfreplay::getInstance().isReplayComplete()) {
+		logger::getInstance().logStatus("Replay finished, cleaning up...");
+		((eventLoop *)context)->stop();
+	}
+}
+
+static void handleSignalEvent(int fd, uint32_t events, void * context) {
+	struct signalfd_siginfo		info;
+
+	eventLoop * loop = (eventLoop *)context;
+
+	while (read(fd, &info, sizeof(info)) == sizeof(info)) {
+		handleSignal((int)info.ssi_signo, *loop);
+	}
 }
 
 int main(int argc, char ** argv) {
@@ -145,6 +206,14 @@ int main(int argc, char ** argv) {
 	int				    i;
 	bool			    isDaemonised = false;
 	bool			    isDumpConfig = false;
+	char *			    pszReplayFileName = NULL;
+	const char *	    pszReplaySpeed = "0";
+	bool			    isScan = false;
+	int				    numScanPasses = 100;
+	int				    numBenchmarkRecords = 0;
+	int				    numBenchmarkDBRecords = 0;
+	char *			    pszImportFileName = NULL;
+	uint64_t		    importOffset = 0;
 	const char *	    defaultLoggingLevel = "LOG_LEVEL_INFO | LOG_LEVEL_ERROR | LOG_LEVEL_FATAL";
 
 	if (argc > 1) {
@@ -162,6 +231,30 @@ int main(int argc, char ** argv) {
 				else if (strcmp(&argv[i][1], "-dump-config") == 0) {
 					isDumpConfig = true;
 				}
+				else if (strcmp(&argv[i][1], "-replay") == 0) {
+					pszReplayFileName = strdup(&argv[++i][0]);
+				}
+				else if (strcmp(&argv[i][1], "-replay-speed") == 0) {
+					pszReplaySpeed = &argv[++i][0];
+				}
+				else if (strcmp(&argv[i][1], "-scan") == 0) {
+					isScan = true;
+				}
+				else if (strcmp(&argv[i][1], "-scan-passes") == 0) {
+					numScanPasses = atoi(&argv[++i][0]);
+				}
+				else if (strcmp(&argv[i][1], "-benchmark") == 0) {
+					numBenchmarkRecords = atoi(&argv[++i][0]);
+				}
+				else if (strcmp(&argv[i][1], "-benchmark-db") == 0) {
+					numBenchmarkDBRecords = atoi(&argv[++i][0]);
+				}
+				else if (strcmp(&argv[i][1], "-import") == 0) {
+					pszImportFileName = strdup(&argv[++i][0]);
+				}
+				else if (strcmp(&argv[i][1], "-import-offset") == 0) {
+					importOffset = strtoull(&argv[++i][0], NULL, 10);
+				}
 				else if (argv[i][1] == 'h' || argv[i][1] == '?') {
 					printUsage();
 					return 0;
@@ -201,6 +294,21 @@ int main(int argc, char ** argv) {
 		free(pszConfigFileName);
 	}
 
+	/*
+	** Replay swaps the radio for the capture file, and
+	** we don't want to capture what we're replaying...
+	*/
+	if (pszReplayFileName != NULL) {
+		cfg.setValue("radio.backend", "replay");
+		cfg.setValue("replay.filename", pszReplayFileName);
+		cfg.setValue("replay.speed", pszReplaySpeed);
+		cfg.setValue("capture.filename", "");
+
+		free(pszReplayFileName);
+
+		isReplay = true;
+	}
+
 	if (isDumpConfig) {
         cfg.dumpConfig();
         return 0;
@@ -241,35 +349,106 @@ int main(int argc, char ** argv) {
 		exit(-1);
 	}
 
-	/*
-	 * Register signal handler for cleanup...
-	 */
-	if (signal(SIGINT, &handleSignal) == SIG_ERR) {
-		log.logFatal("Failed to register signal handler for SIGINT");
-		return -1;
+	if (isScan) {
+		int rtn = runChannelScan(numScanPasses);
+
+		log.closelogger();
+
+		return rtn;
 	}
 
-	if (signal(SIGTERM, &handleSignal) == SIG_ERR) {
-		log.logFatal("Failed to register signal handler for SIGTERM");
-		return -1;
+	if (numBenchmarkRecords > 0) {
+		int rtn = runTransformBenchmark(numBenchmarkRecords);
+
+		log.closelogger();
+
+		return rtn;
 	}
 
-	if (signal(SIGUSR1, &handleSignal) == SIG_ERR) {
-		log.logFatal("Failed to register signal handler for SIGUSR1");
-		return -1;
+	if (numBenchmarkDBRecords > 0) {
+		int rtn = runDBBenchmark(numBenchmarkDBRecords);
+
+		log.closelogger();
+
+		return rtn;
+	}
+
+	if (pszImportFileName != NULL) {
+		int rtn = runImport(pszImportFileName, importOffset);
+
+		free(pszImportFileName);
+		log.closelogger();
+
+		return rtn;
 	}
 
-	if (signal(SIGUSR2, &handleSignal) == SIG_ERR) {
-		log.logFatal("Failed to register signal handler for SIGUSR2");
+	/*
+	** Block the signals we handle before any threads start, so
+	** they all inherit the mask and the signals only ever arrive
+	** through the signalfd in our main loop...
+	*/
+	sigset_t		signals;
+	int				signalFD;
+
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	sigaddset(&signals, SIGUSR1);
+	sigaddset(&signals, SIGUSR2);
+	sigaddset(&signals, SIGHUP);
+
+	eventLoop * loop;
+
+	try {
+		signalFD = createSignalFD(&signals);
+
+		loop = new eventLoop();
+		loop->addFD(signalFD, EPOLLIN, &handleSignalEvent, loop);
+	}
+	catch (reactor_error & e) {
+		log.logFatal("Failed to set up signal handling: %s", e.what());
 		return -1;
 	}
 
 	ThreadManager & threadMgr = ThreadManager::getInstance();
-	threadMgr.start();
 
-    while (1) {
-        PosixThread::sleep(5);
-    }
+	/*
+	** Some of the threads may be running by the time one fails
+	** to start, they are stopped (and the sinks drained) before
+	** we go...
+	*/
+	try {
+		threadMgr.start();
+	}
+	catch (thread_error & e) {
+		log.logFatal("Failed to start threads: %s", e.what());
+
+		threadMgr.stop();
+		nrfdevice::getInstance().close();
+
+		delete loop;
+		close(signalFD);
+
+		log.closelogger();
+
+		return -1;
+	}
+
+	loop->addTimer(SUPERVISOR_INTERVAL_MS, true, &handleSupervisorTimer, loop);
+
+	loop->run();
+
+	puts("\n");
+
+	threadMgr.stop();
+
+	nrfdevice & radio = nrfdevice::getInstance();
+	radio.close();
+
+	delete loop;
+	close(signalFD);
+
+	log.closelogger();
 
 	return 0;
 }
@@ -0,0 +1,39 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "packet.h"
+#include "metrics.h"
+
+using namespace std;
+
+void metricsEngine::update(weather_transform_t * tr) {
+    uint64_t timestamp = tr->timestamp;
+
+    windspeed10min.add(timestamp, tr->windspeed);
+    gust10min.add(timestamp, tr->gustSpeed);
+
+    rainRecent.add(timestamp, tr->rainfall);
+    rain1h.add(timestamp, tr->rainfall);
+    rain24h.add(timestamp, tr->rainfall);
+
+    pressure3h.add(timestamp, tr->normalisedPressure);
+
+    tr->avgWindspeed10min = (float)windspeed10min.getAverage();
+    tr->maxGust10min = gust10min.getMaximum();
+
+    tr->rainfall1h = (float)rain1h.getSum();
+    tr->rainfall24h = (float)rain24h.getSum();
+    tr->rainRate = (float)(rainRecent.getSum() * (60.0 / (double)METRICS_RAIN_RATE_MINUTES));
+
+    /*
+    ** No tendency until we have 3 hours of pressure to go on...
+    */
+    double pressure3hAgo;
+
+    if (pressure3h.getOldestAverage(&pressure3hAgo)) {
+        tr->pressureTendency3h = (float)((double)tr->normalisedPressure - pressure3hAgo);
+    }
+    else {
+        tr->pressureTendency3h = 0.0f;
+    }
+}
@@ -0,0 +1,177 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "packet.h"
+
+#ifndef __INCL_METRICS
+#define __INCL_METRICS
+
+#define NANOSECONDS_PER_MINUTE              60000000000ULL
+
+/*
+** Rain rate is worked out from the last 10 minutes of rain...
+*/
+#define METRICS_RAIN_RATE_MINUTES           10
+
+/*
+** A fixed number of time buckets covering the last NumBuckets x
+** bucket width. Each new value lands in the bucket for its time,
+** moving on expires the buckets that fall out of the window and
+** takes them off the running totals, so an update is O(1) apart
+** from catching up after a quiet spell (at most NumBuckets)...
+*/
+template <int NumBuckets>
+class rollingWindow {
+    private:
+        typedef struct {
+            uint64_t            slot;
+            double              sum;
+            uint32_t            count;
+            float               maximum;
+        }
+        bucket_t;
+
+        bucket_t            buckets[NumBuckets];
+
+        uint64_t            bucketWidth;            // ns
+        uint64_t            currentSlot = 0;
+        uint64_t            firstSlot = 0;
+        bool                isStarted = false;
+
+        double              sum = 0.0;
+        uint32_t            count = 0;
+
+        void clearBucket(bucket_t & b, uint64_t slot) {
+            sum -= b.sum;
+            count -= b.count;
+
+            b.slot = slot;
+            b.sum = 0.0;
+            b.count = 0;
+            b.maximum = 0.0f;
+        }
+
+        void advance(uint64_t slot) {
+            uint64_t numSteps = slot - currentSlot;
+
+            if (numSteps > NumBuckets) {
+                numSteps = NumBuckets;
+            }
+
+            for (uint64_t i = numSteps;i > 0;i--) {
+                uint64_t s = slot - i + 1;
+
+                clearBucket(buckets[s % NumBuckets], s);
+            }
+
+            currentSlot = slot;
+        }
+
+    public:
+        rollingWindow(uint64_t bucketWidthMinutes) {
+            bucketWidth = bucketWidthMinutes * NANOSECONDS_PER_MINUTE;
+            memset(buckets, 0, sizeof(buckets));
+        }
+
+        void add(uint64_t timestamp, float value) {
+            uint64_t slot = timestamp / bucketWidth;
+
+            if (!isStarted) {
+                currentSlot = slot;
+                firstSlot = slot;
+                isStarted = true;
+
+                clearBucket(buckets[slot % NumBuckets], slot);
+            }
+            else if (slot > currentSlot) {
+                advance(slot);
+            }
+            else if (slot + NumBuckets <= currentSlot) {
+                /*
+                ** Too late to count...
+                */
+                return;
+            }
+
+            bucket_t & b = buckets[slot % NumBuckets];
+
+            if (b.count == 0 || value > b.maximum) {
+                b.maximum = value;
+            }
+
+            b.sum += value;
+            b.count++;
+
+            sum += value;
+            count++;
+        }
+
+        double getSum() {
+            return sum;
+        }
+
+        double getAverage() {
+            return (count > 0 ? sum / (double)count : 0.0);
+        }
+
+        float getMaximum() {
+            float maximum = 0.0f;
+
+            for (int i = 0;i < NumBuckets;i++) {
+                if (buckets[i].count > 0 && buckets[i].maximum > maximum) {
+                    maximum = buckets[i].maximum;
+                }
+            }
+
+            return maximum;
+        }
+
+        /*
+        ** True once we have been running for the whole window...
+        */
+        bool isFull() {
+            return (isStarted && currentSlot - firstSlot >= (uint64_t)(NumBuckets - 1));
+        }
+
+        /*
+        ** The average of the oldest bucket in the window, if
+        ** anything landed in it...
+        */
+        bool getOldestAverage(double * average) {
+            bucket_t & b = buckets[(currentSlot + 1) % NumBuckets];
+
+            if (!isFull() || b.count == 0 || b.slot + NumBuckets - 1 != currentSlot) {
+                return false;
+            }
+
+            *average = b.sum / (double)b.count;
+
+            return true;
+        }
+};
+
+/*
+** Rolling wind, rain and pressure figures for one station, worked
+** out as each packet arrives rather than by querying weather_data...
+*/
+class metricsEngine {
+    private:
+        rollingWindow<10>   windspeed10min{1};
+        rollingWindow<10>   gust10min{1};
+        rollingWindow<METRICS_RAIN_RATE_MINUTES>    rainRecent{1};
+        rollingWindow<60>   rain1h{1};
+        rollingWindow<288>  rain24h{5};
+        rollingWindow<37>   pressure3h{5};
+
+    public:
+        metricsEngine() {}
+
+        /*
+        ** Add the packet to the windows and fill in its derived
+        ** metrics. tr->timestamp must be set...
+        */
+        void update(weather_transform_t * tr);
+};
+
+#endif
@@ -0,0 +1,223 @@
+#include <span>
+#include <string>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "cfgmgr.h"
+#include "logger.h"
+#include "utils.h"
+#include "radio.h"
+#include "capture.h"
+#include "bus.h"
+#include "nrfreplay.h"
+
+using namespace std;
+
+#define NANOSECONDS_PER_MILLISECOND         1000000ULL
+
+uint64_t nrfreplay::getDueTime(const capture_record_t * record) {
+    if (speed <= 0.0 || record->timestamp < captureStartTime) {
+        return replayStartTime;
+    }
+
+    return replayStartTime + (uint64_t)((double)(record->timestamp - captureStartTime) / speed);
+}
+
+bool nrfreplay::isRecordDue(uint64_t now) {
+    if (nextRecord >= reader->getNumRecords()) {
+        return false;
+    }
+
+    return (getDueTime(reader->getRecord(nextRecord)) <= now);
+}
+
+uint32_t nrfreplay::getRoom() {
+    return readingBus::getInstance().getRoom();
+}
+
+/*
+** Returns true if cancelWait() woke us...
+*/
+bool nrfreplay::sleepUntil(uint64_t wakeup) {
+    uint64_t now = getEpochNanoseconds();
+
+    if (wakeup > now) {
+        return sleepUntilReadable(cancelFD, wakeup - now);
+    }
+
+    return false;
+}
+
+void nrfreplay::checkComplete() {
+    if (!isComplete && nextRecord >= reader->getNumRecords()) {
+        isComplete = true;
+
+        logger::getInstance().logStatus(
+                "Replay of '%s' complete, %llu packets replayed",
+                filename.c_str(),
+                (unsigned long long)packetCount);
+    }
+}
+
+void nrfreplay::open(nrfcfg & cfg) {
+    logger & log = logger::getInstance();
+    cfgmgr & config = cfgmgr::getInstance();
+
+    filename = config.getValue("replay.filename");
+    speed = config.getValueAsDouble("replay.speed");
+
+    channel = cfg.channel;
+
+    /*
+    ** Clear a cancelWait() from the last time we were stopped...
+    */
+    if (cancelFD >= 0) {
+        uint64_t count;
+
+        while (read(cancelFD, &count, sizeof(count)) < 0 && errno == EINTR);
+    }
+
+    try {
+        reader = new captureReader(filename);
+    }
+    catch (capture_error & e) {
+        throw nrf24_error(nrf24_error::buildMsg("Failed to open replay: %s", e.what()));
+    }
+
+    nextRecord = 0;
+    packetCount = 0;
+    isComplete = false;
+
+    replayStartTime = getEpochNanoseconds();
+
+    if (reader->getNumRecords() > 0) {
+        captureStartTime = reader->getRecord(0)->timestamp;
+    }
+
+    if (speed > 0.0) {
+        log.logStatus("Replaying %llu packets from '%s' at %.1fx real time", (unsigned long long)reader->getNumRecords(), filename.c_str(), speed);
+    }
+    else {
+        log.logStatus("Replaying %llu packets from '%s' as fast as possible", (unsigned long long)reader->getNumRecords(), filename.c_str());
+    }
+}
+
+void nrfreplay::close() {
+    if (reader != NULL) {
+        delete reader;
+        reader = NULL;
+    }
+}
+
+bool nrfreplay::waitForInterrupt(uint32_t timeoutMs, uint64_t * timestamp) {
+    uint64_t deadline = getEpochNanoseconds() + (uint64_t)timeoutMs * NANOSECONDS_PER_MILLISECOND;
+
+    if (nextRecord >= reader->getNumRecords()) {
+        checkComplete();
+        sleepUntil(deadline);
+        return false;
+    }
+
+    const capture_record_t * record = reader->getRecord(nextRecord);
+
+    uint64_t due = getDueTime(record);
+
+    if (due > deadline) {
+        sleepUntil(deadline);
+        return false;
+    }
+
+    if (sleepUntil(due)) {
+        return false;
+    }
+
+    /*
+    ** Due, but the sinks have no room for it yet...
+    */
+    if (getRoom() == 0) {
+        uint64_t wakeup = getEpochNanoseconds() + (uint64_t)REPLAY_BUS_WAIT_MS * NANOSECONDS_PER_MILLISECOND;
+
+        sleepUntil(wakeup < deadline ? wakeup : deadline);
+        return false;
+    }
+
+    *timestamp = record->timestamp;
+
+    return true;
+}
+
+void nrfreplay::cancelWait() {
+    uint64_t one = 1;
+
+    if (cancelFD >= 0) {
+        while (write(cancelFD, &one, sizeof(one)) < 0 && errno == EINTR);
+    }
+}
+
+bool nrfreplay::isDataReady() {
+    return (isRecordDue(getEpochNanoseconds()) && getRoom() > 0);
+}
+
+uint8_t * nrfreplay::readPayload() {
+    static uint8_t rxBuffer[NRF24L01_MAXIMUM_PACKET_LEN];
+
+    memset(rxBuffer, 0, NRF24L01_MAXIMUM_PACKET_LEN);
+
+    if (nextRecord < reader->getNumRecords()) {
+        const capture_record_t * record = reader->getRecord(nextRecord++);
+
+        /*
+        ** The length byte is whatever was in the file...
+        */
+        int length = (record->length <= NRF24L01_MAXIMUM_PACKET_LEN ? record->length : NRF24L01_MAXIMUM_PACKET_LEN);
+
+        memcpy(rxBuffer, record->payload, length);
+        packetCount++;
+    }
+
+    checkComplete();
+
+    return rxBuffer;
+}
+
+span<nrf_payload_t> nrfreplay::readAllPayloads(span<nrf_payload_t> buffer) {
+    size_t numPayloads = 0;
+
+    /*
+    ** Each payload is at most one reading on each queue...
+    */
+    size_t maxPayloads = getRoom();
+
+    if (maxPayloads > buffer.size()) {
+        maxPayloads = buffer.size();
+    }
+
+    uint64_t now = getEpochNanoseconds();
+
+    while (numPayloads < maxPayloads && isRecordDue(now)) {
+        const capture_record_t * record = reader->getRecord(nextRecord++);
+
+        nrf_payload_t & payload = buffer[numPayloads++];
+
+        int length = (record->length <= NRF24L01_MAXIMUM_PACKET_LEN ? record->length : NRF24L01_MAXIMUM_PACKET_LEN);
+
+        memcpy(payload.data, record->payload, length);
+        memset(&payload.data[length], 0, NRF24L01_MAXIMUM_PACKET_LEN - length);
+
+        payload.length = length;
+        payload.pipe = record->pipe;
+        payload.timestamp = record->timestamp;
+    }
+
+    packetCount += numPayloads;
+
+    checkComplete();
+
+    return buffer.first(numPayloads);
+}
@@ -0,0 +1,114 @@
+#include <span>
+#include <string>
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "radio.h"
+#include "capture.h"
+
+using namespace std;
+
+#ifndef __INCL_NRFREPLAY
+#define __INCL_NRFREPLAY
+
+/*
+** While the sinks' queues are full, how often we look again...
+*/
+#define REPLAY_BUS_WAIT_MS                  10
+
+/*
+** Plays a capture file (capture.h) back through the radio
+** interface, either as fast as the pipeline will take it
+** (replay.speed=0) or at a multiple of real time. Nothing is
+** read while the fullest of the sinks' queues has no room, so
+** the sinks hold us back rather than drop what we replay...
+*/
+class nrfreplay : public nrfdevice {
+    public:
+        static nrfreplay & getInstance() {
+            static nrfreplay replay;
+            return replay;
+        }
+
+    private:
+        captureReader *     reader = NULL;
+        string              filename;
+
+        uint64_t            nextRecord = 0;
+        double              speed = 0.0;
+
+        uint64_t            replayStartTime = 0;
+        uint64_t            captureStartTime = 0;
+
+        uint64_t            packetCount = 0;
+        bool                isComplete = false;
+        int                 channel = 0;
+
+        /*
+        ** Readable once cancelWait() has been called...
+        */
+        int                 cancelFD = -1;
+
+        nrfreplay() {
+            cancelFD = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        }
+
+        uint64_t getDueTime(const capture_record_t * record);
+        bool isRecordDue(uint64_t now);
+        uint32_t getRoom();
+        bool sleepUntil(uint64_t wakeup);
+        void checkComplete();
+
+    public:
+        ~nrfreplay() {
+            if (cancelFD >= 0) {
+                ::close(cancelFD);
+            }
+        }
+
+        void open(nrfcfg & cfg) override;
+        void close() override;
+
+        bool isIRQEnabled() override {
+            return true;
+        }
+
+        bool waitForInterrupt(uint32_t timeoutMs, uint64_t * timestamp) override;
+        void cancelWait() override;
+
+        bool isDataReady() override;
+        uint8_t * readPayload() override;
+        span<nrf_payload_t> readAllPayloads(span<nrf_payload_t> buffer) override;
+
+        double getSPITransactionsPerPacket() override {
+            return 0.0;
+        }
+
+        /*
+        ** There is no air to listen to...
+        */
+        void setChannel(int channel) override {
+            this->channel = channel;
+        }
+
+        int getChannel() override {
+            return channel;
+        }
+
+        bool isCarrierDetected() override {
+            return false;
+        }
+
+        /*
+        ** Every record has been read, main() stops once it
+        ** sees this...
+        */
+        bool isReplayComplete() {
+            return isComplete;
+        }
+};
+
+#endif
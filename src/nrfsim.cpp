@@ -0,0 +1,673 @@
+#include <span>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "cfgmgr.h"
+#include "logger.h"
+#include "utils.h"
+#include "radio.h"
+#include "packet.h"
+#include "schema.h"
+#include "nrfsim.h"
+
+using namespace std;
+
+#define NANOSECONDS_PER_SECOND              1000000000ULL
+#define NANOSECONDS_PER_MILLISECOND         1000000ULL
+
+#define NRF24L01_STATUS_RX_P_NO_EMPTY       0x07
+
+/*
+** An 802.11b/g/n channel is ~22MHz wide, centred on 2407 + 5n MHz,
+** nRF24L01 channel n is at 2400 + n MHz...
+*/
+#define WIFI_HALF_BANDWIDTH_MHZ             11
+#define WIFI_MAX_CHANNEL                    13
+
+/*
+** The chance of RPD firing with nothing but background noise...
+*/
+#define RPD_BACKGROUND_PROBABILITY          0.02
+
+/*
+** Reset values from the nRF24L01+ datasheet...
+*/
+static const uint8_t _resetRegisters[NRF24L01_NUM_REGISTERS] = {
+    0x08, 0x3F, 0x03, 0x03, 0x03, 0x02, 0x0F, 0x0E,
+    0x00, 0x00, 0x00, 0x00, 0xC3, 0xC4, 0xC5, 0xC6,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x11,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+void nrfsim::resetRegisters() {
+    memcpy(registers, _resetRegisters, NRF24L01_NUM_REGISTERS);
+
+    memset(rxAddressP0, 0xE7, NRF24L01_ADDRESS_LEN);
+    memset(rxAddressP1, 0xC2, NRF24L01_ADDRESS_LEN);
+    memset(txAddress, 0xE7, NRF24L01_ADDRESS_LEN);
+
+    rxFIFOHead = 0;
+    rxFIFOCount = 0;
+}
+
+uint8_t nrfsim::getStatusRegister() {
+    uint8_t status = registers[NRF24L01_REG_STATUS] & 0x70;
+
+    if (rxFIFOCount > 0) {
+        status |= (uint8_t)(rxFIFO[rxFIFOHead].pipe << 1);
+    }
+    else {
+        status |= (NRF24L01_STATUS_RX_P_NO_EMPTY << 1);
+    }
+
+    return status;
+}
+
+uint8_t nrfsim::getFIFOStatusRegister() {
+    uint8_t fifoStatus = NRF24L01_FIFO_STATUS_TX_EMPTY;
+
+    if (rxFIFOCount == 0) {
+        fifoStatus |= NRF24L01_FIFO_STATUS_RX_EMPTY;
+    }
+    else if (rxFIFOCount == NRF24L01_RX_FIFO_DEPTH) {
+        fifoStatus |= NRF24L01_FIFO_STATUS_RX_FULL;
+    }
+
+    return fifoStatus;
+}
+
+uint8_t * nrfsim::getAddressRegister(int registerID) {
+    switch (registerID) {
+        case NRF24L01_REG_RX_ADDR_PO:
+            return rxAddressP0;
+
+        case NRF24L01_REG_RX_ADDR_P1:
+            return rxAddressP1;
+
+        case NRF24L01_REG_TX_ADDR:
+            return txAddress;
+    }
+
+    return NULL;
+}
+
+/*
+** Emulate a single SPI transaction (one CSN low/high cycle),
+** STATUS is always clocked out as the first byte...
+*/
+int nrfsim::transfer(const uint8_t * txBuffer, uint8_t * rxBuffer, int count) {
+    spiTransactionCount++;
+
+    pump(getEpochNanoseconds());
+
+    uint8_t command = txBuffer[0];
+
+    rxBuffer[0] = getStatusRegister();
+
+    if ((command & 0xE0) == NRF24L01_CMD_R_REGISTER) {
+        int registerID = command & 0x1F;
+
+        uint8_t * address = getAddressRegister(registerID);
+
+        for (int i = 1;i < count;i++) {
+            if (address != NULL) {
+                rxBuffer[i] = (i <= NRF24L01_ADDRESS_LEN) ? address[i - 1] : 0;
+            }
+            else if (registerID == NRF24L01_REG_STATUS) {
+                rxBuffer[i] = getStatusRegister();
+            }
+            else if (registerID == NRF24L01_REG_FIFO_STATUS) {
+                rxBuffer[i] = getFIFOStatusRegister();
+            }
+            else if (registerID < NRF24L01_NUM_REGISTERS) {
+                rxBuffer[i] = registers[registerID];
+            }
+            else {
+                rxBuffer[i] = 0;
+            }
+        }
+    }
+    else if ((command & 0xE0) == NRF24L01_CMD_W_REGISTER) {
+        int registerID = command & 0x1F;
+
+        uint8_t * address = getAddressRegister(registerID);
+
+        if (address != NULL) {
+            for (int i = 1;i < count && i <= NRF24L01_ADDRESS_LEN;i++) {
+                address[i - 1] = txBuffer[i];
+            }
+        }
+        else if (count > 1) {
+            if (registerID == NRF24L01_REG_STATUS) {
+                /*
+                ** Interrupt flags are cleared by writing 1...
+                */
+                registers[NRF24L01_REG_STATUS] &= ~(txBuffer[1] & 0x70);
+            }
+            else if (registerID != NRF24L01_REG_FIFO_STATUS && registerID < NRF24L01_NUM_REGISTERS) {
+                registers[registerID] = txBuffer[1];
+            }
+        }
+
+        for (int i = 1;i < count;i++) {
+            rxBuffer[i] = 0;
+        }
+    }
+    else {
+        for (int i = 1;i < count;i++) {
+            rxBuffer[i] = 0;
+        }
+
+        switch (command) {
+            case NRF24L01_CMD_R_RX_PAYLOAD:
+                if (rxFIFOCount > 0) {
+                    int length = count - 1;
+
+                    if (length > NRF24L01_MAXIMUM_PACKET_LEN) {
+                        length = NRF24L01_MAXIMUM_PACKET_LEN;
+                    }
+
+                    memcpy(&rxBuffer[1], rxFIFO[rxFIFOHead].data, length);
+
+                    /*
+                    ** The arrival time isn't visible over SPI, keep
+                    ** it to one side for readAllPayloads()...
+                    */
+                    lastPayloadTimestamp = rxFIFO[rxFIFOHead].timestamp;
+
+                    rxFIFOHead = (rxFIFOHead + 1) % NRF24L01_RX_FIFO_DEPTH;
+                    rxFIFOCount--;
+                }
+                break;
+
+            case NRF24L01_CMD_R_RX_PL_WID:
+                if (count > 1 && rxFIFOCount > 0) {
+                    rxBuffer[1] = (uint8_t)nrfConfig.payloadLength;
+                }
+                break;
+
+            case NRF24L01_CMD_FLUSH_RX:
+                rxFIFOHead = 0;
+                rxFIFOCount = 0;
+                break;
+
+            default:
+                break;
+        }
+    }
+
+    return count;
+}
+
+void nrfsim::scheduleNext(traffic_stream_t * stream, uint64_t from) {
+    if (stream->rate <= 0.0) {
+        stream->nextDue = UINT64_MAX;
+        return;
+    }
+
+    double periodNs = (double)NANOSECONDS_PER_SECOND / stream->rate;
+    double jitterNs = (erand48(randomState) * 2.0 - 1.0) * jitterMs * (double)NANOSECONDS_PER_MILLISECOND;
+
+    double delayNs = periodNs + jitterNs;
+
+    if (delayNs < 0.0) {
+        delayNs = 0.0;
+    }
+
+    stream->nextDue = from + (uint64_t)delayNs;
+}
+
+uint64_t nrfsim::getNextArrival() {
+    uint64_t next = UINT64_MAX;
+
+    for (int i = 0;i < NRFSIM_NUM_STREAMS;i++) {
+        if (streams[i].nextDue < next) {
+            next = streams[i].nextDue;
+        }
+    }
+
+    return next;
+}
+
+/*
+** Build packets with the same schema the decoder uses, so the
+** simulator can't drift from the wire format...
+*/
+void nrfsim::buildPacket(uint8_t packetID, sim_station_t * stn, uint8_t * payload) {
+    memset(payload, 0, NRF24L01_MAXIMUM_PACKET_LEN);
+
+    if (packetID == PACKET_ID_WEATHER) {
+        typedef weather_schema w;
+
+        /*
+        ** Every weather packet the station sends uses up a packet
+        ** number, whether or not we manage to receive it...
+        */
+        stn->packetNum = (stn->packetNum + 1) & 0x00FFFFFF;
+
+        stn->temperature += (erand48(randomState) - 0.5) * 0.2;
+        stn->humidity += (erand48(randomState) - 0.5) * 0.5;
+        stn->pressure += (erand48(randomState) - 0.5) * 10.0;
+
+        if (stn->humidity < 20.0) {
+            stn->humidity = 20.0;
+        }
+        else if (stn->humidity > 100.0) {
+            stn->humidity = 100.0;
+        }
+
+        w::id::encode(payload, PACKET_ID_WEATHER);
+        w::packetNum::encode(payload, stn->packetNum);
+        w::status::encode(payload, 0x00);
+
+        w::batteryPercentage::encode(payload, 85.0);
+        w::batteryChargeRate::encode(payload, (erand48(randomState) - 0.5) * 20.0);
+        w::batteryVolts::encode(payload, stn->batteryVolts);
+
+        w::temperature::encode(payload, stn->temperature);
+        w::rawPressure::encode(payload, (uint32_t)lround(stn->pressure));
+        w::humidity::encode(payload, stn->humidity);
+
+        uint32_t rawWindspeed = (uint32_t)(erand48(randomState) * 2000.0);
+
+        w::rainfall::field::encode(payload, (erand48(randomState) < 0.1) ? (uint32_t)(erand48(randomState) * 4.0) : 0);
+        w::rawWindspeed::encode(payload, rawWindspeed);
+        w::rawWindGust::encode(payload, rawWindspeed + (uint32_t)(erand48(randomState) * 1000.0));
+    }
+    else if (packetID == PACKET_ID_SLEEP) {
+        typedef sleep_schema sl;
+
+        sl::id::encode(payload, PACKET_ID_SLEEP);
+        sl::status::encode(payload, 0x0000);
+        sl::sleepHours::encode(payload, 1);
+        sl::batteryVolts::encode(payload, stn->batteryVolts);
+        sl::batteryPercentage::encode(payload, 85.0);
+    }
+    else {
+        watchdog_schema::id::encode(payload, PACKET_ID_WATCHDOG);
+        watchdog_schema::status::encode(payload, 0x0000);
+    }
+}
+
+void nrfsim::receivePacket(uint8_t * payload, int pipe, uint64_t timestamp) {
+    /*
+    ** Like the real thing, a packet that arrives to a full
+    ** RX FIFO is lost...
+    */
+    if (rxFIFOCount == NRF24L01_RX_FIFO_DEPTH) {
+        overflowCount++;
+        return;
+    }
+
+    int tail = (rxFIFOHead + rxFIFOCount) % NRF24L01_RX_FIFO_DEPTH;
+
+    memcpy(rxFIFO[tail].data, payload, NRF24L01_MAXIMUM_PACKET_LEN);
+    rxFIFO[tail].pipe = pipe;
+    rxFIFO[tail].timestamp = timestamp;
+
+    rxFIFOCount++;
+
+    if ((registers[NRF24L01_REG_STATUS] & NRF24L01_STATUS_R_RX_DR) == 0) {
+        registers[NRF24L01_REG_STATUS] |= NRF24L01_STATUS_R_RX_DR;
+        irqTimestamp = timestamp;
+    }
+}
+
+/*
+** Deliver every packet due up to 'now', oldest first...
+*/
+void nrfsim::pump(uint64_t now) {
+    uint8_t payload[NRF24L01_MAXIMUM_PACKET_LEN];
+
+    if (!isOpen) {
+        return;
+    }
+
+    while (true) {
+        traffic_stream_t * next = NULL;
+
+        for (int i = 0;i < NRFSIM_NUM_STREAMS;i++) {
+            if (streams[i].nextDue <= now && (next == NULL || streams[i].nextDue < next->nextDue)) {
+                next = &streams[i];
+            }
+        }
+
+        if (next == NULL) {
+            break;
+        }
+
+        uint64_t arrival = next->nextDue;
+
+        /*
+        ** Each packet comes from a randomly chosen station,
+        ** station N transmits to RX pipe N...
+        */
+        int pipe = (int)(erand48(randomState) * (double)numStations);
+
+        if (pipe >= numStations) {
+            pipe = numStations - 1;
+        }
+
+        buildPacket(next->packetID, &stations[pipe], payload);
+        next->numSent++;
+
+        if (erand48(randomState) < lossRate) {
+            next->numLost++;
+        }
+        else if (isWiFiOverlap(getChannel()) && isWiFiTransmitting()) {
+            next->numLost++;
+            numInterferenceLost++;
+        }
+        else {
+            receivePacket(payload, pipe, arrival);
+        }
+
+        scheduleNext(next, arrival);
+    }
+}
+
+bool nrfsim::isWiFiOverlap(int channel) {
+    if (wifiChannel < 1 || wifiChannel > WIFI_MAX_CHANNEL) {
+        return false;
+    }
+
+    int offsetMHz = (2400 + channel) - (2407 + 5 * wifiChannel);
+
+    return (offsetMHz >= -WIFI_HALF_BANDWIDTH_MHZ && offsetMHz <= WIFI_HALF_BANDWIDTH_MHZ);
+}
+
+bool nrfsim::isWiFiTransmitting() {
+    return (erand48(randomState) < wifiDutyCycle);
+}
+
+void nrfsim::setChannel(int channel) {
+    uint8_t txBuffer[2];
+    uint8_t rxBuffer[2];
+
+    txBuffer[0] = NRF24L01_CMD_W_REGISTER | NRF24L01_REG_RF_CH;
+    txBuffer[1] = (uint8_t)channel;
+
+    transfer(txBuffer, rxBuffer, 2);
+}
+
+bool nrfsim::isCarrierDetected() {
+    uint8_t txBuffer[2];
+    uint8_t rxBuffer[2];
+
+    txBuffer[0] = NRF24L01_CMD_R_REGISTER | NRF24L01_REG_CD;
+    txBuffer[1] = 0;
+
+    transfer(txBuffer, rxBuffer, 2);
+
+    if (isWiFiOverlap(getChannel()) && isWiFiTransmitting()) {
+        return true;
+    }
+
+    return (erand48(randomState) < RPD_BACKGROUND_PROBABILITY);
+}
+
+void nrfsim::open(nrfcfg & cfg) {
+    logger & log = logger::getInstance();
+    cfgmgr & config = cfgmgr::getInstance();
+
+    if (!cfg.isValidated) {
+        throw nrf24_error("Error, radio has not been configured or the configuartion is invalid");
+    }
+
+    nrfConfig = cfg;
+
+    /*
+    ** Clear a cancelWait() from the last time we were stopped...
+    */
+    if (cancelFD >= 0) {
+        uint64_t count;
+
+        while (read(cancelFD, &count, sizeof(count)) < 0 && errno == EINTR);
+    }
+
+    /*
+    ** The simulated station always sends full length packets...
+    */
+    if (nrfConfig.payloadLength == 0) {
+        nrfConfig.payloadLength = NRF24L01_MAXIMUM_PACKET_LEN;
+    }
+
+    resetRegisters();
+
+    isIRQMode = (cfg.irqPin != NRF_IRQ_PIN_NONE);
+
+    jitterMs = config.getValueAsDouble("sim.jitter");
+    lossRate = config.getValueAsDouble("sim.loss");
+
+    wifiChannel = config.getValueAsInteger("sim.wifichannel");
+    wifiDutyCycle = config.getValueAsDouble("sim.wifiduty");
+    numInterferenceLost = 0;
+
+    uint32_t seed = config.getValueAsLongUnsignedInteger("sim.seed");
+
+    randomState[0] = 0x330E;
+    randomState[1] = (unsigned short)(seed & 0xFFFF);
+    randomState[2] = (unsigned short)((seed >> 16) & 0xFFFF);
+
+    numStations = config.getValueAsInteger("sim.stations");
+
+    if (numStations < 1) {
+        numStations = 1;
+    }
+    else if (numStations > NRF24L01_NUM_RX_PIPES) {
+        numStations = NRF24L01_NUM_RX_PIPES;
+    }
+
+    for (int i = 0;i < numStations;i++) {
+        stations[i].packetNum = 0;
+        stations[i].temperature = 12.0 + (double)i;
+        stations[i].humidity = 70.0;
+        stations[i].pressure = 101325.0 - (double)i * 120.0;
+        stations[i].batteryVolts = 4.0;
+    }
+
+    streams[0].packetID = PACKET_ID_WEATHER;
+    streams[0].rate = config.getValueAsDouble("sim.weatherrate");
+    streams[1].packetID = PACKET_ID_SLEEP;
+    streams[1].rate = config.getValueAsDouble("sim.sleeprate");
+    streams[2].packetID = PACKET_ID_WATCHDOG;
+    streams[2].rate = config.getValueAsDouble("sim.watchdograte");
+
+    uint64_t now = getEpochNanoseconds();
+
+    for (int i = 0;i < NRFSIM_NUM_STREAMS;i++) {
+        streams[i].numSent = 0;
+        streams[i].numLost = 0;
+
+        scheduleNext(&streams[i], now);
+    }
+
+    log.logInfo(
+        "Opened simulated nRF24L01: %d station(s), weather %.3f/s, sleep %.3f/s, watchdog %.3f/s, jitter %.1fms, loss %.1f%%",
+        numStations,
+        streams[0].rate,
+        streams[1].rate,
+        streams[2].rate,
+        jitterMs,
+        lossRate * 100.0);
+
+    isOpen = true;
+
+    /*
+    ** Run through the same register setup as the driver,
+    ** so the register file looks like a configured radio...
+    */
+    uint8_t txBuffer[2];
+    uint8_t rxBuffer[2];
+
+    txBuffer[0] = NRF24L01_CMD_W_REGISTER | NRF24L01_REG_RF_CH;
+    txBuffer[1] = (uint8_t)cfg.channel;
+    transfer(txBuffer, rxBuffer, 2);
+
+    txBuffer[0] = NRF24L01_CMD_W_REGISTER | NRF24L01_REG_RX_PW_P0;
+    txBuffer[1] = (uint8_t)cfg.payloadLength;
+    transfer(txBuffer, rxBuffer, 2);
+
+    txBuffer[0] = NRF24L01_CMD_W_REGISTER | NRF24L01_REG_CONFIG;
+    txBuffer[1] =
+            NRF24L01_CFG_ENABLE_CRC |
+            NRF24L01_CFG_CRC_2_BYTE |
+            NRF24L01_CFG_POWER_UP |
+            NRF24L01_CFG_MODE_RX;
+    transfer(txBuffer, rxBuffer, 2);
+}
+
+void nrfsim::close() {
+    logger & log = logger::getInstance();
+
+    if (!isOpen) {
+        return;
+    }
+
+    isOpen = false;
+
+    for (int i = 0;i < NRFSIM_NUM_STREAMS;i++) {
+        log.logStatus(
+            "Simulated stream 0x%02X: sent %llu, lost %llu",
+            streams[i].packetID,
+            (unsigned long long)streams[i].numSent,
+            (unsigned long long)streams[i].numLost);
+    }
+
+    log.logStatus(
+        "Simulated radio: read %llu packets, %llu lost to RX FIFO overflow, %llu to Wi-Fi, %.2f SPI transactions per packet",
+        (unsigned long long)packetCount,
+        (unsigned long long)overflowCount,
+        (unsigned long long)numInterferenceLost,
+        getSPITransactionsPerPacket());
+}
+
+bool nrfsim::waitForInterrupt(uint32_t timeoutMs, uint64_t * timestamp) {
+    uint64_t now = getEpochNanoseconds();
+    uint64_t deadline = now + (uint64_t)timeoutMs * NANOSECONDS_PER_MILLISECOND;
+
+    while (true) {
+        pump(now);
+
+        if (registers[NRF24L01_REG_STATUS] & NRF24L01_STATUS_R_RX_DR) {
+            *timestamp = irqTimestamp;
+            return true;
+        }
+
+        if (now >= deadline) {
+            return false;
+        }
+
+        uint64_t wakeup = getNextArrival();
+
+        if (wakeup > deadline) {
+            wakeup = deadline;
+        }
+
+        if (wakeup > now && sleepUntilReadable(cancelFD, wakeup - now)) {
+            return false;
+        }
+
+        now = getEpochNanoseconds();
+    }
+}
+
+void nrfsim::cancelWait() {
+    uint64_t one = 1;
+
+    if (cancelFD >= 0) {
+        while (write(cancelFD, &one, sizeof(one)) < 0 && errno == EINTR);
+    }
+}
+
+bool nrfsim::isDataReady() {
+    uint8_t txBuffer[2];
+    uint8_t rxBuffer[2];
+
+    txBuffer[0] = NRF24L01_CMD_R_REGISTER | NRF24L01_REG_FIFO_STATUS;
+    txBuffer[1] = 0;
+
+    transfer(txBuffer, rxBuffer, 2);
+
+    if (rxBuffer[0] & NRF24L01_STATUS_R_RX_DR) {
+        return true;
+    }
+
+    return ((rxBuffer[1] & NRF24L01_FIFO_STATUS_RX_EMPTY) ? false : true);
+}
+
+uint8_t * nrfsim::readPayload() {
+    static uint8_t  rxBuffer[NRF24L01_MAXIMUM_PACKET_LEN + 1];
+    uint8_t         txBuffer[NRF24L01_MAXIMUM_PACKET_LEN + 1];
+    uint8_t         statusBuffer[2];
+
+    memset(txBuffer, 0, sizeof(txBuffer));
+
+    txBuffer[0] = NRF24L01_CMD_R_RX_PAYLOAD;
+    transfer(txBuffer, rxBuffer, nrfConfig.payloadLength + 1);
+
+    txBuffer[0] = NRF24L01_CMD_W_REGISTER | NRF24L01_REG_STATUS;
+    txBuffer[1] = NRF24L01_STATUS_CLEAR_RX_DR;
+    transfer(txBuffer, statusBuffer, 2);
+
+    packetCount++;
+
+    return &rxBuffer[1];
+}
+
+span<nrf_payload_t> nrfsim::readAllPayloads(span<nrf_payload_t> buffer) {
+    uint8_t     txBuffer[NRF24L01_MAXIMUM_PACKET_LEN + 1];
+    uint8_t     rxBuffer[NRF24L01_MAXIMUM_PACKET_LEN + 1];
+    size_t      numPayloads = 0;
+    bool        isRxDRCleared = false;
+    int         length = nrfConfig.payloadLength;
+
+    memset(txBuffer, 0, sizeof(txBuffer));
+
+    /*
+    ** The same sequence as nrf24l01::readAllPayloads()...
+    */
+    while (numPayloads < buffer.size()) {
+        txBuffer[0] = NRF24L01_CMD_R_RX_PAYLOAD;
+        transfer(txBuffer, rxBuffer, length + 1);
+
+        if ((rxBuffer[0] & NRF24L01_STATUS_R_RX_P_NO_MASK) != NRF24L01_STATUS_R_RX_FIFO_EMPTY) {
+            nrf_payload_t & payload = buffer[numPayloads++];
+
+            memcpy(payload.data, &rxBuffer[1], length);
+
+            payload.length = length;
+            payload.pipe = (rxBuffer[0] & NRF24L01_STATUS_R_RX_P_NO_MASK) >> 1;
+            payload.timestamp = lastPayloadTimestamp;
+
+            isRxDRCleared = false;
+            continue;
+        }
+
+        if (isRxDRCleared) {
+            break;
+        }
+
+        txBuffer[0] = NRF24L01_CMD_W_REGISTER | NRF24L01_REG_STATUS;
+        txBuffer[1] = NRF24L01_STATUS_CLEAR_RX_DR;
+        transfer(txBuffer, rxBuffer, 2);
+
+        txBuffer[1] = 0;
+        isRxDRCleared = true;
+
+        if ((rxBuffer[0] & NRF24L01_STATUS_R_RX_P_NO_MASK) == NRF24L01_STATUS_R_RX_FIFO_EMPTY) {
+            break;
+        }
+    }
+
+    packetCount += numPayloads;
+
+    return buffer.first(numPayloads);
+}
@@ -0,0 +1,171 @@
+#include <span>
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "radio.h"
+#include "packet.h"
+
+using namespace std;
+
+#ifndef __INCL_NRFSIM
+#define __INCL_NRFSIM
+
+#define NRFSIM_NUM_STREAMS                          3
+
+/*
+** A simulated nRF24L01 in RX mode. The register file, STATUS and
+** FIFO_STATUS semantics and the three deep RX FIFO are emulated at
+** the SPI command level, and a set of traffic streams play the part
+** of the weather station, generating weather, sleep and watchdog
+** packets at the rates, jitter and loss given by the sim.* config
+** values. With sim.stations > 1, each packet comes from one of that
+** many stations, on RX pipes 0 upwards. Packets arrive in real time, so the whole ingest pipeline
+** can be run and stress tested without a Raspberry Pi...
+*/
+class nrfsim : public nrfdevice {
+    public:
+        static nrfsim & getInstance() {
+            static nrfsim sim;
+            return sim;
+        }
+
+    private:
+        typedef struct {
+            uint8_t             packetID;
+            double              rate;                   // Packets per second
+            uint64_t            nextDue;                // ns since the epoch
+            uint64_t            numSent;
+            uint64_t            numLost;
+        }
+        traffic_stream_t;
+
+        /*
+        ** Simulated station state...
+        */
+        typedef struct {
+            uint32_t            packetNum;
+            double              temperature;
+            double              humidity;
+            double              pressure;
+            double              batteryVolts;
+        }
+        sim_station_t;
+
+        typedef struct {
+            uint8_t             data[NRF24L01_MAXIMUM_PACKET_LEN];
+            int                 pipe;
+            uint64_t            timestamp;
+        }
+        fifo_entry_t;
+
+        nrfcfg              nrfConfig;
+
+        bool                isOpen = false;
+        bool                isIRQMode = false;
+
+        /*
+        ** Readable once cancelWait() has been called...
+        */
+        int                 cancelFD = -1;
+
+        uint8_t             registers[NRF24L01_NUM_REGISTERS];
+        uint8_t             rxAddressP0[NRF24L01_ADDRESS_LEN];
+        uint8_t             rxAddressP1[NRF24L01_ADDRESS_LEN];
+        uint8_t             txAddress[NRF24L01_ADDRESS_LEN];
+
+        fifo_entry_t        rxFIFO[NRF24L01_RX_FIFO_DEPTH];
+        int                 rxFIFOHead = 0;
+        int                 rxFIFOCount = 0;
+
+        /*
+        ** Arrival time of the packet that set RX_DR...
+        */
+        uint64_t            irqTimestamp = 0;
+        uint64_t            lastPayloadTimestamp = 0;
+
+        traffic_stream_t    streams[NRFSIM_NUM_STREAMS];
+        double              jitterMs = 0.0;
+        double              lossRate = 0.0;
+
+        /*
+        ** A Wi-Fi network (2.4GHz channel 1 - 13) busy for the
+        ** given fraction of the time, anything we receive on an
+        ** overlapping channel is lost while it is transmitting...
+        */
+        int                 wifiChannel = 0;
+        double              wifiDutyCycle = 0.0;
+        uint64_t            numInterferenceLost = 0;
+        unsigned short      randomState[3];
+
+        sim_station_t       stations[NRF24L01_NUM_RX_PIPES];
+        int                 numStations = 1;
+
+        uint64_t            spiTransactionCount = 0;
+        uint64_t            packetCount = 0;
+        uint64_t            overflowCount = 0;
+
+        nrfsim() {
+            cancelFD = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        }
+
+        void resetRegisters();
+
+        uint8_t getStatusRegister();
+        uint8_t getFIFOStatusRegister();
+
+        uint8_t * getAddressRegister(int registerID);
+
+        int transfer(const uint8_t * txBuffer, uint8_t * rxBuffer, int count);
+
+        void scheduleNext(traffic_stream_t * stream, uint64_t from);
+        uint64_t getNextArrival();
+        void pump(uint64_t now);
+
+        void buildPacket(uint8_t packetID, sim_station_t * stn, uint8_t * payload);
+        void receivePacket(uint8_t * payload, int pipe, uint64_t timestamp);
+
+        bool isWiFiOverlap(int channel);
+        bool isWiFiTransmitting();
+
+    public:
+        ~nrfsim() {
+            if (cancelFD >= 0) {
+                ::close(cancelFD);
+            }
+        }
+
+        void open(nrfcfg & cfg) override;
+        void close() override;
+
+        bool isIRQEnabled() override {
+            return isIRQMode;
+        }
+
+        bool waitForInterrupt(uint32_t timeoutMs, uint64_t * timestamp) override;
+        void cancelWait() override;
+
+        bool isDataReady() override;
+        uint8_t * readPayload() override;
+        span<nrf_payload_t> readAllPayloads(span<nrf_payload_t> buffer) override;
+
+        double getSPITransactionsPerPacket() override {
+            return (packetCount > 0 ? (double)spiTransactionCount / (double)packetCount : 0.0);
+        }
+
+        /*
+        ** The simulated stations are assumed to follow us
+        ** to whichever channel we move to...
+        */
+        void setChannel(int channel) override;
+
+        int getChannel() override {
+            return (int)registers[NRF24L01_REG_RF_CH];
+        }
+
+        bool isCarrierDetected() override;
+};
+
+#endif
@@ -10,6 +10,10 @@
 
 #define PACKET_ID_UNKNOWN                           0x00
 
+/*
+** Layouts for reference, the decoder and simulator use the
+** schema in schema.h, which is checked against these...
+*/
 #pragma pack(push, 1)
 typedef struct {                                    // O/S  - Description
                                                     // ----   ---------------------------------
@@ -63,6 +67,9 @@ watchdog_packet_t;
 #pragma pack(pop)
 
 typedef struct {
+    uint64_t            timestamp;                  // Receive time, ns since the epoch
+    uint32_t            stationID;
+    int32_t             pipe;
     uint32_t            packetNum;
     
     float               batteryVoltage;
@@ -81,6 +88,19 @@ typedef struct {
     float               gustSpeed;
     float               windSpeedms;
     float               gustSpeedms;
+
+    float               packetLossRate;             // % of recent packets lost
+    uint32_t            longestGap;                 // Most consecutive packets lost
+
+    /*
+    ** Rolling figures, see metrics.h...
+    */
+    float               avgWindspeed10min;          // mph
+    float               maxGust10min;               // mph
+    float               rainfall1h;                 // mm
+    float               rainfall24h;                // mm
+    float               rainRate;                   // mm/h
+    float               pressureTendency3h;         // hPa, change over the last 3 hours
 }
 weather_transform_t;
 
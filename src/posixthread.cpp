@@ -1,7 +1,17 @@
+#include <stdio.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
 #include <pthread.h>
 #include <signal.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#include <cxxabi.h>
 
 #include "logger.h"
 #include "posixthread.h"
@@ -11,28 +21,207 @@ static void * _threadRunner(void * pThreadArgs) {
 
 	PosixThread * pThread = (PosixThread *)pThreadArgs;
 
-	logger & log = logger::getInstance();
+	pthread_setname_np(pthread_self(), pThread->getName());
+
+	pThread->applySchedulingProfile();
+
+	while (pThread->runOnce(&pThreadRtn));
+
+	pThread->setState(PosixThread::thread_stopped);
+
+	return pThreadRtn;
+}
+
+PosixThread::PosixThread(const char * name) {
+	this->name = name;
+
+	memset(&schedProfile, 0, sizeof(schedProfile));
+
+	stopFD = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+}
+
+PosixThread::~PosixThread() {
+	if (stopFD >= 0) {
+		close(stopFD);
+	}
+}
+
+uint64_t PosixThread::getMonotonicMs() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ((uint64_t)ts.tv_sec * 1000ULL) + ((uint64_t)ts.tv_nsec / 1000000ULL);
+}
+
+uint32_t PosixThread::getBackoffMs() {
+	uint64_t backoffMs = THREAD_BACKOFF_INITIAL_MS;
+
+	for (uint32_t i = 1;i < numConsecutiveFailures && backoffMs < THREAD_BACKOFF_MAX_MS;i++) {
+		backoffMs *= 2;
+	}
+
+	if (backoffMs > THREAD_BACKOFF_MAX_MS) {
+		backoffMs = THREAD_BACKOFF_MAX_MS;
+	}
+
+	/*
+	** So threads that fail together don't come back together...
+	*/
+	uint64_t jitterMs = (backoffMs * THREAD_BACKOFF_JITTER_PERCENT) / 100U;
+
+	if (jitterMs > 0) {
+		backoffMs = backoffMs - jitterMs + ((uint64_t)random() % (jitterMs * 2 + 1));
+	}
+
+	return (uint32_t)backoffMs;
+}
+
+/*
+** Wait out the backoff if this is a restart, call run() once, and
+** return true if it should be called again...
+*/
+bool PosixThread::runOnce(void ** pThreadRtn) {
+	if (isRestartPending) {
+		isRestartPending = false;
+
+		numConsecutiveFailures++;
+		numRestarts++;
+
+		uint32_t backoffMs = getBackoffMs();
+
+		log.logStatus("Restarting %s in %u ms (restart #%u)", name, backoffMs, getNumRestarts());
+
+		setState(thread_backoff);
+
+		if (waitForStop(backoffMs)) {
+			return false;
+		}
+	}
+
+	uint64_t startTime = getMonotonicMs();
 
-	bool go = true;
+	heartbeat();
+	setState(thread_running);
 
-	while (go) {
-		try {
-			pThreadRtn = pThread->run();
+	try {
+		*pThreadRtn = run();
+	}
+	catch (abi::__forced_unwind &) {
+		/*
+		** We've been cancelled by the supervisor, this
+		** has to carry on up the stack...
+		*/
+		throw;
+	}
+	catch (exception & e) {
+		log.logError("%s: Caught exception %s", name, e.what());
+	}
+	catch (...) {
+		log.logError("%s: Caught unknown exception", name);
+	}
+
+	if (isStopping() || !isRestartable) {
+		return false;
+	}
+
+	if (getMonotonicMs() - startTime >= THREAD_BACKOFF_RESET_MS) {
+		numConsecutiveFailures = 0;
+	}
+
+	isRestartPending = true;
+
+	return true;
+}
+
+static const char * getPolicyName(int policy) {
+	switch (policy) {
+		case SCHED_FIFO:
+			return "SCHED_FIFO";
+
+		case SCHED_RR:
+			return "SCHED_RR";
+
+		case SCHED_OTHER:
+			return "SCHED_OTHER";
+
+		default:
+			return "unknown";
+	}
+}
+
+static const char * getPermissionHint(int err) {
+	return ((err == EPERM || err == EACCES) ? " (needs CAP_SYS_NICE or a higher RLIMIT_RTPRIO/RLIMIT_NICE)" : "");
+}
+
+void PosixThread::applySchedulingProfile() {
+	int			err;
+
+	if (schedProfile.isPolicySet) {
+		struct sched_param param;
+
+		memset(&param, 0, sizeof(param));
+
+		param.sched_priority = (schedProfile.policy == SCHED_OTHER ? 0 : schedProfile.priority);
+
+		err = pthread_setschedparam(pthread_self(), schedProfile.policy, &param);
+
+		if (err != 0) {
+			log.logError(
+				"%s: Failed to set %s priority %d: %s%s",
+				name,
+				getPolicyName(schedProfile.policy),
+				param.sched_priority,
+				strerror(err),
+				getPermissionHint(err));
 		}
-		catch (thread_error & e) {
-			log.logError("_threadRunner: Caught exception %s", e.what());
+		else {
+			log.logStatus("%s: Scheduling set to %s priority %d", name, getPolicyName(schedProfile.policy), param.sched_priority);
 		}
+	}
+
+	if (schedProfile.isNiceSet) {
+		/*
+		** On Linux the nice value belongs to the thread, not
+		** the process...
+		*/
+		if (setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), schedProfile.nice) < 0) {
+			err = errno;
 
-		if (pThread->isRestartable) {
-			log.logStatus("Restarting thread...");
-			PosixThread::sleep(1);
+			log.logError("%s: Failed to set nice %d: %s%s", name, schedProfile.nice, strerror(err), getPermissionHint(err));
 		}
 		else {
-			go = false;
+			log.logStatus("%s: Nice set to %d", name, schedProfile.nice);
 		}
 	}
 
-	return pThreadRtn;
+	if (schedProfile.isAffinitySet) {
+		char		szCPUs[CPU_SETSIZE * 4];
+		int			length = 0;
+
+		szCPUs[0] = 0;
+
+		for (int cpu = 0;cpu < CPU_SETSIZE && length < (int)sizeof(szCPUs) - 8;cpu++) {
+			if (CPU_ISSET(cpu, &schedProfile.cpus)) {
+				length += snprintf(&szCPUs[length], sizeof(szCPUs) - length, "%s%d", (length > 0 ? "," : ""), cpu);
+			}
+		}
+
+		err = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &schedProfile.cpus);
+
+		if (err != 0) {
+			log.logError("%s: Failed to pin to CPU(s) %s: %s", name, szCPUs, strerror(err));
+		}
+		else {
+			log.logStatus("%s: Pinned to CPU(s) %s", name, szCPUs);
+		}
+	}
+}
+
+bool PosixThread::start(const thread_sched_profile_t & profile) {
+	setSchedulingProfile(profile);
+
+	return this->start(NULL);
 }
 
 bool PosixThread::start() {
@@ -44,6 +233,8 @@ bool PosixThread::start(void * p) {
 
 	this->threadParameters = p;
 
+	stateTime.store(getMonotonicMs(), memory_order_relaxed);
+
 	err = pthread_create(&this->tid, NULL, &_threadRunner, this);
 
 	if (err != 0) {
@@ -51,9 +242,154 @@ bool PosixThread::start(void * p) {
 		return false;
 	}
 
+	isStarted = true;
+
 	return true;
 }
 
-void PosixThread::stop() {
-	pthread_kill(this->tid, SIGKILL);
+void PosixThread::requestStop() {
+	uint64_t one = 1;
+
+	isStopRequested.store(true, memory_order_release);
+
+	if (stopFD >= 0) {
+		while (write(stopFD, &one, sizeof(one)) < 0 && errno == EINTR);
+	}
+
+	onStopRequested();
+}
+
+bool PosixThread::waitForStop(uint32_t timeoutMs) {
+	struct pollfd pfd;
+
+	if (isStopping()) {
+		return true;
+	}
+
+	if (stopFD < 0) {
+		sleep_ms(timeoutMs);
+		return isStopping();
+	}
+
+	pfd.fd = stopFD;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+
+	poll(&pfd, 1, (int)timeoutMs);
+
+	return isStopping();
+}
+
+bool PosixThread::join(uint32_t timeoutMs) {
+	struct timespec		deadline;
+
+	/*
+	** Nothing to wait for, e.g. an earlier thread failed to
+	** start so we never got to this one...
+	*/
+	if (!isStarted) {
+		return true;
+	}
+
+	clock_gettime(CLOCK_REALTIME, &deadline);
+
+	deadline.tv_sec += timeoutMs / 1000U;
+	deadline.tv_nsec += (long)(timeoutMs % 1000U) * 1000000L;
+
+	if (deadline.tv_nsec >= 1000000000L) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
+	}
+
+	int err = pthread_timedjoin_np(this->tid, NULL, &deadline);
+
+	if (err != 0) {
+		log.logError("%s did not exit within %u ms: %s", name, timeoutMs, strerror(err));
+		return false;
+	}
+
+	return true;
+}
+
+bool PosixThread::stop(uint32_t timeoutMs) {
+	requestStop();
+	return join(timeoutMs);
+}
+
+bool PosixThread::tryJoin() {
+	return (pthread_tryjoin_np(this->tid, NULL) == 0);
+}
+
+void PosixThread::setState(thread_state s) {
+	state.store(s, memory_order_relaxed);
+	stateTime.store(getMonotonicMs(), memory_order_relaxed);
+}
+
+const char * PosixThread::getStateName() {
+	switch (getState()) {
+		case thread_not_started:
+			return "not started";
+
+		case thread_running:
+			return "running";
+
+		case thread_backoff:
+			return "waiting to restart";
+
+		case thread_stalled:
+			return "stalled";
+
+		case thread_stopped:
+			return "stopped";
+	}
+
+	return "unknown";
+}
+
+bool PosixThread::isStalled(uint64_t now) {
+	if (stallTimeoutMs == 0 || getState() != thread_running) {
+		return false;
+	}
+
+	return (getTimeSinceHeartbeat(now) > stallTimeoutMs);
+}
+
+void PosixThread::requestRecovery(uint64_t now) {
+	numStalls++;
+
+	recoveryTime = now;
+
+	onStalled();
+}
+
+/*
+** The last resort for a thread that didn't recover. It unwinds from
+** the next cancellation point it reaches, through whatever C code is
+** on the stack (libpq, lgpio) and may leave it in a mess, and an SPI
+** ioctl never is one. Returns false if it hasn't gone within
+** timeoutMs, tryJoin() until it has...
+*/
+bool PosixThread::cancel(uint32_t timeoutMs) {
+	recoveryTime = 0;
+
+	setState(thread_stalled);
+
+	int err = pthread_cancel(this->tid);
+
+	if (err != 0) {
+		log.logError("Failed to cancel %s: %s", name, strerror(err));
+		return false;
+	}
+
+	return join(timeoutMs);
+}
+
+/*
+** Start a thread that has been cancelled again, after
+** the backoff...
+*/
+bool PosixThread::restart() {
+	isRestartPending = true;
+
+	return start(this->threadParameters);
 }
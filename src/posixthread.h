@@ -1,4 +1,9 @@
+#include <atomic>
+
+#include <stdint.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
 
 #include "logger.h"
 
@@ -52,23 +57,107 @@ class thread_error : public exception {
         }
 };
 
+/*
+** Restarts back off exponentially, from THREAD_BACKOFF_INITIAL_MS up
+** to THREAD_BACKOFF_MAX_MS, +/- THREAD_BACKOFF_JITTER_PERCENT. A run
+** that lasts THREAD_BACKOFF_RESET_MS counts as a success and the
+** next failure starts from the beginning again...
+*/
+#define THREAD_BACKOFF_INITIAL_MS           1000U
+#define THREAD_BACKOFF_MAX_MS               60000U
+#define THREAD_BACKOFF_JITTER_PERCENT       25U
+#define THREAD_BACKOFF_RESET_MS             60000U
+
+/*
+** How a thread should be scheduled, applied by the thread itself
+** each time it starts. Anything not set is left as it was...
+*/
+typedef struct {
+    bool                isPolicySet;
+    int                 policy;                     // SCHED_OTHER, SCHED_FIFO or SCHED_RR
+    int                 priority;                   // 1-99 for SCHED_FIFO/SCHED_RR
+
+    bool                isNiceSet;
+    int                 nice;                       // Only matters for SCHED_OTHER
+
+    bool                isAffinitySet;
+    cpu_set_t           cpus;
+}
+thread_sched_profile_t;
+
 class PosixThread {
+    public:
+        enum thread_state {
+            thread_not_started,
+            thread_running,
+            thread_backoff,
+            thread_stalled,
+            thread_stopped
+        };
+
     private:
         pthread_t tid;
+        bool isStarted = false;
         void * threadParameters = NULL;
+        const char * name;
+
+        /*
+        ** The stop token, the eventfd becomes readable (and stays
+        ** readable) once a stop has been requested...
+        */
+        atomic<bool> isStopRequested{false};
+        int stopFD = -1;
+
+        /*
+        ** Written by the thread, read by the supervisor. Times
+        ** are CLOCK_MONOTONIC milliseconds...
+        */
+        atomic<int> state{thread_not_started};
+        atomic<uint64_t> stateTime{0};
+        atomic<uint64_t> lastHeartbeat{0};
+        atomic<uint32_t> numRestarts{0};
+        atomic<uint32_t> numStalls{0};
+
+        thread_sched_profile_t schedProfile;
+
+        uint32_t numConsecutiveFailures = 0;
+        uint32_t stallTimeoutMs = 0;
+        bool isRestartPending = false;
+
+        /*
+        ** Supervisor only, when we asked a stalled thread to
+        ** recover, 0 if we haven't...
+        */
+        uint64_t recoveryTime = 0;
 
         logger & log = logger::getInstance();
 
+        uint32_t getBackoffMs();
+
     protected:
         virtual void * getThreadParameters() {
             return this->threadParameters;
         }
 
+        /*
+        ** Called by requestStop(), override it to wake the thread
+        ** from wherever it blocks...
+        */
+        virtual void onStopRequested() {}
+
+        /*
+        ** Called by requestRecovery() on the supervisor's thread,
+        ** override it to make whatever the thread is stuck in give
+        ** up (cancel a query...), so it can beat again or fail and
+        ** be restarted without being cancelled...
+        */
+        virtual void onStalled() {}
+
     public:
         bool isRestartable = true;
 
-        PosixThread() {}
-        ~PosixThread() {}
+        PosixThread(const char * name);
+        ~PosixThread();
 
         static void sleep_us(unsigned long t) {
             usleep(t);
@@ -90,10 +179,128 @@ class PosixThread {
             ::sleep(t * 3600UL);
         }
 
+        static uint64_t getMonotonicMs();
+
         virtual bool start();
         virtual bool start(void * p);
 
-        virtual void stop();
+        /*
+        ** Start with a scheduling profile, the profile is applied
+        ** again whenever the thread is restarted...
+        */
+        bool start(const thread_sched_profile_t & profile);
+
+        void setSchedulingProfile(const thread_sched_profile_t & profile) {
+            schedProfile = profile;
+        }
+
+        /*
+        ** Called on the thread as it starts, logs what was set
+        ** and anything we weren't allowed to set...
+        */
+        void applySchedulingProfile();
+
+        bool runOnce(void ** pThreadRtn);
+
+        /*
+        ** Ask the thread to finish what it is doing and return
+        ** from run(), it is not restarted after that. Safe to
+        ** call from any thread...
+        */
+        void requestStop();
+
+        bool isStopping() {
+            return isStopRequested.load(memory_order_acquire);
+        }
+
+        /*
+        ** For threads running an event loop, readable once
+        ** requestStop() has been called...
+        */
+        int getStopFD() {
+            return stopFD;
+        }
+
+        /*
+        ** Sleep for up to timeoutMs, returns true straight away
+        ** if a stop is requested...
+        */
+        bool waitForStop(uint32_t timeoutMs);
+
+        /*
+        ** Wait up to timeoutMs for the thread to exit, returns
+        ** false if it is still running...
+        */
+        bool join(uint32_t timeoutMs);
+        bool tryJoin();
+
+        /*
+        ** requestStop() and join()...
+        */
+        virtual bool stop(uint32_t timeoutMs);
+
+        /*
+        ** For the supervisor. run() should call heartbeat() at
+        ** least every stall timeout (0, the default, means we
+        ** don't watch the thread). A stalled thread is asked to
+        ** recover first. Only if it still hasn't beaten some time
+        ** after that is it cancelled, and started again after the
+        ** usual backoff...
+        */
+        void heartbeat() {
+            lastHeartbeat.store(getMonotonicMs(), memory_order_relaxed);
+        }
+
+        void setStallTimeout(uint32_t timeoutMs) {
+            stallTimeoutMs = timeoutMs;
+        }
+
+        bool isStalled(uint64_t now);
+
+        void requestRecovery(uint64_t now);
+
+        bool isRecovering() {
+            return (recoveryTime > 0);
+        }
+
+        void setRecovered() {
+            recoveryTime = 0;
+        }
+
+        uint64_t getTimeRecovering(uint64_t now) {
+            return now - recoveryTime;
+        }
+
+        bool cancel(uint32_t timeoutMs);
+        bool restart();
+
+        void setState(thread_state s);
+
+        thread_state getState() {
+            return (thread_state)state.load(memory_order_relaxed);
+        }
+
+        const char * getStateName();
+
+        uint64_t getTimeInState(uint64_t now) {
+            return now - stateTime.load(memory_order_relaxed);
+        }
+
+        uint64_t getTimeSinceHeartbeat(uint64_t now) {
+            return now - lastHeartbeat.load(memory_order_relaxed);
+        }
+
+        uint32_t getNumRestarts() {
+            return numRestarts.load(memory_order_relaxed);
+        }
+
+        uint32_t getNumStalls() {
+            return numStalls.load(memory_order_relaxed);
+        }
+
+        const char * getName() {
+            return name;
+        }
 
         virtual pthread_t getID() {
             return this->tid;
@@ -6,24 +6,360 @@
 #include <stdbool.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include <errno.h>
+#include <endian.h>
+#include <poll.h>
+#include <sys/epoll.h>
 
 #include <postgresql/libpq-fe.h>
 
 #include "logger.h"
+#include "utils.h"
 #include "psql.h"
 
 using namespace std;
 
+/*
+** Binary timestamps and dates count from 2000-01-01...
+*/
+#define PSQL_EPOCH_OFFSET_SECONDS           946684800LL
+#define PSQL_SECONDS_PER_DAY                86400LL
+
+/*
+** What the server says when a statement we prepared has gone,
+** e.g. a pooler has handed us a different session...
+*/
+#define PSQL_SQLSTATE_INVALID_STATEMENT     "26000"
+
+/*
+** SQLSTATE classes for errors that are about the server, not the
+** statement: connection exception, insufficient resources, operator
+** intervention (e.g. shutting down) and system error...
+*/
+static const char * transientSQLStateClasses[] = {"08", "53", "57", "58"};
+
+/*
+** The binary COPY header is the signature, a flags word and the
+** length of a header extension (we have none). The trailer is a
+** field count of -1...
+*/
+#define PSQL_COPY_SIGNATURE                 "PGCOPY\n\377\r\n"
+#define PSQL_COPY_SIGNATURE_LEN             11
+#define PSQL_COPY_TRAILER                   -1
+
+/*
+** A binary NUMERIC is a header then digits in base 10000, most
+** significant first. weight is the power of 10000 of the first
+** digit, dscale the number of decimal digits after the point...
+*/
+#define PSQL_NUMERIC_BASE                   10000
+#define PSQL_NUMERIC_POSITIVE               0x0000
+#define PSQL_NUMERIC_NEGATIVE               0x4000
+#define PSQL_NUMERIC_NAN                    0xC000
+#define PSQL_NUMERIC_MAX_SCALE              4
+
+uint8_t * psqlParams::next(int length) {
+    if (numParams >= PSQL_MAX_PARAMS) {
+        throw psql_error(psql_error::buildMsg("Too many parameters, the most is %d", PSQL_MAX_PARAMS));
+    }
+
+    valuePtrs[numParams] = (const char *)values[numParams];
+    lengths[numParams] = length;
+    formats[numParams] = 1;
+
+    return values[numParams++];
+}
+
+psqlParams & psqlParams::addInt4(int32_t value) {
+    uint32_t be = htobe32((uint32_t)value);
+
+    memcpy(next(sizeof(be)), &be, sizeof(be));
+
+    return *this;
+}
+
+psqlParams & psqlParams::addFloat4(float value) {
+    uint32_t bits;
+
+    memcpy(&bits, &value, sizeof(bits));
+
+    uint32_t be = htobe32(bits);
+
+    memcpy(next(sizeof(be)), &be, sizeof(be));
+
+    return *this;
+}
+
+/*
+** The local wall clock time, as if it were UTC, in seconds...
+*/
+static int64_t getLocalSeconds(time_t t) {
+    struct tm localTime;
+
+    localtime_r(&t, &localTime);
+
+    return (int64_t)timegm(&localTime);
+}
+
+/*
+** A TIMESTAMP is microseconds since the start of 2000...
+*/
+static int64_t getTimestampMicroseconds(uint64_t timestampNs) {
+    int64_t seconds = getLocalSeconds((time_t)(timestampNs / 1000000000ULL)) - PSQL_EPOCH_OFFSET_SECONDS;
+
+    return seconds * 1000000LL + (int64_t)((timestampNs % 1000000000ULL) / 1000ULL);
+}
+
+psqlParams & psqlParams::addTimestamp(uint64_t timestampNs) {
+    uint64_t be = htobe64((uint64_t)getTimestampMicroseconds(timestampNs));
+
+    memcpy(next(sizeof(be)), &be, sizeof(be));
+
+    return *this;
+}
+
+psqlParams & psqlParams::addDate(time_t t) {
+    int64_t seconds = getLocalSeconds(t) - PSQL_EPOCH_OFFSET_SECONDS;
+    int64_t days = seconds / PSQL_SECONDS_PER_DAY;
+
+    if (seconds < 0 && (seconds % PSQL_SECONDS_PER_DAY) != 0) {
+        days--;
+    }
+
+    uint32_t be = htobe32((uint32_t)(int32_t)days);
+
+    memcpy(next(sizeof(be)), &be, sizeof(be));
+
+    return *this;
+}
+
+psqlCopy::psqlCopy(psqlConnection & connection, size_t bufferSize) : connection(connection) {
+    this->bufferSize = bufferSize;
+
+    buffer = (uint8_t *)malloc(bufferSize);
+
+    if (buffer == NULL) {
+        throw psql_error(psql_error::buildMsg("Failed to allocate %u bytes for COPY", (unsigned int)bufferSize));
+    }
+}
+
+psqlCopy::~psqlCopy() {
+    free(buffer);
+}
+
+uint8_t * psqlCopy::next(size_t size) {
+    if (length + size > bufferSize) {
+        flush();
+    }
+
+    uint8_t * p = &buffer[length];
+
+    length += size;
+
+    return p;
+}
+
+void psqlCopy::putInt16(int16_t value) {
+    uint16_t be = htobe16((uint16_t)value);
+
+    memcpy(next(sizeof(be)), &be, sizeof(be));
+}
+
+void psqlCopy::putInt32(int32_t value) {
+    uint32_t be = htobe32((uint32_t)value);
+
+    memcpy(next(sizeof(be)), &be, sizeof(be));
+}
+
+void psqlCopy::flush() {
+    if (length > 0) {
+        connection.putCopyData(buffer, (int)length);
+        length = 0;
+    }
+}
+
+void psqlCopy::begin(const char * sql) {
+    length = 0;
+    numRows = 0;
+
+    connection.beginCopy(sql);
+
+    memcpy(next(PSQL_COPY_SIGNATURE_LEN), PSQL_COPY_SIGNATURE, PSQL_COPY_SIGNATURE_LEN);
+
+    putInt32(0);
+    putInt32(0);
+}
+
+uint64_t psqlCopy::end() {
+    putInt16(PSQL_COPY_TRAILER);
+
+    flush();
+
+    return connection.endCopy();
+}
+
+void psqlCopy::abort(const char * reason) {
+    length = 0;
+
+    connection.abortCopy(reason);
+}
+
+psqlCopy & psqlCopy::beginRow(int numFields) {
+    putInt16((int16_t)numFields);
+
+    numRows++;
+
+    return *this;
+}
+
+psqlCopy & psqlCopy::addNull() {
+    putInt32(-1);
+
+    return *this;
+}
+
+psqlCopy & psqlCopy::addInt4(int32_t value) {
+    putInt32(sizeof(int32_t));
+    putInt32(value);
+
+    return *this;
+}
+
+psqlCopy & psqlCopy::addTimestamp(uint64_t timestampNs) {
+    uint64_t be = htobe64((uint64_t)getTimestampMicroseconds(timestampNs));
+
+    putInt32(sizeof(be));
+    memcpy(next(sizeof(be)), &be, sizeof(be));
+
+    return *this;
+}
+
+int psqlCopy::encodeNumeric(double value, int scale, uint8_t * buffer) {
+    static const int64_t    powers[] = {1, 10, 100, 1000, 10000};
+    uint16_t                digits[PSQL_NUMERIC_MAX_DIGITS];
+    uint16_t                words[4 + PSQL_NUMERIC_MAX_DIGITS];
+    int                     numDigits = 0;
+    int                     weight = -1;
+    uint16_t                sign = PSQL_NUMERIC_POSITIVE;
+
+    if (isinf(value)) {
+        return -1;
+    }
+
+    if (scale < 0 || scale > PSQL_NUMERIC_MAX_SCALE) {
+        throw psql_error(psql_error::buildMsg("NUMERIC scale %d is out of range", scale));
+    }
+
+    if (isnan(value)) {
+        sign = PSQL_NUMERIC_NAN;
+        scale = 0;
+        weight = 0;
+    }
+    else {
+        /*
+        ** Round to the scale, then split into the whole part and
+        ** one base 10000 digit after the point...
+        */
+        double scaledValue = value * (double)powers[scale];
+
+        if (fabs(scaledValue) >= 9.0E18) {
+            throw psql_error(psql_error::buildMsg("Value %g is too large for a NUMERIC", value));
+        }
+
+        int64_t scaled = llround(scaledValue);
+
+        if (scaled < 0) {
+            sign = PSQL_NUMERIC_NEGATIVE;
+            scaled = -scaled;
+        }
+
+        int64_t whole = scaled / powers[scale];
+        int64_t fraction = (scaled % powers[scale]) * powers[PSQL_NUMERIC_MAX_SCALE - scale];
+
+        uint16_t wholeDigits[PSQL_NUMERIC_MAX_DIGITS - 1];
+        int numWholeDigits = 0;
+
+        while (whole > 0 && numWholeDigits < PSQL_NUMERIC_MAX_DIGITS - 1) {
+            wholeDigits[numWholeDigits++] = (uint16_t)(whole % PSQL_NUMERIC_BASE);
+            whole /= PSQL_NUMERIC_BASE;
+        }
+
+        for (int i = numWholeDigits - 1;i >= 0;i--) {
+            digits[numDigits++] = wholeDigits[i];
+        }
+
+        weight = numWholeDigits - 1;
+
+        digits[numDigits++] = (uint16_t)fraction;
+
+        /*
+        ** No leading or trailing zero digits, as the server
+        ** keeps them...
+        */
+        while (numDigits > 0 && digits[numDigits - 1] == 0) {
+            numDigits--;
+        }
+
+        if (numDigits == 0) {
+            weight = 0;
+            sign = PSQL_NUMERIC_POSITIVE;
+        }
+    }
+
+    words[0] = (uint16_t)numDigits;
+    words[1] = (uint16_t)(int16_t)weight;
+    words[2] = sign;
+    words[3] = (uint16_t)scale;
+
+    for (int i = 0;i < numDigits;i++) {
+        words[4 + i] = digits[i];
+    }
+
+    int numWords = 4 + numDigits;
+
+    for (int i = 0;i < numWords;i++) {
+        words[i] = htobe16(words[i]);
+    }
+
+    memcpy(buffer, words, sizeof(uint16_t) * numWords);
+
+    return (int)(sizeof(uint16_t) * numWords);
+}
+
+psqlCopy & psqlCopy::addNumeric(double value, int scale) {
+    uint8_t encoded[PSQL_NUMERIC_MAX_LEN];
+
+    int encodedLength = encodeNumeric(value, scale, encoded);
+
+    if (encodedLength < 0) {
+        return addNull();
+    }
+
+    putInt32(encodedLength);
+    memcpy(next(encodedLength), encoded, encodedLength);
+
+    return *this;
+}
+
 psqlConnection::psqlConnection(const string & host, int port, const string & database, const string & username, const string & password) {
     stringstream s;
-    s << "host=" << host << " port=" << port << " user=" << username << " password=" << password;
+    s << "host=" << host << " port=" << port << " user=" << username << " password=" << password << " connect_timeout=" << PSQL_CONNECT_TIMEOUT_SECONDS;
+    s << " keepalives=1 keepalives_idle=" << PSQL_KEEPALIVE_IDLE_SECONDS << " keepalives_interval=" << PSQL_KEEPALIVE_INTERVAL_SECONDS;
+    s << " keepalives_count=" << PSQL_KEEPALIVE_COUNT << " tcp_user_timeout=" << PSQL_TCP_USER_TIMEOUT_MS;
 
     string connectionStr = s.str();
     
     connection = PQconnectdb(connectionStr.c_str());
 
     if (PQstatus(connection) != CONNECTION_OK) {
-        throw psql_error(psql_error::buildMsg("Could not connect to database: %s:%s", database.c_str(), PQerrorMessage(connection)));
+        char * msg = psql_error::buildMsg("Could not connect to database: %s:%s", database.c_str(), PQerrorMessage(connection));
+
+        PQfinish(connection);
+
+        throw psql_error(msg);
     }
     else {
         log.logInfo("Successfully connected to database '%s'", database.c_str());
@@ -34,10 +370,23 @@ psqlConnection::~psqlConnection() {
     PQfinish(connection);
 }
 
+/*
+** Empty if there's no result, the connection has probably gone,
+** which isConnected() will say...
+*/
+void psqlConnection::setLastSQLState(const PGresult * result) {
+    const char * sqlState = (result != NULL ? PQresultErrorField(result, PG_DIAG_SQLSTATE) : NULL);
+
+    lastSQLState.assign(sqlState != NULL ? sqlState : "");
+}
+
 void psqlConnection::beginTransaction() {
+    lastSQLState.clear();
+
     PGresult * result = PQexec(connection, "BEGIN");
 
     if (PQresultStatus(result) != PGRES_COMMAND_OK) {
+        setLastSQLState(result);
         PQclear(result);
         throw psql_error(psql_error::buildMsg("Error beginning transaction [%s]", PQerrorMessage(connection)));
     }
@@ -48,9 +397,12 @@ void psqlConnection::beginTransaction() {
 }
 
 void psqlConnection::endTransaction() {
+    lastSQLState.clear();
+
     PGresult * result = PQexec(connection, "END");
 
     if (PQresultStatus(result) != PGRES_COMMAND_OK) {
+        setLastSQLState(result);
         PQclear(result);
         throw psql_error(psql_error::buildMsg("Error ending transaction [%s]", PQerrorMessage(connection)));
     }
@@ -60,25 +412,740 @@ void psqlConnection::endTransaction() {
     PQclear(result);
 }
 
-PGresult * psqlConnection::execute(const char * sql) {
-    beginTransaction();
+void psqlConnection::rollbackTransaction() {
+    lastSQLState.clear();
+
+    PGresult * result = PQexec(connection, "ROLLBACK");
+
+    if (PQresultStatus(result) != PGRES_COMMAND_OK) {
+        setLastSQLState(result);
+        PQclear(result);
+        throw psql_error(psql_error::buildMsg("Error rolling back transaction [%s]", PQerrorMessage(connection)));
+    }
+
+    log.logDebug("ROLLBACK TRANSACTION");
+
+    PQclear(result);
+}
+
+PGresult * psqlConnection::execute(const char * sql, bool isInTransaction) {
+    lastSQLState.clear();
+
+    if (!isInTransaction) {
+        beginTransaction();
+    }
 
     PGresult * result = PQexec(connection, sql);
 
     if (PQresultStatus(result) != PGRES_COMMAND_OK && PQresultStatus(result) != PGRES_TUPLES_OK) {
+        char * msg = psql_error::buildMsg("Error issuing statement [%s]: '%s'", sql, PQerrorMessage(connection));
+
+        /*
+        ** The caller's transaction has failed, it's up to
+        ** them to roll it back...
+        */
+        if (!isInTransaction) {
+            endTransaction();
+        }
+
+        /*
+        ** After ending our own transaction, so it's the
+        ** statement's state the caller sees...
+        */
+        setLastSQLState(result);
+
         if (result != NULL) {
             PQclear(result);
         }
 
-        endTransaction();
-
-        throw psql_error(psql_error::buildMsg("Error issuing statement [%s]: '%s'", sql, PQerrorMessage(connection)));
+        throw psql_error(msg);
     }
     else {
         log.logDebug("Successfully executed statement [%s]", sql);
     }
 
-    endTransaction();
+    if (!isInTransaction) {
+        endTransaction();
+    }
 
     return result;
 }
+
+void psqlConnection::prepareStatement(const string & name, psql_statement_t & statement) {
+    lastSQLState.clear();
+
+    PGresult * result = PQprepare(
+                            connection,
+                            name.c_str(),
+                            statement.sql.c_str(),
+                            (int)statement.paramTypes.size(),
+                            statement.paramTypes.data());
+
+    if (PQresultStatus(result) != PGRES_COMMAND_OK) {
+        setLastSQLState(result);
+        PQclear(result);
+        throw psql_error(psql_error::buildMsg("Error preparing statement '%s': '%s'", name.c_str(), PQerrorMessage(connection)));
+    }
+
+    PQclear(result);
+
+    statement.isPrepared = true;
+
+    log.logDebug("Prepared statement '%s'", name.c_str());
+}
+
+void psqlConnection::prepare(const string & name, const char * sql, int numParams, const Oid * paramTypes) {
+    psql_statement_t & statement = statements[name];
+
+    statement.sql.assign(sql);
+    statement.paramTypes.assign(paramTypes, paramTypes + numParams);
+    statement.isPrepared = false;
+
+    try {
+        prepareStatement(name, statement);
+    }
+    catch (psql_error & e) {
+        log.logError("%s, it will be prepared again when it is first used", e.what());
+    }
+}
+
+PGresult * psqlConnection::executePrepared(const string & name, psqlParams & params) {
+    auto it = statements.find(name);
+
+    if (it == statements.end()) {
+        throw psql_error(psql_error::buildMsg("No prepared statement called '%s'", name.c_str()));
+    }
+
+    psql_statement_t & statement = it->second;
+
+    lastSQLState.clear();
+
+    /*
+    ** Once more if the server has lost the statement, unless we're
+    ** in a transaction, which the failure has aborted (we'd only
+    ** get 25P02 for trying)...
+    */
+    for (int attempt = 0;attempt < 2;attempt++) {
+        if (!statement.isPrepared) {
+            prepareStatement(name, statement);
+        }
+
+        PGresult * result = PQexecPrepared(
+                                connection,
+                                name.c_str(),
+                                params.getNumParams(),
+                                params.getValues(),
+                                params.getLengths(),
+                                params.getFormats(),
+                                0);
+
+        ExecStatusType status = PQresultStatus(result);
+
+        if (status == PGRES_COMMAND_OK || status == PGRES_TUPLES_OK) {
+            return result;
+        }
+
+        const char * sqlState = PQresultErrorField(result, PG_DIAG_SQLSTATE);
+
+        if (sqlState != NULL && strcmp(sqlState, PSQL_SQLSTATE_INVALID_STATEMENT) == 0) {
+            /*
+            ** Prepared again on first use, next time...
+            */
+            statement.isPrepared = false;
+
+            if (attempt == 0 && !isInTransaction()) {
+                log.logInfo("Prepared statement '%s' has gone, preparing it again", name.c_str());
+
+                PQclear(result);
+                continue;
+            }
+        }
+
+        setLastSQLState(result);
+
+        PQclear(result);
+
+        throw psql_error(psql_error::buildMsg("Error executing prepared statement '%s': '%s'", name.c_str(), PQerrorMessage(connection)));
+    }
+
+    throw psql_error(psql_error::buildMsg("Failed to prepare statement '%s' again", name.c_str()));
+}
+
+bool psqlConnection::isLastErrorTransient() {
+    for (const char * sqlClass : transientSQLStateClasses) {
+        if (lastSQLState.compare(0, 2, sqlClass) == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool psqlConnection::ping() {
+    PGresult * result = PQexec(connection, "SELECT 1");
+
+    bool isOK = (PQresultStatus(result) == PGRES_TUPLES_OK);
+
+    PQclear(result);
+
+    return (isOK && isConnected());
+}
+
+bool psqlConnection::reset() {
+    /*
+    ** The new session starts out of pipeline mode, and should
+    ** block as a new connection does...
+    */
+    PQreset(connection);
+    PQsetnonblocking(connection, 0);
+
+    if (!isConnected()) {
+        return false;
+    }
+
+    /*
+    ** A new session knows nothing of what we prepared. Anything
+    ** that won't prepare now is tried again when it is used...
+    */
+    for (auto & i : statements) {
+        i.second.isPrepared = false;
+    }
+
+    for (auto & i : statements) {
+        try {
+            prepareStatement(i.first, i.second);
+        }
+        catch (psql_error & e) {
+            log.logError("%s", e.what());
+        }
+    }
+
+    return true;
+}
+
+void psqlConnection::beginCopy(const char * sql) {
+    lastSQLState.clear();
+
+    PGresult * result = PQexec(connection, sql);
+
+    if (PQresultStatus(result) != PGRES_COPY_IN) {
+        setLastSQLState(result);
+        PQclear(result);
+        throw psql_error(psql_error::buildMsg("Error starting copy [%s]: '%s'", sql, PQerrorMessage(connection)));
+    }
+
+    PQclear(result);
+
+    log.logDebug("Started copy [%s]", sql);
+}
+
+void psqlConnection::putCopyData(const uint8_t * data, int length) {
+    lastSQLState.clear();
+
+    if (PQputCopyData(connection, (const char *)data, length) != 1) {
+        throw psql_error(psql_error::buildMsg("Error sending copy data: '%s'", PQerrorMessage(connection)));
+    }
+}
+
+uint64_t psqlConnection::endCopy() {
+    uint64_t    numRows = 0;
+    bool        isOK = true;
+    string      error;
+
+    lastSQLState.clear();
+
+    if (PQputCopyEnd(connection, NULL) != 1) {
+        throw psql_error(psql_error::buildMsg("Error ending copy: '%s'", PQerrorMessage(connection)));
+    }
+
+    /*
+    ** The result of the COPY, then NULL once there is nothing
+    ** more to read...
+    */
+    PGresult * result;
+
+    while ((result = PQgetResult(connection)) != NULL) {
+        if (PQresultStatus(result) == PGRES_COMMAND_OK) {
+            numRows += strtoull(PQcmdTuples(result), NULL, 10);
+        }
+        else if (isOK) {
+            isOK = false;
+            error.assign(PQresultErrorMessage(result));
+            setLastSQLState(result);
+        }
+
+        PQclear(result);
+    }
+
+    if (!isOK) {
+        throw psql_error(psql_error::buildMsg("Error copying data: '%s'", error.c_str()));
+    }
+
+    log.logDebug("Copied %llu row(s)", (unsigned long long)numRows);
+
+    return numRows;
+}
+
+void psqlConnection::abortCopy(const char * reason) {
+    PQputCopyEnd(connection, reason);
+
+    PGresult * result;
+
+    while ((result = PQgetResult(connection)) != NULL) {
+        PQclear(result);
+    }
+}
+
+psqlPipeline::psqlPipeline(psqlConnection & connection, psql_result_handler_t handler, psql_result_handler_t syncHandler, void * context) : connection(connection) {
+    this->handler = handler;
+    this->syncHandler = syncHandler;
+    this->context = context;
+}
+
+void psqlPipeline::enter() {
+    PGconn * conn = connection.connection;
+
+    if (PQsetnonblocking(conn, 1) != 0) {
+        throw psql_error(psql_error::buildMsg("Error making the connection non-blocking: '%s'", PQerrorMessage(conn)));
+    }
+
+    if (PQenterPipelineMode(conn) != 1) {
+        PQsetnonblocking(conn, 0);
+        throw psql_error(psql_error::buildMsg("Error entering pipeline mode: '%s'", PQerrorMessage(conn)));
+    }
+
+    isActive = true;
+    isFlushNeeded = false;
+
+    connection.log.logDebug("Entered pipeline mode");
+}
+
+void psqlPipeline::exit() {
+    PGconn * conn = connection.connection;
+
+    if (!pending.empty()) {
+        throw psql_error(psql_error::buildMsg("Can't leave pipeline mode with %u statement(s) in flight", numStatements));
+    }
+
+    if (PQexitPipelineMode(conn) != 1) {
+        throw psql_error(psql_error::buildMsg("Error leaving pipeline mode: '%s'", PQerrorMessage(conn)));
+    }
+
+    PQsetnonblocking(conn, 0);
+
+    isActive = false;
+
+    connection.log.logDebug("Left pipeline mode");
+}
+
+void psqlPipeline::abandon() {
+    while (!pending.empty()) {
+        psql_pending_t entry = pending.front();
+
+        pending.pop_front();
+
+        if (!entry.isSync) {
+            numStatements--;
+            handler(entry.tag, psql_result_aborted, "the pipeline was abandoned", context);
+        }
+        else if (syncHandler != NULL) {
+            syncHandler(entry.tag, psql_result_aborted, "the pipeline was abandoned", context);
+        }
+    }
+
+    isActive = false;
+    isFlushNeeded = false;
+    isBatchFailed = false;
+    batchError.clear();
+}
+
+void psqlPipeline::send(const string & name, psqlParams & params, uint64_t tag) {
+    PGconn * conn = connection.connection;
+
+    int rtn = PQsendQueryPrepared(
+                    conn,
+                    name.c_str(),
+                    params.getNumParams(),
+                    params.getValues(),
+                    params.getLengths(),
+                    params.getFormats(),
+                    0);
+
+    if (rtn != 1) {
+        throw psql_error(psql_error::buildMsg("Error sending statement '%s': '%s'", name.c_str(), PQerrorMessage(conn)));
+    }
+
+    pending.push_back({tag, false, psql_result_ok, ""});
+    numStatements++;
+
+    isFlushNeeded = true;
+}
+
+void psqlPipeline::sync(uint64_t tag) {
+    PGconn * conn = connection.connection;
+
+    if (PQpipelineSync(conn) != 1) {
+        throw psql_error(psql_error::buildMsg("Error sending pipeline sync: '%s'", PQerrorMessage(conn)));
+    }
+
+    pending.push_back({tag, true, psql_result_ok, ""});
+
+    isFlushNeeded = true;
+}
+
+void psqlPipeline::flush() {
+    int rtn = PQflush(connection.connection);
+
+    if (rtn < 0) {
+        throw psql_error(psql_error::buildMsg("Error sending to the server: '%s'", PQerrorMessage(connection.connection)));
+    }
+
+    isFlushNeeded = (rtn == 1);
+}
+
+/*
+** Each statement's results are followed by a NULL, a sync point
+** just has its PGRES_PIPELINE_SYNC result, which is when we know
+** whether its batch committed...
+*/
+void psqlPipeline::processResults() {
+    PGconn * conn = connection.connection;
+
+    if (PQconsumeInput(conn) != 1) {
+        throw psql_error(psql_error::buildMsg("Error reading from the server: '%s'", PQerrorMessage(conn)));
+    }
+
+    while (!pending.empty() && !PQisBusy(conn)) {
+        PGresult * result = PQgetResult(conn);
+
+        psql_pending_t & entry = pending.front();
+
+        if (entry.isSync) {
+            if (result == NULL) {
+                break;
+            }
+
+            if (PQresultStatus(result) == PGRES_PIPELINE_SYNC) {
+                uint64_t tag = entry.tag;
+                string error = batchError;
+                psql_result_status status = (isBatchFailed ? psql_result_error : psql_result_ok);
+
+                pending.pop_front();
+
+                isBatchFailed = false;
+                batchError.clear();
+
+                if (syncHandler != NULL) {
+                    syncHandler(tag, status, error.c_str(), context);
+                }
+            }
+
+            PQclear(result);
+            continue;
+        }
+
+        if (result == NULL) {
+            psql_pending_t done = entry;
+
+            pending.pop_front();
+            numStatements--;
+
+            if (done.status != psql_result_ok) {
+                isBatchFailed = true;
+
+                if (done.status == psql_result_error && batchError.length() == 0) {
+                    batchError = done.error;
+                }
+            }
+
+            handler(done.tag, done.status, done.error.c_str(), context);
+            continue;
+        }
+
+        switch (PQresultStatus(result)) {
+            case PGRES_COMMAND_OK:
+            case PGRES_TUPLES_OK:
+                break;
+
+            case PGRES_PIPELINE_ABORTED:
+                entry.status = psql_result_aborted;
+                entry.error.assign("an earlier statement failed");
+                break;
+
+            default:
+                entry.status = psql_result_error;
+                entry.error.assign(PQresultErrorMessage(result));
+
+                while (entry.error.length() > 0 && entry.error.back() == '\n') {
+                    entry.error.pop_back();
+                }
+                break;
+        }
+
+        PQclear(result);
+    }
+
+    if (PQstatus(conn) != CONNECTION_OK) {
+        throw psql_error(psql_error::buildMsg("Lost the connection with %u statement(s) in flight: '%s'", numStatements, PQerrorMessage(conn)));
+    }
+}
+
+bool psqlPipeline::wait(int timeoutMs) {
+    struct pollfd       pfd;
+
+    pfd.fd = connection.getSocket();
+    pfd.events = POLLIN | (isFlushNeeded ? POLLOUT : 0);
+    pfd.revents = 0;
+
+    int rtn = poll(&pfd, 1, timeoutMs);
+
+    if (rtn < 0) {
+        if (errno == EINTR) {
+            return true;
+        }
+
+        throw psql_error(psql_error::buildMsg("Error waiting for the server: %s", strerror(errno)));
+    }
+
+    if (rtn == 0) {
+        return false;
+    }
+
+    if (pfd.revents & POLLOUT) {
+        flush();
+    }
+
+    if (pfd.revents & (POLLIN | POLLERR | POLLHUP)) {
+        processResults();
+    }
+
+    return true;
+}
+
+uint32_t psqlPipeline::getEvents() {
+    return EPOLLIN | (isFlushNeeded ? EPOLLOUT : 0);
+}
+
+psqlConnectionManager::psqlConnectionManager(
+                const string & host,
+                int port,
+                const string & database,
+                const string & username,
+                const string & password,
+                uint32_t minBackoffMs,
+                uint32_t maxBackoffMs)
+{
+    this->host = host;
+    this->port = port;
+    this->database = database;
+    this->username = username;
+    this->password = password;
+
+    this->minBackoffMs = (minBackoffMs > 0 ? minBackoffMs : 1);
+    this->maxBackoffMs = (maxBackoffMs > this->minBackoffMs ? maxBackoffMs : this->minBackoffMs);
+
+    backoffMs = this->minBackoffMs;
+}
+
+psqlConnectionManager::~psqlConnectionManager() {
+    if (cancelHandle != NULL) {
+        PQfreeCancel(cancelHandle);
+    }
+
+    if (connection != NULL) {
+        delete connection;
+    }
+}
+
+/*
+** A new session has a new backend to cancel...
+*/
+void psqlConnectionManager::updateCancel() {
+    PGcancel * handle = connection->getCancel();
+
+    pthread_mutex_lock(&cancelMutex);
+
+    if (cancelHandle != NULL) {
+        PQfreeCancel(cancelHandle);
+    }
+
+    cancelHandle = handle;
+
+    pthread_mutex_unlock(&cancelMutex);
+}
+
+bool psqlConnectionManager::cancel() {
+    char        szError[256];
+    bool        isSent = false;
+
+    pthread_mutex_lock(&cancelMutex);
+
+    if (cancelHandle != NULL) {
+        isSent = (PQcancel(cancelHandle, szError, sizeof(szError)) == 1);
+
+        if (!isSent) {
+            log.logError("Failed to cancel the statement on database '%s': %s", database.c_str(), szError);
+        }
+    }
+
+    pthread_mutex_unlock(&cancelMutex);
+
+    return isSent;
+}
+
+void psqlConnectionManager::prepare(const string & name, const char * sql, int numParams, const Oid * paramTypes) {
+    psql_registered_t statement;
+
+    statement.name = name;
+    statement.sql.assign(sql);
+    statement.paramTypes.assign(paramTypes, paramTypes + numParams);
+
+    statements.push_back(statement);
+
+    if (connection != NULL) {
+        connection->prepare(name, sql, numParams, paramTypes);
+    }
+}
+
+/*
+** A new connection the first time, after that reset() the one we
+** have, which prepares its statements again...
+*/
+bool psqlConnectionManager::attempt() {
+    string error;
+    bool isConnected = false;
+
+    numAttempts++;
+
+    if (connection == NULL) {
+        try {
+            connection = new psqlConnection(host, port, database, username, password);
+
+            for (psql_registered_t & statement : statements) {
+                connection->prepare(statement.name, statement.sql.c_str(), (int)statement.paramTypes.size(), statement.paramTypes.data());
+            }
+
+            isConnected = true;
+        }
+        catch (psql_error & e) {
+            error.assign(e.what());
+        }
+    }
+    else {
+        isConnected = connection->reset();
+
+        if (!isConnected) {
+            error.assign(connection->getErrorMessage());
+        }
+    }
+
+    if (isConnected) {
+        if (numConnects > 0) {
+            numReconnects++;
+            log.logStatus("Database connection is back after %u attempt(s), %llu reconnect(s) so far", numAttempts, (unsigned long long)numReconnects);
+        }
+
+        numConnects++;
+        numAttempts = 0;
+
+        state = psql_state_connected;
+
+        updateCancel();
+
+        return true;
+    }
+
+    while (error.length() > 0 && error.back() == '\n') {
+        error.pop_back();
+    }
+
+    numFailedAttempts++;
+
+    state = psql_state_down;
+    nextAttemptTime = getEpochNanoseconds() + (uint64_t)backoffMs * 1000000ULL;
+
+    log.logError("Failed to connect to database (attempt %u), trying again in %u ms: %s", numAttempts, backoffMs, error.c_str());
+
+    backoffMs = (backoffMs > maxBackoffMs / 2 ? maxBackoffMs : backoffMs * 2);
+
+    return false;
+}
+
+psqlConnection * psqlConnectionManager::getConnection() {
+    if (state == psql_state_connected) {
+        if (connection->isConnected()) {
+            return connection;
+        }
+
+        setLost(connection->getErrorMessage());
+    }
+
+    if (state == psql_state_down && getEpochNanoseconds() < nextAttemptTime) {
+        return NULL;
+    }
+
+    return (attempt() ? connection : NULL);
+}
+
+void psqlConnectionManager::setLost(const char * reason) {
+    if (state == psql_state_connected) {
+        string why(reason);
+
+        while (why.length() > 0 && why.back() == '\n') {
+            why.pop_back();
+        }
+
+        numLost++;
+
+        log.logError("Lost the connection to database '%s', trying again in %u ms: %s", database.c_str(), backoffMs, why.c_str());
+    }
+
+    state = psql_state_down;
+    nextAttemptTime = getEpochNanoseconds() + (uint64_t)backoffMs * 1000000ULL;
+
+    backoffMs = (backoffMs > maxBackoffMs / 2 ? maxBackoffMs : backoffMs * 2);
+}
+
+psqlConnection * psqlConnectionManager::reconnect(const char * reason) {
+    setLost(reason);
+
+    return (attempt() ? connection : NULL);
+}
+
+bool psqlConnectionManager::probe() {
+    if (state != psql_state_connected) {
+        return false;
+    }
+
+    if (connection->ping()) {
+        log.logDebug("Database connection is healthy");
+        return true;
+    }
+
+    setLost(connection->isConnected() ? "no answer to a health check" : connection->getErrorMessage());
+
+    return false;
+}
+
+uint32_t psqlConnectionManager::getRetryDelayMs() {
+    uint64_t now = getEpochNanoseconds();
+
+    if (state != psql_state_down || now >= nextAttemptTime) {
+        return 0;
+    }
+
+    return (uint32_t)((nextAttemptTime - now) / 1000000ULL);
+}
+
+const char * psqlConnectionManager::getStateName() {
+    switch (state) {
+        case psql_state_connected:
+            return "connected";
+
+        case psql_state_down:
+            return "down";
+
+        default:
+            return "not connected yet";
+    }
+}
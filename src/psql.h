@@ -1,8 +1,13 @@
 #include <string>
+#include <vector>
+#include <deque>
+#include <unordered_map>
 #include <exception>
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <time.h>
+#include <pthread.h>
 
 #include <postgresql/libpq-fe.h>
 
@@ -60,19 +65,502 @@ class psql_error : public exception {
         }
 };
 
+/*
+** Type OIDs for prepare(), from the server's pg_type.h...
+*/
+#define PSQL_TYPE_INT4                      23
+#define PSQL_TYPE_FLOAT4                    700
+#define PSQL_TYPE_DATE                      1082
+#define PSQL_TYPE_TIMESTAMP                 1114
+
+#define PSQL_MAX_PARAMS                     32
+
+/*
+** How long a connection attempt may take, so a database that has
+** gone quiet can't hold up the thread for the TCP timeout...
+*/
+#define PSQL_CONNECT_TIMEOUT_SECONDS        10
+
+/*
+** So a server that has gone away under a statement we're waiting
+** on breaks the connection, rather than leaving us blocked in
+** libpq until the supervisor notices...
+*/
+#define PSQL_KEEPALIVE_IDLE_SECONDS         30
+#define PSQL_KEEPALIVE_INTERVAL_SECONDS     10
+#define PSQL_KEEPALIVE_COUNT                3
+#define PSQL_TCP_USER_TIMEOUT_MS            60000
+
+#define PSQL_DEFAULT_RECONNECT_MIN_MS       1000U
+#define PSQL_DEFAULT_RECONNECT_MAX_MS       60000U
+
+/*
+** What a psqlCopy gathers before handing it to libpq...
+*/
+#define PSQL_COPY_BUFFER_SIZE               (1024U * 1024U)
+
+/*
+** The longest NUMERIC psqlCopy writes, a header of four 16 bit
+** words then up to this many base 10000 digits...
+*/
+#define PSQL_NUMERIC_MAX_DIGITS             8
+#define PSQL_NUMERIC_MAX_LEN                (2 * (4 + PSQL_NUMERIC_MAX_DIGITS))
+
+/*
+** Parameters for executePrepared(), each one in the binary
+** format the server uses, so nothing goes through text...
+*/
+class psqlParams {
+    private:
+        int             numParams = 0;
+
+        uint8_t         values[PSQL_MAX_PARAMS][8];
+        const char *    valuePtrs[PSQL_MAX_PARAMS];
+        int             lengths[PSQL_MAX_PARAMS];
+        int             formats[PSQL_MAX_PARAMS];
+
+        uint8_t * next(int length);
+
+    public:
+        void clear() {
+            numParams = 0;
+        }
+
+        psqlParams & addInt4(int32_t value);
+        psqlParams & addFloat4(float value);
+
+        /*
+        ** Local time, as the TIMESTAMP and DATE columns hold it...
+        */
+        psqlParams & addTimestamp(uint64_t timestampNs);
+        psqlParams & addDate(time_t t);
+
+        int getNumParams() {
+            return numParams;
+        }
+
+        const char * const * getValues() {
+            return valuePtrs;
+        }
+
+        const int * getLengths() {
+            return lengths;
+        }
+
+        const int * getFormats() {
+            return formats;
+        }
+};
+
 class psqlConnection {
+    friend class psqlPipeline;
+
     private:
+        typedef struct {
+            string          sql;
+            vector<Oid>     paramTypes;
+            bool            isPrepared;
+        }
+        psql_statement_t;
+
         PGconn * connection;
         logger & log = logger::getInstance();
 
+        unordered_map<string, psql_statement_t> statements;
+
+        /*
+        ** Of the last call that failed, cleared by each call so
+        ** an old failure is never taken for a new one...
+        */
+        string lastSQLState;
+
+        void setLastSQLState(const PGresult * result);
+        void prepareStatement(const string & name, psql_statement_t & statement);
+
     public:
         psqlConnection(const string & host, int port, const string & database, const string & username, const string & password);
         ~psqlConnection();
 
+        bool isConnected() {
+            return (PQstatus(connection) == CONNECTION_OK);
+        }
+
+        bool isInTransaction() {
+            return (PQtransactionStatus(connection) == PQTRANS_INTRANS);
+        }
+
+        int getSocket() {
+            return PQsocket(connection);
+        }
+
+        /*
+        ** For psqlConnectionManager::cancel(), the caller frees
+        ** it with PQfreeCancel()...
+        */
+        PGcancel * getCancel() {
+            return PQgetCancel(connection);
+        }
+
+        const char * getErrorMessage() {
+            return PQerrorMessage(connection);
+        }
+
+        /*
+        ** Whether the last statement that failed did so for a
+        ** reason that may go away (the server is shutting down,
+        ** starting up, out of resources...), rather than because
+        ** of what we sent...
+        */
+        bool isLastErrorTransient();
+
+        /*
+        ** A round trip to the server, returns false if it
+        ** didn't answer...
+        */
+        bool ping();
+
         void beginTransaction();
         void endTransaction();
+        void rollbackTransaction();
+
+        /*
+        ** Each statement is its own transaction, unless the caller
+        ** has already begun one (isInTransaction), in which case it
+        ** becomes part of that one...
+        */
+        PGresult * execute(const char * sql, bool isInTransaction = false);
+
+        /*
+        ** Prepare a statement to be run by name. We remember it,
+        ** and prepare it again on a new session after reset(). If
+        ** it won't prepare now, executePrepared() tries again...
+        */
+        void prepare(const string & name, const char * sql, int numParams, const Oid * paramTypes);
+
+        PGresult * executePrepared(const string & name, psqlParams & params);
+
+        /*
+        ** Reconnect with the same parameters, returns true if
+        ** we're connected again...
+        */
+        bool reset();
+
+        /*
+        ** Run a COPY ... FROM STDIN, then send it data until
+        ** endCopy(), which returns the number of rows copied.
+        ** abortCopy() throws away everything sent...
+        */
+        void beginCopy(const char * sql);
+        void putCopyData(const uint8_t * data, int length);
+        uint64_t endCopy();
+        void abortCopy(const char * reason);
+};
+
+enum psql_connection_state {
+    psql_state_idle,
+    psql_state_connected,
+    psql_state_down
+};
+
+/*
+** Owns the connection to the database. Nothing connects until
+** getConnection() is first called. Once connected, a connection
+** that breaks is reset, and a failed attempt waits before trying
+** again, twice as long each time up to the maximum. Statements
+** registered with prepare() are prepared on every new session...
+*/
+class psqlConnectionManager {
+    private:
+        typedef struct {
+            string          name;
+            string          sql;
+            vector<Oid>     paramTypes;
+        }
+        psql_registered_t;
+
+        string                      host;
+        int                         port;
+        string                      database;
+        string                      username;
+        string                      password;
+
+        psqlConnection *            connection = NULL;
+
+        /*
+        ** For the current session, the only thing another thread
+        ** may touch...
+        */
+        pthread_mutex_t             cancelMutex = PTHREAD_MUTEX_INITIALIZER;
+        PGcancel *                  cancelHandle = NULL;
+
+        vector<psql_registered_t>   statements;
+
+        psql_connection_state       state = psql_state_idle;
+
+        uint32_t                    minBackoffMs;
+        uint32_t                    maxBackoffMs;
+        uint32_t                    backoffMs;
+        uint64_t                    nextAttemptTime = 0;
+        uint32_t                    numAttempts = 0;
+
+        uint64_t                    numConnects = 0;
+        uint64_t                    numReconnects = 0;
+        uint64_t                    numLost = 0;
+        uint64_t                    numFailedAttempts = 0;
+
+        logger & log = logger::getInstance();
+
+        bool attempt();
+        void updateCancel();
 
-        PGresult * execute(const char * sql);
+    public:
+        psqlConnectionManager(
+                const string & host,
+                int port,
+                const string & database,
+                const string & username,
+                const string & password,
+                uint32_t minBackoffMs = PSQL_DEFAULT_RECONNECT_MIN_MS,
+                uint32_t maxBackoffMs = PSQL_DEFAULT_RECONNECT_MAX_MS);
+
+        ~psqlConnectionManager();
+
+        void prepare(const string & name, const char * sql, int numParams, const Oid * paramTypes);
+
+        /*
+        ** The connection, (re)connecting first if it's down and
+        ** it's time to try again. NULL if we're not connected...
+        */
+        psqlConnection * getConnection();
+
+        /*
+        ** Something we ran says the database can't be used right
+        ** now, so wait before trying it again...
+        */
+        void setLost(const char * reason);
+
+        /*
+        ** Start a new session now, whatever the backoff says,
+        ** for a connection left in a state we can't use (an
+        ** abandoned pipeline)...
+        */
+        psqlConnection * reconnect(const char * reason);
+
+        /*
+        ** The database is working again, the next failure
+        ** starts the backoff from the beginning...
+        */
+        void resetBackoff() {
+            backoffMs = minBackoffMs;
+        }
+
+        /*
+        ** Check an idle connection is still there, returns false
+        ** if it isn't (and it's been marked as lost)...
+        */
+        bool probe();
+
+        /*
+        ** Ask the server to give up on whatever statement it is
+        ** running for us, which then fails (57014). Safe to call
+        ** from any thread, returns false if the request couldn't
+        ** be sent...
+        */
+        bool cancel();
+
+        /*
+        ** How long until the next attempt to connect...
+        */
+        uint32_t getRetryDelayMs();
+
+        psql_connection_state getState() {
+            return state;
+        }
+
+        const char * getStateName();
+
+        uint64_t getNumConnects() {
+            return numConnects;
+        }
+
+        uint64_t getNumReconnects() {
+            return numReconnects;
+        }
+
+        uint64_t getNumLost() {
+            return numLost;
+        }
+
+        uint64_t getNumFailedAttempts() {
+            return numFailedAttempts;
+        }
+};
+
+/*
+** How a statement sent down a pipeline turned out. One that
+** failed aborts everything after it up to the next sync...
+*/
+enum psql_result_status {
+    psql_result_ok,
+    psql_result_error,
+    psql_result_aborted
+};
+
+/*
+** Called once for each statement sent, in the order they were
+** sent, with the tag it was sent with. The sync handler is called
+** the same way for each sync, ok if its batch committed, error if
+** a statement failed and it was rolled back, or aborted if we gave
+** up before finding out...
+*/
+typedef void (* psql_result_handler_t)(uint64_t tag, psql_result_status status, const char * error, void * context);
+
+/*
+** Prepared statements sent in libpq pipeline mode, on a non-blocking
+** socket, so we don't wait a round trip for each one. Statements
+** between syncs run as one transaction. The owner watches the socket
+** for getEvents(), calls flush() when it's writable and
+** processResults() when it's readable, and the results come back
+** through the handler. The statements must have been prepared before
+** enter(), nothing else can run on the connection until exit()...
+*/
+class psqlPipeline {
+    private:
+        typedef struct {
+            uint64_t                tag;
+            bool                    isSync;
+            psql_result_status      status;
+            string                  error;
+        }
+        psql_pending_t;
+
+        psqlConnection &            connection;
+
+        psql_result_handler_t       handler;
+        psql_result_handler_t       syncHandler;
+        void *                      context;
+
+        deque<psql_pending_t>       pending;
+        uint32_t                    numStatements = 0;
+
+        /*
+        ** How the batch since the last sync is going...
+        */
+        bool                        isBatchFailed = false;
+        string                      batchError;
+
+        bool                        isActive = false;
+        bool                        isFlushNeeded = false;
+
+    public:
+        psqlPipeline(psqlConnection & connection, psql_result_handler_t handler, psql_result_handler_t syncHandler, void * context);
+        ~psqlPipeline() {}
+
+        void enter();
+
+        /*
+        ** Only once every result is in...
+        */
+        void exit();
+
+        /*
+        ** Give up on what is in flight, e.g. the connection has
+        ** gone. Each statement and sync is handed back as aborted
+        ** (a batch may have committed without us hearing about it),
+        ** and the connection should be reset()...
+        */
+        void abandon();
+
+        void send(const string & name, psqlParams & params, uint64_t tag);
+        void sync(uint64_t tag = 0);
+
+        void flush();
+        void processResults();
+
+        /*
+        ** Block for up to timeoutMs for the socket, then flush()
+        ** and/or processResults(). Returns false if nothing
+        ** happened...
+        */
+        bool wait(int timeoutMs);
+
+        /*
+        ** EPOLLIN, and EPOLLOUT while there is data to send...
+        */
+        uint32_t getEvents();
+
+        bool isInPipeline() {
+            return isActive;
+        }
+
+        /*
+        ** Statements and syncs sent that we haven't had a
+        ** result for...
+        */
+        uint32_t getNumPending() {
+            return (uint32_t)pending.size();
+        }
+};
+
+/*
+** Rows for a COPY ... FROM STDIN (FORMAT binary), built straight
+** into a large buffer in the server's binary format and sent as
+** it fills, so a copy of any size costs no more memory than the
+** buffer...
+*/
+class psqlCopy {
+    private:
+        psqlConnection &    connection;
+
+        uint8_t *           buffer;
+        size_t              bufferSize;
+        size_t              length = 0;
+
+        uint64_t            numRows = 0;
+
+        uint8_t * next(size_t size);
+        void putInt16(int16_t value);
+        void putInt32(int32_t value);
+
+    public:
+        psqlCopy(psqlConnection & connection, size_t bufferSize = PSQL_COPY_BUFFER_SIZE);
+        ~psqlCopy();
+
+        void begin(const char * sql);
+
+        /*
+        ** Returns the number of rows the server copied...
+        */
+        uint64_t end();
+        void abort(const char * reason);
+        void flush();
+
+        /*
+        ** Each row is beginRow() with the number of fields, then
+        ** one add...() per field, in the order of the columns...
+        */
+        psqlCopy & beginRow(int numFields);
+
+        psqlCopy & addNull();
+        psqlCopy & addInt4(int32_t value);
+        psqlCopy & addTimestamp(uint64_t timestampNs);
+
+        /*
+        ** A NUMERIC with scale digits after the point (0 - 4).
+        ** NaN is sent as NaN, infinity as NULL...
+        */
+        psqlCopy & addNumeric(double value, int scale);
+
+        /*
+        ** What addNumeric() sends, written to buffer (at least
+        ** PSQL_NUMERIC_MAX_LEN bytes). Returns the length, or -1
+        ** for a value sent as NULL...
+        */
+        static int encodeNumeric(double value, int scale, uint8_t * buffer);
+
+        uint64_t getNumRows() {
+            return numRows;
+        }
 };
 
 #endif
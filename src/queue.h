@@ -0,0 +1,209 @@
+#include <atomic>
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/eventfd.h>
+
+using namespace std;
+
+#ifndef __INCL_QUEUE
+#define __INCL_QUEUE
+
+#define QUEUE_CACHE_LINE_SIZE               64
+
+/*
+** A bounded queue between exactly one producer thread and one
+** consumer thread, with no locks. The two ends each own an index
+** on its own cache line, so they never write to the same line.
+** Each end also keeps its own copy of the other end's index, and
+** only re-reads the real one when that copy says the queue looks
+** full (or empty).
+**
+** A consumer with nothing to do sleeps in its event loop, on an
+** eventfd that push() writes to, but only if the consumer has said
+** it is going to sleep, so a busy queue costs no system calls at
+** all...
+*/
+template <typename T, uint32_t Capacity>
+class spscQueue {
+    static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "spscQueue capacity must be a power of 2");
+
+    private:
+        static constexpr uint32_t       mask = Capacity - 1;
+
+        /*
+        ** Producer's cache line...
+        */
+        alignas(QUEUE_CACHE_LINE_SIZE) atomic<uint32_t>     tail{0};
+        uint32_t                                            cachedHead = 0;
+        atomic<uint32_t>                                    highWaterMark{0};
+        atomic<uint64_t>                                    numPushed{0};
+        atomic<uint64_t>                                    numDropped{0};
+
+        /*
+        ** Consumer's cache line...
+        */
+        alignas(QUEUE_CACHE_LINE_SIZE) atomic<uint32_t>     head{0};
+        uint32_t                                            cachedTail = 0;
+        atomic<bool>                                        isConsumerWaiting{false};
+
+        alignas(QUEUE_CACHE_LINE_SIZE) int                  eventFD = -1;
+
+        alignas(QUEUE_CACHE_LINE_SIZE) T                    slots[Capacity];
+
+        void wake() {
+            uint64_t one = 1;
+
+            if (eventFD >= 0) {
+                while (write(eventFD, &one, sizeof(one)) < 0 && errno == EINTR);
+            }
+        }
+
+    public:
+        spscQueue() {
+            eventFD = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        }
+
+        ~spscQueue() {
+            if (eventFD >= 0) {
+                close(eventFD);
+            }
+        }
+
+        spscQueue(const spscQueue &) = delete;
+        spscQueue & operator=(const spscQueue &) = delete;
+
+        /*
+        ** Producer only. If the queue is full the item is dropped
+        ** and counted, we never block the radio...
+        */
+        bool push(const T & item) {
+            uint32_t t = tail.load(memory_order_relaxed);
+
+            if (t - cachedHead >= Capacity) {
+                cachedHead = head.load(memory_order_acquire);
+
+                if (t - cachedHead >= Capacity) {
+                    numDropped.fetch_add(1, memory_order_relaxed);
+                    return false;
+                }
+            }
+
+            slots[t & mask] = item;
+
+            tail.store(t + 1, memory_order_release);
+
+            numPushed.fetch_add(1, memory_order_relaxed);
+
+            uint32_t depth = t + 1 - head.load(memory_order_relaxed);
+
+            if (depth > highWaterMark.load(memory_order_relaxed)) {
+                highWaterMark.store(depth, memory_order_relaxed);
+            }
+
+            /*
+            ** Pairs with the fence in armWakeup(), either we see the
+            ** consumer waiting or it sees our new tail...
+            */
+            atomic_thread_fence(memory_order_seq_cst);
+
+            if (isConsumerWaiting.load(memory_order_relaxed)) {
+                wake();
+            }
+
+            return true;
+        }
+
+        /*
+        ** Consumer only, returns false straight away if there
+        ** is nothing to pop...
+        */
+        bool pop(T & item) {
+            uint32_t h = head.load(memory_order_relaxed);
+
+            if (h == cachedTail) {
+                cachedTail = tail.load(memory_order_acquire);
+
+                if (h == cachedTail) {
+                    return false;
+                }
+            }
+
+            item = slots[h & mask];
+
+            head.store(h + 1, memory_order_release);
+
+            return true;
+        }
+
+        /*
+        ** For the consumer's event loop. Put the eventfd in the
+        ** loop, and once pop() has emptied the queue, call
+        ** armWakeup() before going back to sleep. If it returns
+        ** false something arrived in the meantime, so pop() again.
+        ** Call clearWakeup() when the eventfd fires...
+        */
+        int getEventFD() {
+            return eventFD;
+        }
+
+        bool armWakeup() {
+            isConsumerWaiting.store(true, memory_order_relaxed);
+
+            /*
+            ** Pairs with the fence in push()...
+            */
+            atomic_thread_fence(memory_order_seq_cst);
+
+            if (tail.load(memory_order_acquire) != head.load(memory_order_relaxed)) {
+                isConsumerWaiting.store(false, memory_order_relaxed);
+                return false;
+            }
+
+            return true;
+        }
+
+        /*
+        ** For a consumer leaving items in the queue on purpose
+        ** (e.g. waiting for a batch to fill), every push() wakes
+        ** it until clearWakeup()...
+        */
+        void armWakeupOnPush() {
+            isConsumerWaiting.store(true, memory_order_relaxed);
+            atomic_thread_fence(memory_order_seq_cst);
+        }
+
+        void clearWakeup() {
+            uint64_t count;
+
+            isConsumerWaiting.store(false, memory_order_relaxed);
+
+            if (eventFD >= 0) {
+                while (read(eventFD, &count, sizeof(count)) < 0 && errno == EINTR);
+            }
+        }
+
+        uint32_t getDepth() {
+            return tail.load(memory_order_acquire) - head.load(memory_order_acquire);
+        }
+
+        uint32_t getCapacity() {
+            return Capacity;
+        }
+
+        uint32_t getHighWaterMark() {
+            return highWaterMark.load(memory_order_relaxed);
+        }
+
+        uint64_t getNumPushed() {
+            return numPushed.load(memory_order_relaxed);
+        }
+
+        uint64_t getNumDropped() {
+            return numDropped.load(memory_order_relaxed);
+        }
+};
+
+#endif
@@ -1,17 +1,21 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <pthread.h>
 
 #include <lgpio.h>
 
 #include "cfgmgr.h"
 #include "logger.h"
 #include "radio.h"
+#include "nrfsim.h"
+#include "nrfreplay.h"
 
 using namespace std;
 
 void nrfcfg::validate() {
-    if (channel < 1 || channel > 39) {
+    if (channel < NRF24L01_MIN_CHANNEL || channel > NRF24L01_MAX_CHANNEL) {
         throw nrf24_error(nrf24_error::buildMsg("Invalid RF channel specified: %d", channel));
     }
 
@@ -23,9 +27,64 @@ void nrfcfg::validate() {
         throw nrf24_error(nrf24_error::buildMsg("Invalid address length specified: %d", addressLength));
     }
 
+    for (int pipe = 2;pipe < NRF24L01_NUM_RX_PIPES;pipe++) {
+        if (pipeAddress[pipe] == NULL) {
+            continue;
+        }
+
+        if (pipeAddress[1] == NULL) {
+            throw nrf24_error(nrf24_error::buildMsg("Pipe %d needs an address for pipe 1 to share", pipe));
+        }
+
+        /*
+        ** Only the LSB of pipes 2 - 5 is programmable...
+        */
+        for (int i = 1;i < addressLength;i++) {
+            int a = (i < (int)strlen(pipeAddress[1]) ? pipeAddress[1][i] : paddingByte);
+            int b = (i < (int)strlen(pipeAddress[pipe]) ? pipeAddress[pipe][i] : paddingByte);
+
+            if (a != b) {
+                throw nrf24_error(nrf24_error::buildMsg(
+                            "Address '%s' for pipe %d must match the pipe 1 address '%s' apart from the first character", 
+                            pipeAddress[pipe], 
+                            pipe, 
+                            pipeAddress[1]));
+            }
+        }
+    }
+
     isValidated = true;
 }
 
+nrfdevice & nrfdevice::getInstance() {
+    cfgmgr & cfg = cfgmgr::getInstance();
+
+    string backend = cfg.getValue("radio.backend");
+
+    if (backend.compare("sim") == 0) {
+        return nrfsim::getInstance();
+    }
+    else if (backend.compare("replay") == 0) {
+        return nrfreplay::getInstance();
+    }
+
+    return nrf24l01::getInstance();
+}
+
+static void _irqAlertHandler(int numAlerts, lgGpioAlert_p alerts, void * userdata) {
+    nrf24l01 * radio = (nrf24l01 *)userdata;
+
+    /*
+    ** The IRQ line is active low, we only care about the
+    ** falling edge when the radio asserts it...
+    */
+    for (int i = 0;i < numAlerts;i++) {
+        if (alerts[i].report.level == 0) {
+            radio->handleInterrupt(alerts[i].report.timestamp);
+        }
+    }
+}
+
 void inline nrf24l01::chipEnable() {
     lgGpioWrite(ceGPIOChipID, cePinID, 1);
 }
@@ -34,6 +93,108 @@ void inline nrf24l01::chipDisable() {
     lgGpioWrite(ceGPIOChipID, cePinID, 0);
 }
 
+int nrf24l01::spiXfer(char * txBuffer, char * rxBuffer, int count) {
+    spiTransactionCount++;
+
+    int rtn = lgSpiXfer(spiHandle, txBuffer, rxBuffer, count);
+
+    if (rtn > 0) {
+        lastStatus = (uint8_t)rxBuffer[0];
+    }
+
+    return rtn;
+}
+
+/*
+** STATUS, OBSERVE_TX, CD and FIFO_STATUS are changed by the
+** radio itself, and STATUS is write 1 to clear, so they are
+** never shadowed. 0x18 - 0x1B don't exist...
+*/
+bool nrf24l01::isShadowedRegister(int registerID) {
+    switch (registerID) {
+        case NRF24L01_REG_STATUS:
+        case NRF24L01_REG_OBSERVE_TX:
+        case NRF24L01_REG_CD:
+        case NRF24L01_REG_FIFO_STATUS:
+            return false;
+    }
+
+    return (registerID < NRF24L01_REG_FIFO_STATUS || registerID == NRF24L01_REG_DYNPD || registerID == NRF24L01_REG_FEATURE);
+}
+
+bool nrf24l01::isShadowMatch(int registerID, const uint8_t * buffer, uint16_t numBytes) {
+    if (!isShadowedRegister(registerID)) {
+        return false;
+    }
+
+    register_shadow_t & shadow = registerShadow[registerID];
+
+    return (
+        shadow.isValid && 
+        shadow.length == numBytes && 
+        memcmp(shadow.value, buffer, numBytes) == 0);
+}
+
+void nrf24l01::invalidateShadow() {
+    memset(registerShadow, 0, sizeof(registerShadow));
+}
+
+/*
+** Read back every register we have written and compare it with
+** the shadow. Each register needs its own transfer, the nRF24L01
+** doesn't auto-increment the address on a multi-byte read. With
+** isResync set, the chip's value is taken as the truth, this is
+** used straight after open() so a register the chip won't accept
+** (FEATURE on a non-plus part) doesn't fail every verify...
+*/
+int nrf24l01::compareShadow(bool isResync) {
+    logger & log = logger::getInstance();
+
+    uint8_t     buffer[NRF24L01_ADDRESS_LEN];
+    int         numMismatches = 0;
+
+    for (int registerID = 0;registerID < NRF24L01_NUM_REGISTERS;registerID++) {
+        register_shadow_t & shadow = registerShadow[registerID];
+
+        if (!shadow.isValid) {
+            continue;
+        }
+
+        int rtn = readRegister(registerID, buffer, shadow.length);
+
+        if (rtn < 0) {
+            throw nrf24_error(nrf24_error::buildMsg("Failed to transfer SPI data with radio: %s", lguErrorText(rtn)));
+        }
+
+        if (memcmp(shadow.value, buffer, shadow.length) != 0) {
+            if (isResync) {
+                log.logInfo(
+                    "Register 0x%02X read back as 0x%02X, not 0x%02X as written", 
+                    registerID, 
+                    buffer[0], 
+                    shadow.value[0]);
+
+                memcpy(shadow.value, buffer, shadow.length);
+            }
+            else {
+                log.logError(
+                    "Register 0x%02X has changed from 0x%02X to 0x%02X", 
+                    registerID, 
+                    shadow.value[0], 
+                    buffer[0]);
+            }
+
+            numMismatches++;
+        }
+    }
+
+    return numMismatches;
+}
+
+int nrf24l01::verify() {
+    return compareShadow(false);
+}
+
 int nrf24l01::readRegister(int registerID, uint8_t * buffer, uint16_t numBytes) {
     char txBuf[64];
     char rxBuf[64];
@@ -44,7 +205,7 @@ int nrf24l01::readRegister(int registerID, uint8_t * buffer, uint16_t numBytes)
        txBuf[i] = 0;
     }
  
-    int numBytesTransferred = lgSpiXfer(spiHandle, txBuf, rxBuf, numBytes + 1);
+    int numBytesTransferred = spiXfer(txBuf, rxBuf, numBytes + 1);
  
     if (numBytesTransferred >= 0) {
        for (int i = 0;i < numBytes;i++) {
@@ -60,6 +221,14 @@ int nrf24l01::readRegister(int registerID, uint8_t * buffer, uint16_t numBytes)
 int nrf24l01::writeRegister(int registerID, uint8_t * buffer, uint16_t numBytes) {
     char buf[64];
     char rxBuf[64];
+
+    /*
+    ** Don't bother the radio with a value it already has...
+    */
+    if (isShadowMatch(registerID, buffer, numBytes)) {
+        skippedWriteCount++;
+        return numBytes + 1;
+    }
  
     buf[0] = (char)((NRF24L01_CMD_W_REGISTER | registerID) & 0xFF);
  
@@ -67,7 +236,15 @@ int nrf24l01::writeRegister(int registerID, uint8_t * buffer, uint16_t numBytes)
        buf[i + 1] = buffer[i];
     }
  
-    int numBytesTransferred = lgSpiXfer(spiHandle, buf, rxBuf, numBytes + 1);
+    int numBytesTransferred = spiXfer(buf, rxBuf, numBytes + 1);
+
+    if (numBytesTransferred >= 0 && isShadowedRegister(registerID) && numBytes <= NRF24L01_ADDRESS_LEN) {
+        register_shadow_t & shadow = registerShadow[registerID];
+
+        memcpy(shadow.value, buffer, numBytes);
+        shadow.length = (uint8_t)numBytes;
+        shadow.isValid = true;
+    }
  
     return numBytesTransferred;
 }
@@ -75,7 +252,9 @@ int nrf24l01::writeRegister(int registerID, uint8_t * buffer, uint16_t numBytes)
 void nrf24l01::rfPowerDown() {
     chipDisable();
  
-    uint8_t registerConfig = NRF24L01_CFG_ENABLE_CRC | nrfConfig.numCRCBytes;
+    uint8_t registerConfig = 
+                NRF24L01_CFG_ENABLE_CRC | 
+                (nrfConfig.numCRCBytes == 1 ? NRF24L01_CFG_CRC_1_BYTE : NRF24L01_CFG_CRC_2_BYTE);
     writeRegister(NRF24L01_REG_CONFIG, &registerConfig, 1);
 }
 
@@ -88,6 +267,13 @@ void nrf24l01::rfPowerUpRx() {
                 NRF24L01_CFG_POWER_UP | 
                 NRF24L01_CFG_MODE_RX;
 
+    /*
+    ** In RX mode we only want the IRQ line to fire on RX_DR...
+    */
+    if (isIRQEnabled()) {
+        registerConfig |= NRF24L01_CFG_MASK_TX_DS | NRF24L01_CFG_MASK_MAX_RT;
+    }
+
     writeRegister(NRF24L01_REG_CONFIG, &registerConfig, 1);
  
     uint8_t registerStatus = NRF24L01_STATUS_CLEAR_RX_DR | NRF24L01_STATUS_CLEAR_TX_DS | NRF24L01_STATUS_CLEAR_MAX_RT;
@@ -101,11 +287,10 @@ void nrf24l01::rfPowerUpTx() {
  
     uint8_t registerConfig = 
                 NRF24L01_CFG_ENABLE_CRC | 
-                nrfConfig.numCRCBytes | 
+                (nrfConfig.numCRCBytes == 1 ? NRF24L01_CFG_CRC_1_BYTE : NRF24L01_CFG_CRC_2_BYTE) | 
                 NRF24L01_CFG_POWER_UP;
 
     writeRegister(NRF24L01_REG_CONFIG, &registerConfig, 1);
-    writeRegister(NRF24L01_REG_CONFIG, &registerConfig, 1);
  
     uint8_t registerStatus = NRF24L01_STATUS_CLEAR_RX_DR | NRF24L01_STATUS_CLEAR_TX_DS | NRF24L01_STATUS_CLEAR_MAX_RT;
     writeRegister(NRF24L01_REG_STATUS, &registerStatus, 1);
@@ -116,13 +301,13 @@ void nrf24l01::rfPowerUpTx() {
 void nrf24l01::rfFlushRx() {
     char rxBuf;
     char command = NRF24L01_CMD_FLUSH_RX;
-    lgSpiXfer(spiHandle, &command, &rxBuf, 1);
+    spiXfer(&command, &rxBuf, 1);
  }
 
 void nrf24l01::rfFlushTx() {
     char rxBuf;
     char command = NRF24L01_CMD_FLUSH_TX;
-    lgSpiXfer(spiHandle, &command, &rxBuf, 1);
+    spiXfer(&command, &rxBuf, 1);
 }
 
 void nrf24l01::setRFChannel(int channel) {
@@ -130,18 +315,42 @@ void nrf24l01::setRFChannel(int channel) {
     writeRegister(NRF24L01_REG_RF_CH, &registerRFChannel, 1);
 }
 
+void nrf24l01::setChannel(int channel) {
+    chipDisable();
+    setRFChannel(channel);
+    chipEnable();
+
+    nrfConfig.channel = channel;
+}
+
+bool nrf24l01::isCarrierDetected() {
+    uint8_t registerRPD = 0;
+
+    readRegister(NRF24L01_REG_CD, &registerRPD, 1);
+
+    return ((registerRPD & NRF24L01_RPD_RECEIVED_POWER) ? true : false);
+}
+
 void nrf24l01::setRFPayloadLength(int payloadLength, bool isACK) {
     if (payloadLength >= NRF24L01_MINIMUM_PACKET_LEN) {
         uint8_t registerPayloadN = payloadLength;
-        writeRegister(NRF24L01_REG_RX_PW_P0, &registerPayloadN, 1);
-        writeRegister(NRF24L01_REG_RX_PW_P1, &registerPayloadN, 1);
+
+        for (int pipe = 0;pipe < NRF24L01_NUM_RX_PIPES;pipe++) {
+            writeRegister(NRF24L01_REG_RX_PW_P0 + pipe, &registerPayloadN, 1);
+        }
 
         uint8_t registerDynPD = 0x00;
         writeRegister(NRF24L01_REG_DYNPD, &registerDynPD, 1);
         writeRegister(NRF24L01_REG_FEATURE, &registerDynPD, 1);
     }
     else {
-        uint8_t registerDynPD = NRF24L01_DYNPD_DPL_P0 | NRF24L01_DYNPD_DPL_P1;
+        uint8_t registerDynPD = 
+                    NRF24L01_DYNPD_DPL_P0 | 
+                    NRF24L01_DYNPD_DPL_P1 | 
+                    NRF24L01_DYNPD_DPL_P2 | 
+                    NRF24L01_DYNPD_DPL_P3 | 
+                    NRF24L01_DYNPD_DPL_P4 | 
+                    NRF24L01_DYNPD_DPL_P5;
         writeRegister(NRF24L01_REG_DYNPD, &registerDynPD, 1);
 
         uint8_t registerFeature;
@@ -191,6 +400,11 @@ void nrf24l01::setLocalAddress(const char * address) {
     }
 
     actualAddressLength = padAddress(txBuf, actualAddressLength);
+
+    if (isShadowMatch(NRF24L01_REG_RX_ADDR_PO, txBuf, actualAddressLength)) {
+        skippedWriteCount++;
+        return;
+    }
  
     chipDisable();
     writeRegister(NRF24L01_REG_RX_ADDR_PO, txBuf, actualAddressLength);
@@ -207,6 +421,13 @@ void nrf24l01::setRemoteAddress(const char * address) {
     }
 
     actualAddressLength = padAddress(txBuf, actualAddressLength);
+
+    if (isShadowMatch(NRF24L01_REG_TX_ADDR, txBuf, actualAddressLength) && 
+        isShadowMatch(NRF24L01_REG_RX_ADDR_PO, txBuf, actualAddressLength))
+    {
+        skippedWriteCount += 2;
+        return;
+    }
  
     chipDisable();
     writeRegister(NRF24L01_REG_TX_ADDR, txBuf, actualAddressLength);
@@ -214,19 +435,161 @@ void nrf24l01::setRemoteAddress(const char * address) {
     chipEnable();
 }
 
+void nrf24l01::setRxPipeAddress(int pipe, const char * address) {
+    uint8_t txBuf[64];
+
+    int actualAddressLength = strlen(address);
+
+    for (int i = 0;i < actualAddressLength;i++) {
+       txBuf[i] = address[i];
+    }
+
+    actualAddressLength = padAddress(txBuf, actualAddressLength);
+
+    /*
+    ** Pipes 2 - 5 take just the LSB, the rest comes from pipe 1...
+    */
+    if (pipe > 1) {
+        actualAddressLength = 1;
+    }
+
+    if (isShadowMatch(NRF24L01_REG_RX_ADDR_PO + pipe, txBuf, actualAddressLength)) {
+        skippedWriteCount++;
+        return;
+    }
+
+    chipDisable();
+    writeRegister(NRF24L01_REG_RX_ADDR_PO + pipe, txBuf, actualAddressLength);
+    chipEnable();
+}
+
+void nrf24l01::enableRxPipes(const char * pipeAddress[]) {
+    uint8_t registerEnableRxAddr = NRF24L01_EN_RXADDR_P0;
+    bool    isMultiPipe = false;
+
+    for (int pipe = 0;pipe < NRF24L01_NUM_RX_PIPES;pipe++) {
+        if (pipeAddress[pipe] != NULL) {
+            setRxPipeAddress(pipe, pipeAddress[pipe]);
+
+            registerEnableRxAddr |= (uint8_t)(1 << pipe);
+            isMultiPipe = true;
+        }
+    }
+
+    if (isMultiPipe) {
+        writeRegister(NRF24L01_REG_EN_RXADDR, &registerEnableRxAddr, 1);
+    }
+}
+
+void nrf24l01::configureIRQ(int IRQPin) {
+    logger & log = logger::getInstance();
+
+    int rtn = lgGpioClaimAlert(ceGPIOChipID, LG_SET_PULL_UP, LG_FALLING_EDGE, IRQPin, -1);
+
+    if (rtn < 0) {
+        throw nrf24_error(nrf24_error::buildMsg("Failed to claim IRQ pin %d: %s", IRQPin, lguErrorText(rtn)));
+    }
+
+    rtn = lgGpioSetAlertsFunc(ceGPIOChipID, IRQPin, &_irqAlertHandler, this);
+
+    if (rtn < 0) {
+        lgGpioFree(ceGPIOChipID, IRQPin);
+        throw nrf24_error(nrf24_error::buildMsg("Failed to register IRQ handler for pin %d: %s", IRQPin, lguErrorText(rtn)));
+    }
+
+    irqPinID = IRQPin;
+
+    log.logInfo("Receiving in IRQ mode on GPIO pin %d", irqPinID);
+}
+
+void nrf24l01::handleInterrupt(uint64_t timestamp) {
+    pthread_mutex_lock(&irqMutex);
+
+    /*
+    ** Keep the timestamp of the first interrupt we
+    ** haven't yet consumed...
+    */
+    if (!isIRQPending) {
+        irqTimestamp = timestamp;
+        isIRQPending = true;
+    }
+
+    pthread_cond_signal(&irqCondition);
+    pthread_mutex_unlock(&irqMutex);
+}
+
+bool nrf24l01::waitForInterrupt(uint32_t timeoutMs, uint64_t * timestamp) {
+    struct timespec     deadline;
+    int                 rtn = 0;
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+
+    deadline.tv_sec += timeoutMs / 1000U;
+    deadline.tv_nsec += (long)(timeoutMs % 1000U) * 1000000L;
+
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    int cancelState;
+
+    /*
+    ** pthread_cond_timedwait() is a cancellation point, which
+    ** would leave irqMutex locked...
+    */
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &cancelState);
+    pthread_mutex_lock(&irqMutex);
+
+    while (!isIRQPending && !isWaitCancelled && rtn == 0) {
+        rtn = pthread_cond_timedwait(&irqCondition, &irqMutex, &deadline);
+    }
+
+    bool isInterrupted = isIRQPending;
+
+    if (isInterrupted) {
+        *timestamp = irqTimestamp;
+        isIRQPending = false;
+    }
+
+    pthread_mutex_unlock(&irqMutex);
+    pthread_setcancelstate(cancelState, NULL);
+
+    return isInterrupted;
+}
+
+void nrf24l01::cancelWait() {
+    pthread_mutex_lock(&irqMutex);
+
+    isWaitCancelled = true;
+
+    pthread_cond_broadcast(&irqCondition);
+    pthread_mutex_unlock(&irqMutex);
+}
+
 bool nrf24l01::isDataReady() {
-    int status = getStatus();
+    char txBuffer[2];
+    char rxBuffer[2];
+
+    /*
+    ** Reading FIFO_STATUS clocks out STATUS as the first
+    ** byte, so one transfer gives us both registers...
+    */
+    txBuffer[0] = (char)(NRF24L01_CMD_R_REGISTER | NRF24L01_REG_FIFO_STATUS);
+    txBuffer[1] = 0;
+
+    if (spiXfer(txBuffer, rxBuffer, 2) < 0) {
+        return false;
+    }
+
+    uint8_t status = (uint8_t)rxBuffer[0];
+    uint8_t fifoStatus = (uint8_t)rxBuffer[1];
 
     if (status & NRF24L01_STATUS_R_RX_DR) {
         return true;
     }
 
-    uint8_t fifoStatus;
-    readRegister(NRF24L01_REG_FIFO_STATUS, &fifoStatus, 1);
-
-    bool dataReady = (int)(fifoStatus & NRF24L01_STATUS_R_TX_FIFO_FULL ? false : true);
-
-    return dataReady;
+    return ((fifoStatus & NRF24L01_FIFO_STATUS_RX_EMPTY) ? false : true);
 }
 
 uint8_t * nrf24l01::readPayload() {
@@ -240,7 +603,7 @@ uint8_t * nrf24l01::readPayload() {
         txBuffer[0] = NRF24L01_CMD_R_RX_PL_WID;
         txBuffer[1] = 0;
     
-        lgSpiXfer(spiHandle, txBuffer, plBuffer, 2);
+        spiXfer(txBuffer, plBuffer, 2);
         count = plBuffer[1];
     }
     else {
@@ -249,20 +612,121 @@ uint8_t * nrf24l01::readPayload() {
 
     readRegister(NRF24L01_REG_CONFIG | NRF24L01_CMD_R_RX_PAYLOAD, rxBuffer, count);
 
-    chipDisable();
- 
     uint8_t registerStatus = NRF24L01_STATUS_R_RX_DR;
     writeRegister(NRF24L01_REG_STATUS, &registerStatus, 1);
- 
-    chipEnable();
+
+    packetCount++;
  
     return rxBuffer;
 }
 
+/*
+** Drain the RX FIFO into the caller's buffer. Every SPI command
+** clocks STATUS out as its first byte, and RX_P_NO in STATUS
+** describes the payload at the head of the FIFO, so each
+** R_RX_PAYLOAD tells us which pipe the payload came from, or
+** that the FIFO was empty and the bytes can be thrown away.
+** That gives N + 2 transfers for N packets with a fixed payload
+** length: one per payload, one that finds the FIFO empty and one
+** to clear RX_DR, which also reports anything that arrived while
+** we were draining.
+*/
+span<nrf_payload_t> nrf24l01::readAllPayloads(span<nrf_payload_t> buffer) {
+    char        txBuffer[NRF24L01_MAXIMUM_PACKET_LEN + 1];
+    char        rxBuffer[NRF24L01_MAXIMUM_PACKET_LEN + 1];
+    size_t      numPayloads = 0;
+    bool        isRxDRCleared = false;
+
+    memset(txBuffer, 0, sizeof(txBuffer));
+
+    while (numPayloads < buffer.size()) {
+        int length = nrfConfig.payloadLength;
+
+        if (length == 0) {
+            txBuffer[0] = NRF24L01_CMD_R_RX_PL_WID;
+            txBuffer[1] = 0;
+
+            if (spiXfer(txBuffer, rxBuffer, 2) < 0) {
+                break;
+            }
+
+            if ((rxBuffer[0] & NRF24L01_STATUS_R_RX_P_NO_MASK) == NRF24L01_STATUS_R_RX_FIFO_EMPTY) {
+                length = 0;
+            }
+            else {
+                length = (int)rxBuffer[1];
+
+                if (length < NRF24L01_MINIMUM_PACKET_LEN || length > NRF24L01_MAXIMUM_PACKET_LEN) {
+                    /*
+                    ** A corrupt width means the payload has to be discarded...
+                    */
+                    rfFlushRx();
+                    break;
+                }
+            }
+        }
+
+        uint8_t status;
+
+        if (length > 0) {
+            txBuffer[0] = (char)NRF24L01_CMD_R_RX_PAYLOAD;
+
+            if (spiXfer(txBuffer, rxBuffer, length + 1) < 0) {
+                break;
+            }
+
+            status = (uint8_t)rxBuffer[0];
+        }
+        else {
+            status = NRF24L01_STATUS_R_RX_FIFO_EMPTY;
+        }
+
+        if ((status & NRF24L01_STATUS_R_RX_P_NO_MASK) != NRF24L01_STATUS_R_RX_FIFO_EMPTY) {
+            nrf_payload_t & payload = buffer[numPayloads++];
+
+            memcpy(payload.data, &rxBuffer[1], length);
+
+            payload.length = length;
+            payload.pipe = (status & NRF24L01_STATUS_R_RX_P_NO_MASK) >> 1;
+            payload.timestamp = 0;
+
+            isRxDRCleared = false;
+            continue;
+        }
+
+        if (isRxDRCleared) {
+            break;
+        }
+
+        /*
+        ** The FIFO is empty, clear RX_DR. The STATUS clocked out
+        ** by the write tells us if another packet landed in the
+        ** meantime, in which case we go round again...
+        */
+        txBuffer[0] = (char)(NRF24L01_CMD_W_REGISTER | NRF24L01_REG_STATUS);
+        txBuffer[1] = NRF24L01_STATUS_CLEAR_RX_DR;
+
+        if (spiXfer(txBuffer, rxBuffer, 2) < 0) {
+            break;
+        }
+
+        txBuffer[1] = 0;
+        isRxDRCleared = true;
+
+        if ((rxBuffer[0] & NRF24L01_STATUS_R_RX_P_NO_MASK) == NRF24L01_STATUS_R_RX_FIFO_EMPTY) {
+            break;
+        }
+    }
+
+    packetCount += numPayloads;
+
+    return buffer.first(numPayloads);
+}
+
 int nrf24l01::getStatus() {
     char command = NRF24L01_CMD_NOP;
     char status;
-    int numBytesTransferred = lgSpiXfer(spiHandle, &command, &status, 1);
+    int numBytesTransferred = spiXfer(&command, &status, 1);
  
     if (numBytesTransferred >= 0) {
         return (int)status;
@@ -297,10 +761,43 @@ void nrf24l01::open(nrfcfg & cfg) {
         throw nrf24_error("Error, radio has not been configured or the configuartion is invalid");
     }
 
+    /*
+    ** Opened again without being closed (e.g. a restarted thread),
+    ** let go of the handles and pins we already have first...
+    */
+    if (isOpen) {
+        close();
+    }
+
+    nrfConfig = cfg;
+
+    /*
+    ** A cancelWait() from the last time we were stopped would
+    ** otherwise stop every wait from sleeping...
+    */
+    pthread_mutex_lock(&irqMutex);
+    isWaitCancelled = false;
+    isIRQPending = false;
+    pthread_mutex_unlock(&irqMutex);
+
+    configureSPI(cfg.spiFrequency, cfg.cePin);
+
+    isOpen = true;
+
+    /*
+    ** We can't assume anything about a radio we've only just
+    ** opened, it may have been reset since we last wrote to it...
+    */
+    invalidateShadow();
+
     log.logInfo("Got RF channel: %d", cfg.channel);
     log.logInfo("Got local address '%s'", cfg.localAddress);
     log.logInfo("Got remote address '%s'", cfg.remoteAddress);
 
+    if (cfg.irqPin != NRF_IRQ_PIN_NONE) {
+        configureIRQ(cfg.irqPin);
+    }
+
     setRFChannel(cfg.channel);
     setRFPayloadLength(cfg.payloadLength, false);
     setRFAddressLength(cfg.addressLength);
@@ -324,6 +821,8 @@ void nrf24l01::open(nrfcfg & cfg) {
     setLocalAddress(cfg.localAddress);
     setRemoteAddress(cfg.remoteAddress);
 
+    enableRxPipes(cfg.pipeAddress);
+
     rfFlushRx();
     rfFlushTx();
 
@@ -346,12 +845,26 @@ void nrf24l01::open(nrfcfg & cfg) {
     if (configRegister == 0x00) {
         throw nrf24_error("Config read back as 0x00, device is probably not plugged in?");
     }
+
+    compareShadow(true);
 }
 
 void nrf24l01::close() {
+    if (!isOpen) {
+        return;
+    }
+
+    isOpen = false;
+
     rfPowerDown();
 
     lgSpiClose(spiHandle);
+
+    if (isIRQEnabled()) {
+        lgGpioFree(ceGPIOChipID, irqPinID);
+        irqPinID = NRF_IRQ_PIN_NONE;
+    }
+
     lgGpioFree(ceGPIOChipID, cePinID);
     lgGpiochipClose(ceGPIOChipID);
 }
@@ -1,6 +1,10 @@
+#include <string>
+#include <span>
 #include <exception>
 
 #include <stdint.h>
+#include <stdarg.h>
+#include <pthread.h>
 
 using namespace std;
 
@@ -11,6 +15,21 @@ using namespace std;
 #define NRF24L01_MINIMUM_PACKET_LEN                  1
 #define NRF24L01_MAXIMUM_PACKET_LEN                 NRF24L01_DEFAULT_PACKET_LEN
 
+#define NRF24L01_RX_FIFO_DEPTH                       3
+#define NRF24L01_NUM_RX_PIPES                        6
+
+/*
+** The channels we allow, 2401 - 2439 MHz...
+*/
+#define NRF24L01_MIN_CHANNEL                         1
+#define NRF24L01_MAX_CHANNEL                        39
+
+/*
+** RPD is only valid 130us (standby to RX) + 40us (AGC) after
+** entering RX mode, allow a little extra...
+*/
+#define NRF24L01_RPD_SETTLE_US                     200
+
 /*
 ** nRF24L01 commands
 */
@@ -59,6 +78,19 @@ using namespace std;
 #define NRF24L01_REG_DYNPD                          0x1C
 #define NRF24L01_REG_FEATURE                        0x1D
 
+#define NRF24L01_NUM_REGISTERS                      0x1E
+#define NRF24L01_ADDRESS_LEN                        5
+
+/*
+** EN_RXADDR register flags...
+*/
+#define NRF24L01_EN_RXADDR_P0                       0x01
+#define NRF24L01_EN_RXADDR_P1                       0x02
+#define NRF24L01_EN_RXADDR_P2                       0x04
+#define NRF24L01_EN_RXADDR_P3                       0x08
+#define NRF24L01_EN_RXADDR_P4                       0x10
+#define NRF24L01_EN_RXADDR_P5                       0x20
+
 /*
 ** RF_SETUP register flags...
 */
@@ -105,8 +137,22 @@ using namespace std;
 
 #define NRF24L01_STATUS_R_TX_FIFO_FULL              0x01
 #define NRF24L01_STATUS_R_RX_FIFO_EMPTY             0x0E
+#define NRF24L01_STATUS_R_RX_P_NO_MASK              0x0E
 #define NRF24L01_STATUS_R_RX_DR                     0x40
 
+/*
+** FIFO_STATUS register flags...
+*/
+#define NRF24L01_FIFO_STATUS_RX_EMPTY               0x01
+#define NRF24L01_FIFO_STATUS_RX_FULL                0x02
+#define NRF24L01_FIFO_STATUS_TX_EMPTY               0x10
+#define NRF24L01_FIFO_STATUS_TX_FULL                0x20
+
+/*
+** RPD (CD) register flags...
+*/
+#define NRF24L01_RPD_RECEIVED_POWER                 0x01
+
 /*
 ** FEATURE register flags...
 */
@@ -128,6 +174,7 @@ using namespace std;
 #define NRF_SPI_CHANNEL                             0
 #define NRF_SPI_FREQUENCY                           4000000U
 #define NRF_SPI_CE_PIN                              25
+#define NRF_IRQ_PIN_NONE                            -1
 
 class nrf24_error : public exception {
     private:
@@ -176,8 +223,17 @@ class nrf24_error : public exception {
         }
 };
 
+typedef struct {
+    uint8_t             data[NRF24L01_MAXIMUM_PACKET_LEN];
+    int                 length;
+    int                 pipe;
+    uint64_t            timestamp;                  // ns since the epoch, 0 if the backend doesn't know
+}
+nrf_payload_t;
+
 class nrfcfg {
     friend class nrf24l01;
+    friend class nrfsim;
 
     private:
         bool isValidated = false;
@@ -210,14 +266,74 @@ class nrfcfg {
         rf_power        rfPower = rf_power_high;
         bool            lnaGainOn = true;
         uint8_t         paddingByte = 0x20;
+        uint32_t        spiFrequency = NRF_SPI_FREQUENCY;
+        int             cePin = NRF_SPI_CE_PIN;
+        int             irqPin = NRF_IRQ_PIN_NONE;
 
         const char *    localAddress;
         const char *    remoteAddress;
 
+        /*
+        ** Per pipe RX addresses, NULL if the pipe isn't used. Pipes
+        ** 2 - 5 only have their own LSB (the first character), the
+        ** rest of their address is shared with pipe 1...
+        */
+        const char *    pipeAddress[NRF24L01_NUM_RX_PIPES] = {NULL, NULL, NULL, NULL, NULL, NULL};
+
         void validate();
 };
 
-class nrf24l01 {
+/*
+** The interface the rest of wctl talks to, implemented by the
+** real nRF24L01 driver and by the simulator (nrfsim.h). Pick
+** one with radio.backend in the config...
+*/
+class nrfdevice {
+    public:
+        static nrfdevice & getInstance();
+
+        virtual ~nrfdevice() {}
+
+        virtual void open(nrfcfg & cfg) = 0;
+        virtual void close() = 0;
+
+        virtual bool isIRQEnabled() = 0;
+        virtual bool waitForInterrupt(uint32_t timeoutMs, uint64_t * timestamp) = 0;
+
+        /*
+        ** Used at shutdown, wakes a thread blocked in
+        ** waitForInterrupt(), which returns false straight away
+        ** from then on. Safe to call from any thread...
+        */
+        virtual void cancelWait() = 0;
+
+        virtual bool isDataReady() = 0;
+        virtual uint8_t * readPayload() = 0;
+        virtual span<nrf_payload_t> readAllPayloads(span<nrf_payload_t> buffer) = 0;
+
+        virtual double getSPITransactionsPerPacket() = 0;
+
+        /*
+        ** Retune while in RX mode, and sample the Received Power
+        ** Detector (> -64dBm on the current channel since RX mode
+        ** was entered). The channel is entered afresh each time
+        ** setChannel() is called, even if it hasn't changed...
+        */
+        virtual void setChannel(int channel) = 0;
+        virtual int getChannel() = 0;
+        virtual bool isCarrierDetected() = 0;
+
+        /*
+        ** Check the device still holds the configuration we gave
+        ** it, returns the number of registers that differ. Backends
+        ** with nothing to check don't need to override it...
+        */
+        virtual int verify() {
+            return 0;
+        }
+};
+
+class nrf24l01 : public nrfdevice {
     public:
         static nrf24l01 & getInstance() {
             static nrf24l01 nrf;
@@ -232,14 +348,58 @@ class nrf24l01 {
         int             spiDevice;
 
         int             cePinID;
+        int             irqPinID = NRF_IRQ_PIN_NONE;
+
+        bool            isOpen = false;
+
+        /*
+        ** IRQ state, set from the lgpio alert thread...
+        */
+        pthread_mutex_t irqMutex = PTHREAD_MUTEX_INITIALIZER;
+        pthread_cond_t  irqCondition = PTHREAD_COND_INITIALIZER;
+        bool            isIRQPending = false;
+        bool            isWaitCancelled = false;
+        uint64_t        irqTimestamp = 0;
 
         nrfcfg          nrfConfig;
 
+        /*
+        ** The last value we wrote to each configuration register,
+        ** the address registers hold up to 5 bytes...
+        */
+        typedef struct {
+            uint8_t         value[NRF24L01_ADDRESS_LEN];
+            uint8_t         length;
+            bool            isValid;
+        }
+        register_shadow_t;
+
+        register_shadow_t   registerShadow[NRF24L01_NUM_REGISTERS];
+
+        /*
+        ** STATUS as clocked out by the most recent transfer...
+        */
+        uint8_t         lastStatus = 0;
+
+        /*
+        ** SPI accounting, so we can see what each packet costs...
+        */
+        uint64_t        spiTransactionCount = 0;
+        uint64_t        packetCount = 0;
+        uint64_t        skippedWriteCount = 0;
+
         nrf24l01() {}
 
+        int spiXfer(char * txBuffer, char * rxBuffer, int count);
+
         int readRegister(int registerID, uint8_t * buffer, uint16_t numBytes);
         int writeRegister(int registerID, uint8_t * buffer, uint16_t numBytes);
 
+        static bool isShadowedRegister(int registerID);
+        bool isShadowMatch(int registerID, const uint8_t * buffer, uint16_t numBytes);
+        void invalidateShadow();
+        int compareShadow(bool isResync);
+
         void chipEnable();
         void chipDisable();
 
@@ -263,19 +423,61 @@ class nrf24l01 {
 
         void setLocalAddress(const char * address);
         void setRemoteAddress(const char * address);
+        void setRxPipeAddress(int pipe, const char * address);
+        void enableRxPipes(const char * pipeAddress[]);
+
+        void configureSPI(uint32_t spiFrequency, int CEPin);
+        void configureIRQ(int IRQPin);
 
     public:
         ~nrf24l01() {}
 
-        void configureSPI(uint32_t spiFrequency, int CEPin);
-        void open(nrfcfg & cfg);
+        void open(nrfcfg & cfg) override;
+        void close() override;
 
-        void close();
+        bool isIRQEnabled() override {
+            return (irqPinID != NRF_IRQ_PIN_NONE);
+        }
 
-        bool isDataReady();
-        uint8_t * readPayload();
+        void handleInterrupt(uint64_t timestamp);
+        bool waitForInterrupt(uint32_t timeoutMs, uint64_t * timestamp) override;
+        void cancelWait() override;
+
+        bool isDataReady() override;
+        uint8_t * readPayload() override;
+        span<nrf_payload_t> readAllPayloads(span<nrf_payload_t> buffer) override;
 
         int getStatus();
+
+        uint8_t getLastStatus() {
+            return lastStatus;
+        }
+
+        int verify() override;
+
+        void setChannel(int channel) override;
+
+        int getChannel() override {
+            return nrfConfig.channel;
+        }
+
+        bool isCarrierDetected() override;
+
+        uint64_t getSkippedWriteCount() {
+            return skippedWriteCount;
+        }
+
+        uint64_t getSPITransactionCount() {
+            return spiTransactionCount;
+        }
+
+        uint64_t getPacketCount() {
+            return packetCount;
+        }
+
+        double getSPITransactionsPerPacket() override {
+            return (packetCount > 0 ? (double)spiTransactionCount / (double)packetCount : 0.0);
+        }
 };
 
 #endif
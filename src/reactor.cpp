@@ -0,0 +1,249 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+
+#include "reactor.h"
+
+using namespace std;
+
+eventLoop::eventLoop() {
+    epollFD = epoll_create1(EPOLL_CLOEXEC);
+
+    if (epollFD < 0) {
+        throw reactor_error(reactor_error::buildMsg("Failed to create epoll set: %s", strerror(errno)));
+    }
+
+    stopFD = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    if (stopFD < 0) {
+        close(epollFD);
+        throw reactor_error(reactor_error::buildMsg("Failed to create eventfd: %s", strerror(errno)));
+    }
+
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+
+    ev.events = EPOLLIN;
+    ev.data.fd = stopFD;
+
+    epoll_ctl(epollFD, EPOLL_CTL_ADD, stopFD, &ev);
+}
+
+eventLoop::~eventLoop() {
+    for (auto& i : sources) {
+        if (i.second.isTimer) {
+            close(i.first);
+        }
+    }
+
+    close(stopFD);
+    close(epollFD);
+}
+
+void eventLoop::add(int fd, uint32_t events, event_handler_t handler, void * context, bool isTimer) {
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+
+    ev.events = events;
+    ev.data.fd = fd;
+
+    if (epoll_ctl(epollFD, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        throw reactor_error(reactor_error::buildMsg("Failed to add fd %d to epoll set: %s", fd, strerror(errno)));
+    }
+
+    event_source_t & source = sources[fd];
+
+    source.fd = fd;
+    source.handler = handler;
+    source.context = context;
+    source.isTimer = isTimer;
+}
+
+void eventLoop::addFD(int fd, uint32_t events, event_handler_t handler, void * context) {
+    add(fd, events, handler, context, false);
+}
+
+void eventLoop::modifyFD(int fd, uint32_t events) {
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+
+    ev.events = events;
+    ev.data.fd = fd;
+
+    if (epoll_ctl(epollFD, EPOLL_CTL_MOD, fd, &ev) < 0) {
+        throw reactor_error(reactor_error::buildMsg("Failed to modify fd %d in epoll set: %s", fd, strerror(errno)));
+    }
+}
+
+void eventLoop::removeFD(int fd) {
+    epoll_ctl(epollFD, EPOLL_CTL_DEL, fd, NULL);
+    sources.erase(fd);
+}
+
+int eventLoop::addTimer(uint32_t intervalMs, bool isPeriodic, event_handler_t handler, void * context) {
+    int timerFD = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+    if (timerFD < 0) {
+        throw reactor_error(reactor_error::buildMsg("Failed to create timerfd: %s", strerror(errno)));
+    }
+
+    try {
+        add(timerFD, EPOLLIN, handler, context, true);
+    }
+    catch (reactor_error & e) {
+        close(timerFD);
+        throw;
+    }
+
+    setTimer(timerFD, intervalMs, isPeriodic);
+
+    return timerFD;
+}
+
+void eventLoop::setTimer(int timerFD, uint32_t intervalMs, bool isPeriodic) {
+    struct itimerspec spec;
+
+    memset(&spec, 0, sizeof(spec));
+
+    if (intervalMs == 0) {
+        /*
+        ** An all zero it_value would disarm the timer...
+        */
+        spec.it_value.tv_nsec = 1;
+    }
+    else {
+        spec.it_value.tv_sec = intervalMs / 1000U;
+        spec.it_value.tv_nsec = (long)(intervalMs % 1000U) * 1000000L;
+    }
+
+    if (isPeriodic && intervalMs > 0) {
+        spec.it_interval = spec.it_value;
+    }
+
+    timerfd_settime(timerFD, 0, &spec, NULL);
+}
+
+void eventLoop::disarmTimer(int timerFD) {
+    struct itimerspec spec;
+
+    memset(&spec, 0, sizeof(spec));
+
+    timerfd_settime(timerFD, 0, &spec, NULL);
+}
+
+void eventLoop::removeTimer(int timerFD) {
+    removeFD(timerFD);
+    close(timerFD);
+}
+
+int eventLoop::runOnce(int timeoutMs) {
+    struct epoll_event  events[REACTOR_MAX_EVENTS];
+    int                 numHandled = 0;
+
+    int numEvents = epoll_wait(epollFD, events, REACTOR_MAX_EVENTS, timeoutMs);
+
+    if (numEvents < 0) {
+        if (errno == EINTR) {
+            return 0;
+        }
+
+        throw reactor_error(reactor_error::buildMsg("epoll_wait failed: %s", strerror(errno)));
+    }
+
+    for (int i = 0;i < numEvents;i++) {
+        int fd = events[i].data.fd;
+
+        /*
+        ** Whatever else is ready stays ready for the next
+        ** runOnce(), if there is one...
+        */
+        if (isStopped) {
+            break;
+        }
+
+        if (fd == stopFD) {
+            uint64_t count;
+
+            while (read(stopFD, &count, sizeof(count)) < 0 && errno == EINTR);
+
+            isStopped = true;
+            continue;
+        }
+
+        /*
+        ** An earlier handler in this batch may have removed it...
+        */
+        auto it = sources.find(fd);
+
+        if (it == sources.end()) {
+            continue;
+        }
+
+        event_source_t source = it->second;
+
+        if (source.isTimer) {
+            uint64_t numExpiries;
+
+            if (read(fd, &numExpiries, sizeof(numExpiries)) < 0) {
+                continue;
+            }
+        }
+
+        source.handler(fd, events[i].events, source.context);
+
+        numHandled++;
+    }
+
+    return numHandled;
+}
+
+void eventLoop::run() {
+    uint64_t count;
+
+    while (!isStopped) {
+        runOnce(-1);
+    }
+
+    /*
+    ** If we stopped before reading the eventfd, it mustn't
+    ** stop the next run()...
+    */
+    while (read(stopFD, &count, sizeof(count)) < 0 && errno == EINTR);
+
+    isStopped = false;
+}
+
+void eventLoop::stop() {
+    uint64_t one = 1;
+
+    while (write(stopFD, &one, sizeof(one)) < 0 && errno == EINTR);
+
+    isStopped = true;
+}
+
+int createSignalFD(const sigset_t * signals) {
+    int rtn = pthread_sigmask(SIG_BLOCK, signals, NULL);
+
+    if (rtn != 0) {
+        throw reactor_error(reactor_error::buildMsg("Failed to block signals: %s", strerror(rtn)));
+    }
+
+    int signalFD = signalfd(-1, signals, SFD_NONBLOCK | SFD_CLOEXEC);
+
+    if (signalFD < 0) {
+        throw reactor_error(reactor_error::buildMsg("Failed to create signalfd: %s", strerror(errno)));
+    }
+
+    return signalFD;
+}
@@ -0,0 +1,142 @@
+#include <string>
+#include <unordered_map>
+#include <exception>
+#include <atomic>
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <sys/epoll.h>
+
+using namespace std;
+
+#ifndef __INCL_REACTOR
+#define __INCL_REACTOR
+
+#define REACTOR_MAX_EVENTS                  16
+
+class reactor_error : public exception {
+    private:
+        string message;
+        static const int MESSAGE_BUFFER_LEN = 4096;
+
+    public:
+        const char * getTitle() {
+            return "Reactor Error: ";
+        }
+
+        reactor_error() {
+            this->message.assign(getTitle());
+        }
+
+        reactor_error(const char * msg) : reactor_error() {
+            this->message.append(msg);
+        }
+
+        reactor_error(const char * msg, const char * file, int line) : reactor_error() {
+            char lineNumBuf[8];
+
+            snprintf(lineNumBuf, 8, ":%d", line);
+
+            this->message.append(msg);
+            this->message.append(" at ");
+            this->message.append(file);
+            this->message.append(lineNumBuf);
+        }
+
+        virtual const char * what() const noexcept {
+            return this->message.c_str();
+        }
+
+        static char * buildMsg(const char * fmt, ...) {
+            va_list     args;
+            char *      buffer;
+
+            buffer = (char *)malloc(MESSAGE_BUFFER_LEN);
+
+            va_start(args, fmt);
+            vsnprintf(buffer, MESSAGE_BUFFER_LEN, fmt, args);
+            va_end(args);
+
+            return buffer;
+        }
+};
+
+/*
+** Called when a file descriptor is ready, events are the
+** EPOLLIN/EPOLLOUT/... bits that fired...
+*/
+typedef void (* event_handler_t)(int fd, uint32_t events, void * context);
+
+/*
+** One epoll set and the handlers for everything in it. A thread
+** builds one, adds its file descriptors and timers, and calls
+** run(), which sleeps in the kernel until something happens.
+** Everything but stop() must be called from the thread running
+** the loop...
+*/
+class eventLoop {
+    private:
+        typedef struct {
+            int                 fd;
+            event_handler_t     handler;
+            void *              context;
+            bool                isTimer;
+        }
+        event_source_t;
+
+        int                 epollFD = -1;
+        int                 stopFD = -1;
+        atomic<bool>        isStopped{false};
+
+        unordered_map<int, event_source_t>  sources;
+
+        void add(int fd, uint32_t events, event_handler_t handler, void * context, bool isTimer);
+
+    public:
+        eventLoop();
+        ~eventLoop();
+
+        void addFD(int fd, uint32_t events, event_handler_t handler, void * context);
+        void modifyFD(int fd, uint32_t events);
+        void removeFD(int fd);
+
+        /*
+        ** Timers are timerfds, the loop reads off the expiry
+        ** count before calling the handler. A zero interval on
+        ** setTimer() fires as soon as possible...
+        */
+        int addTimer(uint32_t intervalMs, bool isPeriodic, event_handler_t handler, void * context);
+        void setTimer(int timerFD, uint32_t intervalMs, bool isPeriodic);
+        void disarmTimer(int timerFD);
+        void removeTimer(int timerFD);
+
+        /*
+        ** Wait up to timeoutMs (-1 for ever) and dispatch whatever
+        ** is ready, returns the number of events handled...
+        */
+        int runOnce(int timeoutMs);
+
+        /*
+        ** Dispatch events until stop() is called...
+        */
+        void run();
+
+        /*
+        ** Safe to call from any thread, or from a handler, in which
+        ** case nothing else ready in this pass is dispatched...
+        */
+        void stop();
+};
+
+/*
+** Block the signals in the calling thread (threads created
+** afterwards inherit the mask) and return a signalfd that
+** becomes readable when one of them arrives...
+*/
+int createSignalFD(const sigset_t * signals);
+
+#endif
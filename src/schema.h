@@ -0,0 +1,218 @@
+#include <utility>
+#include <type_traits>
+
+#include <stddef.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "radio.h"
+#include "packet.h"
+
+using namespace std;
+
+#ifndef __INCL_SCHEMA
+#define __INCL_SCHEMA
+
+/*
+** The wire format of each packet the station sends, described
+** once at compile time. Each field knows its offset, width and
+** signedness, and can decode itself from (or encode itself into)
+** a payload buffer. Multi-byte fields are little endian, as sent
+** by the station. Width is a template parameter, so decode() is
+** a handful of loads, shifts and ORs with no loops or branches...
+*/
+template <size_t Offset, size_t Width, bool Signed>
+struct wire_field {
+    static_assert(Width >= 1 && Width <= 4, "wire_field width must be 1 - 4 bytes");
+
+    typedef typename conditional<Signed, int32_t, uint32_t>::type value_type;
+
+    static constexpr size_t     offset = Offset;
+    static constexpr size_t     width = Width;
+    static constexpr size_t     end = Offset + Width;
+    static constexpr bool       isSigned = Signed;
+
+    static constexpr int64_t    minimum = (Signed ? -(1LL << (Width * 8 - 1)) : 0LL);
+    static constexpr int64_t    maximum = (Signed ? (1LL << (Width * 8 - 1)) - 1LL : (1LL << (Width * 8)) - 1LL);
+
+    private:
+        template <size_t... I>
+        static constexpr uint32_t load(const uint8_t * payload, index_sequence<I...>) {
+            return (((uint32_t)payload[Offset + I] << (I * 8)) | ...);
+        }
+
+        template <size_t... I>
+        static constexpr void store(uint8_t * payload, uint32_t raw, index_sequence<I...>) {
+            ((payload[Offset + I] = (uint8_t)(raw >> (I * 8))), ...);
+        }
+
+    public:
+        static constexpr value_type decode(const uint8_t * payload) {
+            uint32_t raw = load(payload, make_index_sequence<Width>{});
+
+            if constexpr (Signed) {
+                /*
+                ** Sign extend by shifting the top bit of the field
+                ** up to bit 31 and arithmetic shifting back...
+                */
+                constexpr int shift = 32 - (int)(Width * 8);
+
+                return (int32_t)(raw << shift) >> shift;
+            }
+            else {
+                return raw;
+            }
+        }
+
+        static constexpr void encode(uint8_t * payload, value_type value) {
+            store(payload, (uint32_t)value, make_index_sequence<Width>{});
+        }
+};
+
+/*
+** A wire field converted to a real value by value = raw * Scale + Bias...
+*/
+template <typename Field, float Scale, float Bias = 0.0f>
+struct scaled_field {
+    typedef Field field;
+
+    static constexpr size_t     offset = Field::offset;
+    static constexpr size_t     end = Field::end;
+    static constexpr float      scale = Scale;
+    static constexpr float      bias = Bias;
+
+    static constexpr float decode(const uint8_t * payload) {
+        return (float)Field::decode(payload) * Scale + Bias;
+    }
+
+    /*
+    ** The nearest raw value, clamped to what the field can hold...
+    */
+    static void encode(uint8_t * payload, double value) {
+        double raw = round((value - (double)Bias) / (double)Scale);
+
+        raw = fmin(fmax(raw, (double)Field::minimum), (double)Field::maximum);
+
+        Field::encode(payload, (typename Field::value_type)raw);
+    }
+};
+
+/*
+** Conversion factors for the station's sensors...
+*/
+#define SCHEMA_BATTERY_VOLTS_FACTOR         0.000078125f
+#define SCHEMA_BATTERY_CRATE_FACTOR         0.208f
+
+/*
+** TMP117 and SHT4x...
+*/
+#define SCHEMA_TEMPERATURE_CELCIUS_FACTOR   0.0078125f
+#define SCHEMA_HUMIDITY_RH_FACTOR           0.0019074f
+#define SCHEMA_HUMIDITY_RH_BIAS             -6.0f
+
+/*
+** ICP10125 reports pressure in Pa...
+*/
+#define SCHEMA_PRESSURE_HPA_FACTOR          0.01f
+
+/*
+** Wind speed per anemometer count, before the station's
+** anemometer calibration factor is applied...
+*/
+#define SCHEMA_ANEMOMETER_MPH               0.0052658575613333f
+#define SCHEMA_ANEMOMETER_METRES_PER_SEC    0.0565486677646163f
+
+/*
+** Each tip of the bucket in the rain gauge equates
+** to 0.2794mm of rainfall...
+*/
+#define SCHEMA_RAIN_GAUGE_MM                0.2794f
+
+struct weather_schema {
+    static constexpr uint8_t    packetID = PACKET_ID_WEATHER;
+
+    typedef wire_field<0x00, 1, false>                                                      id;
+    typedef wire_field<0x01, 3, false>                                                      packetNum;
+    typedef wire_field<0x04, 1, false>                                                      status;
+    typedef scaled_field<wire_field<0x05, 1, false>, 1.0f>                                  batteryPercentage;
+    typedef scaled_field<wire_field<0x06, 2, true>, SCHEMA_BATTERY_CRATE_FACTOR>            batteryChargeRate;
+    typedef scaled_field<wire_field<0x08, 2, false>, SCHEMA_BATTERY_VOLTS_FACTOR>           batteryVolts;
+    typedef scaled_field<wire_field<0x0A, 2, true>, SCHEMA_TEMPERATURE_CELCIUS_FACTOR>      temperature;
+    typedef wire_field<0x0C, 4, false>                                                      rawPressure;
+    typedef scaled_field<rawPressure, SCHEMA_PRESSURE_HPA_FACTOR>                           pressure;
+    typedef scaled_field<wire_field<0x10, 2, false>, SCHEMA_HUMIDITY_RH_FACTOR, SCHEMA_HUMIDITY_RH_BIAS>   humidity;
+    typedef scaled_field<wire_field<0x12, 2, false>, SCHEMA_RAIN_GAUGE_MM>                  rainfall;
+    typedef wire_field<0x14, 2, false>                                                      rawWindspeed;
+    typedef scaled_field<rawWindspeed, SCHEMA_ANEMOMETER_MPH>                               windspeed;
+    typedef scaled_field<rawWindspeed, SCHEMA_ANEMOMETER_METRES_PER_SEC>                    windspeedms;
+    typedef wire_field<0x16, 2, false>                                                      rawWindGust;
+    typedef scaled_field<rawWindGust, SCHEMA_ANEMOMETER_MPH>                                windGust;
+    typedef scaled_field<rawWindGust, SCHEMA_ANEMOMETER_METRES_PER_SEC>                     windGustms;
+
+    static constexpr size_t     length = rawWindGust::end;
+};
+
+struct sleep_schema {
+    static constexpr uint8_t    packetID = PACKET_ID_SLEEP;
+
+    typedef wire_field<0x00, 1, false>                                                      id;
+    typedef wire_field<0x02, 2, false>                                                      status;
+    typedef wire_field<0x04, 2, false>                                                      sleepHours;
+    typedef scaled_field<wire_field<0x06, 2, false>, SCHEMA_BATTERY_VOLTS_FACTOR>           batteryVolts;
+    typedef scaled_field<wire_field<0x08, 2, false>, 1.0f>                                  batteryPercentage;
+
+    static constexpr size_t     length = batteryPercentage::end;
+};
+
+struct watchdog_schema {
+    static constexpr uint8_t    packetID = PACKET_ID_WATCHDOG;
+
+    typedef wire_field<0x00, 1, false>                                                      id;
+    typedef wire_field<0x02, 2, false>                                                      status;
+
+    static constexpr size_t     length = status::end;
+};
+
+static_assert(weather_schema::length <= NRF24L01_MAXIMUM_PACKET_LEN, "Weather packet is too long for the radio");
+static_assert(sleep_schema::length <= NRF24L01_MAXIMUM_PACKET_LEN, "Sleep packet is too long for the radio");
+static_assert(watchdog_schema::length <= NRF24L01_MAXIMUM_PACKET_LEN, "Watchdog packet is too long for the radio");
+
+/*
+** Little endian and sign extension, checked by the compiler...
+*/
+static constexpr uint8_t _schemaTestBytes[4] = {0xFE, 0xFF, 0x34, 0x12};
+
+static_assert(wire_field<0, 2, true>::decode(_schemaTestBytes) == -2);
+static_assert(wire_field<0, 2, false>::decode(_schemaTestBytes) == 0xFFFE);
+static_assert(wire_field<1, 3, false>::decode(_schemaTestBytes) == 0x1234FF);
+static_assert(wire_field<2, 2, true>::decode(_schemaTestBytes) == 0x1234);
+
+/*
+** Keep the packed structs in packet.h honest...
+*/
+static_assert(sizeof(weather_packet_t) == NRF24L01_MAXIMUM_PACKET_LEN, "weather_packet_t must fill a payload");
+static_assert(offsetof(weather_packet_t, packetNum) == weather_schema::packetNum::offset);
+static_assert(offsetof(weather_packet_t, status) == weather_schema::status::offset);
+static_assert(offsetof(weather_packet_t, rawBatteryPercentage) == weather_schema::batteryPercentage::offset);
+static_assert(offsetof(weather_packet_t, rawBatteryChargeRate) == weather_schema::batteryChargeRate::offset);
+static_assert(offsetof(weather_packet_t, rawBatteryVolts) == weather_schema::batteryVolts::offset);
+static_assert(offsetof(weather_packet_t, rawTemperature) == weather_schema::temperature::offset);
+static_assert(offsetof(weather_packet_t, rawICPPressure) == weather_schema::rawPressure::offset);
+static_assert(offsetof(weather_packet_t, rawHumidity) == weather_schema::humidity::offset);
+static_assert(offsetof(weather_packet_t, rawRainfall) == weather_schema::rainfall::offset);
+static_assert(offsetof(weather_packet_t, rawWindspeed) == weather_schema::rawWindspeed::offset);
+static_assert(offsetof(weather_packet_t, rawWindGust) == weather_schema::rawWindGust::offset);
+static_assert(offsetof(weather_packet_t, padding) == weather_schema::length);
+
+static_assert(sizeof(sleep_packet_t) == NRF24L01_MAXIMUM_PACKET_LEN, "sleep_packet_t must fill a payload");
+static_assert(offsetof(sleep_packet_t, status) == sleep_schema::status::offset);
+static_assert(offsetof(sleep_packet_t, sleepHours) == sleep_schema::sleepHours::offset);
+static_assert(offsetof(sleep_packet_t, rawBatteryVolts) == sleep_schema::batteryVolts::offset);
+static_assert(offsetof(sleep_packet_t, rawBatteryPercentage) == sleep_schema::batteryPercentage::offset);
+static_assert(offsetof(sleep_packet_t, padding) == sleep_schema::length);
+
+static_assert(sizeof(watchdog_packet_t) == NRF24L01_MAXIMUM_PACKET_LEN, "watchdog_packet_t must fill a payload");
+static_assert(offsetof(watchdog_packet_t, status) == watchdog_schema::status::offset);
+static_assert(offsetof(watchdog_packet_t, padding) == watchdog_schema::length);
+
+#endif
@@ -0,0 +1,145 @@
+#include <bit>
+
+#include <stdint.h>
+#include <string.h>
+
+#include "sequence.h"
+
+using namespace std;
+
+bool sequenceTracker::isReceived(uint32_t packetNum) {
+    uint32_t bit = packetNum % SEQUENCE_WINDOW_SIZE;
+
+    return ((receivedWindow[bit >> 6] >> (bit & 0x3F)) & 1ULL) ? true : false;
+}
+
+void sequenceTracker::setReceived(uint32_t packetNum, bool isReceived) {
+    uint32_t bit = packetNum % SEQUENCE_WINDOW_SIZE;
+
+    if (isReceived) {
+        receivedWindow[bit >> 6] |= (1ULL << (bit & 0x3F));
+    }
+    else {
+        receivedWindow[bit >> 6] &= ~(1ULL << (bit & 0x3F));
+    }
+}
+
+void sequenceTracker::restart(uint32_t packetNum) {
+    memset(receivedWindow, 0, sizeof(receivedWindow));
+
+    highestPacketNum = packetNum;
+    numExpected = 1;
+
+    setReceived(packetNum, true);
+
+    numReceived++;
+    isStarted = true;
+}
+
+sequenceTracker::sequence_result sequenceTracker::update(uint32_t packetNum) {
+    packetNum &= SEQUENCE_MASK;
+
+    if (!isStarted) {
+        restart(packetNum);
+        return sequence_first;
+    }
+
+    uint32_t ahead = (packetNum - highestPacketNum) & SEQUENCE_MASK;
+
+    if (ahead == 0) {
+        numDuplicates++;
+        return sequence_duplicate;
+    }
+
+    if (ahead < SEQUENCE_MAX_GAP) {
+        /*
+        ** Everything between the old and new highest number is
+        ** missing until it turns up...
+        */
+        uint32_t numToClear = (ahead < SEQUENCE_WINDOW_SIZE ? ahead : SEQUENCE_WINDOW_SIZE);
+
+        for (uint32_t i = 1;i <= numToClear;i++) {
+            setReceived(highestPacketNum + i, false);
+        }
+
+        setReceived(packetNum, true);
+
+        highestPacketNum = packetNum;
+        numExpected += ahead;
+
+        if (numExpected > SEQUENCE_WINDOW_SIZE) {
+            numExpected = SEQUENCE_WINDOW_SIZE;
+        }
+
+        numReceived++;
+
+        uint32_t gap = ahead - 1;
+
+        if (gap > 0) {
+            numLost += gap;
+            lastGap = gap;
+
+            if (gap > longestGap) {
+                longestGap = gap;
+            }
+
+            return sequence_gap;
+        }
+
+        return sequence_next;
+    }
+
+    uint32_t behind = (highestPacketNum - packetNum) & SEQUENCE_MASK;
+
+    /*
+    ** A station restarted early on still has its old numbers in
+    ** the window, so a jump back to a low number is a reboot before
+    ** it's a duplicate. One only a few behind is just late...
+    */
+    if (packetNum < SEQUENCE_REBOOT_THRESHOLD && behind >= SEQUENCE_REBOOT_THRESHOLD) {
+        restart(packetNum);
+
+        numReboots++;
+        return sequence_reboot;
+    }
+
+    if (behind < numExpected) {
+        if (isReceived(packetNum)) {
+            numDuplicates++;
+            return sequence_duplicate;
+        }
+
+        /*
+        ** Out of order, we had already counted it as lost...
+        */
+        setReceived(packetNum, true);
+
+        numReceived++;
+        numLost--;
+
+        return sequence_late;
+    }
+
+    restart(packetNum);
+
+    if (packetNum < SEQUENCE_REBOOT_THRESHOLD) {
+        numReboots++;
+        return sequence_reboot;
+    }
+
+    return sequence_resync;
+}
+
+double sequenceTracker::getLossRate() {
+    if (numExpected == 0) {
+        return 0.0;
+    }
+
+    int numReceivedInWindow = 0;
+
+    for (int i = 0;i < SEQUENCE_WINDOW_WORDS;i++) {
+        numReceivedInWindow += popcount(receivedWindow[i]);
+    }
+
+    return (double)(numExpected - numReceivedInWindow) / (double)numExpected;
+}
@@ -0,0 +1,103 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifndef __INCL_SEQUENCE
+#define __INCL_SEQUENCE
+
+#define SEQUENCE_MASK                       0x00FFFFFFU
+
+/*
+** How many of the most recent packet numbers we remember, this
+** is both the duplicate detection window and the window the
+** rolling loss rate is worked out over...
+*/
+#define SEQUENCE_WINDOW_SIZE                256
+#define SEQUENCE_WINDOW_WORDS               (SEQUENCE_WINDOW_SIZE / 64)
+
+/*
+** A packet number going backwards to one this low means the
+** station has restarted...
+*/
+#define SEQUENCE_REBOOT_THRESHOLD           16
+
+/*
+** Forward jumps bigger than this aren't believable as loss
+** (at one packet every 30s it's over 11 days), so we start
+** counting again from the new number...
+*/
+#define SEQUENCE_MAX_GAP                    0x8000
+
+/*
+** Tracks the 24-bit packet number sent by one station, to spot
+** lost, duplicated and late packets and station reboots...
+*/
+class sequenceTracker {
+    public:
+        enum sequence_result {
+            sequence_first,
+            sequence_next,
+            sequence_gap,
+            sequence_duplicate,
+            sequence_late,
+            sequence_reboot,
+            sequence_resync
+        };
+
+    private:
+        bool            isStarted = false;
+
+        uint32_t        highestPacketNum = 0;
+        uint32_t        numExpected = 0;            // Since the last (re)start, capped at the window size
+
+        uint64_t        receivedWindow[SEQUENCE_WINDOW_WORDS];
+
+        uint64_t        numReceived = 0;
+        uint64_t        numLost = 0;
+        uint64_t        numDuplicates = 0;
+        uint64_t        numReboots = 0;
+
+        uint32_t        lastGap = 0;
+        uint32_t        longestGap = 0;
+
+        bool isReceived(uint32_t packetNum);
+        void setReceived(uint32_t packetNum, bool isReceived);
+
+        void restart(uint32_t packetNum);
+
+    public:
+        sequenceTracker() {}
+
+        sequence_result update(uint32_t packetNum);
+
+        /*
+        ** Fraction of the last SEQUENCE_WINDOW_SIZE packets that
+        ** never arrived...
+        */
+        double getLossRate();
+
+        uint32_t getLastGap() {
+            return lastGap;
+        }
+
+        uint32_t getLongestGap() {
+            return longestGap;
+        }
+
+        uint64_t getNumReceived() {
+            return numReceived;
+        }
+
+        uint64_t getNumLost() {
+            return numLost;
+        }
+
+        uint64_t getNumDuplicates() {
+            return numDuplicates;
+        }
+
+        uint64_t getNumReboots() {
+            return numReboots;
+        }
+};
+
+#endif
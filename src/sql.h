@@ -1,10 +1,15 @@
 #include <stdbool.h>
+#include <time.h>
+
+#include <postgresql/libpq-fe.h>
+
+#include "psql.h"
 
 #ifndef __INCL_SQL
 #define __INCL_SQL
 
 typedef struct {
-    char            created[20];
+    time_t          created;                        // When the day's first reading arrived, the day it is for
 
     float           min_temperature;
     float           max_temperature;
@@ -20,13 +25,49 @@ typedef struct {
     
     float           max_wind_speed;
     float           max_wind_gust;
+
+    uint32_t        num_readings;
 }
 daily_summary_t;
 
+/*
+** A reading already there is overwritten, so a replay after the
+** calibration has changed rebuilds it, and one written twice (the
+** journal after a crash) does no harm...
+*/
+#define PSQL_WEATHER_ON_CONFLICT \
+"ON CONFLICT (station_id, created) DO UPDATE SET \
+packet_num = EXCLUDED.packet_num, \
+temperature = EXCLUDED.temperature, \
+dew_point = EXCLUDED.dew_point, \
+actual_pressure = EXCLUDED.actual_pressure, \
+pressure = EXCLUDED.pressure, \
+humidity = EXCLUDED.humidity, \
+rainfall = EXCLUDED.rainfall, \
+wind_speed = EXCLUDED.wind_speed, \
+wind_gust = EXCLUDED.wind_gust, \
+avg_wind_speed_10m = EXCLUDED.avg_wind_speed_10m, \
+max_wind_gust_10m = EXCLUDED.max_wind_gust_10m, \
+rainfall_1h = EXCLUDED.rainfall_1h, \
+rainfall_24h = EXCLUDED.rainfall_24h, \
+rain_rate = EXCLUDED.rain_rate, \
+pressure_tendency_3h = EXCLUDED.pressure_tendency_3h;"
+
+#define PSQL_TELEMETRY_ON_CONFLICT \
+"ON CONFLICT (station_id, created) DO UPDATE SET \
+packet_num = EXCLUDED.packet_num, \
+battery_voltage = EXCLUDED.battery_voltage, \
+battery_percentage = EXCLUDED.battery_percentage, \
+battery_crate = EXCLUDED.battery_crate, \
+status_bits = EXCLUDED.status_bits, \
+packet_loss_rate = EXCLUDED.packet_loss_rate, \
+longest_gap = EXCLUDED.longest_gap;"
+
 
 const char * pszWeatherInsertStmt = 
 "INSERT INTO weather_data (\
 created, \
+station_id, \
 packet_num, \
 temperature, \
 dew_point, \
@@ -35,10 +76,23 @@ pressure, \
 humidity, \
 rainfall, \
 wind_speed, \
-wind_gust) \
+wind_gust, \
+avg_wind_speed_10m, \
+max_wind_gust_10m, \
+rainfall_1h, \
+rainfall_24h, \
+rain_rate, \
+pressure_tendency_3h) \
 values (\
 '%s', \
 %d, \
+%d, \
+%.2f, \
+%.2f, \
+%.2f, \
+%.2f, \
+%.2f, \
+%.2f, \
 %.2f, \
 %.2f, \
 %.2f, \
@@ -46,27 +100,114 @@ values (\
 %.2f, \
 %.2f, \
 %.2f, \
-%.2f);";
+%.2f) \
+" PSQL_WEATHER_ON_CONFLICT;
 
 const char * pszTelemetryInsertStmt = 
 "INSERT INTO telemetry_data (\
 created, \
+station_id, \
 packet_num, \
 battery_voltage, \
 battery_percentage, \
 battery_crate, \
-status_bits) \
+status_bits, \
+packet_loss_rate, \
+longest_gap) \
 values (\
 '%s', \
 %d, \
+%d, \
+%.2f, \
 %.2f, \
 %.2f, \
+%d, \
 %.2f, \
-%d);";
+%d) \
+" PSQL_TELEMETRY_ON_CONFLICT;
 
-const char * pszSummaryInsertStmt = 
+/*
+** The statements we prepare, with binary parameters. A station's
+** summary for a day is worked out from its weather_data rows for
+** that day, replacing any row already there, so it can be written
+** as often as we like...
+*/
+#define PSQL_WEATHER_INSERT_NAME            "insert_weather"
+#define PSQL_TELEMETRY_INSERT_NAME          "insert_telemetry"
+#define PSQL_SUMMARY_INSERT_NAME            "upsert_summary"
+
+const char * pszWeatherInsertPrepared = 
+"INSERT INTO weather_data (\
+created, \
+station_id, \
+packet_num, \
+temperature, \
+dew_point, \
+actual_pressure, \
+pressure, \
+humidity, \
+rainfall, \
+wind_speed, \
+wind_gust, \
+avg_wind_speed_10m, \
+max_wind_gust_10m, \
+rainfall_1h, \
+rainfall_24h, \
+rain_rate, \
+pressure_tendency_3h) \
+values ($1, $2, $3, $4, $5, $6, $7, $8, $9, $10, $11, $12, $13, $14, $15, $16, $17) \
+" PSQL_WEATHER_ON_CONFLICT;
+
+const Oid weatherInsertTypes[] = {
+    PSQL_TYPE_TIMESTAMP,
+    PSQL_TYPE_INT4,
+    PSQL_TYPE_INT4,
+    PSQL_TYPE_FLOAT4,
+    PSQL_TYPE_FLOAT4,
+    PSQL_TYPE_FLOAT4,
+    PSQL_TYPE_FLOAT4,
+    PSQL_TYPE_FLOAT4,
+    PSQL_TYPE_FLOAT4,
+    PSQL_TYPE_FLOAT4,
+    PSQL_TYPE_FLOAT4,
+    PSQL_TYPE_FLOAT4,
+    PSQL_TYPE_FLOAT4,
+    PSQL_TYPE_FLOAT4,
+    PSQL_TYPE_FLOAT4,
+    PSQL_TYPE_FLOAT4,
+    PSQL_TYPE_FLOAT4
+};
+
+const char * pszTelemetryInsertPrepared = 
+"INSERT INTO telemetry_data (\
+created, \
+station_id, \
+packet_num, \
+battery_voltage, \
+battery_percentage, \
+battery_crate, \
+status_bits, \
+packet_loss_rate, \
+longest_gap) \
+values ($1, $2, $3, $4, $5, $6, $7, $8, $9) \
+" PSQL_TELEMETRY_ON_CONFLICT;
+
+const Oid telemetryInsertTypes[] = {
+    PSQL_TYPE_TIMESTAMP,
+    PSQL_TYPE_INT4,
+    PSQL_TYPE_INT4,
+    PSQL_TYPE_FLOAT4,
+    PSQL_TYPE_FLOAT4,
+    PSQL_TYPE_FLOAT4,
+    PSQL_TYPE_INT4,
+    PSQL_TYPE_FLOAT4,
+    PSQL_TYPE_INT4
+};
+
+const char * pszSummaryInsertPrepared = 
 "INSERT INTO daily_summary (\
 created, \
+station_id, \
 min_temperature, \
 max_temperature, \
 min_pressure, \
@@ -76,16 +217,35 @@ max_humidity, \
 total_rainfall, \
 max_wind_speed, \
 max_wind_gust) \
-values (\
-'%s', \
-%.2f, \
-%.2f, \
-%.2f, \
-%.2f, \
-%.2f, \
-%.2f, \
-%.2f, \
-%.2f, \
-%.2f);";
+SELECT \
+$1, \
+$2, \
+MIN(temperature), \
+MAX(temperature), \
+MIN(pressure), \
+MAX(pressure), \
+MIN(humidity), \
+MAX(humidity), \
+SUM(rainfall), \
+MAX(wind_speed), \
+MAX(wind_gust) \
+FROM weather_data \
+WHERE station_id = $2 AND created >= $1 AND created < $1 + 1 \
+HAVING COUNT(*) > 0 \
+ON CONFLICT (created, station_id) DO UPDATE SET \
+min_temperature = EXCLUDED.min_temperature, \
+max_temperature = EXCLUDED.max_temperature, \
+min_pressure = EXCLUDED.min_pressure, \
+max_pressure = EXCLUDED.max_pressure, \
+min_humidity = EXCLUDED.min_humidity, \
+max_humidity = EXCLUDED.max_humidity, \
+total_rainfall = EXCLUDED.total_rainfall, \
+max_wind_speed = EXCLUDED.max_wind_speed, \
+max_wind_gust = EXCLUDED.max_wind_gust;";
+
+const Oid summaryInsertTypes[] = {
+    PSQL_TYPE_DATE,
+    PSQL_TYPE_INT4
+};
 
 #endif
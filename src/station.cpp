@@ -0,0 +1,195 @@
+#include <string>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "cfgmgr.h"
+#include "logger.h"
+#include "utils.h"
+#include "radio.h"
+#include "schema.h"
+#include "station.h"
+
+using namespace std;
+
+#define ALITUDE_COMP_FACTOR         0.0000225577
+#define ALTITUDE_COMP_POWER         5.25588
+
+/*
+** A decode takes microseconds, so anything swapped out this
+** long ago is certainly no longer in use...
+*/
+#define CALIBRATION_RETIRE_SECONDS  60
+
+station::station(int pipe) : calibration(NULL) {
+    this->pipe = pipe;
+    this->stationID = 0;
+}
+
+static string _getStationValue(const string & prefix, const string & key, const string & defaultKey) {
+    cfgmgr & cfg = cfgmgr::getInstance();
+
+    string value = cfg.getValue(prefix + key);
+
+    if (value.length() == 0) {
+        value = cfg.getValue(defaultKey);
+    }
+
+    return value;
+}
+
+void stationmgr::loadStation(station * s, const string & prefix) {
+    s->address = _getStationValue(prefix, "address", "radio.remoteaddress");
+    s->stationID = strtoul(_getStationValue(prefix, "id", "radio.stationid").c_str(), NULL, 0);
+
+    s->setCalibration(loadCalibration(prefix));
+
+    s->wowSiteID = _getStationValue(prefix, "wow.siteid", "wow.siteid");
+    s->wowAuthKey = _getStationValue(prefix, "wow.authkey", "wow.authkey");
+}
+
+const calibration_t * stationmgr::loadCalibration(const string & prefix) {
+    calibration_t * c = new calibration_t;
+
+    c->altitude = strtod(_getStationValue(prefix, "calibration.altitude", "calibration.altitude").c_str(), NULL);
+    c->anemometerFactor = 1.0;
+
+    string anemometerFactor = _getStationValue(prefix, "calibration.anemometerfactor", "calibration.anemometerfactor");
+
+    if (anemometerFactor.length() > 0) {
+        c->anemometerFactor = strtod(anemometerFactor.c_str(), NULL);
+    }
+
+    c->windspeedMph = (float)(SCHEMA_ANEMOMETER_MPH * c->anemometerFactor);
+    c->windspeedMetresPerSec = (float)(SCHEMA_ANEMOMETER_METRES_PER_SEC * c->anemometerFactor);
+
+    /*
+    ** Raw pressure is in Pa, divide by 100 for hPa and by the
+    ** altitude compensation to get back to sea level...
+    */
+    double pressureCompensationFactor = 
+                pow((1.0 - (ALITUDE_COMP_FACTOR * c->altitude)), ALTITUDE_COMP_POWER) * 100.0;
+
+    c->pressureScale = 1.0 / pressureCompensationFactor;
+
+    c->created = getEpochNanoseconds();
+
+    return c;
+}
+
+void stationmgr::freeRetiredCalibration(uint64_t now) {
+    uint64_t gracePeriod = (uint64_t)CALIBRATION_RETIRE_SECONDS * 1000000000ULL;
+
+    for (auto it = retired.begin();it != retired.end();) {
+        if (now - it->retireTime >= gracePeriod) {
+            delete it->calibration;
+            it = retired.erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
+}
+
+/*
+** Stations are configured as station.<pipe>.<key>, e.g.
+**
+**  station.1.address=AZ439
+**  station.1.id=0x10002930
+**  station.1.calibration.altitude=61.0
+**
+** Anything not given falls back to the single station
+** radio.* and calibration.* values. With no station.*
+** config at all we have the original single station
+** setup on pipe 0...
+*/
+void stationmgr::initialise() {
+    logger & log = logger::getInstance();
+    cfgmgr & cfg = cfgmgr::getInstance();
+
+    for (int pipe = 0;pipe < NRF24L01_NUM_RX_PIPES;pipe++) {
+        if (cfg.getValue("station." + to_string(pipe) + ".address").length() > 0) {
+            isMultiStation = true;
+        }
+    }
+
+    numStations = 0;
+
+    for (int pipe = 0;pipe < NRF24L01_NUM_RX_PIPES;pipe++) {
+        string prefix = "station." + to_string(pipe) + ".";
+
+        if (isMultiStation) {
+            if (cfg.getValue(prefix + "address").length() == 0) {
+                continue;
+            }
+        }
+        else if (pipe > 0) {
+            break;
+        }
+
+        station * s = new station(pipe);
+
+        loadStation(s, prefix);
+
+        stations[pipe] = s;
+        numStations++;
+
+        const calibration_t * c = s->getCalibration();
+
+        log.logInfo(
+            "Station 0x%08X on pipe %d, address '%s', altitude %.1fm, anemometer factor %.2f",
+            s->stationID,
+            s->pipe,
+            s->address.c_str(),
+            c->altitude,
+            c->anemometerFactor);
+    }
+}
+
+void stationmgr::reloadCalibration() {
+    logger & log = logger::getInstance();
+
+    uint64_t now = getEpochNanoseconds();
+
+    freeRetiredCalibration(now);
+
+    for (int pipe = 0;pipe < NRF24L01_NUM_RX_PIPES;pipe++) {
+        station * s = stations[pipe];
+
+        if (s == NULL) {
+            continue;
+        }
+
+        const calibration_t * c = loadCalibration("station." + to_string(pipe) + ".");
+        const calibration_t * old = s->setCalibration(c);
+
+        if (old != NULL) {
+            retired.push_back({now, old});
+        }
+
+        log.logInfo(
+            "Reloaded calibration for station 0x%08X: altitude %.1fm, anemometer factor %.2f",
+            s->stationID,
+            c->altitude,
+            c->anemometerFactor);
+    }
+}
+
+void stationmgr::configureRadio(nrfcfg & radioConfig) {
+    /*
+    ** A single station keeps the original setup, where
+    ** the driver listens on the remote address...
+    */
+    if (!isMultiStation) {
+        return;
+    }
+
+    for (int pipe = 0;pipe < NRF24L01_NUM_RX_PIPES;pipe++) {
+        if (stations[pipe] != NULL) {
+            radioConfig.pipeAddress[pipe] = stations[pipe]->address.c_str();
+        }
+    }
+}
@@ -0,0 +1,132 @@
+#include <string>
+#include <vector>
+#include <atomic>
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "radio.h"
+
+using namespace std;
+
+#ifndef __INCL_STATION
+#define __INCL_STATION
+
+/*
+** A station's calibration, resolved from config once and never
+** changed after that. Every factor the transform needs is already
+** multiplied out, so decoding a packet is just raw * factor...
+*/
+typedef struct {
+    double              altitude;
+    double              anemometerFactor;
+
+    float               windspeedMph;               // SCHEMA_ANEMOMETER_MPH * anemometerFactor
+    float               windspeedMetresPerSec;      // SCHEMA_ANEMOMETER_METRES_PER_SEC * anemometerFactor
+    double              pressureScale;              // Pa -> sea level hPa at our altitude
+
+    uint64_t            created;
+}
+calibration_t;
+
+/*
+** One outdoor weather station, listened to on its own RX pipe...
+*/
+class station {
+    private:
+        atomic<const calibration_t *>   calibration;
+
+    public:
+        int             pipe;
+        uint32_t        stationID;
+        string          address;
+
+        /*
+        ** Met Office WoW details, default to the wow.* values...
+        */
+        string          wowSiteID;
+        string          wowAuthKey;
+
+        station(int pipe);
+
+        /*
+        ** The snapshot is swapped as a whole when config is
+        ** reloaded, readers just take whichever one is current...
+        */
+        const calibration_t * getCalibration() const {
+            return calibration.load(memory_order_acquire);
+        }
+
+        const calibration_t * setCalibration(const calibration_t * c) {
+            return calibration.exchange(c, memory_order_acq_rel);
+        }
+};
+
+class stationmgr {
+    public:
+        static stationmgr & getInstance() {
+            static stationmgr instance;
+            return instance;
+        }
+
+    private:
+        /*
+        ** Snapshots we have swapped out, freed once no reader
+        ** can still be using them...
+        */
+        typedef struct {
+            uint64_t                retireTime;
+            const calibration_t *   calibration;
+        }
+        retired_calibration_t;
+
+        station *       stations[NRF24L01_NUM_RX_PIPES];
+        int             numStations = 0;
+        bool            isMultiStation = false;
+
+        vector<retired_calibration_t>   retired;
+
+        stationmgr() {
+            for (int i = 0;i < NRF24L01_NUM_RX_PIPES;i++) {
+                stations[i] = NULL;
+            }
+        }
+
+        void loadStation(station * s, const string & prefix);
+        const calibration_t * loadCalibration(const string & prefix);
+
+    public:
+        ~stationmgr() {}
+
+        void initialise();
+
+        int getNumStations() {
+            return numStations;
+        }
+
+        station * getStation(int pipe) {
+            if (pipe < 0 || pipe >= NRF24L01_NUM_RX_PIPES) {
+                return NULL;
+            }
+
+            return stations[pipe];
+        }
+
+        void configureRadio(nrfcfg & radioConfig);
+
+        /*
+        ** Re-resolve every station's calibration from the current
+        ** config and swap the new snapshots in. Only ever called
+        ** from the main thread...
+        */
+        void reloadCalibration();
+
+        /*
+        ** Free the snapshots retired long enough ago that no reader
+        ** can still have one. The main thread's supervisor timer
+        ** calls this, so they don't wait for another reload...
+        */
+        void freeRetiredCalibration(uint64_t now);
+};
+
+#endif
@@ -1,5 +1,6 @@
 #include <string>
-#include <queue>
+#include <vector>
+#include <span>
 
 #include <stdint.h>
 #include <stdbool.h>
@@ -7,268 +8,434 @@
 #include <string.h>
 #include <stdio.h>
 #include <math.h>
+#include <errno.h>
+#include <sched.h>
+#include <sys/mman.h>
 
 #include <lgpio.h>
-#include <postgresql/libpq-fe.h>
-#include <curl/curl.h>
 
 #include "radio.h"
 #include "logger.h"
 #include "cfgmgr.h"
 #include "posixthread.h"
-#include "psql.h"
 #include "utils.h"
 #include "packet.h"
+#include "station.h"
+#include "decoder.h"
+#include "reactor.h"
+#include "bus.h"
 #include "threads.h"
 
-#include "sql.h"
-
 using namespace std;
 
-#define INSERT_STRING_LEN           512
-#define URL_STRING_LEN             1024
+#define IRQ_WAIT_TIMEOUT_MS         5000U
+
+#define DUMP_BUFFER_LEN             1024
 
 /*
-** Wind speed in mph:
+** How long the listen thread gets to finish up at shutdown,
+** each sink says how long it needs...
 */
-#define ANEMOMETER_MPH              0.0052658575613333f
-#define ANEMOMETER_METRES_PER_SEC   0.0565486677646163f
-
-#define ALITUDE_COMP_FACTOR         0.0000225577f
-#define ALTITUDE_COMP_POWER         5.25588f
+#define SHUTDOWN_RADIO_TIMEOUT_MS   500U
 
-#define TEMPERATURE_CELCIUS_FACTOR  0.0078125f
-#define HUMIDITY_RH_FACTOR          0.0019074f
-
-#define HPA_TO_INHG                 0.02952998057228486f
-
-#define TIME_BUFFER_SIZE            24
+/*
+** A thread that goes this long without a heartbeat is asked to
+** recover, and if it hasn't beaten THREAD_RECOVERY_TIMEOUT_MS after
+** that it is cancelled and restarted. The listen thread beats at
+** least every IRQ wait, the sinks from a timer in their event loop,
+** which a long PQexec() or a stuck handler holds up...
+*/
+#define LISTEN_STALL_TIMEOUT_MS     30000U
+#define SHUTDOWN_CAPTURE_TIMEOUT_MS 1000U
+#define HEARTBEAT_INTERVAL_MS       1000U
+#define THREAD_RECOVERY_TIMEOUT_MS  15000U
+#define THREAD_CANCEL_TIMEOUT_MS    1000U
 
 /*
-** Each tip of the bucket in the rain gauge equates
-** to 0.2794mm of rainfall, so just multiply this
-** by the pulse count to get mm/hr...
+** For sched.<name>.policy=fifo or rr without a priority, below
+** the kernel's threaded IRQ handlers (50), one of which delivers
+** the radio's interrupt...
 */
-#define RAIN_GAUGE_MM               0.2794f
+#define SCHED_DEFAULT_RT_PRIORITY   40
 
-static queue<weather_transform_t> dbq;
-static queue<weather_transform_t> webPostQueue;
+/*
+** A list of CPUs like "0,2-3", returns false if it doesn't
+** make sense...
+*/
+static bool parseCPUList(const string & list, cpu_set_t * cpus) {
+    const char *    p = list.c_str();
+    char *          end;
 
-static char szDumpBuffer[1024];
+    CPU_ZERO(cpus);
 
-typedef struct {
-    char *      response;
-    size_t      length;
-}
-curl_chunk_t;
+    while (*p != 0) {
+        long first = strtol(p, &end, 10);
 
-static uint8_t _getPacketType(uint8_t * packet) {
-    return packet[0];
-}
+        if (end == p || first < 0 || first >= CPU_SETSIZE) {
+            return false;
+        }
 
-static uint16_t _getExpectedChipID(void) {
-    cfgmgr & cfg = cfgmgr::getInstance();
+        long last = first;
 
-    uint16_t chipID = ((cfg.getValueAsLongUnsignedInteger("radio.stationid") >> 12) & 0xFFFF);
+        p = end;
 
-    return chipID;
-}
+        if (*p == '-') {
+            p++;
 
-static float _getAltitudeAdjustedPressure(uint32_t rawPressure) {
-    static bool         isCalculated = false;
-    static double       compensationFactor;
-    double              altitude;
-    float               adjustedPressure;
+            last = strtol(p, &end, 10);
 
-    cfgmgr & cfg = cfgmgr::getInstance();
+            if (end == p || last < first || last >= CPU_SETSIZE) {
+                return false;
+            }
 
-    if (!isCalculated) {
-        altitude = cfg.getValueAsDouble("calibration.altitude");
+            p = end;
+        }
 
-        compensationFactor = pow(
-                    ((double)1.0f - ((double)ALITUDE_COMP_FACTOR * altitude)), 
-                    (double)ALTITUDE_COMP_POWER) *
-                    (double)100.0f;
+        for (long cpu = first;cpu <= last;cpu++) {
+            CPU_SET((int)cpu, cpus);
+        }
 
-        isCalculated = true;
+        while (*p == ',' || *p == ' ') {
+            p++;
+        }
     }
 
-    logger & log = logger::getInstance();
+    return (CPU_COUNT(cpus) > 0);
+}
 
-    log.logDebug("Altitude compensation factor: %.2f", compensationFactor);
+/*
+** The sched.<name>.* config for a thread, policy (fifo, rr or
+** other), priority, nice and cpus...
+*/
+static thread_sched_profile_t getSchedulingProfile(const char * name) {
+    thread_sched_profile_t      profile;
 
-    adjustedPressure = (float)((double)rawPressure / compensationFactor);
+    logger & log = logger::getInstance();
+    cfgmgr & cfg = cfgmgr::getInstance();
 
-    return adjustedPressure;
-}
+    memset(&profile, 0, sizeof(profile));
 
-static float inline _computeTemperature(int16_t rawTemperature) {
-    return (float)rawTemperature * TEMPERATURE_CELCIUS_FACTOR;
-}
+    string prefix = "sched.";
+    prefix.append(name);
 
-static float inline _computeHumidity(uint16_t rawHumidity) {
-    return (-6.0f + ((float)rawHumidity * HUMIDITY_RH_FACTOR));
-}
+    string policy = cfg.getValue(prefix + ".policy");
+
+    if (policy.length() > 0) {
+        profile.isPolicySet = true;
 
-static float _computeDewPoint(uint16_t rawTemperature, uint16_t rawHumidity) {
-    float           dewPoint;
-    float           lnHumidity;
-    float           temperature;
+        if (policy.compare("fifo") == 0) {
+            profile.policy = SCHED_FIFO;
+        }
+        else if (policy.compare("rr") == 0) {
+            profile.policy = SCHED_RR;
+        }
+        else if (policy.compare("other") == 0) {
+            profile.policy = SCHED_OTHER;
+        }
+        else {
+            log.logError("Unknown %s.policy '%s', leaving the scheduling policy alone", prefix.c_str(), policy.c_str());
+            profile.isPolicySet = false;
+        }
 
-    lnHumidity = (float)log((double)_computeHumidity(rawHumidity) / (double)100.0f);
-    temperature = _computeTemperature(rawTemperature);
+        if (profile.policy != SCHED_OTHER) {
+            profile.priority = SCHED_DEFAULT_RT_PRIORITY;
 
-    dewPoint = 
-        243.04f * 
-        (lnHumidity + 
-        ((17.625f * temperature) / 
-        (243.04f + temperature))) / 
-        (17.625f - lnHumidity -
-        ((17.625f * temperature) / 
-        (243.04f + temperature)));
+            if (cfg.getValue(prefix + ".priority").length() > 0) {
+                profile.priority = cfg.getValueAsInteger(prefix + ".priority");
+            }
 
-    return dewPoint;
-}
+            int minPriority = sched_get_priority_min(profile.policy);
+            int maxPriority = sched_get_priority_max(profile.policy);
 
-static void updateSummary(daily_summary_t * ds, weather_transform_t * tr) {
-    if (tr->temperature > ds->max_temperature) {
-        ds->max_temperature = tr->temperature;
+            if (profile.priority < minPriority || profile.priority > maxPriority) {
+                log.logError("%s.priority must be %d-%d, using %d", prefix.c_str(), minPriority, maxPriority, SCHED_DEFAULT_RT_PRIORITY);
+                profile.priority = SCHED_DEFAULT_RT_PRIORITY;
+            }
+        }
     }
-    if (tr->temperature < ds->min_temperature || (ds->min_temperature == 0.00 && tr->temperature > 0.00)) {
-        ds->min_temperature = tr->temperature;
+
+    if (cfg.getValue(prefix + ".nice").length() > 0) {
+        profile.isNiceSet = true;
+        profile.nice = cfg.getValueAsInteger(prefix + ".nice");
     }
 
-    if (tr->normalisedPressure > ds->max_pressure) {
-        ds->max_pressure = tr->normalisedPressure;
+    string cpus = cfg.getValue(prefix + ".cpus");
+
+    if (cpus.length() > 0) {
+        if (parseCPUList(cpus, &profile.cpus)) {
+            profile.isAffinitySet = true;
+        }
+        else {
+            log.logError("Invalid %s.cpus '%s', not pinning the thread", prefix.c_str(), cpus.c_str());
+        }
     }
-    if (tr->normalisedPressure < ds->min_pressure || (ds->min_pressure == 0.00 && tr->normalisedPressure > 0.00)) {
-        ds->min_pressure = tr->normalisedPressure;
+
+    return profile;
+}
+
+/*
+** Keep everything we have, and will have, in RAM, so the radio
+** thread never waits on a page fault while Postgres hammers the
+** SD card...
+*/
+static void lockMemory() {
+    logger & log = logger::getInstance();
+
+    if (!cfgmgr::getInstance().getValueAsBoolean("sched.mlockall")) {
+        return;
     }
 
-    if (tr->humidity > ds->max_humidity) {
-        ds->max_humidity = tr->humidity;
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0) {
+        int err = errno;
+
+        log.logError(
+            "Failed to lock memory: %s%s",
+            strerror(err),
+            ((err == EPERM || err == ENOMEM) ? " (needs CAP_IPC_LOCK or a higher RLIMIT_MEMLOCK)" : ""));
     }
-    if (tr->humidity < ds->min_humidity || (ds->min_humidity == 0.00 && tr->humidity > 0.00)) {
-        ds->min_humidity = tr->humidity;
+    else {
+        log.logStatus("Locked all memory with mlockall()");
     }
+}
+
+/*
+** Create the sinks listed in the sinks config and subscribe
+** each one to the bus...
+*/
+void ThreadManager::openSinks() {
+    logger & log = logger::getInstance();
+    cfgmgr & cfg = cfgmgr::getInstance();
+
+    string names = cfg.getValue("sinks");
 
-    if (tr->windspeed > ds->max_wind_speed) {
-        ds->max_wind_speed = tr->windspeed;
+    if (names.length() == 0) {
+        names = SINK_DEFAULT_LIST;
     }
 
-    if (tr->gustSpeed > ds->max_wind_gust) {
-        ds->max_wind_gust = tr->gustSpeed;
+    size_t start = 0;
+
+    while (start <= names.length()) {
+        size_t end = names.find(',', start);
+
+        if (end == string::npos) {
+            end = names.length();
+        }
+
+        string name = names.substr(start, end - start);
+
+        start = end + 1;
+
+        size_t first = name.find_first_not_of(" \t");
+
+        if (first == string::npos) {
+            continue;
+        }
+
+        name = name.substr(first, name.find_last_not_of(" \t") - first + 1);
+
+        readingSink * sink = sinkRegistry::getInstance().create(name);
+
+        if (sink == NULL) {
+            log.logError("Unknown sink '%s' in sinks, ignoring it", name.c_str());
+            continue;
+        }
+
+        busSubscription * subscription = readingBus::getInstance().subscribe(*sink);
+
+        SinkThread * thread = new SinkThread(sink, subscription);
+
+        thread->setStallTimeout(sink->getStallTimeoutMs());
+        thread->setSchedulingProfile(getSchedulingProfile(sink->getName()));
+
+        sinkThreads.push_back(thread);
     }
 
-    ds->total_rainfall += tr->rainfall;
+    if (sinkThreads.size() == 0) {
+        log.logError("No sinks configured, readings will go nowhere");
+    }
 }
 
 void ThreadManager::start() {
 	logger & log = logger::getInstance();
 
-		if (nrfListenThread.start()) {
-			log.logStatus("Started NRFListenThread successfully");
-		}
-		else {
-			throw thread_error("Failed to start NRFListenThread");
-		}
+	stationmgr::getInstance().initialise();
 
-		if (dbUpdateThread.start()) {
-			log.logStatus("Started DBUpdateThread successfully");
-		}
-		else {
-			throw thread_error("Failed to start DBUpdateThread");
-		}
+    lockMemory();
 
-		if (wowUpdateThread.start()) {
-			log.logStatus("Started WoWUpdateThread successfully");
-		}
-		else {
-			throw thread_error("Failed to start WoWUpdateThread");
-		}
-}
+    openSinks();
 
-void ThreadManager::kill() {
-    nrfListenThread.stop();
-    dbUpdateThread.stop();
-    wowUpdateThread.stop();
-}
+    nrfListenThread.setStallTimeout(LISTEN_STALL_TIMEOUT_MS);
 
-weather_transform_t * NRFListenThread::transformWeatherPacket(weather_packet_t * source) {
-    static weather_transform_t transform;
+    isCapturing = (cfgmgr::getInstance().getValue("capture.filename").length() > 0);
 
-    weather_transform_t * target = &transform;
+    nextReportTime = PosixThread::getMonotonicMs() + SUPERVISOR_REPORT_INTERVAL_MS;
 
-    target->packetNum = 0;
-    target->packetNum = ((uint32_t)source->packetNum[2] << 16) | ((uint32_t)source->packetNum[1] << 8) | ((uint32_t)source->packetNum[0]);
-    target->packetNum &= 0x00FFFFFF;
+    /*
+    ** The sinks are subscribed and waiting before the first
+    ** reading is published...
+    */
+    for (SinkThread * thread : sinkThreads) {
+        if (thread->start()) {
+            log.logStatus("Started %s successfully", thread->getName());
+        }
+        else {
+            throw thread_error(thread_error::buildMsg("Failed to start %s", thread->getName()));
+        }
+    }
 
-    logger & log = logger::getInstance();
+    if (isCapturing) {
+        if (captureThread.start(getSchedulingProfile("capture"))) {
+            log.logStatus("Started CaptureThread successfully");
+        }
+        else {
+            throw thread_error("Failed to start CaptureThread");
+        }
 
-    log.logDebug("Raw battery volts: %u", (uint32_t)source->rawBatteryVolts);
-    log.logDebug("Raw battery percentage: %u", (uint32_t)source->rawBatteryPercentage);
-    log.logDebug("Raw battery charge rate: %d", (int)source->rawBatteryChargeRate);
+        nrfListenThread.setCaptureThread(&captureThread);
+    }
 
-    target->batteryVoltage = (float)source->rawBatteryVolts * 78.125f / 1000000.0f;
-    target->batteryPercentage = (float)source->rawBatteryPercentage;
-    target->batteryChargeRate = (float)source->rawBatteryChargeRate * 0.208f;
+    if (nrfListenThread.start(getSchedulingProfile("radio"))) {
+        log.logStatus("Started NRFListenThread successfully");
+    }
+    else {
+        throw thread_error("Failed to start NRFListenThread");
+    }
+}
 
-    target->status_bits = (int32_t)(source->status & 0x000000FF);
+void ThreadManager::stop() {
+    logger & log = logger::getInstance();
 
-    log.logDebug("Raw temperature: %d", (int)source->rawTemperature);
+    uint64_t startTime = getEpochNanoseconds();
 
     /*
-    ** TMP117 temperature
+    ** The listen thread publishes whatever is left in the radio's
+    ** RX FIFO on its way out. Once it has gone nothing more can be
+    ** published, so the sinks can drain their queues knowing they
+    ** have everything...
     */
-    target->temperature = _computeTemperature(source->rawTemperature);
-    
+    log.logStatus("Stopping NRFListenThread");
+    nrfListenThread.stop(SHUTDOWN_RADIO_TIMEOUT_MS);
+
+    if (isCapturing) {
+        log.logStatus("Stopping CaptureThread");
+        captureThread.stop(SHUTDOWN_CAPTURE_TIMEOUT_MS);
+    }
+
+    for (SinkThread * thread : sinkThreads) {
+        log.logStatus("Stopping %s", thread->getName());
+        thread->stop(thread->getSink()->getStopTimeoutMs());
+    }
+
+    log.logStatus(
+        "Threads stopped in %.1f ms, %llu reading(s) dropped by the sink queues",
+        (double)(getEpochNanoseconds() - startTime) / 1000000.0,
+        (unsigned long long)readingBus::getInstance().getNumDropped());
+}
+
+void ThreadManager::superviseThread(PosixThread & thread, uint64_t now) {
+    logger & log = logger::getInstance();
+
+    if (thread.isStopping()) {
+        return;
+    }
+
+    if (thread.getState() == PosixThread::thread_stalled) {
+        /*
+        ** We cancelled it but it hadn't gone last time we looked...
+        */
+        if (thread.tryJoin()) {
+            thread.restart();
+        }
+
+        return;
+    }
+
+    if (!thread.isStalled(now)) {
+        if (thread.isRecovering()) {
+            log.logStatus("%s has recovered", thread.getName());
+            thread.setRecovered();
+        }
+
+        return;
+    }
+
+    if (!thread.isRecovering()) {
+        log.logError(
+            "%s has stalled, no heartbeat for %llu ms, asking it to recover",
+            thread.getName(),
+            (unsigned long long)thread.getTimeSinceHeartbeat(now));
+
+        thread.requestRecovery(now);
+
+        return;
+    }
+
+    if (thread.getTimeRecovering(now) < THREAD_RECOVERY_TIMEOUT_MS) {
+        return;
+    }
+
     /*
-    ** SHT4x temperature & humidity
+    ** Cancelling unwinds through whatever the thread is in, so it
+    ** is only ever done once asking hasn't worked...
     */
-    target->humidity = _computeHumidity(source->rawHumidity);;
+    log.logError(
+        "%s has not recovered, no heartbeat for %llu ms, cancelling and restarting it",
+        thread.getName(),
+        (unsigned long long)thread.getTimeSinceHeartbeat(now));
 
-    if (target->humidity < 0.0) {
-        target->humidity = 0.0;
-    }
-    else if (target->humidity > 100.0) {
-        target->humidity = 100.0;
+    if (thread.cancel(THREAD_CANCEL_TIMEOUT_MS)) {
+        thread.restart();
     }
+}
 
-    target->dewPoint = _computeDewPoint(source->rawTemperature, source->rawHumidity);
+void ThreadManager::reportThread(PosixThread & thread, uint64_t now) {
+    logger::getInstance().logInfo(
+        "%s: %s for %llu s, %u restart(s), %u stall(s)",
+        thread.getName(),
+        thread.getStateName(),
+        (unsigned long long)(thread.getTimeInState(now) / 1000ULL),
+        thread.getNumRestarts(),
+        thread.getNumStalls());
+}
 
-    log.logDebug("Raw ICP Pressure: %u", source->rawICPPressure);
+void ThreadManager::supervise() {
+    uint64_t now = PosixThread::getMonotonicMs();
 
-    target->normalisedPressure = _getAltitudeAdjustedPressure(source->rawICPPressure);
-    target->actualPressure = (float)source->rawICPPressure / 100.0f;
+    superviseThread(nrfListenThread, now);
 
-    log.logDebug("Raw windspeed: %u", (uint32_t)source->rawWindspeed);
-    log.logDebug("Raw rainfall: %u", (uint32_t)source->rawRainfall);
+    if (isCapturing) {
+        superviseThread(captureThread, now);
+    }
 
-    cfgmgr & cfg = cfgmgr::getInstance();
+    for (SinkThread * thread : sinkThreads) {
+        superviseThread(*thread, now);
+    }
 
-    float anemometerFactor = (float)cfg.getValueAsDouble("calibration.anemometerfactor");
+    if (now >= nextReportTime) {
+        reportThread(nrfListenThread, now);
 
-    target->windspeed = 
-                (float)source->rawWindspeed * 
-                ANEMOMETER_MPH * 
-                anemometerFactor;
-    target->gustSpeed = 
-                (float)source->rawWindGust * 
-                ANEMOMETER_MPH * 
-                anemometerFactor;
+        if (isCapturing) {
+            reportThread(captureThread, now);
+        }
 
-    target->windSpeedms = 
-                (float)source->rawWindspeed * 
-                ANEMOMETER_METRES_PER_SEC * 
-                anemometerFactor;
-    target->gustSpeedms = 
-                (float)source->rawWindGust * 
-                ANEMOMETER_METRES_PER_SEC * 
-                anemometerFactor;
+        for (SinkThread * thread : sinkThreads) {
+            reportThread(*thread, now);
+        }
+
+        nextReportTime = now + SUPERVISOR_REPORT_INTERVAL_MS;
+    }
+}
 
-    target->rainfall = (float)source->rawRainfall * RAIN_GAUGE_MM;
+/*
+** Shared by the threads running an event loop, fires once
+** requestStop() has been called...
+*/
+static void handleStopEvent(int fd, uint32_t events, void * context) {
+    ((eventLoop *)context)->stop();
+}
 
-    return target;
+static void handleHeartbeatTimer(int fd, uint32_t events, void * context) {
+    ((PosixThread *)context)->heartbeat();
 }
 
 static nrfcfg::data_rate getDataRate() {
@@ -293,7 +460,7 @@ static nrfcfg::data_rate getDataRate() {
     return dataRate;
 }
 
-static nrfcfg & getRadioConfig() {
+nrfcfg & getRadioConfig() {
     static nrfcfg radioConfig;
     static char szLocalAddress[32];
     static char szRemoteAddress[32];
@@ -310,396 +477,602 @@ static nrfcfg & getRadioConfig() {
     radioConfig.remoteAddress = szRemoteAddress;
     radioConfig.lnaGainOn = false;
 
+    if (cfg.getValue("spi.freq").length() > 0) {
+        radioConfig.spiFrequency = cfg.getValueAsLongUnsignedInteger("spi.freq");
+    }
+
+    if (cfg.getValue("spi.cepin").length() > 0) {
+        radioConfig.cePin = cfg.getValueAsInteger("spi.cepin");
+    }
+
+    if (cfg.getValue("radio.irqpin").length() > 0) {
+        radioConfig.irqPin = cfg.getValueAsInteger("radio.irqpin");
+    }
+
     radioConfig.validate();
 
     return radioConfig;
 }
 
-void * NRFListenThread::run() {
-    uint8_t             packetID;
-    weather_packet_t    pkt;
-    sleep_packet_t      sleepPkt;
-    watchdog_packet_t   wdPkt;
-    int                 msgCounter = 0;
-
-    nrf24l01 & radio = nrf24l01::getInstance();
-
+/*
+** Returns false if the packet is a duplicate and should be
+** thrown away...
+*/
+bool NRFListenThread::checkSequence(weather_transform_t * tr, station * s) {
     logger & log = logger::getInstance();
-    cfgmgr & cfg = cfgmgr::getInstance();
 
-    log.logInfo("Opening NRF24L01 device");
+    sequenceTracker & seq = sequence[s->pipe];
 
-    nrfcfg radioConfig = getRadioConfig();
+    sequenceTracker::sequence_result result = seq.update(tr->packetNum);
 
-    radio.configureSPI(NRF_SPI_FREQUENCY, NRF_SPI_CE_PIN);
-    radio.open(radioConfig);
+    switch (result) {
+        case sequenceTracker::sequence_duplicate:
+            log.logInfo("Dropping duplicate packet %u from station 0x%08X", tr->packetNum, s->stationID);
+            return false;
 
-    uint16_t stationID = _getExpectedChipID();
-
-    log.logInfo("Read station ID from config as: 0x%08X", stationID);
+        case sequenceTracker::sequence_gap:
+            log.logStatus(
+                "Lost %u packet(s) from station 0x%08X before packet %u, loss rate %.1f%%, longest gap %u",
+                seq.getLastGap(),
+                s->stationID,
+                tr->packetNum,
+                seq.getLossRate() * 100.0,
+                seq.getLongestGap());
+            break;
 
-    int postCycleSeconds = cfg.getValueAsInteger("wow.postcycletime");
+        case sequenceTracker::sequence_late:
+            log.logInfo("Packet %u from station 0x%08X arrived out of order", tr->packetNum, s->stationID);
+            break;
 
-    log.logInfo("Got post cycle time for WOW service [%d]", postCycleSeconds);
+        case sequenceTracker::sequence_reboot:
+            log.logStatus(
+                "Station 0x%08X has restarted, packet number is now %u (restart #%llu)",
+                s->stationID,
+                tr->packetNum,
+                (unsigned long long)seq.getNumReboots());
+            break;
 
-    while (true) {
-        weather_transform_t * tr;
+        case sequenceTracker::sequence_resync:
+            log.logStatus("Packet number from station 0x%08X jumped to %u, resynchronising", s->stationID, tr->packetNum);
+            break;
 
-        while (radio.isDataReady()) {
-            log.logDebug("NRF24L01 has received data...");
-            uint8_t * payload = radio.readPayload();
+        default:
+            break;
+    }
 
-            if (strHexDump(szDumpBuffer, 1024, payload, NRF24L01_MAXIMUM_PACKET_LEN) > 0) {
-                log.logDebug("%s", szDumpBuffer);
-            }
+    tr->packetLossRate = (float)(seq.getLossRate() * 100.0);
+    tr->longestGap = seq.getLongestGap();
 
-            packetID = _getPacketType(payload);
+    return true;
+}
 
-            switch (packetID) {
-                case PACKET_ID_WEATHER:
-                    memcpy(&pkt, payload, sizeof(weather_packet_t));
+void NRFListenThread::processPayload(uint8_t * payload, int length, uint64_t timestamp, station * s) {
+    decoded_packet_t    decoded;
+    char                szDumpBuffer[DUMP_BUFFER_LEN];
 
-                    tr = transformWeatherPacket(&pkt);
+    logger & log = logger::getInstance();
 
-                    msgCounter += 30;
+    if (strHexDump(szDumpBuffer, DUMP_BUFFER_LEN, payload, length) > 0) {
+        log.logDebug("%s", szDumpBuffer);
+    }
 
-                    if (msgCounter == postCycleSeconds) {
-                        webPostQueue.push(*tr);
+    if (!decoderRegistry::getInstance().decode(payload, length, s, &decoded)) {
+        return;
+    }
 
-                        msgCounter = 0;
-                    }
+    if (!decoded.hasWeatherData) {
+        return;
+    }
 
-                    dbq.push(*tr);
+    weather_transform_t * tr = &decoded.transform;
 
-                    log.logDebug("Got weather data:");
-                    log.logDebug("\tPacket num:  %u", tr->packetNum);
-                    log.logDebug("\tStatus:      0x%04X", pkt.status);
-                    log.logDebug("\tBat. volts:  %.2f", tr->batteryVoltage);
-                    log.logDebug("\tBat. percent:%.2f", tr->batteryPercentage);
-                    log.logDebug("\tBat. crate:  %.2f", tr->batteryChargeRate);
-                    log.logDebug("\tTemperature: %.2f", tr->temperature);
-                    log.logDebug("\tDew point:   %.2f", tr->dewPoint);
-                    log.logDebug("\tAdj pressure:%.2f", tr->normalisedPressure);
-                    log.logDebug("\tAct pressure:%.2f", tr->actualPressure);
-                    log.logDebug("\tHumidity:    %d%%", (int)tr->humidity);
-                    log.logDebug("\tWind speed:  %.2f", tr->windspeed);
-                    log.logDebug("\tWind gust:   %.2f", tr->gustSpeed);
-                    log.logDebug("\tRainfall:    %.2f", tr->rainfall);
-                    break;
+    tr->timestamp = timestamp;
 
-                case PACKET_ID_SLEEP:
-                    memcpy(&sleepPkt, payload, sizeof(sleep_packet_t));
+    if (!checkSequence(tr, s)) {
+        return;
+    }
 
-                    pkt.rawBatteryVolts = sleepPkt.rawBatteryVolts;
+    metrics[s->pipe].update(tr);
+
+    readingBus::getInstance().publish(*tr);
+
+    log.logDebug("Got %s data from station 0x%08X:", decoded.name, s->stationID);
+    log.logDebug("\tPacket num:  %u", tr->packetNum);
+    log.logDebug("\tLoss rate:   %.2f%%", tr->packetLossRate);
+    log.logDebug("\tStatus:      0x%04X", tr->status_bits);
+    log.logDebug("\tBat. volts:  %.2f", tr->batteryVoltage);
+    log.logDebug("\tBat. percent:%.2f", tr->batteryPercentage);
+    log.logDebug("\tBat. crate:  %.2f", tr->batteryChargeRate);
+    log.logDebug("\tTemperature: %.2f", tr->temperature);
+    log.logDebug("\tDew point:   %.2f", tr->dewPoint);
+    log.logDebug("\tAdj pressure:%.2f", tr->normalisedPressure);
+    log.logDebug("\tAct pressure:%.2f", tr->actualPressure);
+    log.logDebug("\tHumidity:    %d%%", (int)tr->humidity);
+    log.logDebug("\tWind speed:  %.2f", tr->windspeed);
+    log.logDebug("\tWind gust:   %.2f", tr->gustSpeed);
+    log.logDebug("\tRainfall:    %.2f", tr->rainfall);
+    log.logDebug("\tWind 10min:  %.2f avg, %.2f gust", tr->avgWindspeed10min, tr->maxGust10min);
+    log.logDebug("\tRain 1h/24h: %.2f / %.2f, rate %.2f mm/h", tr->rainfall1h, tr->rainfall24h, tr->rainRate);
+    log.logDebug("\tTendency:    %+.2f hPa/3h", tr->pressureTendency3h);
+}
 
-                    tr = transformWeatherPacket(&pkt);
+int NRFListenThread::processAllPayloads(nrfdevice & radio, uint64_t timestamp) {
+    logger & log = logger::getInstance();
 
-                    log.logStatus("Got sleep packet:");
-                    log.logStatus("\tStatus:      0x%08X", sleepPkt.status);
-                    log.logStatus("\tBat. volts:  %.2f", tr->batteryVoltage);
-                    log.logStatus("\tSleep for:   %d", (int)sleepPkt.sleepHours);
-                    break;
+    span<nrf_payload_t> payloads = radio.readAllPayloads(rxPayloads);
 
-                case PACKET_ID_WATCHDOG:
-                    memcpy(&wdPkt, payload, sizeof(watchdog_packet_t));
+    for (nrf_payload_t & payload : payloads) {
+        if (payload.timestamp == 0) {
+            payload.timestamp = timestamp;
+        }
 
-                    log.logStatus("Got watchdog packet");
-                    break;
+        if (captureThread != NULL) {
+            captureThread->offer(payload);
+        }
 
-                default:
-                    log.logError("Undefined packet type received: ID[0x%02X]", packetID);
-                    break;
-            }
+        station * s = stationmgr::getInstance().getStation(payload.pipe);
 
-            PosixThread::sleep_ms(250);
+        if (s == NULL) {
+            log.logError("Dropping packet received on unconfigured pipe %d", payload.pipe);
+            continue;
         }
 
-        PosixThread::sleep(2);
+        processPayload(payload.data, payload.length, payload.timestamp, s);
     }
 
-    return NULL;
+    if (payloads.size() > 0) {
+        log.logDebug(
+            "Read %d payload(s), SPI transactions per packet: %.2f", 
+            (int)payloads.size(), 
+            radio.getSPITransactionsPerPacket());
+    }
+
+    return (int)payloads.size();
 }
 
-void * DBUpdateThread::run() {
-    weather_transform_t     tr;
-    daily_summary_t         ds;
-    bool                    isSummaryDone = false;
-    int                     hour;
-    int                     minute;
-    char                    szInsertStr[INSERT_STRING_LEN];
+/*
+** Every radio.verifyinterval seconds, check the radio still has
+** the configuration we gave it. A brown-out can reset it without
+** us knowing, after which it listens on the wrong address or
+** channel (or not at all), so start it over...
+*/
+void NRFListenThread::verifyRadio(nrfdevice & radio, nrfcfg & radioConfig) {
+    logger & log = logger::getInstance();
+
+    if (verifyIntervalSeconds <= 0) {
+        return;
+    }
+
+    uint64_t now = getEpochNanoseconds();
+
+    if (now < nextVerifyTime) {
+        return;
+    }
+
+    nextVerifyTime = now + (uint64_t)verifyIntervalSeconds * 1000000000ULL;
+
+    int numMismatches = radio.verify();
 
+    if (numMismatches > 0) {
+        log.logError("Radio has lost %d register setting(s), re-opening it", numMismatches);
+
+        radio.close();
+        radio.open(radioConfig);
+
+        /*
+        ** We may have moved off the configured channel...
+        */
+        if (linkMonitor.getCurrentChannel() != radio.getChannel()) {
+            radio.setChannel(linkMonitor.getCurrentChannel());
+        }
+    }
+}
+
+/*
+** Every radio.scaninterval seconds, sweep the band to see how
+** busy each channel is. If another channel is clearly quieter we
+** say so, and with radio.autochannel on we move there. The
+** stations must be running firmware that follows us...
+*/
+void NRFListenThread::monitorChannels(nrfdevice & radio) {
     logger & log = logger::getInstance();
-    cfgmgr & cfg = cfgmgr::getInstance();
 
-    memset(&ds, 0, sizeof(daily_summary_t));
+    if (scanIntervalSeconds <= 0) {
+        return;
+    }
 
-    psqlConnection * wctlConnection;
+    uint64_t now = getEpochNanoseconds();
 
-    try {
-        wctlConnection = new psqlConnection(
-                                    cfg.getValue("db.host"), 
-                                    cfg.getValueAsInteger("db.port"),
-                                    cfg.getValue("db.database"),
-                                    cfg.getValue("db.user"),
-                                    cfg.getValue("db.password"));
+    if (now < nextScanTime) {
+        return;
     }
-    catch (psql_error & e) {
-        log.logError("Failed to connect to database: %s", e.what());
+
+    nextScanTime = now + (uint64_t)scanIntervalSeconds * 1000000000ULL;
+
+    linkMonitor.sweep(radio, scanSamples);
+    linkMonitor.logReport();
+
+    int currentChannel = linkMonitor.getCurrentChannel();
+    int recommendedChannel = linkMonitor.getRecommendedChannel();
+
+    if (recommendedChannel == currentChannel) {
+        return;
     }
 
-    while (true) {
-        while (dbq.empty()) {
-            PosixThread::sleep_ms(25);
-        }
+    if (isAutoChannel && linkMonitor.isMoveAllowed()) {
+        log.logStatus(
+            "Moving from channel %d (%.1f%% busy) to channel %d (%.1f%% busy)",
+            currentChannel,
+            linkMonitor.getBusyFraction(currentChannel) * 100.0,
+            recommendedChannel,
+            linkMonitor.getBusyFraction(recommendedChannel) * 100.0);
 
-        tr = dbq.front();
-        dbq.pop();
+        radio.setChannel(recommendedChannel);
+        linkMonitor.setCurrentChannel(recommendedChannel, getEpochNanoseconds());
+    }
+    else {
+        log.logStatus(
+            "Channel %d is %.1f%% busy, channel %d (%.1f%% busy) is recommended",
+            currentChannel,
+            linkMonitor.getBusyFraction(currentChannel) * 100.0,
+            recommendedChannel,
+            linkMonitor.getBusyFraction(recommendedChannel) * 100.0);
+    }
+}
 
-        log.logDebug("Updating summary structure");
+void * NRFListenThread::run() {
+    nrfdevice & radio = nrfdevice::getInstance();
 
-        updateSummary(&ds, &tr);
+    logger & log = logger::getInstance();
 
-        string timestamp = getTimestamp();
+    log.logInfo("Opening NRF24L01 device");
 
-        log.logDebug("Inserting weather data");
+    nrfcfg radioConfig = getRadioConfig();
 
-        snprintf(
-            szInsertStr,
-            INSERT_STRING_LEN,
-            pszWeatherInsertStmt,
-            timestamp.c_str(),
-            (int32_t)tr.packetNum,
-            tr.temperature,
-            tr.dewPoint,
-            tr.actualPressure,
-            tr.normalisedPressure,
-            tr.humidity,
-            tr.rainfall,
-            tr.windspeed,
-            tr.gustSpeed
-        );
+    stationmgr::getInstance().configureRadio(radioConfig);
+    radioConfig.validate();
 
-        wctlConnection->execute(szInsertStr);
+    /*
+    ** The supervisor restarts us after an exception or a stall, so
+    ** whichever way we leave, the radio is closed ready for the
+    ** next run()...
+    */
+    try {
+        radio.open(radioConfig);
 
-        PosixThread::sleep_ms(100);
+        listen(radio, radioConfig);
+    }
+    catch (...) {
+        closeListener(radio);
+        throw;
+    }
 
-        log.logDebug("Inserting telemetry data");
+    closeListener(radio);
 
-        snprintf(
-            szInsertStr,
-            INSERT_STRING_LEN,
-            pszTelemetryInsertStmt,
-            timestamp.c_str(),
-            (int32_t)tr.packetNum,
-            tr.batteryVoltage,
-            tr.batteryPercentage,
-            tr.batteryChargeRate,
-            tr.status_bits
-        );
+    return NULL;
+}
 
-        wctlConnection->execute(szInsertStr);
+void NRFListenThread::closeListener(nrfdevice & radio) {
+    try {
+        radio.close();
+    }
+    catch (exception & e) {
+        logger::getInstance().logError("Failed to close radio: %s", e.what());
+    }
+}
 
-        struct tm * localtime = getLocalTime();
+void NRFListenThread::listen(nrfdevice & radio, nrfcfg & radioConfig) {
+    uint64_t            rxTimestamp;
 
-        hour = localtime->tm_hour;
-        minute = localtime->tm_min;
+    logger & log = logger::getInstance();
+    cfgmgr & cfg = cfgmgr::getInstance();
 
-        /*
-        ** On the stroke of midnight, write the daily_summary
-        ** and reset the summary values...
-        */
-        if (hour == 23 && minute == 59 && !isSummaryDone) {
-            PosixThread::sleep_ms(100);
+    log.logInfo("Listening for %d station(s)", stationmgr::getInstance().getNumStations());
 
-            log.logDebug("Inserting daily summary");
+    verifyIntervalSeconds = cfg.getValueAsInteger("radio.verifyinterval");
 
-            string date = getTodaysDate();
+    scanIntervalSeconds = cfg.getValueAsInteger("radio.scaninterval");
+    isAutoChannel = cfg.getValueAsBoolean("radio.autochannel");
 
-            snprintf(
-                szInsertStr,
-                INSERT_STRING_LEN,
-                pszSummaryInsertStmt,
-                date.c_str(),
-                ds.min_temperature,
-                ds.max_temperature,
-                ds.min_pressure,
-                ds.max_pressure,
-                ds.min_humidity,
-                ds.max_humidity,
-                ds.total_rainfall,
-                ds.max_wind_speed,
-                ds.max_wind_gust
-            );
+    if (cfg.getValue("radio.scansamples").length() > 0) {
+        scanSamples = cfg.getValueAsInteger("radio.scansamples");
+    }
 
-            wctlConnection->execute(szInsertStr);
+    linkMonitor.setCurrentChannel(radio.getChannel(), getEpochNanoseconds());
 
-            memset(&ds, 0, sizeof(daily_summary_t));
+    while (!isStopping()) {
+        heartbeat();
 
-            isSummaryDone = true;
-        }
-        else if (hour == 1) {
+        if (radio.isIRQEnabled()) {
             /*
-            ** Once we've got to 1am, reset isSummaryDone flag...
+            ** Block until the radio asserts RX_DR, the timeout is
+            ** just a safety net in case we ever miss an edge...
             */
-            isSummaryDone = false;
-        }
+            if (!radio.waitForInterrupt(IRQ_WAIT_TIMEOUT_MS, &rxTimestamp)) {
+                rxTimestamp = getEpochNanoseconds();
+            }
 
-        PosixThread::sleep_ms(250);
-    }
+            linkMonitor.recordPackets(processAllPayloads(radio, rxTimestamp));
+
+            verifyRadio(radio, radioConfig);
+            monitorChannels(radio);
+        }
+        else {
+            while (radio.isDataReady() && !isStopping()) {
+                heartbeat();
 
-    delete(wctlConnection);
+                log.logDebug("NRF24L01 has received data...");
+                linkMonitor.recordPackets(processAllPayloads(radio, getEpochNanoseconds()));
 
-    return NULL;
-}
+                waitForStop(250);
+            }
 
-static char * getEncodedTimeStamp(void) {
-    struct tm *         utc;
-	time_t				t;
-    char *              pszTimeBuffer;
+            verifyRadio(radio, radioConfig);
+            monitorChannels(radio);
 
-    pszTimeBuffer = (char *)malloc(TIME_BUFFER_SIZE);
+            waitForStop(2000);
+        }
+    }
 
-	t = time(NULL);
-	utc = gmtime(&t);
+    /*
+    ** Anything still in the RX FIFO has been received, so it
+    ** goes to the sinks like everything else...
+    */
+    int numDrained = processAllPayloads(radio, getEpochNanoseconds());
 
-    snprintf(
-        pszTimeBuffer,
-        TIME_BUFFER_SIZE,
-        "%d-%02d-%02d+%02d%%3A%02d%%3A%02d",
-        utc->tm_year + 1900,
-        utc->tm_mon + 1,
-        utc->tm_mday,
-        utc->tm_hour,
-        utc->tm_min,
-        utc->tm_sec);
+    log.logStatus("Radio stopped, %d payload(s) drained from the RX FIFO", numDrained);
+}
 
-	return pszTimeBuffer;
+void NRFListenThread::onStopRequested() {
+    nrfdevice::getInstance().cancelWait();
 }
 
-size_t CurlWrite_CallbackFunc(void * contents, size_t size, size_t nmemb, void * p)
-{
-    curl_chunk_t *      pChunk = (curl_chunk_t *)p;
-    size_t              newLength =  size * nmemb;
-    char *              s;
 
-    s = (char *)realloc(pChunk->response, (pChunk->length + newLength + 1));
+SinkThread::SinkThread(readingSink * sink, busSubscription * subscription) : PosixThread(sink->getThreadName()) {
+    this->sink = sink;
+    this->subscription = subscription;
 
-    if (s == NULL) {
-        return 0;
-    }
+    batch = new weather_transform_t[subscription->getPolicy().maxBatch];
+}
 
-    pChunk->response = s;
+SinkThread::~SinkThread() {
+    delete[] batch;
+    delete sink;
+}
 
-    memcpy(&pChunk->response[pChunk->length], contents, newLength);
-    pChunk->length += newLength;
+/*
+** The listen thread only counts what it drops...
+*/
+void SinkThread::logDropped() {
+    uint64_t numDropped = subscription->getNumDropped();
 
-    pChunk->response[pChunk->length] = 0;
+    if (numDropped > numDroppedLogged) {
+        logger::getInstance().logError(
+            "%s queue was full, %llu reading(s) dropped (%llu in all)",
+            getName(),
+            (unsigned long long)(numDropped - numDroppedLogged),
+            (unsigned long long)numDropped);
 
-    return newLength;
+        numDroppedLogged = numDropped;
+    }
 }
 
-void * WoWUpdateThread::run() {
-    float                   tempF;
-    float                   dewPointF;
-    float                   pressureInHg;
-    weather_transform_t     tr;
-    CURL *                  pCurl;
-	CURLcode			    result;
-    char                    szCurlError[CURL_ERROR_SIZE];
-    char                    szURL[1024];
-    curl_chunk_t            chunk;
-    char *                  encodedDate;
+/*
+** Hand everything queued to the sink, a batch at a time. If the
+** sink wants us to wait for a batch to fill, a partial batch waits
+** until it is full or the batch timer goes off...
+*/
+void SinkThread::deliver(bool isFlush) {
+    const sink_policy_t & policy = subscription->getPolicy();
 
     logger & log = logger::getInstance();
-    cfgmgr & cfg = cfgmgr::getInstance();
 
-    chunk.length = 0;
-    chunk.response = NULL;
+    logDropped();
 
     while (true) {
-        pCurl = curl_easy_init();
+        uint32_t numWaiting = subscription->getDepth();
 
-        if (pCurl == NULL) {
-            curl_easy_cleanup(pCurl);
-            log.logError("Failed to initialise curl");
-            break;
+        if (numWaiting == 0) {
+            if (subscription->armWakeup()) {
+                return;
+            }
+
+            continue;
         }
 
-        curl_easy_setopt(pCurl, CURLOPT_PROTOCOLS, CURLPROTO_HTTP);
-        curl_easy_setopt(pCurl, CURLOPT_ERRORBUFFER, szCurlError);
+        if (!isFlush && policy.batchDelayMs > 0 && numWaiting < policy.maxBatch) {
+            if (!isBatchPending) {
+                loop->setTimer(batchTimerFD, policy.batchDelayMs, false);
+                isBatchPending = true;
+            }
+
+            subscription->armWakeupOnPush();
+            return;
+        }
 
-        string baseURL = cfg.getValue("wow.baseurl");
-        string siteID = cfg.getValue("wow.siteid");
-        string authKey = cfg.getValue("wow.authkey");
-        string softwareType = cfg.getValue("wow.softwareid");
+        log.logDebug(
+            "%s queue depth %u/%u, high water %u, dropped %llu",
+            getName(),
+            numWaiting,
+            subscription->getCapacity(),
+            subscription->getHighWaterMark(),
+            (unsigned long long)subscription->getNumDropped());
 
-        log.logDebug("Base URL: %s", baseURL.c_str());
-        log.logDebug("Site ID: %s", siteID.c_str());
-        log.logDebug("Software ID: %s", softwareType.c_str());
+        uint32_t numReadings = subscription->collect(batch, policy.maxBatch);
 
-        while (webPostQueue.empty()) {
-            PosixThread::sleep_ms(25);
+        /*
+        ** The timer was for the readings that have just gone, what
+        ** comes next waits the whole delay...
+        */
+        if (isBatchPending) {
+            loop->disarmTimer(batchTimerFD);
+            isBatchPending = false;
         }
 
-        tr = webPostQueue.front();
-        webPostQueue.pop();
+        if (numReadings > 0) {
+            span<weather_transform_t> readings(batch, numReadings);
 
-        encodedDate = getEncodedTimeStamp();
+            /*
+            ** We're falling behind, so the sink gets the chance to
+            ** put readings aside before the queue fills and drops
+            ** them...
+            */
+            if (numWaiting < BUS_SPILL_THRESHOLD || !sink->spill(readings)) {
+                sink->write(readings);
+            }
+        }
+    }
+}
 
-        tempF = (tr.temperature * 1.8) + 32;
-        dewPointF = (tr.dewPoint * 1.8) + 32;
-        pressureInHg = (tr.normalisedPressure) * HPA_TO_INHG;
+void SinkThread::onStalled() {
+    sink->onStalled();
+}
 
-        log.logDebug("Preparing to POST to WoW service");
+void SinkThread::handleQueueEvent() {
+    subscription->clearWakeup();
+    deliver(false);
+}
 
-        snprintf(
-            szURL, 
-            URL_STRING_LEN,
-            "%s?siteid=%s&siteAuthenticationKey=%s&dateutc=%s&softwaretype=%s",
-            baseURL.c_str(),
-            siteID.c_str(),
-            authKey.c_str(),
-            encodedDate,
-            softwareType.c_str());
+void SinkThread::handleBatchTimer() {
+    isBatchPending = false;
+    deliver(true);
+}
 
-        free(encodedDate);
+static void handleSinkQueueEvent(int fd, uint32_t events, void * context) {
+    ((SinkThread *)context)->handleQueueEvent();
+}
 
-        snprintf(
-            &szURL[strlen(szURL)],
-            (URL_STRING_LEN - strlen(szURL)),
-            "&tempf=%.2f&baromin=%.2f&humidity=%.2f&dewptf=%.2f&windspeedmph=%.2f&windgustmph=%.2f",
-            tempF,
-            pressureInHg,
-            tr.humidity,
-            dewPointF,
-            tr.windspeed,
-            tr.gustSpeed);
+static void handleSinkBatchTimer(int fd, uint32_t events, void * context) {
+    ((SinkThread *)context)->handleBatchTimer();
+}
 
-        log.logInfo("Posting to URL: %s", szURL);
+void * SinkThread::run() {
+    if (subscription->getEventFD() < 0) {
+        throw thread_error(thread_error::buildMsg("%s queue has no eventfd to wait on", getName()));
+    }
 
-        if (cfg.getValueAsBoolean("wow.isenabled")) {
-            curl_easy_setopt(pCurl, CURLOPT_URL, szURL);
+    /*
+    ** Sleep in epoll until there is something in the queue, or
+    ** the sink has something of its own to do...
+    */
+    eventLoop threadLoop;
 
-            curl_easy_setopt(pCurl, CURLOPT_HTTPGET, 1L);
-            curl_easy_setopt(pCurl, CURLOPT_USERAGENT, "libcrp/0.1");
-            curl_easy_setopt(pCurl, CURLOPT_WRITEFUNCTION, &CurlWrite_CallbackFunc);
-            curl_easy_setopt(pCurl, CURLOPT_WRITEDATA, &chunk);
+    loop = &threadLoop;
+    isBatchPending = false;
 
-            result = curl_easy_perform(pCurl);
+    threadLoop.addFD(subscription->getEventFD(), EPOLLIN, &handleSinkQueueEvent, this);
+    threadLoop.addFD(getStopFD(), EPOLLIN, &handleStopEvent, &threadLoop);
+    threadLoop.addTimer(HEARTBEAT_INTERVAL_MS, true, &handleHeartbeatTimer, this);
 
-            if (result != CURLE_OK) {
-                log.logError("Failed to post to %s - Curl error [%s]", szURL, szCurlError);
-                return NULL;
-            }
+    batchTimerFD = threadLoop.addTimer(0, false, &handleSinkBatchTimer, this);
+
+    threadLoop.disarmTimer(batchTimerFD);
+
+    sink->open(threadLoop);
+
+    deliver(false);
+
+    threadLoop.run();
+
+    /*
+    ** We're stopping, the listen thread has already gone so this
+    ** empties the queue for good. The stop eventfd stays readable,
+    ** so it comes out of the loop first in case the sink wants to
+    ** run it again in close()...
+    */
+    threadLoop.removeFD(getStopFD());
+
+    deliver(true);
+
+    sink->close(threadLoop);
+
+    loop = NULL;
 
-            log.logInfo("WoW service responded: %s", chunk.response);
+    return NULL;
+}
+
+
+/*
+** Write everything queued, and say if the listen thread has had to
+** drop any since we last looked. A failed write escapes run(), so
+** the supervisor re-opens the file after a backoff...
+*/
+void CaptureThread::drain() {
+    nrf_payload_t       payload;
+
+    while (true) {
+        while (queue.pop(payload)) {
+            capture->write(payload.data, payload.length, payload.pipe, payload.timestamp);
         }
-        else {
-            log.logInfo("Posting disbaled by config - do nothing");
+
+        if (queue.armWakeup()) {
+            break;
         }
+    }
+
+    uint64_t numDropped = queue.getNumDropped();
+
+    if (numDropped > numDroppedLogged) {
+        logger::getInstance().logError(
+            "Capture queue was full, %llu packet(s) not captured (%llu in all)",
+            (unsigned long long)(numDropped - numDroppedLogged),
+            (unsigned long long)numDropped);
+
+        numDroppedLogged = numDropped;
+    }
+}
+
+void CaptureThread::handleQueueEvent() {
+    queue.clearWakeup();
+    drain();
+}
+
+static void handleCaptureQueueEvent(int fd, uint32_t events, void * context) {
+    ((CaptureThread *)context)->handleQueueEvent();
+}
+
+void CaptureThread::closeCapture() {
+    if (capture != NULL) {
+        delete capture;
+        capture = NULL;
+    }
+}
+
+void * CaptureThread::run() {
+    cfgmgr & cfg = cfgmgr::getInstance();
+
+    if (queue.getEventFD() < 0) {
+        throw thread_error("Capture queue has no eventfd to wait on");
+    }
+
+    eventLoop threadLoop;
+
+    threadLoop.addFD(queue.getEventFD(), EPOLLIN, &handleCaptureQueueEvent, this);
+    threadLoop.addFD(getStopFD(), EPOLLIN, &handleStopEvent, &threadLoop);
+    threadLoop.addTimer(HEARTBEAT_INTERVAL_MS, true, &handleHeartbeatTimer, this);
 
-        PosixThread::sleep_ms(250);
+    /*
+    ** Whichever way we leave, the file is let go, ready for the
+    ** next run()...
+    */
+    try {
+        capture = new captureWriter(cfg.getValue("capture.filename"), cfg.getValueAsLongUnsignedInteger("capture.maxsize"));
+
+        drain();
+
+        threadLoop.run();
+
+        /*
+        ** The listen thread has gone, so this is the last of it...
+        */
+        drain();
     }
+    catch (...) {
+        closeCapture();
+        throw;
+    }
+
+    closeCapture();
 
     return NULL;
 }
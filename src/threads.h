@@ -1,36 +1,152 @@
+#include <vector>
+
 #include <stdint.h>
 #include <stdbool.h>
 
 #include "posixthread.h"
+#include "radio.h"
+#include "capture.h"
+#include "station.h"
+#include "sequence.h"
+#include "metrics.h"
+#include "channel.h"
 #include "packet.h"
+#include "reactor.h"
+#include "queue.h"
+#include "bus.h"
 
 #ifndef __INCL_THREADS
 #define __INCL_THREADS
 
-class NRFListenThread : public PosixThread {
+/*
+** How often supervise() should be called, and how often
+** it logs how the threads are getting on...
+*/
+#define SUPERVISOR_INTERVAL_MS              1000U
+#define SUPERVISOR_REPORT_INTERVAL_MS       (15U * 60U * 1000U)
+
+/*
+** Payloads waiting to be written to the capture file...
+*/
+#define CAPTURE_QUEUE_CAPACITY              256
+
+/*
+** Writes everything the listen thread hears to the capture file.
+** A slow SD card holds this thread up rather than the radio's, and
+** costs us captured packets (counted) rather than received ones...
+*/
+class CaptureThread : public PosixThread {
     private:
-        weather_transform_t * transformWeatherPacket(weather_packet_t * weatherPacket);
-        
+        spscQueue<nrf_payload_t, CAPTURE_QUEUE_CAPACITY>   queue;
+
+        captureWriter *     capture = NULL;
+        uint64_t            numDroppedLogged = 0;
+
+        void closeCapture();
+
     public:
-        NRFListenThread() : PosixThread() {}
+        CaptureThread() : PosixThread("CaptureThread") {}
+
+        /*
+        ** The listen thread's end, never blocks. Returns false if
+        ** the payload was dropped because the queue is full...
+        */
+        bool offer(const nrf_payload_t & payload) {
+            return queue.push(payload);
+        }
+
+        uint64_t getNumDropped() {
+            return queue.getNumDropped();
+        }
+
+        void drain();
+        void handleQueueEvent();
 
         void * run();
 };
 
-class DBUpdateThread : public PosixThread {
+class NRFListenThread : public PosixThread {
+    private:
+        int                 verifyIntervalSeconds = 0;
+        uint64_t            nextVerifyTime = 0;
+
+        channelMonitor      linkMonitor;
+        int                 scanIntervalSeconds = 0;
+        int                 scanSamples = CHANNEL_DEFAULT_SAMPLES;
+        bool                isAutoChannel = false;
+        uint64_t            nextScanTime = 0;
+
+        sequenceTracker     sequence[NRF24L01_NUM_RX_PIPES];
+        metricsEngine       metrics[NRF24L01_NUM_RX_PIPES];
+
+        nrf_payload_t       rxPayloads[NRF24L01_RX_FIFO_DEPTH];
+
+        CaptureThread *     captureThread = NULL;
+
+        bool checkSequence(weather_transform_t * tr, station * s);
+        void processPayload(uint8_t * payload, int length, uint64_t timestamp, station * s);
+        int processAllPayloads(nrfdevice & radio, uint64_t timestamp);
+        void verifyRadio(nrfdevice & radio, nrfcfg & radioConfig);
+        void monitorChannels(nrfdevice & radio);
+
+        void listen(nrfdevice & radio, nrfcfg & radioConfig);
+        void closeListener(nrfdevice & radio);
+
+    protected:
+        void onStopRequested() override;
+        
     public:
-        DBUpdateThread() : PosixThread() {}
+        NRFListenThread() : PosixThread("NRFListenThread") {}
+
+        /*
+        ** Where we send every payload to be captured, NULL if
+        ** we aren't capturing...
+        */
+        void setCaptureThread(CaptureThread * thread) {
+            captureThread = thread;
+        }
 
         void * run();
 };
 
-class WoWUpdateThread : public PosixThread {
+/*
+** Runs one sink, feeding it from its subscription to the bus...
+*/
+class SinkThread : public PosixThread {
+    private:
+        readingSink *       sink;
+        busSubscription *   subscription;
+
+        eventLoop *         loop = NULL;
+        int                 batchTimerFD = -1;
+        bool                isBatchPending = false;
+
+        weather_transform_t * batch;
+
+        uint64_t            numDroppedLogged = 0;
+
+        void logDropped();
+        void deliver(bool isFlush);
+
+    protected:
+        void onStalled() override;
+
     public:
-        WoWUpdateThread() : PosixThread() {}
+        SinkThread(readingSink * sink, busSubscription * subscription);
+        ~SinkThread();
+
+        readingSink * getSink() {
+            return sink;
+        }
+
+        void handleQueueEvent();
+        void handleBatchTimer();
 
         void * run();
 };
 
+nrfcfg & getRadioConfig();
+
 class ThreadManager {
     public:
         static ThreadManager & getInstance() {
@@ -42,12 +158,31 @@ class ThreadManager {
         ThreadManager() {}
 
         NRFListenThread nrfListenThread;
-        DBUpdateThread dbUpdateThread;
-        WoWUpdateThread wowUpdateThread;
+        CaptureThread captureThread;
+        bool isCapturing = false;
+        vector<SinkThread *> sinkThreads;
+
+        uint64_t nextReportTime = 0;
+
+        void openSinks();
+
+        void superviseThread(PosixThread & thread, uint64_t now);
+        void reportThread(PosixThread & thread, uint64_t now);
 
     public:
         void start();
-        void kill();
+
+        /*
+        ** Watch for stalled threads and restart them, called every
+        ** SUPERVISOR_INTERVAL_MS from the main loop...
+        */
+        void supervise();
+
+        /*
+        ** Stop the threads in order, radio first, so everything
+        ** received is captured and reaches the sinks...
+        */
+        void stop();
 };
 
 #endif
@@ -11,6 +11,7 @@
 #include <time.h>
 #include <sys/time.h>
 #include <pthread.h>
+#include <poll.h>
 
 #include "utils.h"
 
@@ -21,32 +22,40 @@ using namespace std;
 
 static pthread_mutex_t _mutex = PTHREAD_MUTEX_INITIALIZER;
 
-static string & _getTimestamp(bool includeMicroseconds) {
-    static string ts;
-    struct timeval tv;
-
-	pthread_mutex_lock(&_mutex);
+static string & _formatTimestamp(string & ts, time_t t, long microseconds) {
+    struct tm localTime;
 
-    gettimeofday(&tv, NULL);
-    time_t t = tv.tv_sec;
-    struct tm * localTime = localtime(&t);
+    localtime_r(&t, &localTime);
 
     char timestamp[TIME_STAMP_BUFFER_LEN];
 
     snprintf(
         timestamp, 
         TIME_STAMP_BUFFER_LEN, 
-        "%d-%02d-%02d %02d:%02d:%02d.%06d", 
-        localTime->tm_year + 1900, 
-        localTime->tm_mon + 1, 
-        localTime->tm_mday,
-        localTime->tm_hour,
-        localTime->tm_min,
-        localTime->tm_sec,
-        tv.tv_usec);
+        "%d-%02d-%02d %02d:%02d:%02d.%06ld", 
+        localTime.tm_year + 1900, 
+        localTime.tm_mon + 1, 
+        localTime.tm_mday,
+        localTime.tm_hour,
+        localTime.tm_min,
+        localTime.tm_sec,
+        microseconds);
 
     ts.assign(timestamp);
 
+    return ts;
+}
+
+static string & _getTimestamp(bool includeMicroseconds) {
+    static string ts;
+    struct timeval tv;
+
+	pthread_mutex_lock(&_mutex);
+
+    gettimeofday(&tv, NULL);
+
+    _formatTimestamp(ts, tv.tv_sec, tv.tv_usec);
+
     pthread_mutex_unlock(&_mutex);
 
     return ts;
@@ -88,6 +97,48 @@ string & getTimestampUs() {
     return _getTimestamp(true);
 }
 
+string & getTimestamp(uint64_t timestampNs) {
+    static string ts;
+
+    pthread_mutex_lock(&_mutex);
+
+    _formatTimestamp(
+            ts, 
+            (time_t)(timestampNs / 1000000000ULL), 
+            (long)((timestampNs % 1000000000ULL) / 1000ULL));
+
+    pthread_mutex_unlock(&_mutex);
+
+    return ts;
+}
+
+uint64_t getEpochNanoseconds() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    return ((uint64_t)ts.tv_sec * 1000000000ULL) + (uint64_t)ts.tv_nsec;
+}
+
+bool sleepUntilReadable(int fd, uint64_t durationNs) {
+    struct timespec ts;
+    struct pollfd   pfd;
+
+    ts.tv_sec = (time_t)(durationNs / 1000000000ULL);
+    ts.tv_nsec = (long)(durationNs % 1000000000ULL);
+
+    if (fd < 0) {
+        nanosleep(&ts, NULL);
+        return false;
+    }
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    return (ppoll(&pfd, 1, &ts, NULL) > 0);
+}
+
 int strHexDump(char * pszBuffer, int strBufferLen, void * buffer, uint32_t bufferLen) {
     int         i;
     int         j = 0;
@@ -13,6 +13,14 @@ struct tm * getLocalTime();
 string & getTodaysDate();
 string & getTimestamp();
 string & getTimestampUs();
+string & getTimestamp(uint64_t timestampNs);
+uint64_t getEpochNanoseconds();
+
+/*
+** Sleep for durationNs, or until fd becomes readable, returns
+** true if fd woke us...
+*/
+bool sleepUntilReadable(int fd, uint64_t durationNs);
 
 int         strHexDump(char * pszBuffer, int strBufferLen, void * buffer, uint32_t bufferLen);
 void        hexDump(void * buffer, uint32_t bufferLen);
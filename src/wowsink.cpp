@@ -0,0 +1,477 @@
+#include <string>
+#include <span>
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+
+#include <curl/curl.h>
+
+#include "logger.h"
+#include "cfgmgr.h"
+#include "posixthread.h"
+#include "utils.h"
+#include "packet.h"
+#include "station.h"
+#include "reactor.h"
+#include "bus.h"
+
+using namespace std;
+
+#define URL_STRING_LEN             1024
+
+#define HPA_TO_INHG                 0.02952998057228486f
+#define MM_TO_INCHES                0.03937007874015748f
+
+/*
+** Room for the longest thing each %d could print, not just a
+** real date, so the compiler can see it never truncates...
+*/
+#define TIME_BUFFER_SIZE            80
+
+#define WOW_POST_TIMEOUT_MS         30000U
+
+/*
+** At shutdown we give up on posts still in flight a little
+** before the thread's deadline...
+*/
+#define WOW_STALL_TIMEOUT_MS        60000U
+#define SHUTDOWN_WOW_TIMEOUT_MS     2000U
+#define WOW_FLUSH_TIMEOUT_MS        1500U
+
+typedef struct {
+    char *      response;
+    size_t      length;
+}
+curl_chunk_t;
+
+static char * getEncodedTimeStamp(uint64_t timestampNs) {
+    struct tm *         utc;
+	time_t				t;
+    char *              pszTimeBuffer;
+
+    pszTimeBuffer = (char *)malloc(TIME_BUFFER_SIZE);
+
+	t = (time_t)(timestampNs / 1000000000ULL);
+	utc = gmtime(&t);
+
+    snprintf(
+        pszTimeBuffer,
+        TIME_BUFFER_SIZE,
+        "%d-%02d-%02d+%02d%%3A%02d%%3A%02d",
+        utc->tm_year + 1900,
+        utc->tm_mon + 1,
+        utc->tm_mday,
+        utc->tm_hour,
+        utc->tm_min,
+        utc->tm_sec);
+
+	return pszTimeBuffer;
+}
+
+size_t CurlWrite_CallbackFunc(void * contents, size_t size, size_t nmemb, void * p)
+{
+    curl_chunk_t *      pChunk = (curl_chunk_t *)p;
+    size_t              newLength =  size * nmemb;
+    char *              s;
+
+    s = (char *)realloc(pChunk->response, (pChunk->length + newLength + 1));
+
+    if (s == NULL) {
+        return 0;
+    }
+
+    pChunk->response = s;
+
+    memcpy(&pChunk->response[pChunk->length], contents, newLength);
+    pChunk->length += newLength;
+
+    pChunk->response[pChunk->length] = 0;
+
+    return newLength;
+}
+
+/*
+** One post in flight, freed once curl says it has finished, or
+** when we give up on it...
+*/
+typedef struct _wow_post_t {
+    CURL *                  handle;
+    curl_chunk_t            chunk;
+    char                    szCurlError[CURL_ERROR_SIZE];
+    char                    szURL[URL_STRING_LEN];
+
+    struct _wow_post_t *    prev;
+    struct _wow_post_t *    next;
+}
+wow_post_t;
+
+/*
+** Everything the WoW sink's event handlers share...
+*/
+typedef struct {
+    eventLoop *             loop;
+    CURLM *                 multi;
+    int                     curlTimerFD;
+    int                     numInFlight;
+    wow_post_t *            inFlight;
+}
+wow_sink_state_t;
+
+static void freePost(wow_sink_state_t * state, wow_post_t * post) {
+    curl_multi_remove_handle(state->multi, post->handle);
+    curl_easy_cleanup(post->handle);
+
+    if (post->prev != NULL) {
+        post->prev->next = post->next;
+    }
+    else {
+        state->inFlight = post->next;
+    }
+
+    if (post->next != NULL) {
+        post->next->prev = post->prev;
+    }
+
+    free(post->chunk.response);
+    delete post;
+
+    state->numInFlight--;
+}
+
+static void checkCompletedPosts(wow_sink_state_t * state) {
+    CURLMsg *               msg;
+    wow_post_t *            post;
+    int                     numMessages;
+
+    logger & log = logger::getInstance();
+
+    while ((msg = curl_multi_info_read(state->multi, &numMessages)) != NULL) {
+        if (msg->msg != CURLMSG_DONE) {
+            continue;
+        }
+
+        curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **)&post);
+
+        if (msg->data.result != CURLE_OK) {
+            log.logError("Failed to post to %s - Curl error [%s]", post->szURL, post->szCurlError);
+        }
+        else {
+            log.logInfo("WoW service responded: %s", post->chunk.response != NULL ? post->chunk.response : "");
+        }
+
+        freePost(state, post);
+    }
+}
+
+static void handleCurlSocketEvent(int fd, uint32_t events, void * context) {
+    int                     mask = 0;
+    int                     numRunning;
+
+    wow_sink_state_t * state = (wow_sink_state_t *)context;
+
+    if (events & EPOLLIN) {
+        mask |= CURL_CSELECT_IN;
+    }
+    if (events & EPOLLOUT) {
+        mask |= CURL_CSELECT_OUT;
+    }
+    if (events & (EPOLLERR | EPOLLHUP)) {
+        mask |= CURL_CSELECT_ERR;
+    }
+
+    curl_multi_socket_action(state->multi, fd, mask, &numRunning);
+
+    checkCompletedPosts(state);
+}
+
+static void handleCurlTimerEvent(int fd, uint32_t events, void * context) {
+    int                     numRunning;
+
+    wow_sink_state_t * state = (wow_sink_state_t *)context;
+
+    curl_multi_socket_action(state->multi, CURL_SOCKET_TIMEOUT, 0, &numRunning);
+
+    checkCompletedPosts(state);
+}
+
+/*
+** curl tells us which of its sockets to watch and for what,
+** socketp is non-NULL once a socket is in our epoll set...
+*/
+static int curlSocketCallback(CURL * easy, curl_socket_t sockfd, int what, void * userp, void * socketp) {
+    uint32_t                events = 0;
+
+    wow_sink_state_t * state = (wow_sink_state_t *)userp;
+
+    if (what & CURL_POLL_IN) {
+        events |= EPOLLIN;
+    }
+    if (what & CURL_POLL_OUT) {
+        events |= EPOLLOUT;
+    }
+
+    try {
+        if (what == CURL_POLL_REMOVE) {
+            if (socketp != NULL) {
+                state->loop->removeFD(sockfd);
+                curl_multi_assign(state->multi, sockfd, NULL);
+            }
+        }
+        else if (socketp == NULL) {
+            state->loop->addFD(sockfd, events, &handleCurlSocketEvent, state);
+            curl_multi_assign(state->multi, sockfd, state);
+        }
+        else {
+            state->loop->modifyFD(sockfd, events);
+        }
+    }
+    catch (reactor_error & e) {
+        logger::getInstance().logError("Failed to watch curl socket: %s", e.what());
+        return -1;
+    }
+
+    return 0;
+}
+
+static int curlTimerCallback(CURLM * multi, long timeoutMs, void * userp) {
+    wow_sink_state_t * state = (wow_sink_state_t *)userp;
+
+    if (timeoutMs < 0) {
+        state->loop->disarmTimer(state->curlTimerFD);
+    }
+    else {
+        state->loop->setTimer(state->curlTimerFD, (uint32_t)timeoutMs, false);
+    }
+
+    return 0;
+}
+
+static void postToWoW(wow_sink_state_t * state, weather_transform_t & tr) {
+    float                   tempF;
+    float                   dewPointF;
+    float                   pressureInHg;
+    char *                  encodedDate;
+
+    logger & log = logger::getInstance();
+    cfgmgr & cfg = cfgmgr::getInstance();
+
+    string baseURL = cfg.getValue("wow.baseurl");
+    string softwareType = cfg.getValue("wow.softwareid");
+
+    log.logDebug("Base URL: %s", baseURL.c_str());
+    log.logDebug("Software ID: %s", softwareType.c_str());
+
+    station * s = stationmgr::getInstance().getStation(tr.pipe);
+
+    string siteID = s->wowSiteID;
+    string authKey = s->wowAuthKey;
+
+    log.logDebug("Site ID: %s", siteID.c_str());
+
+    wow_post_t * post = new wow_post_t;
+
+    memset(post, 0, sizeof(wow_post_t));
+
+    encodedDate = getEncodedTimeStamp(tr.timestamp);
+
+    tempF = (tr.temperature * 1.8) + 32;
+    dewPointF = (tr.dewPoint * 1.8) + 32;
+    pressureInHg = (tr.normalisedPressure) * HPA_TO_INHG;
+
+    log.logDebug("Preparing to POST to WoW service");
+
+    snprintf(
+        post->szURL, 
+        URL_STRING_LEN,
+        "%s?siteid=%s&siteAuthenticationKey=%s&dateutc=%s&softwaretype=%s",
+        baseURL.c_str(),
+        siteID.c_str(),
+        authKey.c_str(),
+        encodedDate,
+        softwareType.c_str());
+
+    free(encodedDate);
+
+    snprintf(
+        &post->szURL[strlen(post->szURL)],
+        (URL_STRING_LEN - strlen(post->szURL)),
+        "&tempf=%.2f&baromin=%.2f&humidity=%.2f&dewptf=%.2f&windspeedmph=%.2f&windgustmph=%.2f&rainin=%.2f",
+        tempF,
+        pressureInHg,
+        tr.humidity,
+        dewPointF,
+        tr.windspeed,
+        tr.gustSpeed,
+        tr.rainfall1h * MM_TO_INCHES);
+
+    log.logInfo("Posting to URL: %s", post->szURL);
+
+    if (!cfg.getValueAsBoolean("wow.isenabled")) {
+        log.logInfo("Posting disbaled by config - do nothing");
+        delete post;
+        return;
+    }
+
+    post->handle = curl_easy_init();
+
+    if (post->handle == NULL) {
+        log.logError("Failed to initialise curl");
+        delete post;
+        return;
+    }
+
+    curl_easy_setopt(post->handle, CURLOPT_PROTOCOLS, CURLPROTO_HTTP);
+    curl_easy_setopt(post->handle, CURLOPT_ERRORBUFFER, post->szCurlError);
+    curl_easy_setopt(post->handle, CURLOPT_URL, post->szURL);
+    curl_easy_setopt(post->handle, CURLOPT_HTTPGET, 1L);
+    curl_easy_setopt(post->handle, CURLOPT_USERAGENT, "libcrp/0.1");
+    curl_easy_setopt(post->handle, CURLOPT_WRITEFUNCTION, &CurlWrite_CallbackFunc);
+    curl_easy_setopt(post->handle, CURLOPT_WRITEDATA, &post->chunk);
+    curl_easy_setopt(post->handle, CURLOPT_PRIVATE, post);
+    curl_easy_setopt(post->handle, CURLOPT_TIMEOUT_MS, (long)WOW_POST_TIMEOUT_MS);
+
+    /*
+    ** curl calls us back through curlSocketCallback() and
+    ** curlTimerCallback() to drive the post from here...
+    */
+    curl_multi_add_handle(state->multi, post->handle);
+
+    post->next = state->inFlight;
+
+    if (state->inFlight != NULL) {
+        state->inFlight->prev = post;
+    }
+
+    state->inFlight = post;
+    state->numInFlight++;
+}
+
+/*
+** Posts readings to the Met Office WoW service, once every
+** wow.postcycletime seconds per station. Posts go through one
+** curl multi handle driven from our loop, so a slow WoW server
+** never holds up the queue...
+*/
+class wowSink : public readingSink {
+    private:
+        wow_sink_state_t      state;
+
+        void release();
+
+    public:
+        wowSink() {
+            memset(&state, 0, sizeof(state));
+        }
+
+        ~wowSink() {
+            release();
+        }
+
+        const char * getName() override {
+            return "wow";
+        }
+
+        const char * getThreadName() override {
+            return "WoWUpdateThread";
+        }
+
+        /*
+        ** A post is only ever of the latest weather, so if we
+        ** fall behind the older readings go...
+        */
+        void getPolicy(sink_policy_t * policy) override {
+            policy->intervalSeconds = (uint32_t)cfgmgr::getInstance().getValueAsInteger("wow.postcycletime");
+            policy->dropPolicy = sink_drop_superseded;
+        }
+
+        uint32_t getStallTimeoutMs() override {
+            return WOW_STALL_TIMEOUT_MS;
+        }
+
+        uint32_t getStopTimeoutMs() override {
+            return SHUTDOWN_WOW_TIMEOUT_MS;
+        }
+
+        void open(eventLoop & loop) override;
+        void write(span<weather_transform_t> readings) override;
+        void close(eventLoop & loop) override;
+};
+
+/*
+** curl_multi_cleanup() leaves the easy handles to us. The loop
+** they were watched from may already have gone, so curl isn't
+** to call us back while they are removed...
+*/
+void wowSink::release() {
+    if (state.multi != NULL) {
+        curl_multi_setopt(state.multi, CURLMOPT_SOCKETFUNCTION, NULL);
+        curl_multi_setopt(state.multi, CURLMOPT_TIMERFUNCTION, NULL);
+
+        while (state.inFlight != NULL) {
+            freePost(&state, state.inFlight);
+        }
+
+        curl_multi_cleanup(state.multi);
+        state.multi = NULL;
+    }
+}
+
+void wowSink::open(eventLoop & loop) {
+    release();
+
+    state.multi = curl_multi_init();
+
+    if (state.multi == NULL) {
+        throw thread_error("Failed to initialise curl");
+    }
+
+    state.loop = &loop;
+    state.numInFlight = 0;
+    state.inFlight = NULL;
+    state.curlTimerFD = loop.addTimer(WOW_POST_TIMEOUT_MS, false, &handleCurlTimerEvent, &state);
+
+    loop.disarmTimer(state.curlTimerFD);
+
+    curl_multi_setopt(state.multi, CURLMOPT_SOCKETFUNCTION, &curlSocketCallback);
+    curl_multi_setopt(state.multi, CURLMOPT_SOCKETDATA, &state);
+    curl_multi_setopt(state.multi, CURLMOPT_TIMERFUNCTION, &curlTimerCallback);
+    curl_multi_setopt(state.multi, CURLMOPT_TIMERDATA, &state);
+}
+
+void wowSink::write(span<weather_transform_t> readings) {
+    for (weather_transform_t & tr : readings) {
+        postToWoW(&state, tr);
+    }
+}
+
+/*
+** Give the posts in flight a little while to finish...
+*/
+void wowSink::close(eventLoop & loop) {
+    logger & log = logger::getInstance();
+
+    uint64_t deadline = getEpochNanoseconds() + (uint64_t)WOW_FLUSH_TIMEOUT_MS * 1000000ULL;
+
+    while (state.numInFlight > 0) {
+        uint64_t now = getEpochNanoseconds();
+
+        if (now >= deadline) {
+            log.logError("Gave up on %d WoW post(s) still in flight", state.numInFlight);
+            break;
+        }
+
+        loop.runOnce((int)((deadline - now) / 1000000ULL) + 1);
+    }
+
+    release();
+}
+
+static readingSink * createWoWSink() {
+    return new wowSink();
+}
+
+static sinkRegistration _wowSink("wow", &createWoWSink);
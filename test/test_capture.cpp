@@ -0,0 +1,174 @@
+#include <string>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <glob.h>
+
+#include "capture.h"
+
+#define TEST_FILE_NAME              "/tmp/test_capture.cap"
+#define TEST_TIMESTAMP_BASE         1700000000000000000ULL
+
+static int numFailed = 0;
+
+static void check(bool isOK, const char * name) {
+    printf("%s: %s\n", isOK ? "PASS" : "FAIL", name);
+
+    if (!isOK) {
+        numFailed++;
+    }
+}
+
+/*
+** The capture and anything it was moved aside to...
+*/
+static void removeCaptures() {
+    glob_t files;
+
+    unlink(TEST_FILE_NAME);
+
+    if (glob(TEST_FILE_NAME "_*", 0, NULL, &files) == 0) {
+        for (size_t i = 0;i < files.gl_pathc;i++) {
+            unlink(files.gl_pathv[i]);
+        }
+
+        globfree(&files);
+    }
+}
+
+static int countSetAside() {
+    glob_t files;
+    int count = 0;
+
+    if (glob(TEST_FILE_NAME "_*", 0, NULL, &files) == 0) {
+        count = (int)files.gl_pathc;
+        globfree(&files);
+    }
+
+    return count;
+}
+
+static void writeRecords(uint32_t first, uint32_t count) {
+    uint8_t payload[CAPTURE_PAYLOAD_LEN];
+
+    captureWriter writer(TEST_FILE_NAME, 0);
+
+    for (uint32_t i = first;i < first + count;i++) {
+        memset(payload, (int)i, sizeof(payload));
+        writer.write(payload, CAPTURE_PAYLOAD_LEN, (int)(i % 6), TEST_TIMESTAMP_BASE + i);
+    }
+}
+
+static void appendBytes(const char * bytes) {
+    int fd = open(TEST_FILE_NAME, O_WRONLY | O_APPEND);
+
+    if (fd >= 0) {
+        if (write(fd, bytes, strlen(bytes)) < 0) {
+            perror("write");
+        }
+
+        close(fd);
+    }
+}
+
+/*
+** Are the records in the capture the ones writeRecords() wrote, in order...
+*/
+static bool isInSequence(uint64_t numExpected) {
+    captureReader reader(TEST_FILE_NAME);
+
+    if (reader.getNumRecords() != numExpected) {
+        return false;
+    }
+
+    for (uint64_t i = 0;i < numExpected;i++) {
+        const capture_record_t * record = reader.getRecord(i);
+
+        if (record->timestamp != TEST_TIMESTAMP_BASE + i || record->payload[0] != (uint8_t)i || record->pipe != i % 6) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void testReopen() {
+    removeCaptures();
+
+    writeRecords(0, 3);
+    writeRecords(3, 2);
+
+    check(isInSequence(5), "re-opening a capture appends to it");
+    check(countSetAside() == 0, "a good capture is not moved aside");
+}
+
+static void testTruncation() {
+    removeCaptures();
+
+    writeRecords(0, 2);
+
+    /*
+    ** Part of a record, as if we crashed mid write...
+    */
+    appendBytes("partial");
+
+    {
+        captureReader reader(TEST_FILE_NAME);
+
+        check(reader.getNumRecords() == 2, "a reader ignores a torn record");
+    }
+
+    writeRecords(2, 1);
+
+    check(isInSequence(3), "a torn record is cut off before appending");
+}
+
+static void testSetAside() {
+    removeCaptures();
+
+    int fd = open(TEST_FILE_NAME, O_WRONLY | O_CREAT | O_APPEND, 0644);
+
+    if (fd >= 0) {
+        const char * text = "This is not a capture file, nor is it ever likely to be\n";
+
+        check(write(fd, text, strlen(text)) == (ssize_t)strlen(text), "foreign file written");
+        close(fd);
+    }
+
+    writeRecords(0, 1);
+
+    check(countSetAside() == 1, "a file we can't append to is moved aside");
+    check(isInSequence(1), "a new capture is started in its place");
+}
+
+static void testLongPayload() {
+    uint8_t payload[CAPTURE_PAYLOAD_LEN + 8];
+
+    removeCaptures();
+
+    memset(payload, 0xAA, sizeof(payload));
+
+    {
+        captureWriter writer(TEST_FILE_NAME, 0);
+        writer.write(payload, (int)sizeof(payload), 1, TEST_TIMESTAMP_BASE);
+    }
+
+    captureReader reader(TEST_FILE_NAME);
+
+    check(reader.getNumRecords() == 1 && reader.getRecord(0)->length == CAPTURE_PAYLOAD_LEN, "a long payload is cut to CAPTURE_PAYLOAD_LEN");
+}
+
+int main(void) {
+    testReopen();
+    testTruncation();
+    testSetAside();
+    testLongPayload();
+
+    removeCaptures();
+
+    return (numFailed > 0 ? 1 : 0);
+}
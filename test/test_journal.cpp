@@ -0,0 +1,250 @@
+#include <string>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+
+#include "journal.h"
+
+#define TEST_DIRECTORY_TEMPLATE     "/tmp/test_journal_XXXXXX"
+#define TEST_BATCH_SIZE             32
+
+static int numFailed = 0;
+
+static void check(bool isOK, const char * name) {
+    printf("%s: %s\n", isOK ? "PASS" : "FAIL", name);
+
+    if (!isOK) {
+        numFailed++;
+    }
+}
+
+static string makeDirectory() {
+    char szTemplate[] = TEST_DIRECTORY_TEMPLATE;
+
+    if (mkdtemp(szTemplate) == NULL) {
+        perror("mkdtemp");
+        exit(1);
+    }
+
+    return string(szTemplate);
+}
+
+static void removeDirectory(const string & directory) {
+    struct dirent * entry;
+
+    DIR * dir = opendir(directory.c_str());
+
+    if (dir == NULL) {
+        return;
+    }
+
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] != '.') {
+            unlink((directory + "/" + entry->d_name).c_str());
+        }
+    }
+
+    closedir(dir);
+    rmdir(directory.c_str());
+}
+
+static bool isFile(const string & fileName) {
+    return (access(fileName.c_str(), F_OK) == 0);
+}
+
+static weather_transform_t makeReading(uint32_t packetNum) {
+    weather_transform_t tr;
+
+    memset(&tr, 0, sizeof(tr));
+
+    tr.timestamp = 1000000000ULL * (uint64_t)(packetNum + 1);
+    tr.packetNum = packetNum;
+
+    return tr;
+}
+
+static void appendReadings(spillJournal & journal, uint32_t first, uint32_t count) {
+    for (uint32_t i = first;i < first + count;i++) {
+        journal.append(makeReading(i));
+    }
+}
+
+/*
+** The packet number of the next reading to replay, -1 if there isn't one...
+*/
+static int64_t peekPacketNum(spillJournal & journal) {
+    weather_transform_t tr;
+
+    if (!journal.peek(&tr)) {
+        return -1;
+    }
+
+    return (int64_t)tr.packetNum;
+}
+
+static void testRecovery() {
+    weather_transform_t batch[TEST_BATCH_SIZE];
+
+    string directory = makeDirectory();
+
+    spillJournal * journal = new spillJournal(directory, 0, 0, 0);
+    appendReadings(*journal, 0, 10);
+    delete journal;
+
+    journal = new spillJournal(directory, 0, 0, 0);
+
+    check(journal->getNumPending() == 10, "readings survive re-opening the journal");
+
+    uint32_t numRecords = journal->peek(batch, TEST_BATCH_SIZE);
+    bool isInOrder = (numRecords == 10);
+
+    for (uint32_t i = 0;i < numRecords;i++) {
+        isInOrder = (isInOrder && batch[i].packetNum == i);
+    }
+
+    check(isInOrder, "readings are replayed in the order they were spilled");
+
+    delete journal;
+
+    removeDirectory(directory);
+}
+
+static void testCheckpoint() {
+    weather_transform_t batch[TEST_BATCH_SIZE];
+
+    string directory = makeDirectory();
+
+    spillJournal * journal = new spillJournal(directory, 0, 0, 0);
+    appendReadings(*journal, 0, 10);
+
+    journal->advance(journal->peek(batch, 4));
+
+    /*
+    ** Crash without closing, the batch was checkpointed...
+    */
+    journal = new spillJournal(directory, 0, 0, 0);
+
+    check(journal->getNumPending() == 6, "a checkpointed batch is not replayed again");
+    check(peekPacketNum(*journal) == 4, "replay resumes after the checkpointed batch");
+
+    /*
+    ** Moved past, but not checkpointed before we crash...
+    */
+    journal->advance();
+
+    journal = new spillJournal(directory, 0, 0, 0);
+
+    check(peekPacketNum(*journal) == 4, "a reading not checkpointed is replayed again after a crash");
+
+    /*
+    ** Closing checkpoints for us...
+    */
+    journal->advance();
+    delete journal;
+
+    journal = new spillJournal(directory, 0, 0, 0);
+
+    check(journal->getNumPending() == 5 && peekPacketNum(*journal) == 5, "closing the journal checkpoints");
+
+    journal->advance(journal->peek(batch, TEST_BATCH_SIZE));
+
+    check(journal->isEmpty(), "empty once everything has been replayed");
+
+    delete journal;
+
+    removeDirectory(directory);
+}
+
+static void testTornRecord() {
+    weather_transform_t batch[TEST_BATCH_SIZE];
+
+    string directory = makeDirectory();
+
+    spillJournal * journal = new spillJournal(directory, 0, 0, 0);
+    appendReadings(*journal, 0, 5);
+    delete journal;
+
+    /*
+    ** Part of a record, as if we crashed mid write...
+    */
+    int fd = open((directory + "/segment-0000000000.jnl").c_str(), O_WRONLY | O_APPEND);
+
+    check(fd >= 0, "segment file is where we expect");
+
+    if (fd >= 0) {
+        check(write(fd, "partial", 7) == 7, "torn record written");
+        close(fd);
+    }
+
+    journal = new spillJournal(directory, 0, 0, 0);
+
+    check(journal->getNumPending() == 5, "a torn record is cut off");
+
+    appendReadings(*journal, 5, 1);
+
+    uint32_t numRecords = journal->peek(batch, TEST_BATCH_SIZE);
+
+    check(numRecords == 6 && batch[5].packetNum == 5, "records appended after a torn one are readable");
+
+    delete journal;
+
+    removeDirectory(directory);
+}
+
+static void testDiscard() {
+    uint64_t segmentSize = sizeof(journal_segment_header_t) + 4 * sizeof(journal_record_t);
+
+    string directory = makeDirectory();
+
+    spillJournal * journal = new spillJournal(directory, segmentSize, segmentSize * 2, 0);
+    appendReadings(*journal, 0, 20);
+
+    uint64_t numPending = journal->getNumPending();
+    uint64_t numDiscarded = journal->getNumDiscarded();
+
+    check(numDiscarded > 0 && numPending <= 8, "a full journal discards readings");
+    check(numPending + numDiscarded == 20, "every reading is either pending or discarded");
+    check(peekPacketNum(*journal) == (int64_t)numDiscarded, "the oldest readings are the ones discarded");
+
+    delete journal;
+
+    removeDirectory(directory);
+}
+
+static void testSetAside() {
+    const char * text = "This is not a journal segment, nor is it ever likely to be\n";
+
+    string directory = makeDirectory();
+
+    int fd = open((directory + "/segment-0000000000.jnl").c_str(), O_WRONLY | O_CREAT, 0644);
+
+    check(fd >= 0 && write(fd, text, strlen(text)) == (ssize_t)strlen(text), "unreadable segment written");
+
+    if (fd >= 0) {
+        close(fd);
+    }
+
+    spillJournal * journal = new spillJournal(directory, 0, 0, 0);
+
+    check(journal->isEmpty(), "an unreadable segment is not replayed");
+    check(isFile(directory + "/set-aside-0000000000.jnl"), "an unreadable segment is set aside, not deleted");
+
+    delete journal;
+
+    removeDirectory(directory);
+}
+
+int main(void) {
+    testRecovery();
+    testCheckpoint();
+    testTornRecord();
+    testDiscard();
+    testSetAside();
+
+    return (numFailed > 0 ? 1 : 0);
+}
@@ -0,0 +1,156 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include <endian.h>
+
+#include "psql.h"
+
+#define EPOCH_2000_SECONDS          946684800LL
+#define SECONDS_PER_DAY             86400LL
+
+static int numFailed = 0;
+
+static void check(bool isOK, const char * name) {
+    printf("%s: %s\n", isOK ? "PASS" : "FAIL", name);
+
+    if (!isOK) {
+        numFailed++;
+    }
+}
+
+static void setTimeZone(const char * tz) {
+    setenv("TZ", tz, 1);
+    tzset();
+}
+
+/*
+** Does value encode to exactly these 16 bit words (ndigits,
+** weight, sign, dscale then the digits)...
+*/
+static bool isNumeric(double value, int scale, const uint16_t * expected, int numExpected) {
+    uint8_t     buffer[PSQL_NUMERIC_MAX_LEN];
+    uint16_t    words[PSQL_NUMERIC_MAX_LEN / 2];
+
+    int length = psqlCopy::encodeNumeric(value, scale, buffer);
+
+    if (length != (int)(sizeof(uint16_t) * numExpected)) {
+        return false;
+    }
+
+    memcpy(words, buffer, length);
+
+    for (int i = 0;i < numExpected;i++) {
+        if (be16toh(words[i]) != expected[i]) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static int64_t getInt8(psqlParams & params, int index) {
+    uint64_t be;
+
+    memcpy(&be, params.getValues()[index], sizeof(be));
+
+    return (int64_t)be64toh(be);
+}
+
+static int32_t getInt4(psqlParams & params, int index) {
+    uint32_t be;
+
+    memcpy(&be, params.getValues()[index], sizeof(be));
+
+    return (int32_t)be32toh(be);
+}
+
+static void testNumeric() {
+    static const uint16_t twoPlaces[] = {2, 0, 0x0000, 2, 12, 3400};
+    static const uint16_t negative[] = {2, 0, 0x4000, 1, 1, 5000};
+    static const uint16_t threeDigits[] = {3, 1, 0x0000, 4, 1, 2345, 6789};
+    static const uint16_t fractionOnly[] = {1, 0xFFFF, 0x0000, 2, 500};
+    static const uint16_t trailingZeros[] = {1, 1, 0x0000, 0, 1};
+    static const uint16_t zero[] = {0, 0, 0x0000, 1};
+    static const uint16_t notANumber[] = {0, 0, 0xC000, 0};
+
+    check(isNumeric(12.34, 2, twoPlaces, 6), "NUMERIC 12.34");
+    check(isNumeric(-1.5, 1, negative, 6), "NUMERIC -1.5");
+    check(isNumeric(12345.6789, 4, threeDigits, 7), "NUMERIC spanning three base 10000 digits");
+    check(isNumeric(0.05, 2, fractionOnly, 5), "NUMERIC with no whole part has weight -1");
+    check(isNumeric(10000.0, 0, trailingZeros, 5), "NUMERIC drops trailing zero digits");
+    check(isNumeric(0.0, 1, zero, 4), "NUMERIC zero has no digits");
+    check(isNumeric(-0.04, 1, zero, 4), "NUMERIC rounding to zero is not negative zero");
+    check(isNumeric(NAN, 2, notANumber, 4), "NUMERIC NaN");
+
+    uint8_t buffer[PSQL_NUMERIC_MAX_LEN];
+
+    check(psqlCopy::encodeNumeric(INFINITY, 2, buffer) == -1, "NUMERIC infinity is sent as NULL");
+
+    bool isThrown = false;
+
+    try {
+        psqlCopy::encodeNumeric(1.0, 5, buffer);
+    }
+    catch (psql_error & e) {
+        isThrown = true;
+    }
+
+    check(isThrown, "NUMERIC scale out of range is rejected");
+}
+
+static void testTimestamp() {
+    psqlParams params;
+
+    setTimeZone("UTC");
+
+    params.addTimestamp((uint64_t)EPOCH_2000_SECONDS * 1000000000ULL);
+    params.addTimestamp((uint64_t)(EPOCH_2000_SECONDS + SECONDS_PER_DAY) * 1000000000ULL + 1500ULL);
+
+    check(params.getLengths()[0] == 8, "TIMESTAMP is 8 bytes");
+    check(getInt8(params, 0) == 0, "TIMESTAMP counts from 2000-01-01");
+    check(getInt8(params, 1) == SECONDS_PER_DAY * 1000000LL + 1, "TIMESTAMP in microseconds");
+
+    params.clear();
+
+    setTimeZone("<+02>-2");
+
+    params.addTimestamp((uint64_t)EPOCH_2000_SECONDS * 1000000000ULL);
+
+    check(getInt8(params, 0) == 7200LL * 1000000LL, "TIMESTAMP is local time");
+}
+
+static void testDate() {
+    psqlParams params;
+
+    setTimeZone("UTC");
+
+    params.addDate((time_t)EPOCH_2000_SECONDS);
+    params.addDate((time_t)(EPOCH_2000_SECONDS + SECONDS_PER_DAY - 1));
+    params.addDate((time_t)(EPOCH_2000_SECONDS - 1));
+    params.addDate((time_t)(EPOCH_2000_SECONDS + SECONDS_PER_DAY * 366));
+
+    check(params.getLengths()[0] == 4, "DATE is 4 bytes");
+    check(getInt4(params, 0) == 0, "DATE counts from 2000-01-01");
+    check(getInt4(params, 1) == 0, "DATE at the end of the day");
+    check(getInt4(params, 2) == -1, "DATE before 2000 rounds down");
+    check(getInt4(params, 3) == 366, "DATE a leap year later");
+
+    params.clear();
+
+    setTimeZone("<+02>-2");
+
+    params.addDate((time_t)(EPOCH_2000_SECONDS - 3600));
+
+    check(getInt4(params, 0) == 0, "DATE is the local date");
+}
+
+int main(void) {
+    testNumeric();
+    testTimestamp();
+    testDate();
+
+    return (numFailed > 0 ? 1 : 0);
+}
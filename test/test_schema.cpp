@@ -0,0 +1,115 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#include "schema.h"
+
+static int numFailed = 0;
+
+static void check(bool isOK, const char * name) {
+    printf("%s: %s\n", isOK ? "PASS" : "FAIL", name);
+
+    if (!isOK) {
+        numFailed++;
+    }
+}
+
+/*
+** Does value survive encode() and decode(), to within half
+** a step of the field's scale...
+*/
+template <typename Field>
+static bool isRoundTrip(double value) {
+    uint8_t payload[NRF24L01_MAXIMUM_PACKET_LEN];
+
+    memset(payload, 0, sizeof(payload));
+
+    Field::encode(payload, value);
+
+    return (fabs((double)Field::decode(payload) - value) <= fabs((double)Field::scale) / 2.0 + 1.0E-6);
+}
+
+static void testRoundTrip() {
+    check(isRoundTrip<weather_schema::temperature>(21.5), "temperature");
+    check(isRoundTrip<weather_schema::temperature>(-12.25), "negative temperature");
+    check(isRoundTrip<weather_schema::humidity>(63.2), "humidity, with its bias");
+    check(isRoundTrip<weather_schema::pressure>(1013.25), "pressure");
+    check(isRoundTrip<weather_schema::batteryVolts>(4.05), "battery volts");
+    check(isRoundTrip<weather_schema::batteryChargeRate>(-150.0), "negative charge rate");
+    check(isRoundTrip<weather_schema::rainfall>(2.794), "rainfall");
+    check(isRoundTrip<weather_schema::windspeed>(12.5), "wind speed");
+    check(isRoundTrip<sleep_schema::batteryVolts>(3.3), "sleep packet battery volts");
+}
+
+static void testClamping() {
+    uint8_t payload[NRF24L01_MAXIMUM_PACKET_LEN];
+
+    memset(payload, 0, sizeof(payload));
+
+    weather_schema::temperature::encode(payload, 1000.0);
+
+    check(
+        weather_schema::temperature::field::decode(payload) == weather_schema::temperature::field::maximum,
+        "a value too big for the field is clamped");
+
+    weather_schema::temperature::encode(payload, -1000.0);
+
+    check(
+        weather_schema::temperature::field::decode(payload) == weather_schema::temperature::field::minimum,
+        "a value too small for the field is clamped");
+
+    weather_schema::batteryPercentage::encode(payload, -5.0);
+
+    check(weather_schema::batteryPercentage::field::decode(payload) == 0, "an unsigned field clamps at 0");
+}
+
+/*
+** Every field of a whole packet, so one field writing over
+** its neighbour would show...
+*/
+static void testWholePacket() {
+    uint8_t payload[NRF24L01_MAXIMUM_PACKET_LEN];
+
+    memset(payload, 0xFF, sizeof(payload));
+
+    weather_schema::id::encode(payload, weather_schema::packetID);
+    weather_schema::packetNum::encode(payload, 0x123456);
+    weather_schema::status::encode(payload, 0x5A);
+    weather_schema::batteryPercentage::encode(payload, 87.0);
+    weather_schema::batteryChargeRate::encode(payload, -20.8);
+    weather_schema::batteryVolts::encode(payload, 3.9);
+    weather_schema::temperature::encode(payload, 18.75);
+    weather_schema::pressure::encode(payload, 998.5);
+    weather_schema::humidity::encode(payload, 55.0);
+    weather_schema::rainfall::encode(payload, 0.5588);
+    weather_schema::rawWindspeed::encode(payload, 1234);
+    weather_schema::rawWindGust::encode(payload, 2345);
+
+    check(weather_schema::id::decode(payload) == weather_schema::packetID, "packet ID");
+    check(weather_schema::packetNum::decode(payload) == 0x123456, "24 bit packet number");
+    check(weather_schema::status::decode(payload) == 0x5A, "status");
+    check(weather_schema::batteryPercentage::decode(payload) == 87.0f, "battery percentage");
+    check(fabsf(weather_schema::batteryChargeRate::decode(payload) + 20.8f) < 0.11f, "charge rate");
+    check(fabsf(weather_schema::batteryVolts::decode(payload) - 3.9f) < 0.0001f, "battery volts");
+    check(weather_schema::temperature::decode(payload) == 18.75f, "temperature");
+    check(fabsf(weather_schema::pressure::decode(payload) - 998.5f) < 0.01f, "pressure");
+    check(fabsf(weather_schema::humidity::decode(payload) - 55.0f) < 0.001f, "humidity");
+    check(fabsf(weather_schema::rainfall::decode(payload) - 0.5588f) < 0.0001f, "rainfall");
+    check(weather_schema::rawWindspeed::decode(payload) == 1234, "wind speed count");
+    check(weather_schema::rawWindGust::decode(payload) == 2345, "wind gust count");
+
+    weather_packet_t packet;
+
+    memcpy(&packet, payload, sizeof(packet));
+
+    check(packet.rawWindGust == 2345, "matches weather_packet_t");
+}
+
+int main(void) {
+    testRoundTrip();
+    testClamping();
+    testWholePacket();
+
+    return (numFailed > 0 ? 1 : 0);
+}
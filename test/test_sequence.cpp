@@ -0,0 +1,64 @@
+#include <stdio.h>
+#include <stdint.h>
+
+#include "sequence.h"
+
+static int numFailed = 0;
+
+static void check(bool isOK, const char * name) {
+    printf("%s: %s\n", isOK ? "PASS" : "FAIL", name);
+
+    if (!isOK) {
+        numFailed++;
+    }
+}
+
+/*
+** Feed packets first..last, returns the result of the last one...
+*/
+static sequenceTracker::sequence_result feed(sequenceTracker & seq, uint32_t first, uint32_t last) {
+    sequenceTracker::sequence_result result = sequenceTracker::sequence_first;
+
+    for (uint32_t i = first;i <= last;i++) {
+        result = seq.update(i);
+    }
+
+    return result;
+}
+
+static void testRebootDuringEarlyUptime() {
+    sequenceTracker seq;
+
+    feed(seq, 0, 100);
+
+    check(seq.update(0) == sequenceTracker::sequence_reboot, "reboot while the window still holds the old numbers");
+    check(feed(seq, 1, 4) == sequenceTracker::sequence_next, "packets after an early reboot are not duplicates");
+    check(seq.getNumReboots() == 1 && seq.getNumDuplicates() == 0, "early reboot counted once, no duplicates");
+}
+
+static void testRebootAfterLongUptime() {
+    sequenceTracker seq;
+
+    feed(seq, 0, 1000);
+
+    check(seq.update(1) == sequenceTracker::sequence_reboot, "reboot after a long uptime");
+}
+
+static void testLateAndDuplicate() {
+    sequenceTracker seq;
+
+    feed(seq, 0, 1);
+
+    check(seq.update(3) == sequenceTracker::sequence_gap, "gap");
+    check(seq.update(2) == sequenceTracker::sequence_late, "late packet near the start is not a reboot");
+    check(seq.update(2) == sequenceTracker::sequence_duplicate, "duplicate");
+    check(seq.getNumLost() == 0, "late packet no longer counted as lost");
+}
+
+int main(void) {
+    testRebootDuringEarlyUptime();
+    testRebootAfterLongUptime();
+    testLateAndDuplicate();
+
+    return (numFailed > 0 ? 1 : 0);
+}
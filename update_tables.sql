@@ -0,0 +1,29 @@
+ALTER TABLE weather_data ADD COLUMN IF NOT EXISTS station_id INTEGER;
+ALTER TABLE telemetry_data ADD COLUMN IF NOT EXISTS station_id INTEGER;
+ALTER TABLE daily_summary ADD COLUMN IF NOT EXISTS station_id INTEGER;
+ALTER TABLE telemetry_data ADD COLUMN IF NOT EXISTS packet_loss_rate NUMERIC(5,2);
+ALTER TABLE telemetry_data ADD COLUMN IF NOT EXISTS longest_gap INTEGER;
+ALTER TABLE weather_data ADD COLUMN IF NOT EXISTS avg_wind_speed_10m NUMERIC(5,2);
+ALTER TABLE weather_data ADD COLUMN IF NOT EXISTS max_wind_gust_10m NUMERIC(5,2);
+ALTER TABLE weather_data ADD COLUMN IF NOT EXISTS rainfall_1h NUMERIC(7,2);
+ALTER TABLE weather_data ADD COLUMN IF NOT EXISTS rainfall_24h NUMERIC(7,2);
+ALTER TABLE weather_data ADD COLUMN IF NOT EXISTS rain_rate NUMERIC(7,2);
+ALTER TABLE weather_data ADD COLUMN IF NOT EXISTS pressure_tendency_3h NUMERIC(5,2);
+-- Rows from before station_id belong to the one station we had, radio.stationid
+-- (0x10002927 by default), pass yours with psql -v station_id=<decimal id>
+\if :{?station_id}
+\else
+\set station_id 268445991
+\endif
+UPDATE weather_data SET station_id = :station_id WHERE station_id IS NULL;
+UPDATE telemetry_data SET station_id = :station_id WHERE station_id IS NULL;
+UPDATE daily_summary SET station_id = :station_id WHERE station_id IS NULL;
+ALTER TABLE weather_data ALTER COLUMN station_id SET NOT NULL;
+ALTER TABLE telemetry_data ALTER COLUMN station_id SET NOT NULL;
+ALTER TABLE daily_summary ALTER COLUMN station_id SET NOT NULL;
+DELETE FROM daily_summary a USING daily_summary b WHERE a.created = b.created AND a.station_id = b.station_id AND a.id < b.id;
+CREATE UNIQUE INDEX IF NOT EXISTS daily_summary_created_station_idx ON daily_summary (created, station_id);
+DELETE FROM weather_data a USING weather_data b WHERE a.station_id = b.station_id AND a.created = b.created AND a.id < b.id;
+CREATE UNIQUE INDEX IF NOT EXISTS weather_data_station_created_idx ON weather_data (station_id, created);
+DELETE FROM telemetry_data a USING telemetry_data b WHERE a.station_id = b.station_id AND a.created = b.created AND a.id < b.id;
+CREATE UNIQUE INDEX IF NOT EXISTS telemetry_data_station_created_idx ON telemetry_data (station_id, created);